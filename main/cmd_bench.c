@@ -0,0 +1,256 @@
+/*
+ * cmd_bench.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: root
+ *
+ * 'bench' command: latency of the storage, lookup and schedule paths on the device, against the SPIFFS partition.
+ * Every operation is timed by esp_timer_get_time(), the percentiles are printed in microseconds.
+ *  - lookup: ibd_get_by_code() with the codes of the trace written by 'gendb' (FILE_GEN_TRACE),
+ *  or with random codes when there is no trace: these are not found, every lookup reads the whole database.
+ *  - cron: cron_compile(), cron_match() and checkcrons() of generated schedules at random times.
+ *  - csv: csv_eat_a_line() and csv_process_line() of a generated buffer.
+ *  - flash: blocks written to a temporary file and flushed, the file is deleted.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "esp_log.h"
+#include "esp_console.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_spiffs.h"
+#include "argtable3/argtable3.h"
+
+#include "cmd_bench.h"
+#include "cron.h"
+#include "ib_database.h"
+#include "ib_pool.h"
+#include "ib_gen.h"
+#include "ib_tz.h"
+
+/** \brief Timed operations of a section by default. */
+#define BENCH_N 				200
+#define BENCH_N_MAX 			10000
+/** \brief Written block and bytes of the flash section. */
+#define BENCH_BLOCK_SIZE 		4096
+#define BENCH_FLASH_BYTES 		(64 * 1024)
+#define FILE_BENCH 				"/spiffs/ibd/bench.tmp"
+/** \brief Random times of the cron section are in this year from BENCH_FROM_S. */
+#define BENCH_FROM_S 			1767225600LL
+
+static struct {
+	struct arg_int *n;
+	struct arg_str *section;
+	struct arg_end *end;
+} bench_args;
+
+static int compare_u32(const void *a, const void *b) {
+	const uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+	return (x > y) - (x < y);
+}
+
+/** \brief Print the percentiles of the samples, they are sorted. */
+static void report(const char *name, uint32_t *samples, int n) {
+	uint64_t sum = 0;
+
+	if ( !n ) {
+		printf("%-16s no samples\n", name);
+		return;
+	}
+	qsort(samples, n, sizeof(uint32_t), compare_u32);
+	for ( int i = 0; i < n; i++ )
+		sum += samples[i];
+	printf("%-16s n:%5i min:%6u p50:%6u p90:%6u p99:%6u max:%6u avg:%6llu us\n", name, n,
+			samples[0], samples[n / 2], samples[n * 90 / 100], samples[n * 99 / 100], samples[n - 1], sum / n);
+}
+
+/** \brief Lookups of the trace codes, or of random codes. */
+static void bench_lookup(uint32_t *samples, int n) {
+	char line[IB_GEN_TRACE_LINE_SIZE];
+	FILE *trace = fopen(FILE_GEN_TRACE, "r");
+	ib_data_t *data;
+	uint64_t code;
+	int64_t start, time;
+	int found = 0, count = 0;
+
+	printf("lookup: %s\n", trace ? FILE_GEN_TRACE : "random codes, not found");
+	for ( count = 0; count < n; count++ ) {
+		if ( trace ) {
+			if ( !fgets(line, sizeof(line), trace) || ib_gen_trace_parse(line, &time, &code) )
+				break;
+		} else {
+			code = 0x0100000000000000ULL | ((uint64_t)esp_random() << 24) | (esp_random() & 0xFFFFFF);
+		}
+		data = NULL;
+		start = esp_timer_get_time();
+		if ( ibd_get_by_code(code, &data) == IBD_FOUND )
+			found++;
+		samples[count] = esp_timer_get_time() - start;
+		ib_pool_free(data);
+	}
+	if ( trace )
+		fclose(trace);
+	report("ibd_get_by_code", samples, count);
+	printf("%i found\n", found);
+}
+
+/** \brief Compile and evaluate generated schedules. */
+static void bench_cron(uint32_t *samples, int n) {
+	const ib_gen_t g = { .keys = n, .schedules = n, .crons = 3, .complexity = 2, .seed = esp_random() };
+	uint32_t *match = samples + n, *check = samples + 2 * n;
+	char crons[CRON_MAX_SIZE];
+	Evmask masks[CRON_MAX_N];
+	struct tm time;
+	int64_t start;
+	int count, matches = 0;
+
+	for ( int i = 0; i < n; i++ ) {
+		ib_gen_schedule(&g, i, crons, sizeof(crons));
+		ib_tz_gmtime(BENCH_FROM_S + esp_random() % (365 * 86400), &time);
+		start = esp_timer_get_time();
+		count = cron_compile(crons, masks, CRON_MAX_N, NULL);
+		samples[i] = esp_timer_get_time() - start;
+		start = esp_timer_get_time();
+		matches += cron_match(masks, count, &time);
+		match[i] = esp_timer_get_time() - start;
+		start = esp_timer_get_time();
+		checkcrons(crons, &time);
+		check[i] = esp_timer_get_time() - start;
+	}
+	report("cron_compile", samples, n);
+	report("cron_match", match, n);
+	report("checkcrons", check, n);
+	printf("%i matches\n", matches);
+}
+
+/** \brief Parse a generated CSV buffer line by line. */
+static void bench_csv(uint32_t *samples, int n) {
+	const ib_gen_t g = { .keys = n, .schedules = n / 4 + 1, .crons = 3, .complexity = 1, .validity_pct = 20,
+			.seed = esp_random(), .from = BENCH_FROM_S };
+	char line[IBD_CSV_LINE_MAX_SIZE], *buf, *from;
+	size_t size = 0;
+	ib_data_t *data;
+	int64_t start;
+	int count = 0, len;
+
+	buf = malloc((size_t)n * IBD_CSV_LINE_MAX_SIZE + 1);
+	if ( !buf ) {
+		printf("csv: no memory\n");
+		return;
+	}
+	for ( int i = 0; i < n; i++ ) {
+		len = ib_gen_csv_line(&g, i, buf + size, IBD_CSV_LINE_MAX_SIZE + 1);
+		if ( len > 0 )
+			size += len;
+	}
+	buf[size] = '\0';
+	from = buf;
+	while ( *from && count < n ) {
+		start = esp_timer_get_time();
+		if ( !csv_eat_a_line(line, sizeof(line), &from) )
+			break;
+		data = csv_process_line(line);
+		samples[count++] = esp_timer_get_time() - start;
+		ib_pool_free(data);
+	}
+	report("csv line", samples, count);
+	printf("%u bytes\n", (unsigned)size);
+	free(buf);
+}
+
+/** \brief Write and flush blocks to a temporary file. */
+static void bench_flash(uint32_t *samples, int n) {
+	size_t total = 0, used = 0;
+	char *block = malloc(BENCH_BLOCK_SIZE);
+	FILE *fptr;
+	int64_t start, all;
+	int count = 0;
+
+	esp_spiffs_info(IBD_PARTITION_LABEL, &total, &used);
+	if ( !block || total - used < 2 * BENCH_FLASH_BYTES ) {
+		printf("flash: %s\n", block ? "not enough free space" : "no memory");
+		free(block);
+		return;
+	}
+	for ( int i = 0; i < BENCH_BLOCK_SIZE; i++ )
+		block[i] = esp_random();
+	fptr = fopen(FILE_BENCH, "wb");
+	if ( !fptr ) {
+		printf("Cannot open %s\n", FILE_BENCH);
+		free(block);
+		return;
+	}
+	all = esp_timer_get_time();
+	for ( ; count < n && count < BENCH_FLASH_BYTES / BENCH_BLOCK_SIZE; count++ ) {
+		start = esp_timer_get_time();
+		if ( BENCH_BLOCK_SIZE != fwrite(block, 1, BENCH_BLOCK_SIZE, fptr) || fflush(fptr) ) {
+			printf("Cannot write %s\n", FILE_BENCH);
+			break;
+		}
+		samples[count] = esp_timer_get_time() - start;
+	}
+	fclose(fptr);
+	all = esp_timer_get_time() - all;
+	unlink(FILE_BENCH);
+	report("4 KB write", samples, count);
+	if ( all > 0 )
+		printf("%lld KB/s\n", (int64_t)count * BENCH_BLOCK_SIZE * 1000000 / 1024 / all);
+	free(block);
+}
+
+/** \brief Run the benchmark sections. */
+static int bench(int argc, char **argv) {
+	const char *section = "all";
+	uint32_t *samples;
+	int n = BENCH_N, all;
+
+	int nerrors = arg_parse(argc, argv, (void**) &bench_args);
+	if ( nerrors ) {
+		arg_print_errors(stderr, bench_args.end, argv[0]);
+		return 1;
+	}
+	if ( bench_args.n->count )
+		n = bench_args.n->ival[0];
+	if ( bench_args.section->count )
+		section = bench_args.section->sval[0];
+	if ( n < 1 || n > BENCH_N_MAX ) {
+		printf("1-%i operations\n", BENCH_N_MAX);
+		return 1;
+	}
+	samples = malloc(3 * n * sizeof(uint32_t));
+	if ( !samples ) {
+		printf("No memory\n");
+		return 1;
+	}
+	all = !strcmp(section, "all");
+	esp_log_level_set("*", ESP_LOG_WARN);
+	if ( all || !strcmp(section, "lookup") )
+		bench_lookup(samples, n);
+	if ( all || !strcmp(section, "cron") )
+		bench_cron(samples, n);
+	if ( all || !strcmp(section, "csv") )
+		bench_csv(samples, n);
+	if ( all || !strcmp(section, "flash") )
+		bench_flash(samples, n);
+	esp_log_level_set("*", CONFIG_LOG_DEFAULT_LEVEL);
+	free(samples);
+	return 0;
+}
+
+/** \brief Command register function. */
+void register_bench() {
+	bench_args.n = arg_int0("n", "count", "<n>", "Timed operations of a section");
+	bench_args.section = arg_str0(NULL, NULL, "<lookup|cron|csv|flash|all>", "Section, all by default");
+	bench_args.end = arg_end(1);
+	const esp_console_cmd_t bench_cmd = {
+			.command = "bench",
+			.help = "Latency percentiles of the database lookup, crons, CSV parser and flash writes",
+			.hint = NULL,
+			.func = &bench,
+			.argtable = &bench_args
+	};
+	ESP_ERROR_CHECK( esp_console_cmd_register(&bench_cmd) );
+}
@@ -0,0 +1,13 @@
+/*
+ * cmd_bench.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: root
+ */
+
+#ifndef MAIN_CMD_BENCH_H_
+#define MAIN_CMD_BENCH_H_
+
+void register_bench();
+
+#endif /* MAIN_CMD_BENCH_H_ */
@@ -24,6 +24,16 @@
 #include "cmd_tests.h"
 #include "ib_http_client.h"
 #include "ib_reader.h"
+#include "ib_trace.h"
+#include "ib_metrics.h"
+#include "ib_pool.h"
+#include "ib_throttle.h"
+#include "ib_clock.h"
+#include "ib_database.h"
+#include "ib_tz.h"
+#include "ib_schedule.h"
+#include "ib_calendar.h"
+#include "cmd_bench.h"
 
 
 #define TEST_COMMANDS
@@ -135,16 +145,19 @@ static struct {
 
 static struct {
 	struct arg_str *code;
+	struct arg_int *reader;
     struct arg_end *end;
 } setsu_args;
 
 static struct {
 	struct arg_int *time;
+	struct arg_int *reader;
     struct arg_end *end;
 } settime_args;
 
 static struct {
 	struct arg_int *mode;
+	struct arg_int *reader;
     struct arg_end *end;
 } setmode_args;
 
@@ -159,6 +172,11 @@ static int setname(int argc, char **argv) {
 	return 0;
 }
 
+/** \brief Reader id of the optional -r argument, default is 0. */
+static int reader_arg(struct arg_int *reader) {
+	return reader->count ? reader->ival[0] : 0;
+}
+
 static int setsu(int argc, char **argv) {
 	uint64_t code;
 	int nerrors = arg_parse(argc, argv, (void**) &setsu_args);
@@ -168,7 +186,7 @@ static int setsu(int argc, char **argv) {
 	}
 	code = strtoull(setsu_args.code->sval[0], NULL, 16);
 	ESP_LOGI(TAG, "Set code to: %lld", code);
-	ib_set_su_key(code);
+	ib_set_su_key(reader_arg(setsu_args.reader), code);
 	return 0;
 }
 
@@ -179,7 +197,7 @@ static int settime(int argc, char **argv) {
 		return 1;
 	}
 	ESP_LOGI(TAG, "Set opening time to: %i",settime_args.time->ival[0]);
-	ib_set_opening_time(settime_args.time->ival[0]);
+	ib_set_opening_time(reader_arg(settime_args.reader), settime_args.time->ival[0]);
 	return 0;
 }
 
@@ -190,7 +208,7 @@ static int setmode(int argc, char **argv) {
 		return 1;
 	}
 	ESP_LOGI(TAG, "Set mode to: %i",settime_args.time->ival[0]);
-	ib_set_mode(setmode_args.mode->ival[0]);
+	ib_set_mode(reader_arg(setmode_args.reader), setmode_args.mode->ival[0]);
 	return 0;
 }
 
@@ -207,6 +225,7 @@ static void register_setters() {
 	ESP_ERROR_CHECK(esp_console_cmd_register(&setname_cmd))
 
 	setsu_args.code = arg_str1(NULL, NULL, "<su code>", "Superuser key code");
+	setsu_args.reader = arg_int0("r", "reader", "<id>", "Reader id, default 0");
 	setsu_args.end = arg_end(0);
 	const esp_console_cmd_t setsu_cmd = {
 		.command = "setsu",
@@ -218,6 +237,7 @@ static void register_setters() {
 	ESP_ERROR_CHECK(esp_console_cmd_register(&setsu_cmd))
 
 	settime_args.time = arg_int1(NULL, NULL, "<ms>", "Set the opening time");
+	settime_args.reader = arg_int0("r", "reader", "<id>", "Reader id, default 0");
 	settime_args.end = arg_end(0);
 	const esp_console_cmd_t settime_cmd = {
 		.command = "opening",
@@ -230,6 +250,7 @@ static void register_setters() {
 
 	setmode_args.mode = arg_int1(NULL, NULL,
 			"<mode>", "Set the operation mode: \n 0: monostable\n1: bistable\n2: bistable with the same key");
+	setmode_args.reader = arg_int0("r", "reader", "<id>", "Reader id, default 0");
 	setmode_args.end = arg_end(0);
 	const esp_console_cmd_t setmode_cmd = {
 		.command = "mode",
@@ -249,6 +270,16 @@ void register_system()
     register_restart();
     register_setserver();
     register_setters();
+    register_trace();
+    register_stats();
+    register_pool();
+    register_throttle();
+    register_clock();
+    register_tz();
+    register_schedule();
+    register_calendar();
+    register_database();
+    register_bench();
 #ifdef TEST_COMMANDS
 	register_tests();
 #endif
@@ -7,12 +7,15 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
 #include <time.h>
 #include "esp_log.h"
 #include "esp_console.h"
 #include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
 #include "esp_spi_flash.h"
 #include "driver/rtc_io.h"
 #include "driver/uart.h"
@@ -27,12 +30,1842 @@
 #include "esp_spiffs.h"
 
 #include "ib_reader.h"
+#include "ib_onewire_sim.h"
+#include "ib_fsm.h"
+#include "ib_clock.h"
+#include "ib_tz.h"
+#include "ib_schedule.h"
+#include "ib_calendar.h"
+#include "cron.h"
+#include "ib_database.h"
+#include "ib_pool.h"
+#include "ib_throttle.h"
+#include "cron_slice.h"
+#include "ib_gen.h"
+#include "cJSON.h"
 
+/** \brief Number of simulated reads by default. */
+#define OWSIM_DEFAULT_READS 	1000
+
+static struct {
+	struct arg_int *reads;
+	struct arg_int *jitter;
+	struct arg_int *noise;
+	struct arg_int *rise;
+	struct arg_int *slaves;
+	struct arg_lit *overdrive;
+	struct arg_end *end;
+} owsim_args;
 
 void erase_fs() {
 	ESP_ERROR_CHECK(esp_spiffs_format(NULL));
 }
 
+/** \brief Are all the ROMs of the slaves found by the search? */
+static int owsim_search_ok(ow_sim_t *sim, uint8_t roms[][OW_ROM_SIZE], int n) {
+	int found;
+	if ( sim->engine.found != n )
+		return 0;
+	for ( int i = 0; i < n; i++ ) {
+		found = 0;
+		for ( int j = 0; j < sim->engine.found; j++ ) {
+			if ( !memcmp(roms[i], sim->engine.roms[j], OW_ROM_SIZE) )
+				found = 1;
+		}
+		if ( !found )
+			return 0;
+	}
+	return 1;
+}
+
+/** \brief Run transactions of the 1-Wire engine on a simulated bus.
+ *  READ ROM with one slave, SEARCH ROM when the number of slaves is given.
+ *  Prints the read success rate and the read latency.
+ * */
+static int owsim(int argc, char **argv) {
+	ow_sim_t *sim;
+	uint8_t roms[OW_SIM_MAX_SLAVES][OW_ROM_SIZE], got[OW_ROM_SIZE];
+	uint32_t latency, lat_min = UINT32_MAX, lat_max = 0;
+	uint64_t lat_sum = 0;
+	int reads = OWSIM_DEFAULT_READS, ok = 0, status[3] = {0}, slaves = 1, search = 0, ret;
+
+	int nerrors = arg_parse(argc, argv, (void**) &owsim_args);
+	if ( nerrors ) {
+		arg_print_errors(stderr, owsim_args.end, argv[0]);
+		return 1;
+	}
+	if ( owsim_args.reads->count )
+		reads = owsim_args.reads->ival[0];
+	if ( owsim_args.slaves->count ) {
+		slaves = owsim_args.slaves->ival[0];
+		search = 1;
+		if ( slaves < 1 || slaves > OW_SIM_MAX_SLAVES ) {
+			printf("Number of slaves: 1..%i\n", OW_SIM_MAX_SLAVES);
+			return 1;
+		}
+	}
+	sim = malloc(sizeof(ow_sim_t));
+	if ( !sim ) {
+		printf("No memory for the simulator\n");
+		return 1;
+	}
+	ow_sim_init(sim, esp_random());
+	sim->jitter_us = owsim_args.jitter->count ? owsim_args.jitter->ival[0] : 0;
+	sim->noise_ppm = owsim_args.noise->count ? owsim_args.noise->ival[0] : 0;
+	sim->rise_us = owsim_args.rise->count ? owsim_args.rise->ival[0] : 0;
+	sim->overdrive = owsim_args.overdrive->count;
+	ow_engine_set_overdrive(&sim->engine, owsim_args.overdrive->count);
+	for ( int i = 0; i < slaves; i++ ) {
+		ow_sim_make_rom(0x01, esp_random(), roms[i]);
+		ow_sim_add_slave(sim, roms[i]);
+	}
+
+	for ( int i = 0; i < reads; i++ ) {
+		if ( search ) {
+			ret = ow_sim_search(sim, &latency);
+			if ( ret == OW_OK && owsim_search_ok(sim, roms, slaves) )
+				ok++;
+		} else {
+			ret = ow_sim_read_rom(sim, got, &latency);
+			if ( ret == OW_OK && !memcmp(roms[0], got, OW_ROM_SIZE) )
+				ok++;
+		}
+		if ( ret >= 0 && ret < 3 )
+			status[ret]++;
+		lat_sum += latency;
+		if ( latency < lat_min )
+			lat_min = latency;
+		if ( latency > lat_max )
+			lat_max = latency;
+		sim->now_us += 1000;	// Idle time between the reads
+	}
+	printf("reads:%i ok:%i (%.2f%%) no presence:%i short:%i\n",
+			reads, ok, reads ? 100.0 * ok / reads : 0.0,
+			status[OW_NO_PRESENCE], status[OW_SHORT]);
+	printf("latency us min:%u avg:%llu max:%u%s\n",
+			lat_min, reads ? lat_sum / reads : 0, lat_max,
+			ow_engine_overdrive_used(&sim->engine) ? " (overdrive)" : "");
+	free(sim);
+	return 0;
+}
+
+/** \brief A step of an FSM trace: input, key and the expected state and actions. */
+typedef struct fsm_test_step {
+	ib_fsm_input_t input;
+	uint64_t key;
+	ib_fsm_state_t state;
+	uint16_t actions;
+} fsm_test_step_t;
+
+typedef struct fsm_test_trace {
+	const char *name;
+	ib_fsm_ctx_t ctx;
+	const fsm_test_step_t *steps;
+	size_t steps_n;
+} fsm_test_trace_t;
+
+#define FSM_OPEN 	(IB_ACT_LED_ACCESS | IB_ACT_RELAY_OPEN)
+#define FSM_CLOSE 	(IB_ACT_LED_IDLE | IB_ACT_RELAY_CLOSE | IB_ACT_INFO_NONE)
+#define FSM_TRACE(name, mode, su, steps) \
+	{ name, { mode, su }, steps, sizeof(steps) / sizeof(steps[0]) }
+
+static const fsm_test_step_t FSM_NORMAL[] = {
+	{ IB_IN_TOUCHED,		1, IB_ST_ACCESS,	FSM_OPEN | IB_ACT_TIMEOUT },
+	{ IB_IN_BUTTON,			0, IB_ST_ACCESS,	0 },
+	{ IB_IN_TIMEOUT,		0, IB_ST_IDLE,		FSM_CLOSE },
+	{ IB_IN_INVALID,		2, IB_ST_IDLE,		IB_ACT_DENY },
+	{ IB_IN_BUTTON,			0, IB_ST_ACCESS,	FSM_OPEN | IB_ACT_TIMEOUT },
+	{ IB_IN_TIMEOUT,		0, IB_ST_IDLE,		FSM_CLOSE },
+	{ IB_IN_TIMEOUT,		0, IB_ST_IDLE,		0 },
+	{ IB_IN_SU_TOUCHED,		3, IB_ST_ACCESS,	FSM_OPEN | IB_ACT_TIMEOUT },
+};
+
+static const fsm_test_step_t FSM_BISTABLE[] = {
+	{ IB_IN_TOUCHED,		1, IB_ST_BISTABLE,	FSM_OPEN },
+	{ IB_IN_BUTTON,			0, IB_ST_BISTABLE,	0 },
+	{ IB_IN_TIMEOUT,		0, IB_ST_BISTABLE,	0 },
+	{ IB_IN_TOUCHED,		2, IB_ST_IDLE,		FSM_CLOSE },
+	{ IB_IN_BUTTON,			0, IB_ST_IDLE,		0 },
+};
+
+static const fsm_test_step_t FSM_SAME_KEY[] = {
+	{ IB_IN_TOUCHED,		1, IB_ST_BISTABLE_SAME_KEY,	FSM_OPEN | IB_ACT_SAVE_KEY },
+	{ IB_IN_TOUCHED,		2, IB_ST_BISTABLE_SAME_KEY,	0 },
+	{ IB_IN_TOUCHED,		1, IB_ST_IDLE,				FSM_CLOSE },
+};
+
+static const fsm_test_step_t FSM_LOG_FULL[] = {
+	{ IB_IN_TOUCHED,		1, IB_ST_ACCESS,	FSM_OPEN | IB_ACT_TIMEOUT },
+	{ IB_IN_LOG_FULL,		0, IB_ST_LOG_FULL,	IB_ACT_RELAY_CLOSE | IB_ACT_LED_BOTH | IB_ACT_INFO_LOG_FULL },
+	{ IB_IN_TOUCHED,		1, IB_ST_LOG_FULL,	0 },
+	{ IB_IN_BUTTON,			0, IB_ST_LOG_FULL,	IB_ACT_RELAY_OPEN | IB_ACT_TIMEOUT },
+	{ IB_IN_TIMEOUT,		0, IB_ST_LOG_FULL,	IB_ACT_RELAY_CLOSE },
+	{ IB_IN_SU_TOUCHED,		3, IB_ST_LOG_FULL,	IB_ACT_LOG_DELETE },
+	{ IB_IN_LOG_CLEARED,	0, IB_ST_IDLE,		IB_ACT_LED_IDLE | IB_ACT_INFO_NONE },
+	{ IB_IN_LOG_CLEARED,	0, IB_ST_IDLE,		0 },
+};
+
+static const fsm_test_step_t FSM_SU[] = {
+	{ IB_IN_SU_TOUCHED,		3, IB_ST_SU_MODE,	IB_ACT_INFO_SU | IB_ACT_TIMEOUT_SU },
+	{ IB_IN_TOUCHED,		1, IB_ST_SU_MODE,	0 },
+	{ IB_IN_TIMEOUT,		0, IB_ST_IDLE,		IB_ACT_INFO_NONE },
+};
+
+static const fsm_test_trace_t FSM_TRACES[] = {
+	FSM_TRACE("normal", IB_READER_MODE_NORMAL, 0, FSM_NORMAL),
+	FSM_TRACE("bistable", IB_READER_MODE_BISTABLE, 0, FSM_BISTABLE),
+	FSM_TRACE("bistable same key", IB_READER_MODE_BISTABLE_SAME_KEY, 0, FSM_SAME_KEY),
+	FSM_TRACE("log full", IB_READER_MODE_NORMAL, 0, FSM_LOG_FULL),
+	FSM_TRACE("superuser", IB_READER_MODE_NORMAL, 1, FSM_SU),
+};
+
+/** \brief Number of random events of the throughput test by default. */
+#define FSMTEST_DEFAULT_EVENTS 	100000
+
+static struct {
+	struct arg_int *events;
+	struct arg_end *end;
+} fsmtest_args;
+
+/** \brief Replay a trace, print the first wrong transition.
+ *  \return 1 passed
+ * */
+static int fsmtest_replay(const fsm_test_trace_t *trace) {
+	ib_fsm_t fsm;
+	ib_fsm_event_t event;
+	uint16_t actions;
+	const fsm_test_step_t *step;
+
+	ib_fsm_init(&fsm);
+	for ( size_t i = 0; i < trace->steps_n; i++ ) {
+		step = &trace->steps[i];
+		event.input = step->input;
+		event.key = step->key;
+		actions = ib_fsm_step(&fsm, &event, &trace->ctx);
+		if ( fsm.state != step->state || actions != step->actions ) {
+			printf("%s: step %u %s: got %s 0x%03X, expected %s 0x%03X\n",
+					trace->name, i, ib_fsm_input_name(step->input),
+					ib_fsm_state_name(fsm.state), actions,
+					ib_fsm_state_name(step->state), step->actions);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/** \brief Replay the FSM traces and check the transitions,
+ *  then measure the throughput with random events.
+ * */
+static int fsmtest(int argc, char **argv) {
+	const size_t traces_n = sizeof(FSM_TRACES) / sizeof(FSM_TRACES[0]);
+	int events = FSMTEST_DEFAULT_EVENTS, passed = 0, transitions = 0;
+	ib_fsm_t fsm;
+	ib_fsm_event_t event;
+	ib_fsm_ctx_t ctx = { .mode = IB_READER_MODE_NORMAL, .su_enabled = 1 };
+	ib_fsm_state_t prev;
+	uint32_t rnd;
+	int64_t start, elapsed;
+
+	int nerrors = arg_parse(argc, argv, (void**) &fsmtest_args);
+	if ( nerrors ) {
+		arg_print_errors(stderr, fsmtest_args.end, argv[0]);
+		return 1;
+	}
+	if ( fsmtest_args.events->count )
+		events = fsmtest_args.events->ival[0];
+
+	for ( size_t i = 0; i < traces_n; i++ )
+		passed += fsmtest_replay(&FSM_TRACES[i]);
+	printf("traces: %i/%u passed\n", passed, traces_n);
+
+	ib_fsm_init(&fsm);
+	start = esp_timer_get_time();
+	for ( int i = 0; i < events; i++ ) {
+		rnd = esp_random();
+		event.input = rnd % IB_IN_N;
+		event.key = (rnd >> 8) & 0x03;
+		ctx.mode = (rnd >> 12) % 3;
+		prev = fsm.state;
+		ib_fsm_step(&fsm, &event, &ctx);
+		if ( prev != fsm.state )
+			transitions++;
+	}
+	elapsed = esp_timer_get_time() - start;
+	printf("events:%i transitions:%i time:%lld us (%.0f events/s, random generator included)\n",
+			events, transitions, elapsed, elapsed ? events * 1000000.0 / elapsed : 0.0);
+	return passed == traces_n ? 0 : 1;
+}
+
+/** \brief Power cut of the clock simulation: Monday 2026-10-19 07:55:00 UTC. */
+#define CLOCKSIM_CUT_S 			1792396500LL
+/** \brief Schedule of the simulated key: working hours. */
+#define CLOCKSIM_SCHEDULE 		"* 8-17 * * 1-5"
+#define CLOCKSIM_TOUCH_S 		10
+
+static struct {
+	struct arg_int *outage;
+	struct arg_int *sntp;
+	struct arg_int *duration;
+	struct arg_end *end;
+} clocksim_args;
+
+/** \brief Schedule check of the simulated key. The simulation uses UTC. */
+static int clocksim_allowed(int64_t t) {
+	char schedule[] = CLOCKSIM_SCHEDULE;
+	time_t raw = t;
+	struct tm time_info;
+	gmtime_r(&raw, &time_info);
+	return checkcrons(schedule, &time_info);
+}
+
+/** \brief Boot after a power cut with a simulated clock, a touch every CLOCKSIM_TOUCH_S.
+ *  Prints the time from the boot to the first correct decision and the wrong decisions.
+ * */
+static void clocksim_run(const char *name, ib_clock_policy_t policy, int restore,
+		int64_t outage_s, int64_t sntp_s, int64_t duration_s) {
+	const ib_clock_saved_t saved = { .time_s = CLOCKSIM_CUT_S - IB_CLOCK_SAVE_PERIOD_S / 2, .error_s = 0 };
+	const int64_t boot_s = CLOCKSIM_CUT_S + outage_s;
+	ib_clock_state_t st;
+	int64_t first = -1;
+	int wrong = 0, wrong_allow = 0, touches = 0;
+	int truth, verdict;
+
+	ib_clock_state_init(&st, policy);
+	if ( restore )
+		ib_clock_state_restore(&st, &saved, 0);
+	for ( int64_t mono = 0; mono <= duration_s; mono += CLOCKSIM_TOUCH_S ) {
+		if ( sntp_s >= 0 && mono >= sntp_s && st.source != IB_CLOCK_SYNCED )
+			ib_clock_state_sync(&st, boot_s + mono, mono);
+		truth = clocksim_allowed(boot_s + mono);
+		switch ( ib_clock_state_eval(&st, mono) ) {
+			case IB_CLOCK_EVAL:
+				verdict = clocksim_allowed(ib_clock_state_now(&st, mono));
+				break;
+			case IB_CLOCK_ALLOW:
+				verdict = 1;
+				break;
+			default:
+				verdict = 0;
+				break;
+		}
+		touches++;
+		if ( verdict != truth ) {
+			wrong++;
+			wrong_allow += verdict;
+		} else if ( first < 0 ) {
+			first = mono;
+		}
+	}
+	printf("%-20s %10lld %6i/%-6i %11i %8u\n", name, first, wrong, touches, wrong_allow,
+			ib_clock_state_error(&st, duration_s));
+}
+
+/** \brief Boot-to-first-correct-decision of the clock policies with a simulated clock. */
+static int clocksim(int argc, char **argv) {
+	int64_t outage_s = 600, sntp_s = -1, duration_s = 3600;
+
+	int nerrors = arg_parse(argc, argv, (void**) &clocksim_args);
+	if ( nerrors ) {
+		arg_print_errors(stderr, clocksim_args.end, argv[0]);
+		return 1;
+	}
+	if ( clocksim_args.outage->count )
+		outage_s = clocksim_args.outage->ival[0];
+	if ( clocksim_args.sntp->count )
+		sntp_s = clocksim_args.sntp->ival[0];
+	if ( clocksim_args.duration->count )
+		duration_s = clocksim_args.duration->ival[0];
+
+	printf("power cut %lld s, sntp %lld s, schedule '%s', touch every %i s\n",
+			outage_s, sntp_s, CLOCKSIM_SCHEDULE, CLOCKSIM_TOUCH_S);
+	printf("%-20s %10s %13s %11s %8s\n", "policy", "first ok s", "wrong", "wrong allow", "error s");
+	clocksim_run("no saved time", IB_CLOCK_POLICY_RESTORED, 0, outage_s, sntp_s, duration_s);
+	for ( int p = 0; p < IB_CLOCK_POLICY_N; p++ )
+		clocksim_run(ib_clock_policy_name(p), p, 1, outage_s, sntp_s, duration_s);
+	return 0;
+}
+
+/** \brief First year of the time zone test: 2026-01-01 00:00:00 UTC. */
+#define TZTEST_FROM_S 			1767225600LL
+/** \brief Minutes checked before and after each transition. */
+#define TZTEST_AROUND_MIN 		180
+#define TZTEST_SAMPLES 			10000
+
+static struct {
+	struct arg_str *tz;
+	struct arg_end *end;
+} tztest_args;
+
+static int tztest_same(const struct tm *a, const struct tm *b) {
+	return a->tm_min == b->tm_min && a->tm_hour == b->tm_hour && a->tm_mday == b->tm_mday &&
+			a->tm_mon == b->tm_mon && a->tm_year == b->tm_year && a->tm_wday == b->tm_wday &&
+			a->tm_yday == b->tm_yday && (a->tm_isdst > 0) == (b->tm_isdst > 0);
+}
+
+static int tztest_compare(const ib_tz_table_t *table, int64_t t) {
+	time_t raw = t;
+	struct tm expected, got = { 0 };
+
+	localtime_r(&raw, &expected);
+	if ( !ib_tz_table_local(table, t, &got) || !tztest_same(&expected, &got) ) {
+		printf("mismatch at %lld: %02i:%02i expected %02i:%02i\n", t,
+				got.tm_hour, got.tm_min, expected.tm_hour, expected.tm_min);
+		return 1;
+	}
+	return 0;
+}
+
+/** \brief Matches of a schedule of the wall clock minute in the middle of the skipped or repeated hour.
+ *  Every minute of the day before and after the transition is checked.
+ * */
+static int tztest_matches(const ib_tz_table_t *table, int i) {
+	const ib_tz_transition_t *tr = &table->transitions[i];
+	const int32_t before = i ? table->transitions[i - 1].offset : table->offset;
+	const int32_t delta = tr->offset - before;
+	struct tm wall, time_info;
+	char schedule[32];
+	int matches = 0;
+
+	if ( delta > 0 )
+		ib_tz_gmtime(tr->at + before + delta / 2, &wall);
+	else
+		ib_tz_gmtime(tr->at + tr->offset - delta / 2, &wall);
+	for ( int64_t t = tr->at - 86400; t < tr->at + 86400; t += 60 ) {
+		snprintf(schedule, sizeof(schedule), "%i %i %i %i *",
+				wall.tm_min, wall.tm_hour, wall.tm_mday, wall.tm_mon + 1);
+		ib_tz_table_local(table, t, &time_info);
+		matches += checkcrons(schedule, &time_info);
+	}
+	return matches;
+}
+
+/** \brief Compare the transition table of a time zone with localtime_r. */
+static int tztest(int argc, char **argv) {
+	const char *tz = ib_tz_get();
+	ib_tz_table_t *table;
+	struct tm time_info;
+	time_t raw;
+	int64_t start, t_table, t_libc, t;
+	int errors = 0, n, matches;
+	int32_t delta;
+
+	int nerrors = arg_parse(argc, argv, (void**) &tztest_args);
+	if ( nerrors ) {
+		arg_print_errors(stderr, tztest_args.end, argv[0]);
+		return 1;
+	}
+	if ( tztest_args.tz->count )
+		tz = tztest_args.tz->sval[0];
+	table = malloc(sizeof(ib_tz_table_t));
+	if ( !table ) {
+		printf("No memory\n");
+		return 1;
+	}
+	setenv("TZ", tz, 1);
+	tzset();
+	n = ib_tz_table_build(table, TZTEST_FROM_S, IB_TZ_YEARS);
+	printf("%s: %i transitions in %i years\n", tz, n, IB_TZ_YEARS);
+
+	for ( int i = 0; i < n; i++ ) {
+		const int64_t at = table->transitions[i].at;
+		for ( t = at - TZTEST_AROUND_MIN * 60; t <= at + TZTEST_AROUND_MIN * 60; t += 60 )
+			errors += tztest_compare(table, t);
+		errors += tztest_compare(table, at - 1);
+		delta = table->transitions[i].offset - (i ? table->transitions[i - 1].offset : table->offset);
+		matches = tztest_matches(table, i);
+		if ( matches != (delta > 0 ? 0 : 2) ) {
+			printf("transition %lld: %s hour matched %i times\n", at, delta > 0 ? "skipped" : "repeated", matches);
+			errors++;
+		}
+	}
+	srand(1);
+	for ( int i = 0; i < TZTEST_SAMPLES; i++ )
+		errors += tztest_compare(table, table->from + (int64_t)(((uint64_t)rand() << 16 ^ rand()) %
+				(uint64_t)(table->until - table->from)));
+
+	start = esp_timer_get_time();
+	for ( int i = 0; i < TZTEST_SAMPLES; i++ )
+		ib_tz_table_local(table, TZTEST_FROM_S + i * 7919LL, &time_info);
+	t_table = esp_timer_get_time() - start;
+	start = esp_timer_get_time();
+	for ( int i = 0; i < TZTEST_SAMPLES; i++ ) {
+		raw = TZTEST_FROM_S + i * 7919LL;
+		localtime_r(&raw, &time_info);
+	}
+	t_libc = esp_timer_get_time() - start;
+
+	setenv("TZ", ib_tz_get(), 1);
+	tzset();
+	free(table);
+	printf("table %lld us, localtime_r %lld us for %i conversions\n", t_table, t_libc, TZTEST_SAMPLES);
+	printf("%s, %i errors\n", errors ? "FAILED" : "PASSED", errors);
+	return errors ? 1 : 0;
+}
+
+#define CRONTEST_CASES 			100
+/** \brief Minutes checked one by one after the start time: 8 days. */
+#define CRONTEST_MINUTES 		(8 * 24 * 60)
+
+static struct {
+	struct arg_int *cases;
+	struct arg_end *end;
+} crontest_args;
+
+/** \brief Random cron of the test, from typical fields. */
+static void crontest_cron(char *buf, size_t size) {
+	static const char *min[] = { "*", "0", "*/15", "0-29", "5,35" };
+	static const char *hour[] = { "*", "8-17", "22", "0-6", "*/6" };
+	static const char *mday[] = { "*", "*", "1", "1-15", "29", "L" };
+	static const char *month[] = { "*", "*", "1-6", "2", "dec", "jan-mar" };
+	static const char *wday[] = { "*", "1-5", "0", "6", "*", "mon#2", "friL", "sat-sun" };
+	static const char *cal[] = { "", "", "", " !1", " @2", " @1 !2" };
+	int len = 0;
+
+	for ( int i = 0, n = 1 + rand() % 2; i < n; i++ ) {
+		len += snprintf(buf + len, size - len, "%s%s %s %s %s %s%s", i ? ";" : "",
+				min[rand() % 5], hour[rand() % 5], mday[rand() % 6], month[rand() % 6], wday[rand() % 8],
+				cal[rand() % 6]);
+	}
+}
+
+/** \brief Calendars of the test, the random schedules start in 2026-2029. */
+static const char crontest_calendar_text[] =
+		"1|2026|0101,0406,0501,0820,1224-1226\n"
+		"1|2027|0101,0329,0501,1224-1226\n"
+		"2|2026|0103,0110-0120,0704\n"
+		"2|2028|0229,0301-0307\n"
+		"1|2029|0101,0402-0403,1225\n";
+static ib_cal_table_t crontest_calendars;
+
+/** \brief The calendar hook is global, the readers keep using it during the tests.
+ *  Only the task of the test sees the test calendars, the others get the live ones,
+ *  so no decision and no cached verdict depends on the test holidays. */
+static struct {
+	TaskHandle_t task;
+	cron_calendar_fn live;
+} crontest_hook;
+
+static uint32_t crontest_calendar(int year, int yday) {
+	if ( xTaskGetCurrentTaskHandle() == crontest_hook.task )
+		return ib_cal_table_days(&crontest_calendars, year, yday);
+	return crontest_hook.live ? crontest_hook.live(year, yday) : 0;
+}
+
+/** \brief Use the test calendars in the calling task. */
+static void crontest_calendar_begin() {
+	crontest_hook.task = xTaskGetCurrentTaskHandle();
+	crontest_hook.live = cron_set_calendar(&crontest_calendar);
+}
+
+/** \brief Give back the live hook. */
+static void crontest_calendar_end() {
+	cron_set_calendar(crontest_hook.live);
+	crontest_hook.task = NULL;
+}
+
+/** \brief Grammar cases of the crons, the times are UTC. */
+static const struct {
+	const char *cron;
+	int64_t t;
+	int match;
+} crontest_matches[] = {
+		{ "* * * jan mon-fri", 1767607200, 1 },		// Monday 2026-01-05 10:00
+		{ "* * * jan mon-fri", 1767434400, 0 },		// Saturday 2026-01-03
+		{ "* * L * *", 1772272800, 1 },				// 2026-02-28
+		{ "* * L * *", 1835344800, 0 },				// 2028-02-28, leap year
+		{ "* * L * *", 1835431200, 1 },				// 2028-02-29
+		{ "* * * * 1#2", 1768212000, 1 },			// Monday 2026-01-12
+		{ "* * * * 1#2", 1767607200, 0 },			// Monday 2026-01-05
+		{ "* * * * friL", 1769767200, 1 },			// Friday 2026-01-30
+		{ "* * * * 5L", 1769162400, 0 },			// Friday 2026-01-23
+		{ "0 9 * * fri-sun", 1767517200, 1 },		// Sunday 2026-01-04 09:00
+		{ "0 9 * * MON", 1767603600, 1 },			// Monday 2026-01-05 09:00
+		{ "*/20 * * * *", 1767606000, 1 },			// 09:40
+		{ "*/20 * * * *", 1767606600, 0 },			// 09:50
+		{ "50/5 9 5 1 1,3", 1767606600, 1 },
+		{ "* * * * * !1", 1767261600, 0 },			// 2026-01-01, calendar 1
+		{ "* * * * * !1", 1767348000, 1 },			// 2026-01-02
+		{ "* * * * * @2", 1767434400, 1 },			// 2026-01-03, calendar 2
+		{ "* * * * * @2", 1767348000, 0 },
+		{ "* * * * * @1 @2", 1767434400, 1 },		// in one of them
+		{ "* * * * sat @2 !1", 1767434400, 1 },
+		{ "* * * * * @2", 1835431200, 1 },			// 2028-02-29
+};
+
+/** \brief Invalid crons with the expected error. */
+static const struct {
+	const char *cron;
+	const char *msg;
+} crontest_errors[] = {
+		{ "60 * * * *", "value out of range" },
+		{ "* * 0 * *", "value out of range" },
+		{ "* * * * 1#6", "nth weekday must be 1-5" },
+		{ "* * * foo *", "unknown name" },
+		{ "* * * *", "missing field" },
+		{ "* * * * * *", "too many fields" },
+		{ "5-1 * * * *", "empty range" },
+		{ "*/0 * * * *", "invalid step" },
+		{ "* * * * 1;* 25 * * *", "value out of range" },
+		{ "1.5 * * * *", "unexpected character" },
+		{ "* * * * * @0", "calendar must be 1-32" },
+		{ "* * * * * !33", "calendar must be 1-32" },
+		{ "* * * * * @1x", "unexpected character" },
+};
+
+static int crontest_grammar() {
+	Evmask masks[CRON_MAX_N];
+	cron_error_t err;
+	struct tm t;
+	int errors = 0, n;
+
+	for ( int i = 0; i < sizeof(crontest_matches) / sizeof(crontest_matches[0]); i++ ) {
+		ib_tz_gmtime(crontest_matches[i].t, &t);
+		n = cron_compile(crontest_matches[i].cron, masks, CRON_MAX_N, &err);
+		if ( n < 0 || cron_match(masks, n, &t) != crontest_matches[i].match ) {
+			printf("[%s] at %lld: expected %i\n", crontest_matches[i].cron, crontest_matches[i].t,
+					crontest_matches[i].match);
+			errors++;
+		}
+	}
+	for ( int i = 0; i < sizeof(crontest_errors) / sizeof(crontest_errors[0]); i++ ) {
+		if ( cron_compile(crontest_errors[i].cron, masks, CRON_MAX_N, &err) >= 0 ||
+				strcmp(err.msg, crontest_errors[i].msg) ) {
+			printf("[%s]: expected error '%s'\n", crontest_errors[i].cron, crontest_errors[i].msg);
+			errors++;
+		}
+	}
+	return errors;
+}
+
+/** \brief Minute of the time for ordering. */
+static int64_t crontest_minute(const struct tm *t) {
+	return (((int64_t)t->tm_year * 366 + t->tm_yday) * 24 + t->tm_hour) * 60 + t->tm_min;
+}
+
+/** \brief Check the grammar cases, compare cron_next_change with a minute by minute search
+ *  and the compiled check with checkcrons. The test calendars are used while it runs. */
+static int crontest(int argc, char **argv) {
+	Evmask masks[CRON_MAX_N];
+	char crons[CRON_MAX_SIZE], buf[CRON_MAX_SIZE];
+	char calendar_text[sizeof(crontest_calendar_text)];
+	struct tm from, t, at;
+	int cases = CRONTEST_CASES, errors = 0, n, state, found, changed;
+	int64_t start, t_search = 0, t_step = 0, epoch;
+
+	int nerrors = arg_parse(argc, argv, (void**) &crontest_args);
+	if ( nerrors ) {
+		arg_print_errors(stderr, crontest_args.end, argv[0]);
+		return 1;
+	}
+	if ( crontest_args.cases->count )
+		cases = crontest_args.cases->ival[0];
+	strcpy(calendar_text, crontest_calendar_text);
+	if ( ib_cal_table_parse(&crontest_calendars, calendar_text, strlen(calendar_text), 0) ) {
+		printf("test calendars rejected\n");
+		errors++;
+	}
+	crontest_calendar_begin();
+	errors += crontest_grammar();
+	srand(1);
+	for ( int c = 0; c < cases; c++ ) {
+		crontest_cron(crons, sizeof(crons));
+		n = cron_compile(crons, masks, CRON_MAX_N, NULL);
+		epoch = TZTEST_FROM_S + (int64_t)(rand() % (4 * 366)) * 86400 + (rand() % 1440) * 60;
+		ib_tz_gmtime(epoch, &from);
+
+		start = esp_timer_get_time();
+		changed = cron_next_change(masks, n, &from, &at);
+		t_search += esp_timer_get_time() - start;
+
+		start = esp_timer_get_time();
+		state = cron_match(masks, n, &from);
+		found = 0;
+		for ( int m = 1; m <= CRONTEST_MINUTES && !found; m++ ) {
+			ib_tz_gmtime(epoch + m * 60, &t);
+			found = (cron_match(masks, n, &t) != state);
+		}
+		t_step += esp_timer_get_time() - start;
+
+		strcpy(buf, crons);
+		if ( state != checkcrons(buf, &from) ) {
+			printf("[%s] compiled check differs\n", crons);
+			errors++;
+		}
+		if ( found && (changed != !state || at.tm_year != t.tm_year || at.tm_mon != t.tm_mon ||
+				at.tm_mday != t.tm_mday || at.tm_hour != t.tm_hour || at.tm_min != t.tm_min) ) {
+			printf("[%s] from %lld: expected %i at %02i-%02i %02i:%02i, got %i at %02i-%02i %02i:%02i\n",
+					crons, epoch, !state, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min,
+					changed, at.tm_mon + 1, at.tm_mday, at.tm_hour, at.tm_min);
+			errors++;
+		} else if ( !found && changed >= 0 && crontest_minute(&at) <= crontest_minute(&t) ) {
+			printf("[%s] from %lld: change found in the checked days\n", crons, epoch);
+			errors++;
+		}
+	}
+	crontest_calendar_end();
+	printf("next change %lld us, minute by minute %lld us for %i schedules\n", t_search, t_step, cases);
+	printf("%s, %i errors\n", errors ? "FAILED" : "PASSED", errors);
+	return errors ? 1 : 0;
+}
+
+/** \brief Minutes evaluated by the benchmark, each is a refresh at a minute rollover. */
+#define SLICEBENCH_MINUTES 		60
+
+static struct {
+	struct arg_int *schedules;
+	struct arg_end *end;
+} slicebench_args;
+
+/** \brief Random schedule of the benchmark, one or two crons. */
+static void slicebench_cron(char *buf, size_t size) {
+	static const char *wday[] = { "*", "1-5", "sat-sun", "mon#1", "friL", "*" };
+	static const char *cal[] = { "", "", " !1", " @2" };
+	int len = 0, m, h;
+
+	for ( int i = 0, n = 1 + rand() % 2; i < n; i++ ) {
+		m = rand() % 60;
+		h = rand() % 24;
+		len += snprintf(buf + len, size - len, "%s%i-%i %i-%i * * %s%s", i ? ";" : "",
+				m, m + rand() % (60 - m), h, h + rand() % (24 - h), wday[rand() % 6], cal[rand() % 4]);
+	}
+}
+
+/** \brief Evaluate n random schedules per schedule (check_domain()) and bit-sliced, compare the results.
+ *  \return number of differences, -1 no memory
+ * */
+static int slicebench_run(int n) {
+	cron_slices_t slices = { 0 };
+	Evmask *masks = malloc(2 * n * sizeof(Evmask)), t;
+	uint32_t *first = malloc((n + 1) * sizeof(uint32_t));
+	uint32_t *crons = NULL, *matched = NULL;
+	char buf[CRON_MAX_SIZE];
+	struct tm time;
+	int64_t start, t_each = 0, t_sliced = 0, epoch;
+	int errors = 0, k, m, count_each = 0, count_sliced = 0;
+
+	if ( !masks || !first ) {
+		errors = -1;
+		goto end;
+	}
+	first[0] = 0;
+	for ( int s = 0; s < n; s++ ) {
+		slicebench_cron(buf, sizeof(buf));
+		k = cron_compile(buf, masks + first[s], 2, NULL);
+		first[s + 1] = first[s] + (k > 0 ? k : 0);
+	}
+	if ( cron_slices_init(&slices, first[n]) ) {
+		errors = -1;
+		goto end;
+	}
+	for ( int s = 0; s < n; s++ )
+		cron_slices_add(&slices, masks + first[s], first[s + 1] - first[s]);
+	crons = malloc(slices.words * sizeof(uint32_t));
+	matched = malloc(CRON_SLICE_WORDS(n) * sizeof(uint32_t));
+	if ( !crons || !matched ) {
+		errors = -1;
+		goto end;
+	}
+	epoch = TZTEST_FROM_S + (int64_t)(rand() % 366) * 86400 + (rand() % 1440) * 60;
+	for ( int i = 0; i < SLICEBENCH_MINUTES; i++ ) {
+		ib_tz_gmtime(epoch + i * 60, &time);
+
+		start = esp_timer_get_time();
+		cron_slices_match(&slices, &time, crons);
+		cron_slices_schedules(&slices, crons, matched);
+		t_sliced += esp_timer_get_time() - start;
+
+		start = esp_timer_get_time();
+		memset(&t, 0, sizeof(t));
+		tmtoEvmask(&time, &t);
+		for ( int s = 0; s < n; s++ ) {
+			m = 0;
+			for ( uint32_t c = first[s]; c < first[s + 1] && !m; c++ )
+				m = check_domain(&t, &masks[c]);
+			count_each += m;
+			if ( m != ((matched[s / 32] >> (s % 32)) & 1) )
+				errors++;
+		}
+		t_each += esp_timer_get_time() - start;
+		for ( int s = 0; s < n; s++ )
+			count_sliced += (matched[s / 32] >> (s % 32)) & 1;
+	}
+	printf("%5i schedules: check_domain %lld us, sliced %lld us per minute, %i matches, %u bytes of rows\n",
+			n, t_each / SLICEBENCH_MINUTES, t_sliced / SLICEBENCH_MINUTES, count_each,
+			(unsigned)(CRON_SLICE_ROWS * slices.words * sizeof(uint32_t)));
+	if ( count_each != count_sliced )
+		printf("matches differ: %i sliced\n", count_sliced);
+end:
+	cron_slices_free(&slices);
+	free(masks);
+	free(first);
+	free(crons);
+	free(matched);
+	return errors;
+}
+
+/** \brief Benchmark the bit-sliced evaluation against check_domain() per schedule. */
+static int slicebench(int argc, char **argv) {
+	static const int sizes[] = { 10, 1000, 10000 };
+	int errors = 0, ret;
+
+	int nerrors = arg_parse(argc, argv, (void**) &slicebench_args);
+	if ( nerrors ) {
+		arg_print_errors(stderr, slicebench_args.end, argv[0]);
+		return 1;
+	}
+	srand(1);
+	for ( int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++ ) {
+		const int n = slicebench_args.schedules->count ? slicebench_args.schedules->ival[0] : sizes[i];
+		ret = slicebench_run(n);
+		if ( ret < 0 )
+			printf("%5i schedules: no memory\n", n);
+		else
+			errors += ret;
+		if ( slicebench_args.schedules->count )
+			break;
+	}
+	printf("%s, %i differences\n", errors ? "FAILED" : "PASSED", errors);
+	return errors ? 1 : 0;
+}
+
+/** \brief Random inputs of the fuzzer by default. */
+#define CRONFUZZ_CASES 			10000
+/** \brief Random times of a valid input. */
+#define CRONFUZZ_TIMES 			8
+/** \brief Bytes after the buffers, they must not be written. */
+#define CRONFUZZ_GUARD 			16
+#define CRONFUZZ_GUARD_BYTE 	0xA5
+
+static struct {
+	struct arg_int *cases;
+	struct arg_int *seed;
+	struct arg_end *end;
+} cronfuzz_args;
+
+static const char *const cronfuzz_seeds[] = {
+		"* * * * *",
+		"*/15 8-17 * jan-mar mon-fri",
+		"0 9 L * *",
+		"5,35 * 1-15 * 1#2 @1 !2",
+		"* * * * friL",
+		"50/5 9 5 1 1,3;* 22 * dec sat-sun",
+		"0-29 */6 29 2 0 !1",
+		"* 8-17 * * 1-5;* 9-12 * * 6,0 @2",
+};
+
+static const char *const cronfuzz_tokens[] = {
+		"*", ",", "-", "/", "#", "L", ";", " ", "\t", "@", "!", "0", "1", "5", "7", "12", "23", "31",
+		"32", "59", "60", "99999999999", "4294967297", "mon", "sun", "dec", "FRI", "x", "|", "\n", "\r",
+};
+
+/** \brief Days of a month of the reference matcher, mon 1-12. */
+static int cronfuzz_days(int year, int mon) {
+	static const uint8_t days[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+	const int leap = (year % 4 == 0) && ((year % 100 != 0) || (year % 400 == 0));
+	return days[mon - 1] + (mon == 2 && leap);
+}
+
+/** \brief A number or a name of a field of the reference matcher.
+ *  \return -1 invalid
+ * */
+static int cronfuzz_ref_value(const char **s, int field) {
+	static const char *const names[5] = { NULL, NULL, NULL,
+			"janfebmaraprmayjunjulaugsepoctnovdec", "sunmontuewedthufrisat" };
+	static const int lo[5] = { 0, 0, 1, 1, 0 }, hi[5] = { 59, 23, 31, 12, 7 };
+	long v = 0;
+
+	if ( names[field] && isalpha((unsigned char)**s) ) {
+		for ( int i = 0; names[field][3 * i]; i++ ) {
+			if ( !strncasecmp(*s, names[field] + 3 * i, 3) ) {
+				*s += 3;
+				return i + lo[field];
+			}
+		}
+		return -1;
+	}
+	if ( !isdigit((unsigned char)**s) )
+		return -1;
+	while ( isdigit((unsigned char)**s) ) {
+		v = v * 10 + *(*s)++ - '0';
+		if ( v > 1000 )
+			v = 1000;
+	}
+	return (v < lo[field] || v > hi[field]) ? -1 : v;
+}
+
+/** \brief Reference matcher of a field: reads the items of the text and checks the time directly, without masks.
+ *  \return 1 match, 0 no match, -1 invalid
+ * */
+static int cronfuzz_ref_field(const char **s, int field, const struct tm *t) {
+	static const int lo[5] = { 0, 0, 1, 1, 0 }, hi[5] = { 59, 23, 31, 12, 7 };
+	const int year = t->tm_year + 1900, last = cronfuzz_days(year, t->tm_mon + 1);
+	const int now[5] = { t->tm_min, t->tm_hour, t->tm_mday, t->tm_mon + 1, t->tm_wday };
+	int match = 0, a, b, step, n;
+
+	do {
+		step = 1;
+		if ( **s == '*' ) {
+			a = lo[field];
+			b = hi[field];
+			(*s)++;
+		} else if ( field == 2 && **s == 'L' ) {
+			(*s)++;
+			match |= (t->tm_mday == last);
+			goto next;
+		} else {
+			if ( (a = b = cronfuzz_ref_value(s, field)) < 0 )
+				return -1;
+			if ( field == 4 && (**s == '#' || **s == 'L') ) {
+				if ( **s == 'L' ) {
+					(*s)++;
+					n = 0;
+				} else {
+					(*s)++;
+					if ( **s < '1' || **s > '5' )
+						return -1;
+					n = *(*s)++ - '0';
+				}
+				if ( a % 7 == t->tm_wday )
+					match |= n ? ((t->tm_mday - 1) / 7 + 1 == n) : (t->tm_mday + 7 > last);
+				goto next;
+			}
+			if ( **s == '-' ) {
+				(*s)++;
+				if ( (b = cronfuzz_ref_value(s, field)) < 0 )
+					return -1;
+				if ( field == 4 && b == 0 )
+					b = 7;
+				if ( b < a )
+					return -1;
+			} else if ( **s == '/' ) {
+				b = hi[field];
+			}
+		}
+		if ( **s == '/' ) {
+			(*s)++;
+			if ( !isdigit((unsigned char)**s) )
+				return -1;
+			step = 0;
+			while ( isdigit((unsigned char)**s) ) {
+				step = step * 10 + *(*s)++ - '0';
+				if ( step > 1000 )
+					step = 1000;
+			}
+			if ( step < 1 || step > hi[field] )
+				return -1;
+		}
+		for ( int v = a; v <= b; v += step ) {
+			if ( field == 4 ? (v % 7 == now[4]) : (v == now[field]) )
+				match = 1;
+		}
+	next:
+		if ( **s == ',' ) {
+			(*s)++;
+			continue;
+		}
+		if ( **s && **s != ';' && !isspace((unsigned char)**s) )
+			return -1;
+		while ( **s && isspace((unsigned char)**s) )
+			(*s)++;
+		return match;
+	} while ( 1 );
+}
+
+/** \brief Reference matcher of the crons, the calendars are the test calendars.
+ *  \param n set to the number of crons
+ *  \return 1 match, 0 no match, -1 invalid
+ * */
+static int cronfuzz_ref(const char *crons, const struct tm *t, int *n) {
+	const uint32_t cals = ib_cal_table_days(&crontest_calendars, t->tm_year + 1900, t->tm_yday);
+	const char *s = crons;
+	uint32_t need, not;
+	int match = 0, all, m, c;
+
+	*n = 0;
+	if ( strlen(crons) >= CRON_MAX_SIZE )
+		return -1;
+	do {
+		(*n)++;
+		all = 1;
+		while ( *s && isspace((unsigned char)*s) )
+			s++;
+		for ( int f = 0; f < 5; f++ ) {
+			if ( *s == '\0' || *s == ';' )
+				return -1;
+			if ( (m = cronfuzz_ref_field(&s, f, t)) < 0 )
+				return -1;
+			all &= m;
+		}
+		need = not = 0;
+		while ( *s == '@' || *s == '!' ) {
+			const char type = *s++;
+			if ( !isdigit((unsigned char)*s) )
+				return -1;
+			for ( c = 0; isdigit((unsigned char)*s) && c <= CRON_CALENDARS; s++ )
+				c = c * 10 + *s - '0';
+			if ( c < 1 || c > CRON_CALENDARS || (*s && *s != ';' && !isspace((unsigned char)*s)) )
+				return -1;
+			if ( type == '@' )
+				need |= 1UL << (c - 1);
+			else
+				not |= 1UL << (c - 1);
+			while ( *s && isspace((unsigned char)*s) )
+				s++;
+		}
+		if ( *s && *s != ';' )
+			return -1;
+		match |= all && (!need || (cals & need)) && !(cals & not);
+	} while ( *s++ == ';' );
+	return match;
+}
+
+/** \brief Mutate the input: replace, insert, delete or repeat a part, or cut it. */
+static void cronfuzz_mutate(char *buf, size_t size) {
+	const char *token;
+	size_t len = strlen(buf), pos, n;
+
+	for ( int i = 0, ops = 1 + rand() % 4; i < ops; i++ ) {
+		pos = len ? rand() % (len + 1) : 0;
+		switch ( rand() % 6 ) {
+			case 0:			// Replace a character
+				if ( pos < len )
+					buf[pos] = 1 + rand() % 127;
+				break;
+			case 1:			// Insert a token
+				token = cronfuzz_tokens[rand() % (sizeof(cronfuzz_tokens) / sizeof(cronfuzz_tokens[0]))];
+				n = strlen(token);
+				if ( len + n < size ) {
+					memmove(buf + pos + n, buf + pos, len - pos + 1);
+					memcpy(buf + pos, token, n);
+					len += n;
+				}
+				break;
+			case 2:			// Delete a part
+				n = rand() % 4;
+				if ( pos + n > len )
+					n = len - pos;
+				memmove(buf + pos, buf + pos + n, len - pos - n + 1);
+				len -= n;
+				break;
+			case 3:			// Repeat the input, it grows over the buffers
+				n = (len < size - 1 - len) ? len : size - 1 - len;
+				memcpy(buf + len, buf, n);
+				len += n;
+				buf[len] = '\0';
+				break;
+			case 4:			// Cut
+				buf[pos] = '\0';
+				len = pos;
+				break;
+			default:		// Another cron
+				if ( len + 1 + strlen(cronfuzz_seeds[0]) < size ) {
+					strcat(buf, ";");
+					strcat(buf, cronfuzz_seeds[rand() % (sizeof(cronfuzz_seeds) / sizeof(cronfuzz_seeds[0]))]);
+					len = strlen(buf);
+				}
+				break;
+		}
+	}
+}
+
+static int cronfuzz_guard_ok(const char *guard) {
+	for ( int i = 0; i < CRONFUZZ_GUARD; i++ ) {
+		if ( (uint8_t)guard[i] != CRONFUZZ_GUARD_BYTE )
+			return 0;
+	}
+	return 1;
+}
+
+/** \brief Log level of the parsers, the rejected inputs would flood the console.
+ *  The other tags keep their levels. */
+static void cronfuzz_log_level(esp_log_level_t level) {
+	esp_log_level_set("csv_process_line", level);
+	esp_log_level_set("csv_eat_a_line", level);
+}
+
+/** \brief Feed a mutated input to the parsers and compare the decisions with the reference matcher.
+ *  The buffers of the fuzzer are static: the console task has CONSOLE_TASK_STACK (4 KB), and
+ *  csv_process_line() under it already takes about 1 KB (the cron copy and the masks).
+ *  \return number of errors
+ * */
+static int cronfuzz_case(const char *input, int *valid) {
+	static Evmask masks[CRON_MAX_N];
+	static char copy[CRON_MAX_SIZE + CRONFUZZ_GUARD];
+	static char line[IBD_CSV_LINE_MAX_SIZE + CRONFUZZ_GUARD];
+	static char csv[2 * CRON_MAX_SIZE + 64];
+	char *from, *start;
+	ib_data_t *data;
+	struct tm t;
+	int errors = 0, n, ref, ref_n, compiled;
+	uint32_t eaten, total;
+
+	compiled = cron_compile(input, masks, CRON_MAX_N, NULL);
+	for ( int i = 0; i < CRONFUZZ_TIMES; i++ ) {
+		ib_tz_gmtime(TZTEST_FROM_S + (int64_t)(rand() % (4 * 366)) * 86400 + (rand() % 1440) * 60, &t);
+		ref = cronfuzz_ref(input, &t, &ref_n);
+		if ( (compiled >= 0) != (ref >= 0 && ref_n <= CRON_MAX_N) ) {
+			printf("[%s] compiled %i, reference %i\n", input, compiled, ref);
+			return errors + 1;
+		}
+		*valid = (ref >= 0);
+		if ( ref < 0 )
+			break;
+		if ( compiled >= 0 && cron_match(masks, compiled, &t) != ref ) {
+			printf("[%s] at %lld: compiled %i, reference %i\n", input, (long long)mktime(&t), !ref, ref);
+			errors++;
+		}
+		memset(copy, CRONFUZZ_GUARD_BYTE, sizeof(copy));
+		strcpy(copy, input);
+		if ( checkcrons(copy, &t) != ref ) {
+			printf("[%s] checkcrons %i, reference %i\n", input, !ref, ref);
+			errors++;
+		}
+		if ( !cronfuzz_guard_ok(copy + CRON_MAX_SIZE) ) {
+			printf("[%s] checkcrons wrote after the buffer\n", input);
+			errors++;
+		}
+	}
+	if ( strlen(input) >= CRON_MAX_SIZE ) {
+		strcpy(csv, input);
+		if ( checkcrons(csv, &t) ) {
+			printf("[%s] checkcrons matched too long crons\n", input);
+			errors++;
+		}
+	} else {
+		memset(copy, CRONFUZZ_GUARD_BYTE, sizeof(copy));
+		strcpy(copy, input);
+		from = getdatespec(copy, &masks[0]);
+		if ( from && (from < copy || from > copy + strlen(input)) ) {
+			printf("[%s] getdatespec out of the input\n", input);
+			errors++;
+		}
+	}
+
+	/* CSV: the input as crons, then as lines */
+	snprintf(csv, sizeof(csv), "0130000000000001|%s|%s|", input, (rand() % 4) ? "" : "1767225600");
+	data = csv_process_line(csv);
+	if ( data ) {
+		if ( !data->crons || cron_compile(data->crons, masks, CRON_MAX_N, NULL) < 0 ) {
+			printf("[%s] accepted line with invalid crons\n", input);
+			errors++;
+		}
+		ib_pool_free(data);
+	}
+	snprintf(csv, sizeof(csv), "0130000000000001|%s\n%s\r\n\n|", input, input);
+	from = csv;
+	total = 0;
+	do {
+		memset(line, CRONFUZZ_GUARD_BYTE, sizeof(line));
+		start = from;
+		eaten = csv_eat_a_line(line, IBD_CSV_LINE_MAX_SIZE, &from);
+		total += eaten;
+		if ( !cronfuzz_guard_ok(line + IBD_CSV_LINE_MAX_SIZE) || strlen(line) >= IBD_CSV_LINE_MAX_SIZE
+				|| from > csv + strlen(csv) || total > strlen(csv) + 1 ) {
+			printf("[%s] csv_eat_a_line out of the buffers\n", input);
+			return errors + 1;
+		}
+		if ( (n = strlen(line)) && (strncmp(start, line, n) || (start[n] && start[n] != '\n' && start[n] != '\r')) ) {
+			printf("[%s] csv_eat_a_line returned a part of a line\n", input);
+			return errors + 1;
+		}
+		if ( n ) {
+			data = csv_process_line(line);
+			ib_pool_free(data);
+		}
+	} while ( eaten && *from );
+	return errors;
+}
+
+/** \brief Fuzz the cron and CSV parsers with mutated inputs, compare the decisions with a reference matcher
+ *  and measure the parser throughput. */
+static int cronfuzz(int argc, char **argv) {
+	static char buf[2 * CRON_MAX_SIZE], calendar_text[sizeof(crontest_calendar_text)];
+	static Evmask masks[CRON_MAX_N];
+	static char csv[IBD_CSV_LINE_MAX_SIZE];
+	int cases = CRONFUZZ_CASES, errors = 0, valid, n_valid = 0, bytes = 0;
+	int64_t start, t_compile;
+	ib_data_t *data;
+
+	int nerrors = arg_parse(argc, argv, (void**) &cronfuzz_args);
+	if ( nerrors ) {
+		arg_print_errors(stderr, cronfuzz_args.end, argv[0]);
+		return 1;
+	}
+	if ( cronfuzz_args.cases->count )
+		cases = cronfuzz_args.cases->ival[0];
+	srand(cronfuzz_args.seed->count ? cronfuzz_args.seed->ival[0] : 1);
+	strcpy(calendar_text, crontest_calendar_text);
+	ib_cal_table_parse(&crontest_calendars, calendar_text, strlen(calendar_text), 0);
+	crontest_calendar_begin();
+	cronfuzz_log_level(ESP_LOG_NONE);
+
+	for ( int c = 0; c < cases; c++ ) {
+		strcpy(buf, cronfuzz_seeds[rand() % (sizeof(cronfuzz_seeds) / sizeof(cronfuzz_seeds[0]))]);
+		cronfuzz_mutate(buf, sizeof(buf));
+		valid = 0;
+		errors += cronfuzz_case(buf, &valid);
+		n_valid += valid;
+	}
+
+	/* Throughput of the seeds */
+	start = esp_timer_get_time();
+	for ( int i = 0; i < 1000; i++ ) {
+		const char *seed = cronfuzz_seeds[i % (sizeof(cronfuzz_seeds) / sizeof(cronfuzz_seeds[0]))];
+		cron_compile(seed, masks, CRON_MAX_N, NULL);
+		bytes += strlen(seed);
+	}
+	t_compile = esp_timer_get_time() - start;
+	start = esp_timer_get_time();
+	for ( int i = 0; i < 1000; i++ ) {
+		snprintf(csv, sizeof(csv), "0130000000000001|%s|1767225600|",
+				cronfuzz_seeds[i % (sizeof(cronfuzz_seeds) / sizeof(cronfuzz_seeds[0]))]);
+		data = csv_process_line(csv);
+		ib_pool_free(data);
+	}
+	start = esp_timer_get_time() - start;
+
+	cronfuzz_log_level(CONFIG_LOG_DEFAULT_LEVEL);
+	crontest_calendar_end();
+	printf("%i inputs, %i valid\n", cases, n_valid);
+	printf("cron_compile: %lld crons/s, %lld KB/s; csv_process_line: %lld lines/s\n",
+			t_compile ? 1000000LL * 1000 / t_compile : 0, t_compile ? 1000000LL * bytes / 1024 / t_compile : 0,
+			start ? 1000000LL * 1000 / start : 0);
+	printf("%s, %i errors\n", errors ? "FAILED" : "PASSED", errors);
+	return errors ? 1 : 0;
+}
+
+/** \brief Default parameters of the generated database and trace. */
+#define GENDB_KEYS 				1000
+#define GENDB_TOUCHES 			10000
+#define GENDB_DAYS 				7
+/** \brief Size of a written block. */
+#define GENDB_BLOCK_SIZE 		1024
+
+static struct {
+	struct arg_int *keys;
+	struct arg_int *schedules;
+	struct arg_int *crons;
+	struct arg_int *complexity;
+	struct arg_int *validity;
+	struct arg_int *touches;
+	struct arg_dbl *zipf;
+	struct arg_int *unknown;
+	struct arg_int *days;
+	struct arg_int *from;
+	struct arg_int *seed;
+	struct arg_lit *load;
+	struct arg_end *end;
+} gendb_args;
+
+static int gendb_int(struct arg_int *arg, int def) {
+	return arg->count ? arg->ival[0] : def;
+}
+
+/** \brief Write a block of the database to FILE_GEN_CSV, or to the database csv.
+ *  \return 0 ok
+ * */
+static int gendb_write(FILE *fptr, char *block, int *len, uint64_t checksum) {
+	int ret = 0;
+
+	if ( !*len )
+		return 0;
+	if ( fptr )
+		ret = (*len != fwrite(block, 1, *len, fptr));
+	else
+		ret = (ibd_append_csv_file(block, len, checksum) != IBD_OK);
+	*len = 0;
+	return ret;
+}
+
+/** \brief Generate a synthetic database and a touch trace for the benchmarks. */
+static int gendb(int argc, char **argv) {
+	ib_gen_t g;
+	ib_gen_trace_t trace;
+	char block[GENDB_BLOCK_SIZE + IBD_CSV_LINE_MAX_SIZE];
+	FILE *fptr = NULL;
+	int64_t start, time, first = 0, last = 0;
+	uint64_t code, checksum;
+	uint32_t touches, unknown = 0, bytes = 0;
+	int len = 0, n, load, locked = 0, ret = 1;
+
+	int nerrors = arg_parse(argc, argv, (void**) &gendb_args);
+	if ( nerrors ) {
+		arg_print_errors(stderr, gendb_args.end, argv[0]);
+		return 1;
+	}
+	memset(&g, 0, sizeof(g));
+	g.keys = gendb_int(gendb_args.keys, GENDB_KEYS);
+	g.schedules = gendb_int(gendb_args.schedules, g.keys / 10 ? g.keys / 10 : 1);
+	g.crons = gendb_int(gendb_args.crons, 2);
+	g.complexity = gendb_int(gendb_args.complexity, 1);
+	g.validity_pct = gendb_int(gendb_args.validity, 10);
+	g.from = gendb_int(gendb_args.from, TZTEST_FROM_S);
+	g.seed = gendb_int(gendb_args.seed, 1);
+	touches = gendb_int(gendb_args.touches, GENDB_TOUCHES);
+	load = gendb_args.load->count;
+	if ( !g.keys || g.crons < 1 || g.crons > CRON_MAX_N || g.complexity > IB_GEN_COMPLEXITY_MAX
+			|| g.validity_pct > 100 || gendb_int(gendb_args.unknown, 5) > 100 ) {
+		printf("Invalid parameter\n");
+		return 1;
+	}
+
+	/* Database */
+	start = esp_timer_get_time();
+	checksum = ((uint64_t)g.seed << 32) ^ ((uint64_t)g.keys << 8) ^ 0x9E;		// Differs from the server's
+	if ( !load && !(fptr = fopen(FILE_GEN_CSV, "w")) ) {
+		printf("Cannot open %s\n", FILE_GEN_CSV);
+		return 1;
+	}
+	if ( load )
+		locked = ibd_lock();		// Like a download
+	for ( uint32_t k = 0; k < g.keys; k++ ) {
+		if ( (n = ib_gen_csv_line(&g, k, block + len, sizeof(block) - len)) < 0 )
+			goto end;
+		len += n;
+		bytes += n;
+		if ( len >= GENDB_BLOCK_SIZE && gendb_write(fptr, block, &len, checksum) ) {
+			printf("Cannot write the database, %u bytes written\n", bytes);
+			goto end;
+		}
+	}
+	if ( gendb_write(fptr, block, &len, checksum) ) {
+		printf("Cannot write the database, %u bytes written\n", bytes);
+		goto end;
+	}
+	if ( fptr ) {
+		fclose(fptr);
+		fptr = NULL;
+	} else if ( ibd_make_bin_database() != ESP_OK ) {
+		printf("Cannot make the database\n");
+		goto end;
+	}
+	if ( locked ) {
+		ibd_unlock();
+		locked = 0;
+	}
+	printf("%u keys, %u schedules, %u bytes%s: %lld ms\n", g.keys, g.schedules, bytes,
+			load ? " loaded into the database" : "", (esp_timer_get_time() - start) / 1000);
+
+	/* Trace */
+	start = esp_timer_get_time();
+	if ( !(fptr = fopen(FILE_GEN_TRACE, "w")) ) {
+		printf("Cannot open %s\n", FILE_GEN_TRACE);
+		goto end;
+	}
+	ib_gen_trace_init(&trace, &g, touches, gendb_args.zipf->count ? gendb_args.zipf->dval[0] : 1.0,
+			gendb_int(gendb_args.unknown, 5), gendb_int(gendb_args.days, GENDB_DAYS));
+	while ( !ib_gen_trace_next(&trace, &time, &code) ) {
+		if ( trace.emitted == 1 )
+			first = time;
+		last = time;
+		unknown += ib_gen_unknown(code);
+		n = ib_gen_trace_line(time, code, block, sizeof(block));
+		if ( n != fwrite(block, 1, n, fptr) ) {
+			printf("Cannot write the trace\n");
+			goto end;
+		}
+	}
+	printf("%u touches, %u unknown, %lld-%lld: %lld ms\n", trace.emitted, unknown, first, last,
+			(esp_timer_get_time() - start) / 1000);
+	ret = 0;
+end:
+	if ( locked )
+		ibd_unlock();
+	if ( fptr )
+		fclose(fptr);
+	return ret;
+}
+
+/** \brief Iterations of the pool soak by default. */
+#define POOLSOAK_N 				100000
+/** \brief Live records of the workload, like the decision worker and the CSV processing. */
+#define POOLSOAK_RECORDS 		4
+/** \brief Long living heap allocations of the other modules, replaced at random. */
+#define POOLSOAK_BACKGROUND 	32
+#define POOLSOAK_BACKGROUND_MAX 512
+#define POOLSOAK_REPORTS 		10
+
+static struct {
+	struct arg_int *n;
+	struct arg_lit *heap;
+	struct arg_end *end;
+} poolsoak_args;
+
+/** \brief A record with random crons and validity, from the pool or from the heap. */
+static ib_data_t *poolsoak_record(int heap) {
+	char crons[IBD_CRON_MAX_SIZE];
+	uint32_t len = esp_random() % (sizeof(crons) - 1);
+
+	memset(crons, '*', len);
+	crons[len] = '\0';
+	if ( heap )
+		return malloc(sizeof(ib_data_t) + len + 1 + IBD_VALIDITY_SIZE);
+	return create_ib_data(0x0100000000000000ULL | esp_random(), crons, 0, esp_random() % 2 ? TZTEST_FROM_S : 0);
+}
+
+/** \brief A log message like create_json_msg(), printed and deleted. */
+static void poolsoak_message() {
+	static const char *const fields[] = { "sec", "min", "hour", "day", "month", "year", "weekday" };
+	cJSON *msg = cJSON_CreateObject(), *time_j = cJSON_CreateObject();
+	char code[17];
+	char *str;
+
+	if ( msg && time_j ) {
+		snprintf(code, sizeof(code), "%08X%08X", esp_random(), esp_random());
+		cJSON_AddStringToObject(msg, "device", "poolsoak");
+		cJSON_AddStringToObject(msg, "key code", code);
+		cJSON_AddStringToObject(msg, "type", "SOAK");
+		cJSON_AddNumberToObject(msg, "reader", esp_random() % 2);
+		for ( int i = 0; i < sizeof(fields) / sizeof(fields[0]); i++ )
+			cJSON_AddNumberToObject(time_j, fields[i], esp_random() % 60);
+		cJSON_AddItemToObject(msg, "time stamp", time_j);
+		time_j = NULL;
+		str = cJSON_Print(msg);
+		ib_pool_free(str);
+	}
+	cJSON_Delete(time_j);
+	cJSON_Delete(msg);
+}
+
+static void poolsoak_report(uint32_t i, uint32_t *worst) {
+	const size_t free_heap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+	const size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+	const uint32_t pct = free_heap ? largest * 100 / free_heap : 0;
+	ib_pool_stats_t stats;
+
+	if ( pct < *worst )
+		*worst = pct;
+	printf("%8u free:%7u largest:%7u %3u%% peaks:", i, free_heap, largest, pct);
+	for ( int p = 0; p < IB_POOLS_N; p++ ) {
+		ib_pool_stats(p, &stats);
+		printf(" %s %u/%u", ib_pool_name(p), stats.peak, stats.blocks);
+	}
+	printf("\n");
+}
+
+/** \brief Mixed allocations of the records, CSV lines and log messages between long living heap blocks.
+ *  The largest free block of the heap compared to the free heap shows the fragmentation.
+ *  With --heap the same workload uses malloc() and the default cJSON allocator, for comparison.
+ * */
+static int poolsoak(int argc, char **argv) {
+	ib_data_t *records[POOLSOAK_RECORDS] = { 0 };
+	void *background[POOLSOAK_BACKGROUND] = { 0 };
+	uint32_t n = POOLSOAK_N, worst = 100, r, slot;
+	int heap;
+	void *line;
+	/* ib_pool_free() frees both, the other tasks may use cJSON while the hooks are changed. */
+	cJSON_Hooks hooks = { .malloc_fn = malloc, .free_fn = ib_pool_free };
+
+	int nerrors = arg_parse(argc, argv, (void**) &poolsoak_args);
+	if ( nerrors ) {
+		arg_print_errors(stderr, poolsoak_args.end, argv[0]);
+		return 1;
+	}
+	if ( poolsoak_args.n->count && poolsoak_args.n->ival[0] > 0 )
+		n = poolsoak_args.n->ival[0];
+	heap = poolsoak_args.heap->count;
+	if ( heap )
+		cJSON_InitHooks(&hooks);
+	esp_log_level_set("*", ESP_LOG_WARN);
+	poolsoak_report(0, &worst);
+	for ( uint32_t i = 1; i <= n; i++ ) {
+		r = esp_random() % 100;
+		if ( r < 50 ) {
+			slot = esp_random() % POOLSOAK_RECORDS;
+			ib_pool_free(records[slot]);
+			records[slot] = poolsoak_record(heap);
+		} else if ( r < 80 ) {
+			poolsoak_message();
+		} else if ( r < 90 ) {
+			line = heap ? malloc(IBD_CSV_LINE_MAX_SIZE + 2) : ib_pool_alloc(IB_POOL_LINE, IBD_CSV_LINE_MAX_SIZE + 2);
+			ib_pool_free(line);
+		} else {
+			slot = esp_random() % POOLSOAK_BACKGROUND;
+			free(background[slot]);
+			background[slot] = malloc(16 + esp_random() % POOLSOAK_BACKGROUND_MAX);
+		}
+		if ( !(i % (n / POOLSOAK_REPORTS ? n / POOLSOAK_REPORTS : 1)) )
+			poolsoak_report(i, &worst);
+	}
+	for ( int i = 0; i < POOLSOAK_RECORDS; i++ )
+		ib_pool_free(records[i]);
+	for ( int i = 0; i < POOLSOAK_BACKGROUND; i++ )
+		free(background[i]);
+	if ( heap )
+		ib_pool_init();
+	esp_log_level_set("*", CONFIG_LOG_DEFAULT_LEVEL);
+	printf("%s: %u iterations, largest free block at least %u%% of the free heap\n",
+			heap ? "heap" : "pools", n, worst);
+	return 0;
+}
+
+/** \brief Codes of the simulated attack, touched every THRTEST_STEP_MS. */
+#define THRTEST_CODES 			40
+#define THRTEST_STEP_MS 		100
+#define THRTEST_VALID_CODE 		0x01000000000000AAULL
+
+/** \brief Counters of the simulated touches. */
+typedef struct thrtest_count {
+	/** Misses not logged. */
+	uint32_t quiet;
+	/** Database scans. */
+	uint32_t scans;
+	/** Database generation. */
+	uint32_t generation;
+} thrtest_count_t;
+
+/** \brief A touch like key_code_lookup(): a locked code is denied, a known miss is not scanned,
+ *  the others are looked up.
+ *  \return 1 the key opens
+ * */
+static int thrtest_touch(ib_throttle_t *thr, uint64_t code, uint32_t now, thrtest_count_t *count) {
+	const ib_throttle_ret_t ret = ib_throttle_check(thr, code, count->generation, now);
+
+	if ( ret == IB_THR_LOCKED )
+		return 0;
+	if ( ret != IB_THR_MISSED ) {
+		count->scans++;
+		if ( code == THRTEST_VALID_CODE )
+			return 1;
+	}
+	ib_throttle_miss(thr, code, 0, count->generation, now);
+	if ( ret == IB_THR_QUIET || ret == IB_THR_MISSED )
+		count->quiet++;
+	return 0;
+}
+
+/** \brief Random codes start a global lockout, a valid key must still open and the misses must not be logged.
+ *  During the lockout a code which missed is not scanned again, until the database changes.
+ * */
+static int thrtest(int argc, char **argv) {
+	ib_throttle_t *thr = malloc(sizeof(ib_throttle_t));
+	ib_throttle_report_t report;
+	thrtest_count_t count = { .generation = 1 };
+	uint32_t now = 0, in_ms, suppressed = 0, scans;
+	int errors = 0;
+
+	if ( !thr ) {
+		printf("No memory\n");
+		return 1;
+	}
+	ib_throttle_init(thr, now);
+	for ( int i = 0; i < THRTEST_CODES; i++ ) {
+		now += THRTEST_STEP_MS;
+		thrtest_touch(thr, 0x0100000000000000ULL | esp_random(), now, &count);
+	}
+	if ( ib_throttle_check(thr, 0x0100000000000001ULL, count.generation, now) != IB_THR_QUIET ) {
+		printf("No global lockout after %i random codes\n", THRTEST_CODES);
+		errors++;
+	}
+	if ( count.quiet != THRTEST_CODES - IB_THROTTLE_GLOBAL_BURST ) {
+		printf("%u of %i misses not logged, expected %i\n", count.quiet, THRTEST_CODES,
+				THRTEST_CODES - IB_THROTTLE_GLOBAL_BURST);
+		errors++;
+	}
+	now += THRTEST_STEP_MS;
+	if ( !thrtest_touch(thr, THRTEST_VALID_CODE, now, &count) ) {
+		printf("Valid key denied during the global lockout\n");
+		errors++;
+	}
+	scans = count.scans;
+	for ( int i = 0; i <= IB_THROTTLE_CODE_BURST; i++ ) {		// The same code again and again
+		now += THRTEST_STEP_MS;
+		thrtest_touch(thr, 0x0100000000000002ULL, now, &count);
+	}
+	if ( count.scans - scans != 1 ) {
+		printf("Repeated code scanned %u times during the global lockout\n", count.scans - scans);
+		errors++;
+	}
+	if ( ib_throttle_check(thr, 0x0100000000000002ULL, count.generation, now) != IB_THR_LOCKED ) {
+		printf("Repeated code not locked out\n");
+		errors++;
+	}
+	now += THRTEST_STEP_MS;
+	if ( !thrtest_touch(thr, THRTEST_VALID_CODE, now, &count) ) {
+		printf("Valid key denied during the lockout of an other code\n");
+		errors++;
+	}
+	now += THRTEST_STEP_MS;
+	thrtest_touch(thr, 0x0100000000000003ULL, now, &count);
+	count.generation++;		// A new database may have the code
+	scans = count.scans;
+	now += THRTEST_STEP_MS;
+	thrtest_touch(thr, 0x0100000000000003ULL, now, &count);
+	if ( count.scans == scans ) {
+		printf("Code not scanned in the new database\n");
+		errors++;
+	}
+	while ( ib_throttle_next_expiry(thr, now, &in_ms) ) {
+		now += in_ms;
+		while ( ib_throttle_expired(thr, now, &report) ) {
+			if ( report.code == IB_THROTTLE_GLOBAL_CODE )
+				suppressed = report.suppressed;
+		}
+	}
+	printf("global lockout: %u misses not logged (%u without scan), %u reported at its end; %u touches denied\n",
+			count.quiet, thr->stats.cached, suppressed, thr->stats.denied);
+	if ( suppressed != count.quiet ) {
+		printf("Suppressed misses are not reported\n");
+		errors++;
+	}
+	free(thr);
+	printf("%s, %i errors\n", errors ? "FAILED" : "PASSED", errors);
+	return errors ? 1 : 0;
+}
+
+/** \brief Default swaps, keys and lookup tasks of the database stress. */
+#define DBSTRESS_SWAPS 			20
+#define DBSTRESS_KEYS 			200
+/** \brief At most this many, a lookup and the writer open files at the same time (max_files of SPIFFS).
+ *  The writers wait for each other, the second one opens no file.
+ * */
+#define DBSTRESS_TASKS 			2
+/** \brief Period of the second writer, which downloads and purges like the sync task. */
+#define DBSTRESS_WRITER_MS 		150
+#define DBSTRESS_STACK 			4096
+/** \brief Latency samples kept of the lookups during the swaps and between them. */
+#define DBSTRESS_SAMPLES 		512
+
+typedef struct dbstress_lat {
+	uint32_t us[DBSTRESS_SAMPLES];
+	uint32_t n;
+	uint32_t max;
+} dbstress_lat_t;
+
+static struct {
+	struct arg_int *swaps;
+	struct arg_int *keys;
+	struct arg_int *tasks;
+	struct arg_end *end;
+} dbstress_args;
+
+static struct {
+	ib_gen_t g;
+	volatile int run;
+	/** Writers in a swap. */
+	volatile int swapping;
+	volatile int tasks;
+	uint64_t checksum;
+	uint32_t lookups;
+	uint32_t failures;
+	uint32_t writes;
+	uint32_t write_failures;
+	dbstress_lat_t swap;
+	dbstress_lat_t quiet;
+	portMUX_TYPE mux;
+} dbstress_state = { .mux = portMUX_INITIALIZER_UNLOCKED };
+
+/** \brief Keep a sample, a random one is replaced when the array is full. */
+static void dbstress_sample(dbstress_lat_t *lat, uint32_t us) {
+	const uint32_t i = lat->n < DBSTRESS_SAMPLES ? lat->n : esp_random() % (lat->n + 1);
+
+	if ( i < DBSTRESS_SAMPLES )
+		lat->us[i] = us;
+	lat->n++;
+	if ( us > lat->max )
+		lat->max = us;
+}
+
+static void dbstress_swapping(int n) {
+	portENTER_CRITICAL(&dbstress_state.mux);
+	dbstress_state.swapping += n;
+	portEXIT_CRITICAL(&dbstress_state.mux);
+}
+
+/** \brief Look up keys of the database until the swaps are finished, every key must be found. */
+static void dbstress_task(void *arg) {
+	ib_data_t *data;
+	uint64_t code;
+	int64_t start;
+	uint32_t us;
+	esp_err_t ret;
+	int swapping;
+
+	while ( dbstress_state.run ) {
+		code = ib_gen_code(&dbstress_state.g, esp_random() % dbstress_state.g.keys);
+		swapping = dbstress_state.swapping;
+		data = NULL;
+		start = esp_timer_get_time();
+		ret = ibd_get_by_code(code, &data);
+		us = (uint32_t)(esp_timer_get_time() - start);
+		swapping |= dbstress_state.swapping;
+		if ( ret == IBD_FOUND && (!data || data->code_s.code != code) )
+			ret = IBD_ERR_DATA;
+		ib_pool_free(data);
+		portENTER_CRITICAL(&dbstress_state.mux);
+		dbstress_state.lookups++;
+		if ( ret != IBD_FOUND )
+			dbstress_state.failures++;
+		dbstress_sample(swapping ? &dbstress_state.swap : &dbstress_state.quiet, us);
+		portEXIT_CRITICAL(&dbstress_state.mux);
+		if ( ret != IBD_FOUND )
+			printf("%016llX: %x\n", code, ret);
+		vTaskDelay(1);
+	}
+	portENTER_CRITICAL(&dbstress_state.mux);
+	dbstress_state.tasks--;
+	portEXIT_CRITICAL(&dbstress_state.mux);
+	vTaskDelete(NULL);
+}
+
+/** \brief Load the keys like a download: CSV, then the binary database, then the swap.
+ *  \return 0 ok
+ * */
+static int dbstress_load(uint64_t checksum) {
+	char block[GENDB_BLOCK_SIZE + IBD_CSV_LINE_MAX_SIZE];
+	int len = 0, n, ret = 1;
+
+	if ( !ibd_lock() )
+		return 1;
+	for ( uint32_t k = 0; k < dbstress_state.g.keys; k++ ) {
+		if ( (n = ib_gen_csv_line(&dbstress_state.g, k, block + len, sizeof(block) - len)) < 0 )
+			goto end;
+		len += n;
+		if ( len >= GENDB_BLOCK_SIZE && gendb_write(NULL, block, &len, checksum) )
+			goto end;
+	}
+	if ( !gendb_write(NULL, block, &len, checksum) )
+		ret = ibd_make_bin_database() != IBD_OK;
+end:
+	ibd_unlock();
+	return ret;
+}
+
+/** \brief Second writer of the database, like the sync task: downloads the same keys and purges.
+ *  Its databases differ in the checksum only, the lookups must find their keys in them too.
+ * */
+static void dbstress_writer(void *arg) {
+	uint32_t purged, i = 0;
+	int64_t now;
+	struct tm time_info;
+	int ret;
+
+	while ( dbstress_state.run ) {
+		dbstress_swapping(1);
+		ret = dbstress_load(dbstress_state.checksum ^ ((uint64_t)++i << 16));
+		dbstress_swapping(-1);
+		if ( !ret && IB_CLOCK_EVAL == ib_clock_eval(&now, &time_info) )
+			ret = ibd_purge_expired(now, &purged) != IBD_OK;
+		portENTER_CRITICAL(&dbstress_state.mux);
+		dbstress_state.writes++;
+		if ( ret )
+			dbstress_state.write_failures++;
+		portEXIT_CRITICAL(&dbstress_state.mux);
+		vTaskDelay(DBSTRESS_WRITER_MS / portTICK_PERIOD_MS);
+	}
+	portENTER_CRITICAL(&dbstress_state.mux);
+	dbstress_state.tasks--;
+	portEXIT_CRITICAL(&dbstress_state.mux);
+	vTaskDelete(NULL);
+}
+
+static int compare_u32(const void *a, const void *b) {
+	const uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+	return (x > y) - (x < y);
+}
+
+static void dbstress_report(const char *name, dbstress_lat_t *lat) {
+	const uint32_t n = lat->n < DBSTRESS_SAMPLES ? lat->n : DBSTRESS_SAMPLES;
+
+	if ( !n ) {
+		printf("%-8s no lookups\n", name);
+		return;
+	}
+	qsort(lat->us, n, sizeof(uint32_t), compare_u32);
+	printf("%-8s %6u lookups, us p50:%u p99:%u max:%u\n", name, lat->n, lat->us[n / 2], lat->us[n * 99 / 100],
+			lat->max);
+}
+
+/** \brief Lookups of the database while it is replaced again and again.
+ *  The console and a second writer task replace it concurrently, like expired -p or gendb --load
+ *  while the sync task downloads. The keys are the same in every database, so every lookup must find its key.
+ *  The latency of the lookups during the swaps is compared to the one between them.
+ * */
+static int dbstress(int argc, char **argv) {
+	uint32_t swaps = DBSTRESS_SWAPS, generation;
+	int tasks = DBSTRESS_TASKS, ret = 0;
+	uint64_t checksum;
+	int64_t start;
+
+	int nerrors = arg_parse(argc, argv, (void**) &dbstress_args);
+	if ( nerrors ) {
+		arg_print_errors(stderr, dbstress_args.end, argv[0]);
+		return 1;
+	}
+	if ( dbstress_args.swaps->count && dbstress_args.swaps->ival[0] > 0 )
+		swaps = dbstress_args.swaps->ival[0];
+	if ( dbstress_args.tasks->count )
+		tasks = dbstress_args.tasks->ival[0];
+	memset(&dbstress_state.g, 0, sizeof(dbstress_state.g));
+	dbstress_state.g.keys = gendb_int(dbstress_args.keys, DBSTRESS_KEYS);
+	dbstress_state.g.schedules = dbstress_state.g.keys / 10 ? dbstress_state.g.keys / 10 : 1;
+	dbstress_state.g.crons = 2;
+	dbstress_state.g.complexity = 1;
+	dbstress_state.g.validity_pct = 0;
+	dbstress_state.g.from = TZTEST_FROM_S;
+	dbstress_state.g.seed = 1;
+	if ( !dbstress_state.g.keys || tasks < 1 || tasks > DBSTRESS_TASKS ) {
+		printf("Invalid parameter\n");
+		return 1;
+	}
+	checksum = ((uint64_t)esp_random() << 32) ^ 0x5D;		// Differs from the server's
+	dbstress_state.checksum = checksum ^ 0xA000;
+	esp_log_level_set("*", ESP_LOG_WARN);
+	if ( dbstress_load(checksum) ) {
+		printf("Cannot load the database\n");
+		esp_log_level_set("*", CONFIG_LOG_DEFAULT_LEVEL);
+		return 1;
+	}
+	dbstress_state.lookups = dbstress_state.failures = 0;
+	dbstress_state.writes = dbstress_state.write_failures = 0;
+	dbstress_state.swap.n = dbstress_state.swap.max = 0;
+	dbstress_state.quiet.n = dbstress_state.quiet.max = 0;
+	dbstress_state.swapping = 0;
+	dbstress_state.run = 1;
+	for ( int i = 0; i < tasks; i++ ) {
+		if ( pdPASS != xTaskCreate(dbstress_task, "dbstress", DBSTRESS_STACK, NULL, 1, NULL) ) {
+			printf("Cannot create a lookup task\n");
+			break;
+		}
+		portENTER_CRITICAL(&dbstress_state.mux);
+		dbstress_state.tasks++;
+		portEXIT_CRITICAL(&dbstress_state.mux);
+	}
+	if ( pdPASS == xTaskCreate(dbstress_writer, "dbwriter", DBSTRESS_STACK, NULL, 1, NULL) ) {
+		portENTER_CRITICAL(&dbstress_state.mux);
+		dbstress_state.tasks++;
+		portEXIT_CRITICAL(&dbstress_state.mux);
+	} else {
+		printf("Cannot create the writer task\n");
+	}
+	start = esp_timer_get_time();
+	generation = ibd_generation();
+	for ( uint32_t i = 1; i <= swaps && dbstress_state.tasks; i++ ) {
+		vTaskDelay(100 / portTICK_PERIOD_MS);
+		dbstress_swapping(1);
+		ret = dbstress_load(checksum + i);
+		dbstress_swapping(-1);
+		if ( ret ) {
+			printf("Cannot load the database at swap %u\n", i);
+			break;
+		}
+	}
+	dbstress_state.run = 0;
+	while ( dbstress_state.tasks )
+		vTaskDelay(10 / portTICK_PERIOD_MS);
+	esp_log_level_set("*", CONFIG_LOG_DEFAULT_LEVEL);
+	printf("%u swaps in %lld ms, %u keys, %i tasks, %u of %u writes of the second writer failed\n",
+			ibd_generation() - generation, (esp_timer_get_time() - start) / 1000, dbstress_state.g.keys, tasks,
+			dbstress_state.write_failures, dbstress_state.writes);
+	dbstress_report("swap", &dbstress_state.swap);
+	dbstress_report("between", &dbstress_state.quiet);
+	ret |= !dbstress_state.lookups || dbstress_state.failures || !dbstress_state.writes
+			|| dbstress_state.write_failures;
+	printf("%s, %u of %u lookups failed\n", ret ? "FAILED" : "PASSED", dbstress_state.failures,
+			dbstress_state.lookups);
+	return ret ? 1 : 0;
+}
+
 void register_tests(){
 	const esp_console_cmd_t cmd = {
 			.command = "erasefs",
@@ -40,4 +1873,133 @@ void register_tests(){
 			.func = &erase_fs,
 	};
 	ESP_ERROR_CHECK(esp_console_cmd_register(&cmd));
+
+	owsim_args.reads = arg_int0("n", "reads", "<n>", "Number of reads");
+	owsim_args.jitter = arg_int0("j", "jitter", "<us>", "Maximum alarm latency");
+	owsim_args.noise = arg_int0("e", "noise", "<ppm>", "Flipped samples per million");
+	owsim_args.rise = arg_int0("r", "rise", "<us>", "Rise time of the line");
+	owsim_args.slaves = arg_int0("s", "search", "<n>", "Search n slaves with SEARCH ROM");
+	owsim_args.overdrive = arg_lit0("o", "overdrive", "Overdrive speed");
+	owsim_args.end = arg_end(0);
+	const esp_console_cmd_t owsim_cmd = {
+			.command = "owsim",
+			.help = "Test the 1-Wire engine on a simulated bus",
+			.func = &owsim,
+			.argtable = &owsim_args
+	};
+	ESP_ERROR_CHECK(esp_console_cmd_register(&owsim_cmd));
+
+	fsmtest_args.events = arg_int0("n", "events", "<n>", "Number of random events");
+	fsmtest_args.end = arg_end(0);
+	const esp_console_cmd_t fsmtest_cmd = {
+			.command = "fsmtest",
+			.help = "Replay input traces on the reader FSM",
+			.func = &fsmtest,
+			.argtable = &fsmtest_args
+	};
+	ESP_ERROR_CHECK(esp_console_cmd_register(&fsmtest_cmd));
+
+	clocksim_args.outage = arg_int0("o", "outage", "<s>", "Length of the power cut");
+	clocksim_args.sntp = arg_int0("s", "sntp", "<s>", "SNTP sync after the boot, never when negative");
+	clocksim_args.duration = arg_int0("n", "duration", "<s>", "Simulated time after the boot");
+	clocksim_args.end = arg_end(0);
+	const esp_console_cmd_t clocksim_cmd = {
+			.command = "clocksim",
+			.help = "Boot to first correct decision with the clock policies",
+			.func = &clocksim,
+			.argtable = &clocksim_args
+	};
+	ESP_ERROR_CHECK(esp_console_cmd_register(&clocksim_cmd));
+
+	tztest_args.tz = arg_str0("z", "tz", "<TZ>", "POSIX time zone, the current one by default");
+	tztest_args.end = arg_end(0);
+	const esp_console_cmd_t tztest_cmd = {
+			.command = "tztest",
+			.help = "Compare the time zone table with localtime_r around the DST transitions",
+			.func = &tztest,
+			.argtable = &tztest_args
+	};
+	ESP_ERROR_CHECK(esp_console_cmd_register(&tztest_cmd));
+
+	crontest_args.cases = arg_int0("n", "cases", "<n>", "Number of random schedules");
+	crontest_args.end = arg_end(0);
+	const esp_console_cmd_t crontest_cmd = {
+			.command = "crontest",
+			.help = "Compare the next change search of the crons with a minute by minute search",
+			.func = &crontest,
+			.argtable = &crontest_args
+	};
+	ESP_ERROR_CHECK(esp_console_cmd_register(&crontest_cmd));
+
+	slicebench_args.schedules = arg_int0("n", "schedules", "<n>", "Number of schedules, 10, 1000 and 10000 by default");
+	slicebench_args.end = arg_end(0);
+	const esp_console_cmd_t slicebench_cmd = {
+			.command = "slicebench",
+			.help = "Evaluate many schedules bit-sliced and one by one",
+			.func = &slicebench,
+			.argtable = &slicebench_args
+	};
+	ESP_ERROR_CHECK(esp_console_cmd_register(&slicebench_cmd));
+
+	cronfuzz_args.cases = arg_int0("n", "cases", "<n>", "Number of mutated inputs");
+	cronfuzz_args.seed = arg_int0("s", "seed", "<n>", "Seed of the random inputs");
+	cronfuzz_args.end = arg_end(0);
+	const esp_console_cmd_t cronfuzz_cmd = {
+			.command = "cronfuzz",
+			.help = "Fuzz the cron and CSV parsers against a reference matcher",
+			.func = &cronfuzz,
+			.argtable = &cronfuzz_args
+	};
+	ESP_ERROR_CHECK(esp_console_cmd_register(&cronfuzz_cmd));
+
+	gendb_args.keys = arg_int0("n", "keys", "<n>", "Keys of the database");
+	gendb_args.schedules = arg_int0("s", "schedules", "<n>", "Different schedules, keys / 10 by default");
+	gendb_args.crons = arg_int0("c", "crons", "<n>", "Maximum crons of a schedule");
+	gendb_args.complexity = arg_int0("x", "complexity", "<0-2>", "Ranges, lists and steps, last days and calendars");
+	gendb_args.validity = arg_int0("v", "validity", "<%>", "Keys with a validity range");
+	gendb_args.touches = arg_int0("t", "touches", "<n>", "Touches of the trace");
+	gendb_args.zipf = arg_dbl0("z", "zipf", "<s>", "Zipf exponent of the touched keys");
+	gendb_args.unknown = arg_int0("u", "unknown", "<%>", "Touches of unknown keys");
+	gendb_args.days = arg_int0("d", "days", "<n>", "Days of the trace");
+	gendb_args.from = arg_int0("f", "from", "<epoch>", "Start of the trace and of the validity ranges");
+	gendb_args.seed = arg_int0("r", "seed", "<n>", "Seed of the generator");
+	gendb_args.load = arg_lit0("l", "load", "Load the keys into the database instead of " FILE_GEN_CSV);
+	gendb_args.end = arg_end(0);
+	const esp_console_cmd_t gendb_cmd = {
+			.command = "gendb",
+			.help = "Generate a synthetic database and a touch trace (" FILE_GEN_TRACE ")",
+			.func = &gendb,
+			.argtable = &gendb_args
+	};
+	ESP_ERROR_CHECK(esp_console_cmd_register(&gendb_cmd));
+
+	poolsoak_args.n = arg_int0("n", "iterations", "<n>", "Allocation rounds");
+	poolsoak_args.heap = arg_lit0(NULL, "heap", "Use the heap instead of the pools");
+	poolsoak_args.end = arg_end(0);
+	const esp_console_cmd_t poolsoak_cmd = {
+			.command = "poolsoak",
+			.help = "Heap fragmentation under the allocations of the records, CSV lines and log messages",
+			.func = &poolsoak,
+			.argtable = &poolsoak_args
+	};
+	ESP_ERROR_CHECK(esp_console_cmd_register(&poolsoak_cmd));
+
+	const esp_console_cmd_t thrtest_cmd = {
+			.command = "thrtest",
+			.help = "A valid key opens during a global lockout of the invalid keys",
+			.func = &thrtest,
+	};
+	ESP_ERROR_CHECK(esp_console_cmd_register(&thrtest_cmd));
+
+	dbstress_args.swaps = arg_int0("n", "swaps", "<n>", "Database swaps");
+	dbstress_args.keys = arg_int0("k", "keys", "<n>", "Keys of the database");
+	dbstress_args.tasks = arg_int0("t", "tasks", "<1-2>", "Lookup tasks");
+	dbstress_args.end = arg_end(0);
+	const esp_console_cmd_t dbstress_cmd = {
+			.command = "dbstress",
+			.help = "Lookups while the database is swapped, replaces the database",
+			.func = &dbstress,
+			.argtable = &dbstress_args
+	};
+	ESP_ERROR_CHECK(esp_console_cmd_register(&dbstress_cmd));
 }
@@ -13,6 +13,7 @@
 #include "nvs.h"
 #include "nvs_flash.h"
 #include "ib_sntp.h"
+#include "ib_static.h"
 
 #define true 1
 #define false 0
@@ -20,6 +21,7 @@
 const int DEFAULT_TIMEOUT_MS = 15000;
 
 EventGroupHandle_t wifi_event_group;
+IB_EVENT_GROUP_STORAGE(wifi_group, 1);
 
 const int CONNECTED_BIT = BIT0;
 
@@ -65,7 +67,7 @@ static void initialise_wifi(void)
         return;
     }
     tcpip_adapter_init();
-    wifi_event_group = xEventGroupCreate();
+    wifi_event_group = IB_EVENT_GROUP_CREATE(wifi_group, 0);
     ESP_ERROR_CHECK( esp_event_loop_init(event_handler, NULL) );
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK( esp_wifi_init(&cfg) );
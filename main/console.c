@@ -21,6 +21,11 @@
 
 
 #include "console.h"
+#include "ib_static.h"
+
+#define CONSOLE_TASK_STACK 4096
+
+IB_TASK_STORAGE(console_task, CONSOLE_TASK_STACK, 1);
 
 /**\brief Try to read the saved WiFi configuration from the flash.
  * \return ESP_ERR_NVS* when error occurs.
@@ -152,7 +157,7 @@ void start_console(){
     register_system();
     register_wifi();
 
-	if(xTaskCreate(cmd_task, task_name, 4096,
+	if(IB_TASK_CREATE(console_task, 0, cmd_task, task_name,
 				0, 5, &cmd_handler) !=pdPASS){
 		printf("%s cannot be created.\n",task_name);
 	}
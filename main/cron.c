@@ -21,6 +21,9 @@
 
 char *pgm;
 
+/** \brief Calendars of the days, none without it. */
+static cron_calendar_fn calendar_days;
+
 /** \brief Eat blanks. */
 char* firstnonblank(char *s) {
     while (*s && isspace((unsigned char)*s)) ++s;
@@ -40,8 +43,151 @@ int check_domain(Evmask *t, Evmask *m) {
 	&& (t->hours & m->hours)
 	&& (t->mday & m->mday)
 	&& (t->month & m->month)
-	&& (t->wday & m->wday) ) return 1;
+	&& (t->wday & m->wday)
+	&& (!m->cal || (t->cal & m->cal))
+	&& !(t->cal & m->cal_not) ) return 1;
     return 0;
 }
 
+/** \brief All the 60 minutes of an hour. */
+#define MINUTES_ALL		((1ULL << 60) - 1)
+
+static int
+is_leap(int year)
+{
+	return (year % 4 == 0) && ((year % 100 != 0) || (year % 400 == 0));
+}
+
+static int
+days_in_month(int mon, int year)
+{
+	static const uint8_t days[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+	if ( mon == 1 && is_leap(year) )
+		return 29;
+	return days[mon];
+}
+
+/** \brief Set the source of the calendars (ib_calendar).
+ * \return the previous source
+ */
+cron_calendar_fn
+cron_set_calendar(cron_calendar_fn fn)
+{
+	cron_calendar_fn prev = calendar_days;
+	calendar_days = fn;
+	return prev;
+}
+
+/** \brief Set the day fields of a time mask.
+ * \param mon 0-11
+ * \param wday 0-6, 0 is Sunday
+ */
+void
+daytoEvmask(int year, int mon, int mday, int wday, Evmask *time)
+{
+	const int last = days_in_month(mon, year);
+	const int w = wday ? wday : 7;
+
+	time->mday |= 1UL << mday;
+	if ( mday == last )
+		time->mday |= 1UL << CRON_MDAY_LAST;
+	time->month |= 1U << (mon + 1);
+	time->wday |= 1ULL << w;
+	time->wday |= 1ULL << CRON_WDAY_NTH(w, (mday - 1) / 7 + 1);
+	if ( mday + 7 > last )
+		time->wday |= 1ULL << CRON_WDAY_NTH(w, 6);
+	if ( calendar_days ) {
+		static const uint16_t before[12] = { 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334 };
+		time->cal = calendar_days(year, before[mon] + (mon > 1 && is_leap(year)) + mday - 1);
+	}
+}
+
+/** \brief Minutes of a day in the domains, bit m of minutes[h] is h:m.
+ *  \return 0 no minute of the day is in a domain
+ */
+static int
+day_minutes(const Evmask *masks, int n, int year, int mon, int mday, int wday, uint64_t minutes[24])
+{
+	Evmask day = { 0 };
+	uint64_t mins;
+	int any = 0;
+
+	daytoEvmask(year, mon, mday, wday, &day);
+	memset(minutes, 0, 24 * sizeof(uint64_t));
+	for ( int i = 0; i < n; i++ ) {
+		const Evmask *m = &masks[i];
+		if ( !(m->mday & day.mday) || !(m->month & day.month) || !(m->wday & day.wday)
+				|| (m->cal && !(day.cal & m->cal)) || (day.cal & m->cal_not) )
+			continue;
+		mins = (uint32_t)m->minutes[0] | ((uint64_t)(uint32_t)m->minutes[1] << 32);
+		for ( int h = 0; h < 24; h++ ) {
+			if ( m->hours & (1UL << h) ) {
+				minutes[h] |= mins;
+				any = 1;
+			}
+		}
+	}
+	return any;
+}
+
+/** \brief Find the next minute when the compiled crons change state (access opens or closes).
+ *  The days are checked with the day fields, the minutes of an hour with one 64 bit word,
+ *  so the search does not step minute by minute.
+ *  The times are wall clock (local) times, at->tm_isdst is -1.
+ *  \param masks compiled crons (cron_compile())
+ *  \param from the search starts at this minute
+ *  \param at set to the first minute of the new state
+ *  \return 1 access opens at at
+ *  \return 0 access closes at at
+ *  \return -1 no change in CRON_SEARCH_DAYS, or no crons
+ */
+int
+cron_next_change(const Evmask *masks, int n, const struct tm *from, struct tm *at)
+{
+	uint64_t minutes[24], word;
+	int year = from->tm_year + 1900;
+	int mon = from->tm_mon, mday = from->tm_mday, wday = from->tm_wday, yday = from->tm_yday;
+	int hour = from->tm_hour, min = from->tm_min;
+	int state, any;
+
+	if ( n <= 0 )
+		return -1;
+	any = day_minutes(masks, n, year, mon, mday, wday, minutes);
+	state = (minutes[hour] >> min) & 1;
+	for ( int day = 0; day <= CRON_SEARCH_DAYS; day++ ) {
+		if ( day ) {
+			hour = min = 0;
+			wday = (wday + 1) % 7;
+			yday++;
+			if ( ++mday > days_in_month(mon, year) ) {
+				mday = 1;
+				if ( ++mon > 11 ) {
+					mon = 0;
+					year++;
+					yday = 0;
+				}
+			}
+			any = day_minutes(masks, n, year, mon, mday, wday, minutes);
+		}
+		if ( !any && !state )		// Closed all day.
+			continue;
+		for ( ; hour < 24; hour++, min = 0 ) {
+			word = (state ? ~minutes[hour] : minutes[hour]) & (MINUTES_ALL << min) & MINUTES_ALL;
+			if ( !word )
+				continue;
+			memset(at, 0, sizeof(*at));
+			at->tm_min = __builtin_ctzll(word);
+			at->tm_hour = hour;
+			at->tm_mday = mday;
+			at->tm_mon = mon;
+			at->tm_year = year - 1900;
+			at->tm_wday = wday;
+			at->tm_yday = yday;
+			at->tm_isdst = -1;
+			return !state;
+		}
+	}
+	return -1;
+}
+
 /** @} */
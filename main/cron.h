@@ -13,33 +13,68 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <time.h>
+#include <stdint.h>
 
 /** Separator between multiple crons. */
 #define SEPARATOR ';'
 
 #define CRON_MAX_SIZE 256
 #define CBIT(t)		(1 << (t))
+/** Maximum number of crons compiled by cron_compile(). */
+#define CRON_MAX_N 		16
+/** Days searched by cron_next_change(), a Feb 29 schedule changes in it. */
+#define CRON_SEARCH_DAYS	(4 * 366 + 1)
 
 
+/** mday bit of the last day of the month ('L'). */
+#define CRON_MDAY_LAST		0
+/** wday bit of the nth (1-5) weekday w (1-7) of the month ('w#n'), n = 6 is the last one ('wL'). */
+#define CRON_WDAY_NTH(w, n)	(8 + ((w) - 1) * 6 + ((n) - 1))
+/** Number of date calendars, referenced by '@n' (only the dates of calendar n)
+ * or '!n' (not the dates of calendar n) after the fields of a cron. */
+#define CRON_CALENDARS		32
+
 /**
  * 60 bits for minute,
- * 31 bits for mday,
+ * 31 bits for mday and the last day,
  * 24 bits for hour,
  * 12 bits for month,
- *  7 bits for wday
+ *  7 bits for wday and 42 bits for the nth and last weekdays,
+ * 32 bits for the calendars
  */
 typedef struct {
 	unsigned long minutes[2];	/* 60 bits worth 16B */
     unsigned long hours;	/* 24 bits worth 8B */
-    unsigned long mday;		/* 31 bits worth 8B */
-    unsigned int  wday;		/*  7 bits worth 4B */
+    unsigned long mday;		/* 32 bits worth 8B */
+    uint64_t      wday;		/* 50 bits worth 8B */
     unsigned int  month;	/* 12 bits worth 4B */
+    uint32_t      cal;		/* calendars of the day, or one of them is required ('@n') */
+    uint32_t      cal_not;	/* calendars excluded ('!n') */
 } Evmask;
 
+/** \brief Calendars of a day, bit n - 1 is set when the day is in calendar n.
+ * \param yday 0-365
+ */
+typedef uint32_t (*cron_calendar_fn)(int year, int yday);
+
+/** \brief Compile error of a cron string. */
+typedef struct {
+	/** Index of the cron in the string, from 1. */
+	int cron;
+	/** Position in the cron, from 1. */
+	int column;
+	const char *msg;
+} cron_error_t;
+
 int check_domain(Evmask *t, Evmask *m);
 char *getdatespec(char *cron_s, Evmask *time_mask);
 void tmtoEvmask(struct tm *, Evmask*);
+void daytoEvmask(int year, int mon, int mday, int wday, Evmask *time);
+cron_calendar_fn cron_set_calendar(cron_calendar_fn fn);
 int checkcrons(char *crons_s, struct tm *time);
+int cron_compile(const char *crons_s, Evmask *masks, int max, cron_error_t *err);
+int cron_match(const Evmask *masks, int n, const struct tm *time);
+int cron_next_change(const Evmask *masks, int n, const struct tm *from, struct tm *at);
 
 char *firstnonblank(char*);
 void error(char*,...);
@@ -9,6 +9,7 @@
 #include <sys/stat.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
 #include <stdarg.h>
 #include <dirent.h>
@@ -25,150 +26,232 @@ typedef void (*ef)(Evmask*,int);
 /** A constraint defines part of a time spec.
  * min & max are the smallest and largest possible values,
  * units is a string describing what the constraint is,
- * setter is a function that sets the time spec.
+ * setter is a function that sets the time spec,
+ * names are the 3 letter names of the values from min, or NULL.
  */
 typedef struct {
     int min;
     int max;
     char *units;
     ef setter;
+    const char *const *names;
 } constraint;
 
 static void
 sminute(Evmask *mask, int min)
 {
     if (min >= 32)
-	mask->minutes[1] |= 1 << (min-32);
+	mask->minutes[1] |= 1UL << (min-32);
     else
-	mask->minutes[0] |= 1 << (min);
+	mask->minutes[0] |= 1UL << (min);
 }
 
 static void
 shour(Evmask *mask, int hour)
 {
-    mask->hours |= 1 << (hour);
+    mask->hours |= 1UL << (hour);
 }
 
 static void
 smday(Evmask *mask, int mday)
 {
-    mask->mday |= 1 << (mday);
+    mask->mday |= 1UL << (mday);
 }
 
 static void
 smonth(Evmask *mask, int month)
 {
-    mask->month |= 1 << (month);
+    mask->month |= 1U << (month);
 }
 
 static void
 swday(Evmask *mask, int wday)
 {
     if (wday == 0) wday = 7;
-    mask->wday |= 1 << (wday);
+    mask->wday |= 1ULL << (wday);
 }
 
-static constraint minutes = { 0, 59, "minutes", sminute };
-static constraint hours =   { 0, 23, "hours", shour };
-static constraint mday =    { 0, 31, "day of the month", smday };
-static constraint months =  { 1, 12, "months",  smonth };
-static constraint wday =    { 0,  7, "day of the week", swday };
-
-
-/* Check a number against a constraint.
- */
-static int
-constrain(int num, constraint *limit)
+/** Set the nth (1-5) weekday of the month, n = 6 is the last one. */
+static void
+swday_nth(Evmask *mask, int wday, int n)
 {
-    return (num >= limit->min) || (num <= limit->max);
+    if (wday == 0) wday = 7;
+    mask->wday |= 1ULL << CRON_WDAY_NTH(wday, n);
 }
 
-/** Pick a number off the front of a string, validate it,
- * and repoint the string to after the number.
+static const char *const month_names[] = { "jan", "feb", "mar", "apr", "may", "jun",
+		"jul", "aug", "sep", "oct", "nov", "dec", NULL };
+static const char *const wday_names[] = { "sun", "mon", "tue", "wed", "thu", "fri", "sat", NULL };
+
+static const constraint minutes = { 0, 59, "minutes", sminute, NULL };
+static const constraint hours =   { 0, 23, "hours", shour, NULL };
+static const constraint mday =    { 1, 31, "day of the month", smday, NULL };
+static const constraint months =  { 1, 12, "months",  smonth, month_names };
+static const constraint wday =    { 0,  7, "day of the week", swday, wday_names };
+
+/** Pick a number or a name off the front of a string, validate it,
+ * and repoint the string to after it.
+ * \return -1 error, err is set
  */
 static int
-number(char **s, constraint *limit)
+value(const char **s, const constraint *limit, const char **err)
 {
-    int num;
+    long num;
     char *e;
 
-    num = strtoul(*s, &e, 10);
-    if (e == *s) {
-    	return 0;
-    }
-
-    if (limit) {
-	if (constrain(num, limit) == 0) {
-	    return 0;
+    if (limit->names && isalpha((unsigned char)**s)) {
+	for (int i = 0; limit->names[i]; i++) {
+	    if (strncasecmp(*s, limit->names[i], 3) == 0) {
+		*s += 3;
+		return limit->min + i;
+	    }
 	}
+	*err = "unknown name";
+	return -1;
+    }
+    if (!isdigit((unsigned char)**s)) {
+	*err = "number expected";
+	return -1;
+    }
+    num = strtol(*s, &e, 10);
+    if (num < limit->min || num > limit->max) {
+	*err = "value out of range";
+	return -1;
     }
     *s = e;
     return num;
 }
 
-
-/** Assign a value to an Evmask.
- */
-static void
-assign(int time, Evmask *mask, ef setter)
-{
-    (*setter)(mask, time);
-}
-
-
-/** \brief Parsing the cron string to a time mask
- * Pick a time field off a line, returning a pointer to
- * the rest of the line.
+/** \brief Compile a time field to the time mask.
+ * Items separated by ',': '*', a value, a range 'a-b', a step '/n' after them,
+ * 'L' last day of the month, 'w#n' nth weekday, 'wL' last weekday of the month.
+ * \param s the field, on return after the field and the blanks, or the position of the error
+ * \return 0 ok
+ * \return -1 error, err is set
  */
-static char *
-parse(char *s, Evmask *time_mask, constraint *limit)
+static int
+parse(const char **s, Evmask *time_mask, const constraint *limit, const char **err)
 {
-    int num, num2, skip;
-
-    if (s == 0)
-	return 0;
+    int num, num2, n;
+    long step;
+    char *e;
 
     do {
-	skip = 0;
-	num2 = 0;
-
-	if (*s == '*') {
+	step = 1;
+	if (**s == '*') {
 	    num = limit->min;
 	    num2 = limit->max;
-	    ++s;
+	    ++*s;
+	}
+	else if (limit == &mday && **s == 'L') {
+	    time_mask->mday |= 1UL << CRON_MDAY_LAST;
+	    ++*s;
+	    goto next;
 	}
 	else {
-	    num = number(&s,limit);
-
-	    if (*s == '-') {
-		++s;
-		num2 = number(&s, limit);
-		skip = 1;
+	    if ((num = value(s, limit, err)) < 0)
+		return -1;
+	    num2 = num;
+	    if (limit == &wday && (**s == '#' || **s == 'L')) {
+		if (**s == 'L') {
+		    n = 6;
+		}
+		else {
+		    ++*s;
+		    n = **s - '0';
+		    if (n < 1 || n > 5) {
+			*err = "nth weekday must be 1-5";
+			return -1;
+		    }
+		}
+		++*s;
+		swday_nth(time_mask, num, n);
+		goto next;
 	    }
+	    if (**s == '-') {
+		++*s;
+		if ((num2 = value(s, limit, err)) < 0)
+		    return -1;
+		if (limit == &wday && num2 == 0)	/* fri-sun */
+		    num2 = 7;
+		if (num2 < num) {
+		    *err = "empty range";
+		    return -1;
+		}
+	    }
+	    else if (**s == '/')
+		num2 = limit->max;
 	}
 
-	if ( *s == '/' ) {
-	    ++s;
-	    skip = number(&s, 0);
-	}
-
-	if (num2) {
-	    if (skip == 0) skip = 1;
-	    while ( constrain(num, limit) && (num <= num2) ) {
-		assign(num, time_mask, limit->setter);
-		num += skip;
+	if (**s == '/') {
+	    ++*s;
+	    step = isdigit((unsigned char)**s) ? strtol(*s, &e, 10) : 0;
+	    if (step < 1 || step > limit->max) {
+		*err = "invalid step";
+		return -1;
 	    }
+	    *s = e;
 	}
-	else
-	    assign(num, time_mask, limit->setter);
+	for ( ; num <= num2; num += step)
+	    (*limit->setter)(time_mask, num);
 
-	if ( isspace((unsigned char)*s) ) return firstnonblank(s);
-	else if (*s != ',') 
+    next:
+	if (**s == ',') {
+	    ++*s;
+	    continue;
+	}
+	if (**s == '\0' || isspace((unsigned char)**s)) {
+	    *s = firstnonblank((char*)*s);
 	    return 0;
-	++s;
+	}
+	*err = "unexpected character";
+	return -1;
     } while (1);
 }
 
+/** \brief Compile the five fields of a cron and the calendar references.
+ * \param s the cron, on return after the fields, or the position of the error
+ * \return 0 ok
+ * \return -1 error, err is set
+ */
+static int
+compile_datespec(const char **s, Evmask *time_mask, const char **err)
+{
+    static const constraint *const fields[] = { &minutes, &hours, &mday, &months, &wday };
+
+    bzero(time_mask, sizeof *time_mask);
+    *s = firstnonblank((char*)*s);
+    for (int i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+	if (**s == '\0') {
+	    *err = "missing field";
+	    return -1;
+	}
+	if (parse(s, time_mask, fields[i], err))
+	    return -1;
+    }
+    while (**s == '@' || **s == '!') {	/* Calendars */
+	const char c = **s;
+	char *e;
+	long n;
+	++*s;
+	n = isdigit((unsigned char)**s) ? strtol(*s, &e, 10) : 0;
+	if (n < 1 || n > CRON_CALENDARS) {
+	    *err = "calendar must be 1-32";
+	    return -1;
+	}
+	*s = e;
+	if (**s != '\0' && !isspace((unsigned char)**s)) {
+	    *err = "unexpected character";
+	    return -1;
+	}
+	if (c == '@')
+	    time_mask->cal |= 1UL << (n - 1);
+	else
+	    time_mask->cal_not |= 1UL << (n - 1);
+	*s = firstnonblank((char*)*s);
+    }
+    return 0;
+}
 
 /** \brief Create a mask type data from cron string.
  * Read the entire time spec off the start of a line.
@@ -180,13 +263,12 @@ parse(char *s, Evmask *time_mask, constraint *limit)
 char *
 getdatespec(char *cron_s, Evmask *time_mask)
 {
-    bzero(time_mask, sizeof *time_mask);
-    cron_s = parse(cron_s, time_mask, &minutes);
-    cron_s = parse(cron_s, time_mask, &hours);
-    cron_s = parse(cron_s, time_mask, &mday);
-    cron_s = parse(cron_s, time_mask, &months);
-    cron_s = parse(cron_s, time_mask, &wday);
-    return cron_s;
+    const char *s = cron_s;
+    const char *err;
+
+    if (cron_s == 0 || compile_datespec(&s, time_mask, &err))
+	return 0;
+    return (char*)s;
 }
 
 
@@ -201,9 +283,7 @@ tmtoEvmask(struct tm *tm, Evmask *time)
 
     sminute(time, tm->tm_min);
     shour(time,   tm->tm_hour);
-    smday(time,   tm->tm_mday);
-    smonth(time,1+tm->tm_mon);
-    swday(time,   tm->tm_wday);
+    daytoEvmask(tm->tm_year + 1900, tm->tm_mon, tm->tm_mday, tm->tm_wday, time);
 }
 
 char *
@@ -212,7 +292,8 @@ split_crons(char *crons_s, size_t *length){
 		return NULL;
 
 	char *cron_next = crons_s;
-	while((*length)--){
+	while(*length > 0){
+		(*length)--;		// Stops at 0, the caller loops while it is not 0
 		switch(*cron_next){
 			case '\0':
 				ESP_LOGD(TAG,"EOF");
@@ -241,7 +322,7 @@ split_crons(char *crons_s, size_t *length){
 int
 checkcrons(char *crons_s, struct tm *time)
 {
-	char cron[256];
+	char cron[CRON_MAX_SIZE];
 	char *cron_next;
 	char *cron_cur = cron;
 	size_t cron_length = CRON_MAX_SIZE-1;
@@ -256,6 +337,10 @@ checkcrons(char *crons_s, struct tm *time)
 			time->tm_mday, time->tm_mon, time->tm_wday);
 #endif
 	tmtoEvmask(time, &mask_time);	// Convert tm struct into mask
+	if(strlen(crons_s) >= sizeof(cron)) {
+		ESP_LOGW(TAG,"Crons too long");
+		return 0;	// A truncated cron would be another schedule
+	}
 	strcpy(cron,crons_s);
 	while(cron_length > 0){
 		cron_next = split_crons(cron_cur, &cron_length);
@@ -263,8 +348,8 @@ checkcrons(char *crons_s, struct tm *time)
 		ESP_LOGD(TAG,"cron_next=%s\n",cron_next == NULL ? "NULL" : cron_next);
 		ESP_LOGD(TAG,"Check this cron=[%s]\n",cron_cur == NULL ? "NULL" : cron_cur);
 #endif
-		getdatespec(cron_cur, &mask_cron);	// Convert string into mask
-		if(check_domain(&mask_time, &mask_cron))
+		if(getdatespec(cron_cur, &mask_cron)	// Convert string into mask, an invalid cron is out of domain
+				&& check_domain(&mask_time, &mask_cron))
 			return 1;									// In domain
 		if(cron_next == NULL)
 			return 0;	// End of domain / Null parameter
@@ -274,6 +359,82 @@ checkcrons(char *crons_s, struct tm *time)
 	return 0;	// Not found a domain fitted in
 }
 
+/** \brief Compile the crons once, so they can be checked without parsing.
+ *  \param crons_s cron strings with separators, NULL: no crons
+ *  \param masks output, one mask per cron
+ *  \param max size of masks
+ *  \param err set on error, may be NULL
+ *  \return number of masks, 0 when there are no crons (always in domain)
+ *  \return -1 invalid cron or more than max crons
+ * */
+int
+cron_compile(const char *crons_s, Evmask *masks, int max, cron_error_t *err)
+{
+	char cron[CRON_MAX_SIZE];
+	char *cron_next;
+	char *cron_cur = cron;
+	size_t cron_length = CRON_MAX_SIZE-1;
+	const char *s;
+	const char *msg;
+	int n = 0;
+
+	if ( crons_s == NULL )
+		return 0;
+	if ( strlen(crons_s) >= sizeof(cron) ) {
+		if ( err ) {
+			err->cron = 1;
+			err->column = sizeof(cron);
+			err->msg = "crons too long";
+		}
+		return -1;
+	}
+	strcpy(cron, crons_s);
+	while ( cron_length > 0 ) {
+		cron_next = split_crons(cron_cur, &cron_length);
+		s = cron_cur;
+		if ( n >= max )
+			msg = "too many crons";
+		else if ( compile_datespec(&s, &masks[n], &msg) )
+			;
+		else if ( *s != '\0' )
+			msg = "too many fields";
+		else
+			msg = NULL;
+		if ( msg ) {
+			if ( err ) {
+				err->cron = n + 1;
+				err->column = s - cron_cur + 1;
+				err->msg = msg;
+			}
+			return -1;
+		}
+		n++;
+		if ( cron_next == NULL )
+			break;
+		cron_cur = cron_next;
+	}
+	return n;
+}
+
+/** \brief Check the compiled crons, same result as checkcrons().
+ *  \return 0 out of domains
+ *  \return 1 in a domain
+ * */
+int
+cron_match(const Evmask *masks, int n, const struct tm *time)
+{
+	Evmask mask_time;
+
+	if ( n == 0 )
+		return 1;
+	tmtoEvmask((struct tm*)time, &mask_time);
+	for ( int i = 0; i < n; i++ ) {
+		if ( check_domain(&mask_time, (Evmask*)&masks[i]) )
+			return 1;
+	}
+	return 0;
+}
+
 /** @} */
 
 
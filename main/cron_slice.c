@@ -0,0 +1,144 @@
+/**
+ * cron_slice.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: root
+ *  @ingroup cron_slice
+ *  @{
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cron_slice.h"
+
+static inline uint32_t *row(const cron_slices_t *s, int r) {
+	return s->rows + (size_t)r * s->words;
+}
+
+/** \brief Allocate the rows for max_crons crons.
+ *  \return 0 ok
+ *  \return -1 no memory
+ * */
+int cron_slices_init(cron_slices_t *s, uint32_t max_crons) {
+	memset(s, 0, sizeof(*s));
+	s->words = CRON_SLICE_WORDS(max_crons);
+	s->rows = calloc((size_t)CRON_SLICE_ROWS * s->words, sizeof(uint32_t));
+	s->schedule = malloc(max_crons * sizeof(uint16_t));
+	if ( !s->rows || !s->schedule ) {
+		cron_slices_free(s);
+		return -1;
+	}
+	s->max = max_crons;
+	return 0;
+}
+
+void cron_slices_free(cron_slices_t *s) {
+	free(s->rows);
+	free(s->schedule);
+	memset(s, 0, sizeof(*s));
+}
+
+static void set_bits(cron_slices_t *s, int first, int count, uint64_t bits, uint32_t column) {
+	for ( int b = 0; b < count; b++ ) {
+		if ( bits & (1ULL << b) )
+			row(s, first + b)[column / 32] |= 1UL << (column % 32);
+	}
+}
+
+/** \brief Add a schedule, the compiled crons of a key (cron_compile()).
+ *  \return index of the schedule
+ *  \return -1 no more columns
+ * */
+int cron_slices_add(cron_slices_t *s, const Evmask *masks, int n) {
+	uint32_t c;
+
+	if ( n < 0 || s->n + n > s->max || s->schedules > UINT16_MAX )
+		return -1;
+	for ( int i = 0; i < n; i++ ) {
+		const Evmask *m = &masks[i];
+		c = s->n++;
+		s->schedule[c] = s->schedules;
+		set_bits(s, CRON_SLICE_MIN, 32, (uint32_t)m->minutes[0], c);
+		set_bits(s, CRON_SLICE_MIN + 32, 28, (uint32_t)m->minutes[1], c);
+		set_bits(s, CRON_SLICE_HOUR, 24, m->hours, c);
+		set_bits(s, CRON_SLICE_MDAY, 32, m->mday, c);
+		set_bits(s, CRON_SLICE_MONTH, 13, m->month, c);
+		set_bits(s, CRON_SLICE_WDAY, 50, m->wday, c);
+		if ( m->cal )
+			set_bits(s, CRON_SLICE_CAL + 1, CRON_CALENDARS, m->cal, c);
+		else
+			set_bits(s, CRON_SLICE_CAL, 1, 1, c);
+		set_bits(s, CRON_SLICE_CAL_NOT, CRON_CALENDARS, m->cal_not, c);
+	}
+	return s->schedules++;
+}
+
+/** \brief Rows of the set bits of a field. \return number of rows */
+static int rows_of(const cron_slices_t *s, int first, int count, uint64_t bits, const uint32_t **rows) {
+	int n = 0;
+	for ( int b = 0; b < count; b++ ) {
+		if ( bits & (1ULL << b) )
+			rows[n++] = row(s, first + b);
+	}
+	return n;
+}
+
+/** \brief The crons which match a local time.
+ *  \param crons words bits, bit c is set when cron c matches
+ * */
+void cron_slices_match(const cron_slices_t *s, const struct tm *time, uint32_t *crons) {
+	const uint32_t *mday[2], *wday[3], *cal[1 + CRON_CALENDARS], *cal_not[CRON_CALENDARS];
+	const uint32_t *min = row(s, CRON_SLICE_MIN + time->tm_min);
+	const uint32_t *hour = row(s, CRON_SLICE_HOUR + time->tm_hour);
+	const uint32_t *month = row(s, CRON_SLICE_MONTH + time->tm_mon + 1);
+	Evmask day = { 0 };
+	int n_mday, n_wday, n_cal, n_not;
+	uint32_t w, any, not;
+
+	daytoEvmask(time->tm_year + 1900, time->tm_mon, time->tm_mday, time->tm_wday, &day);
+	n_mday = rows_of(s, CRON_SLICE_MDAY, 32, day.mday, mday);
+	n_wday = rows_of(s, CRON_SLICE_WDAY, 50, day.wday, wday);
+	cal[0] = row(s, CRON_SLICE_CAL);
+	n_cal = 1 + rows_of(s, CRON_SLICE_CAL + 1, CRON_CALENDARS, day.cal, cal + 1);
+	n_not = rows_of(s, CRON_SLICE_CAL_NOT, CRON_CALENDARS, day.cal, cal_not);
+
+	for ( uint32_t i = 0; i < s->words; i++ ) {
+		w = min[i] & hour[i] & month[i];
+		if ( !w ) {
+			crons[i] = 0;
+			continue;
+		}
+		any = 0;
+		for ( int r = 0; r < n_mday; r++ )
+			any |= mday[r][i];
+		w &= any;
+		any = 0;
+		for ( int r = 0; r < n_wday; r++ )
+			any |= wday[r][i];
+		w &= any;
+		any = 0;
+		for ( int r = 0; r < n_cal; r++ )
+			any |= cal[r][i];
+		not = 0;
+		for ( int r = 0; r < n_not; r++ )
+			not |= cal_not[r][i];
+		crons[i] = w & any & ~not;
+	}
+}
+
+/** \brief The schedules of the matching crons.
+ *  \param schedules CRON_SLICE_WORDS(s->schedules) words, bit k is set when schedule k matches
+ * */
+void cron_slices_schedules(const cron_slices_t *s, const uint32_t *crons, uint32_t *schedules) {
+	uint32_t w, c;
+
+	memset(schedules, 0, CRON_SLICE_WORDS(s->schedules) * sizeof(uint32_t));
+	for ( uint32_t i = 0; i < s->words; i++ ) {
+		for ( w = crons[i]; w; w &= w - 1 ) {
+			c = i * 32 + __builtin_ctz(w);
+			schedules[s->schedule[c] / 32] |= 1UL << (s->schedule[c] % 32);
+		}
+	}
+}
+/** @} */
@@ -0,0 +1,63 @@
+/**
+ * @defgroup cron_slice
+ * @{
+ *
+ * cron_slice.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: root
+ *
+ * Bit-sliced evaluation of many schedules at once.
+ *
+ * Every bit of the Evmask fields is a row, a row is a bitset over all the compiled crons (the columns):
+ * bit c of row "minute 5" is set when cron c allows minute 5. The crons which match a time are the AND of
+ * the minute, hour and month rows of the time, the OR of its mday and wday rows (last day, nth weekday),
+ * and the calendar rows, 32 crons per word. A schedule is one or more crons in consecutive columns,
+ * its bit is set when one of its crons match.
+ *
+ * The functions do not depend on the device, the time is passed as a struct tm.
+ */
+
+#ifndef MAIN_CRON_SLICE_H_
+#define MAIN_CRON_SLICE_H_
+
+#include <stdint.h>
+#include <time.h>
+#include "cron.h"
+
+/** @defgroup cron_slice_rows Rows
+ * @{ */
+#define CRON_SLICE_MIN 			0
+#define CRON_SLICE_HOUR 		(CRON_SLICE_MIN + 60)
+#define CRON_SLICE_MDAY 		(CRON_SLICE_HOUR + 24)
+#define CRON_SLICE_MONTH 		(CRON_SLICE_MDAY + 32)
+#define CRON_SLICE_WDAY 		(CRON_SLICE_MONTH + 13)
+/** Row 0: the crons without a required calendar, row n: calendar n is required ('@n'). */
+#define CRON_SLICE_CAL 			(CRON_SLICE_WDAY + 50)
+#define CRON_SLICE_CAL_NOT 		(CRON_SLICE_CAL + 1 + CRON_CALENDARS)
+#define CRON_SLICE_ROWS 		(CRON_SLICE_CAL_NOT + CRON_CALENDARS)
+/** @} */
+
+#define CRON_SLICE_WORDS(n) 	(((n) + 31) / 32)
+
+typedef struct cron_slices {
+	/** Columns (crons) in use and allocated. */
+	uint32_t n;
+	uint32_t max;
+	/** Words of a row. */
+	uint32_t words;
+	/** CRON_SLICE_ROWS * words. */
+	uint32_t *rows;
+	/** Schedule of each column. */
+	uint16_t *schedule;
+	uint32_t schedules;
+} cron_slices_t;
+
+int cron_slices_init(cron_slices_t *s, uint32_t max_crons);
+void cron_slices_free(cron_slices_t *s);
+int cron_slices_add(cron_slices_t *s, const Evmask *masks, int n);
+void cron_slices_match(const cron_slices_t *s, const struct tm *time, uint32_t *crons);
+void cron_slices_schedules(const cron_slices_t *s, const uint32_t *crons, uint32_t *schedules);
+
+#endif /* MAIN_CRON_SLICE_H_ */
+/** @} */
@@ -0,0 +1,258 @@
+/**
+ * ib_calendar.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: root
+ *  @ingroup ib_calendar
+ *  @{
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "esp_console.h"
+#include "esp_log.h"
+#include "argtable3/argtable3.h"
+
+#include "cron.h"
+#include "ib_calendar.h"
+
+#define TAG "IB_CAL"
+
+/** Double buffer: the new table is parsed in the inactive one, then it is switched. */
+static ib_cal_table_t g_tables[2];
+static ib_cal_table_t * volatile g_active;
+static volatile uint32_t g_generation;
+
+/** @defgroup cal_table Table
+ * @{ */
+static int is_leap(int year) {
+	return (year % 4 == 0) && ((year % 100 != 0) || (year % 400 == 0));
+}
+
+/** \brief Day of the year of a MMDD date.
+ *  \return -1 invalid date
+ * */
+static int date_yday(const char **s, int year) {
+	static const uint8_t days[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+	int mon, mday, yday = 0;
+
+	for ( int i = 0; i < 4; i++ ) {
+		if ( !isdigit((unsigned char)(*s)[i]) )
+			return -1;
+	}
+	mon = ((*s)[0] - '0') * 10 + (*s)[1] - '0';
+	mday = ((*s)[2] - '0') * 10 + (*s)[3] - '0';
+	*s += 4;
+	if ( mon < 1 || mon > 12 || mday < 1 || mday > days[mon - 1] + (mon == 2 && is_leap(year)) )
+		return -1;
+	for ( int m = 1; m < mon; m++ )
+		yday += days[m - 1] + (m == 2 && is_leap(year));
+	return yday + mday - 1;
+}
+
+static ib_cal_entry_t *find(ib_cal_table_t *table, int id, int year) {
+	for ( int i = 0; i < table->n; i++ ) {
+		if ( table->entries[i].id == id && table->entries[i].year == year )
+			return &table->entries[i];
+	}
+	return NULL;
+}
+
+/** \brief Parse a line: id|year|dates.
+ *  \return NULL ok, or the error
+ * */
+static const char *parse_line(ib_cal_table_t *table, const char *line) {
+	ib_cal_entry_t entry = { 0 }, *e;
+	const char *s = line;
+	char *end;
+	long id, year;
+	int from, to;
+
+	id = strtol(s, &end, 10);
+	if ( end == s || *end != '|' || id < 1 || id > CRON_CALENDARS )
+		return "invalid calendar id";
+	s = end + 1;
+	year = strtol(s, &end, 10);
+	if ( end == s || *end != '|' || year < 1970 || year > 2200 )
+		return "invalid year";
+	s = end + 1;
+	while ( *s ) {
+		if ( (from = date_yday(&s, year)) < 0 )
+			return "invalid date";
+		to = from;
+		if ( *s == '-' ) {
+			s++;
+			if ( (to = date_yday(&s, year)) < from )
+				return "invalid date range";
+		}
+		for ( int d = from; d <= to; d++ )
+			entry.days[d / 8] |= 1 << (d % 8);
+		if ( *s == ',' )
+			s++;
+		else if ( *s )
+			return "unexpected character";
+	}
+	e = find(table, id, year);
+	if ( !e ) {
+		if ( table->n >= IB_CAL_ENTRIES )
+			return "too many calendar years";
+		e = &table->entries[table->n++];
+		e->id = id;
+		e->year = year;
+		memset(e->days, 0, sizeof(e->days));
+	}
+	for ( int i = 0; i < IB_CAL_DAYS_BYTES; i++ )
+		e->days[i] |= entry.days[i];
+	return NULL;
+}
+
+/** \brief Parse the downloaded calendars. The text is modified.
+ *  \return number of rejected lines
+ * */
+int ib_cal_table_parse(ib_cal_table_t *table, char *text, size_t len, uint64_t checksum) {
+	char *line = text, *next;
+	const char *err;
+	int rejected = 0, lineno = 1;
+
+	memset(table, 0, sizeof(*table));
+	table->checksum = checksum;
+	text[len] = '\0';
+	for ( ; line; line = next, lineno++ ) {
+		next = strchr(line, '\n');
+		if ( next )
+			*next++ = '\0';
+		for ( char *c = line + strlen(line); c > line && isspace((unsigned char)c[-1]); )
+			*--c = '\0';
+		if ( *line == '\0' || *line == '#' )
+			continue;
+		err = parse_line(table, line);
+		if ( err ) {
+			ESP_LOGW(TAG, "Line %i: %s", lineno, err);
+			rejected++;
+		}
+	}
+	return rejected;
+}
+
+/** \brief Calendars of a day.
+ *  \param yday 0-365
+ *  \return bit n - 1 is set when the day is in calendar n
+ * */
+uint32_t ib_cal_table_days(const ib_cal_table_t *table, int year, int yday) {
+	uint32_t cals = 0;
+	for ( int i = 0; i < table->n; i++ ) {
+		if ( table->entries[i].year == year && (table->entries[i].days[yday / 8] & (1 << (yday % 8))) )
+			cals |= 1UL << (table->entries[i].id - 1);
+	}
+	return cals;
+}
+/** @} */
+
+static uint32_t calendar_days(int year, int yday) {
+	const ib_cal_table_t *table = g_active;
+	return table ? ib_cal_table_days(table, year, yday) : 0;
+}
+
+static ib_cal_table_t *inactive() {
+	return (g_active == &g_tables[0]) ? &g_tables[1] : &g_tables[0];
+}
+
+/** \brief Load the saved calendars and connect them to the crons. Call it after ibd_init(). */
+void ib_cal_init() {
+	ib_cal_table_t *table = inactive();
+	FILE *fptr = fopen(FILE_CAL, "rb");
+
+	if ( fptr ) {
+		if ( 1 == fread(table, offsetof(ib_cal_table_t, entries), 1, fptr) && table->n <= IB_CAL_ENTRIES
+				&& table->n == fread(table->entries, sizeof(ib_cal_entry_t), table->n, fptr) ) {
+			g_active = table;
+			ESP_LOGI(TAG, "%i calendar years", table->n);
+		} else {
+			ESP_LOGE(TAG, "Cannot read %s", FILE_CAL);
+		}
+		fclose(fptr);
+	}
+	cron_set_calendar(&calendar_days);
+}
+
+/** \brief Use and save new calendars.
+ *  \param text downloaded text, len + 1 bytes, it is modified
+ *  \param checksum of the text, it is downloaded again when it changes
+ * */
+esp_err_t ib_cal_update(char *text, size_t len, uint64_t checksum) {
+	ib_cal_table_t *table = inactive();
+	FILE *fptr;
+	int rejected;
+
+	rejected = ib_cal_table_parse(table, text, len, checksum);
+	fptr = fopen(FILE_CAL, "wb");
+	if ( !fptr ) {
+		ESP_LOGE(TAG, "Cannot open %s", FILE_CAL);
+		return ESP_ERR_NOT_FOUND;
+	}
+	if ( 1 != fwrite(table, offsetof(ib_cal_table_t, entries), 1, fptr)
+			|| table->n != fwrite(table->entries, sizeof(ib_cal_entry_t), table->n, fptr) ) {
+		ESP_LOGE(TAG, "Cannot save %s", FILE_CAL);
+		fclose(fptr);
+		return ESP_FAIL;
+	}
+	fclose(fptr);
+	g_active = table;
+	g_generation++;
+	ESP_LOGI(TAG, "%i calendar years, %i lines rejected", table->n, rejected);
+	return ESP_OK;
+}
+
+/** \brief Checksum of the current calendars, 0 when there are none. */
+uint64_t ib_cal_checksum() {
+	const ib_cal_table_t *table = g_active;
+	return table ? table->checksum : 0;
+}
+
+/** \brief Changes when the calendars change. */
+uint32_t ib_cal_generation() {
+	return g_generation;
+}
+
+/** \brief Prints the dates of the calendars. */
+static int calendar_cmd(int argc, char **argv) {
+	const ib_cal_table_t *table = g_active;
+	const ib_cal_entry_t *e;
+	static const uint16_t before[13] = { 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334, 365 };
+	int mon, leap;
+
+	if ( !table ) {
+		printf("No calendars\n");
+		return 0;
+	}
+	printf("checksum:%llX\n", table->checksum);
+	for ( int i = 0; i < table->n; i++ ) {
+		e = &table->entries[i];
+		leap = is_leap(e->year);
+		printf("%i|%i|", e->id, e->year);
+		for ( int d = 0, first = 1; d < 365 + leap; d++ ) {
+			if ( !(e->days[d / 8] & (1 << (d % 8))) )
+				continue;
+			for ( mon = 1; mon < 12 && d >= before[mon] + (mon >= 2 && leap); mon++ )
+				;
+			printf("%s%02i%02i", first ? "" : ",", mon, d - before[mon - 1] - (mon > 2 && leap) + 1);
+			first = 0;
+		}
+		printf("\n");
+	}
+	return 0;
+}
+
+/** \brief Command register function. */
+void register_calendar() {
+	const esp_console_cmd_t calendar_cmd_def = {
+			.command = "calendar",
+			.help = "Dates of the holiday and exception calendars",
+			.hint = NULL,
+			.func = &calendar_cmd,
+	};
+	ESP_ERROR_CHECK( esp_console_cmd_register(&calendar_cmd_def) );
+}
+/** @} */
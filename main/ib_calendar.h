@@ -0,0 +1,68 @@
+/**
+ * @defgroup ib_calendar
+ * @{
+ *
+ * ib_calendar.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: root
+ *
+ * Holiday and exception calendars of the schedules.
+ *
+ * A calendar is a set of dates, stored as a 366 bit day of year bitmap per year. A cron refers to it after its
+ * five fields: '@n' matches only on the dates of calendar n, '!n' never matches on them. Example:
+ * "* 8-17 * * mon-fri !1;* 9-12 * * * @2" working hours except the holidays of calendar 1,
+ * and 9-12 on the extra days of calendar 2.
+ *
+ * The calendars are downloaded separately from the database ('setcalendar' command), when the second value
+ * of the checksum file changes. The file is text, one line per calendar and year:
+ * \code
+ *   id|year|dates
+ *   1|2027|0101,0315,0415-0418,1224-1226
+ * \endcode
+ * id is 1-CRON_CALENDARS, the dates are MMDD or MMDD-MMDD ranges. An invalid line is skipped and logged.
+ * The parsed table is saved to FILE_CAL and loaded at boot. A change of the calendars does not rebuild the database.
+ *
+ * The table functions (ib_cal_table_*) do not use the file system.
+ */
+
+#ifndef MAIN_IB_CALENDAR_H_
+#define MAIN_IB_CALENDAR_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define FILE_CAL 				"/spiffs/ibd/calendar.bin"
+/** \brief Calendar years in the table. */
+#define IB_CAL_ENTRIES 			24
+/** \brief 366 bits. */
+#define IB_CAL_DAYS_BYTES 		46
+/** \brief Maximum size of the downloaded text. */
+#define IB_CAL_TEXT_MAX 		4096
+
+/** \brief Dates of a calendar in a year, bit n is day n of the year (0: January 1). */
+typedef struct __attribute__((__packed__)) ib_cal_entry {
+	uint8_t id;
+	uint16_t year;
+	uint8_t days[IB_CAL_DAYS_BYTES];
+} ib_cal_entry_t;
+
+typedef struct ib_cal_table {
+	/** Checksum of the downloaded text. */
+	uint64_t checksum;
+	uint16_t n;
+	ib_cal_entry_t entries[IB_CAL_ENTRIES];
+} ib_cal_table_t;
+
+int ib_cal_table_parse(ib_cal_table_t *table, char *text, size_t len, uint64_t checksum);
+uint32_t ib_cal_table_days(const ib_cal_table_t *table, int year, int yday);
+
+void ib_cal_init();
+esp_err_t ib_cal_update(char *text, size_t len, uint64_t checksum);
+uint64_t ib_cal_checksum();
+uint32_t ib_cal_generation();
+void register_calendar();
+
+#endif /* MAIN_IB_CALENDAR_H_ */
+/** @} */
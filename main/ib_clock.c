@@ -0,0 +1,340 @@
+/**
+ * ib_clock.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: root
+ *  @ingroup ib_clock
+ *  @{
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/timers.h"
+#include "freertos/event_groups.h"
+#include "esp_timer.h"
+#include "esp_console.h"
+#include "esp_log.h"
+#include "argtable3/argtable3.h"
+#include "nvs.h"
+
+#include "ib_clock.h"
+#include "ib_tz.h"
+#include "ib_static.h"
+
+#define TAG "IB_CLOCK"
+
+#define CLOCK_VALID_BIT BIT0
+
+const char CLOCK_NSPACE_NVS[] = "clock_ns";
+const char CLOCK_TIME_NVS[] = "last_time";
+const char CLOCK_POLICY_NVS[] = "policy";
+
+static const char *SOURCE_NAMES[] = { "none", "restored", "synced" };
+static const char *POLICY_NAMES[IB_CLOCK_POLICY_N] = { "restored", "deny", "allow" };
+
+static ib_clock_state_t g_state;
+static portMUX_TYPE g_clock_mux = portMUX_INITIALIZER_UNLOCKED;
+static EventGroupHandle_t g_clock_group;
+static TimerHandle_t g_save_tim;
+IB_EVENT_GROUP_STORAGE(clock_group, 1);
+IB_TIMER_STORAGE(save_tim, 1);
+
+/** @defgroup clock_state State
+ *  mono_s is the time since boot.
+ * @{ */
+void ib_clock_state_init(ib_clock_state_t *st, ib_clock_policy_t policy) {
+	memset(st, 0, sizeof(*st));
+	st->source = IB_CLOCK_NONE;
+	st->policy = (policy < IB_CLOCK_POLICY_N) ? policy : IB_CLOCK_POLICY_RESTORED;
+}
+
+/** \brief Restore a saved time.
+ *  \return 1 restored
+ *  \return 0 saved time is not valid
+ * */
+int ib_clock_state_restore(ib_clock_state_t *st, const ib_clock_saved_t *saved, int64_t mono_s) {
+	uint64_t error_s;
+
+	if ( saved->time_s < IB_CLOCK_VALID_FROM )
+		return 0;
+	error_s = (uint64_t)saved->error_s + IB_CLOCK_SAVE_PERIOD_S;
+	st->source = IB_CLOCK_RESTORED;
+	st->base_s = saved->time_s;
+	st->base_mono_s = mono_s;
+	st->base_error_s = (error_s > UINT32_MAX) ? UINT32_MAX : (uint32_t)error_s;
+	return 1;
+}
+
+/** \brief Time is set by SNTP. */
+void ib_clock_state_sync(ib_clock_state_t *st, int64_t time_s, int64_t mono_s) {
+	st->source = IB_CLOCK_SYNCED;
+	st->base_s = time_s;
+	st->base_mono_s = mono_s;
+	st->base_error_s = 0;
+}
+
+int64_t ib_clock_state_now(const ib_clock_state_t *st, int64_t mono_s) {
+	return st->base_s + (mono_s - st->base_mono_s);
+}
+
+/** \brief Error bound in s, the length of the power cut is not included. */
+uint32_t ib_clock_state_error(const ib_clock_state_t *st, int64_t mono_s) {
+	uint64_t error_s;
+
+	if ( st->source != IB_CLOCK_RESTORED )
+		return 0;
+	error_s = st->base_error_s + (uint64_t)(mono_s - st->base_mono_s) * IB_CLOCK_DRIFT_PPM / 1000000;
+	return (error_s > UINT32_MAX) ? UINT32_MAX : (uint32_t)error_s;
+}
+
+ib_clock_source_t ib_clock_state_source(const ib_clock_state_t *st, int64_t mono_s) {
+	if ( st->source == IB_CLOCK_RESTORED && ib_clock_state_error(st, mono_s) > IB_CLOCK_MAX_ERROR_S )
+		return IB_CLOCK_NONE;
+	return st->source;
+}
+
+/** \brief Decide how to evaluate a schedule now. */
+ib_clock_eval_t ib_clock_state_eval(const ib_clock_state_t *st, int64_t mono_s) {
+	const ib_clock_source_t source = ib_clock_state_source(st, mono_s);
+
+	if ( source == IB_CLOCK_SYNCED )
+		return IB_CLOCK_EVAL;
+	switch ( st->policy ) {
+		case IB_CLOCK_POLICY_ALLOW:
+			return IB_CLOCK_ALLOW;
+		case IB_CLOCK_POLICY_RESTORED:
+			return (source == IB_CLOCK_RESTORED) ? IB_CLOCK_EVAL : IB_CLOCK_DENY;
+		default:
+			return IB_CLOCK_DENY;
+	}
+}
+
+/** \brief The time to save.
+ *  \return 0 there is no valid time
+ * */
+int ib_clock_state_save(const ib_clock_state_t *st, int64_t mono_s, ib_clock_saved_t *saved) {
+	if ( ib_clock_state_source(st, mono_s) == IB_CLOCK_NONE )
+		return 0;
+	saved->time_s = ib_clock_state_now(st, mono_s);
+	saved->error_s = ib_clock_state_error(st, mono_s);
+	return 1;
+}
+/** @} */
+
+const char *ib_clock_source_name(ib_clock_source_t source) {
+	return (source <= IB_CLOCK_SYNCED) ? SOURCE_NAMES[source] : "?";
+}
+
+const char *ib_clock_policy_name(ib_clock_policy_t policy) {
+	return (policy < IB_CLOCK_POLICY_N) ? POLICY_NAMES[policy] : "?";
+}
+
+static int64_t mono_s() {
+	return esp_timer_get_time() / 1000000;
+}
+
+static void save_nvs(const ib_clock_saved_t *saved) {
+	nvs_handle handle;
+	esp_err_t ret;
+
+	ret = nvs_open(CLOCK_NSPACE_NVS, NVS_READWRITE, &handle);
+	if ( ret != ESP_OK ) {
+		ESP_LOGE(__func__, "NVS open: %s", esp_err_to_name(ret));
+		return;
+	}
+	ret = nvs_set_blob(handle, CLOCK_TIME_NVS, saved, sizeof(*saved));
+	if ( ret == ESP_OK )
+		ret = nvs_commit(handle);
+	if ( ret != ESP_OK )
+		ESP_LOGE(__func__, "NVS set: %s", esp_err_to_name(ret));
+	nvs_close(handle);
+}
+
+static void save_policy(ib_clock_policy_t policy) {
+	nvs_handle handle;
+	esp_err_t ret;
+
+	ret = nvs_open(CLOCK_NSPACE_NVS, NVS_READWRITE, &handle);
+	if ( ret != ESP_OK ) {
+		ESP_LOGE(__func__, "NVS open: %s", esp_err_to_name(ret));
+		return;
+	}
+	ret = nvs_set_u8(handle, CLOCK_POLICY_NVS, policy);
+	if ( ret == ESP_OK )
+		ret = nvs_commit(handle);
+	if ( ret != ESP_OK )
+		ESP_LOGE(__func__, "NVS set: %s", esp_err_to_name(ret));
+	nvs_close(handle);
+}
+
+/** \brief Save the current time. */
+static void save_time() {
+	ib_clock_saved_t saved;
+	int valid;
+
+	portENTER_CRITICAL(&g_clock_mux);
+	valid = ib_clock_state_save(&g_state, mono_s(), &saved);
+	portEXIT_CRITICAL(&g_clock_mux);
+	if ( valid )
+		save_nvs(&saved);
+}
+
+static void save_callback(TimerHandle_t timer) {
+	save_time();
+}
+
+/** \brief Restore the saved time, start the periodic save.
+ *  Call it before the readers start.
+ * */
+void ib_clock_init() {
+	nvs_handle handle;
+	ib_clock_saved_t saved = { 0 };
+	size_t size = sizeof(saved);
+	uint8_t policy = IB_CLOCK_POLICY_RESTORED;
+	time_t now;
+	esp_err_t ret;
+
+	if ( g_clock_group )
+		return;
+	g_clock_group = IB_EVENT_GROUP_CREATE(clock_group, 0);
+
+	ret = nvs_open(CLOCK_NSPACE_NVS, NVS_READONLY, &handle);
+	if ( ret == ESP_OK ) {
+		nvs_get_u8(handle, CLOCK_POLICY_NVS, &policy);
+		if ( nvs_get_blob(handle, CLOCK_TIME_NVS, &saved, &size) != ESP_OK )
+			saved.time_s = 0;
+		nvs_close(handle);
+	}
+	ib_clock_state_init(&g_state, policy);
+
+	time(&now);
+	if ( now >= IB_CLOCK_VALID_FROM ) {		// System time is kept over a software reset.
+		saved.time_s = now;
+		saved.error_s = 0;
+	}
+	if ( ib_clock_state_restore(&g_state, &saved, mono_s()) ) {
+		xEventGroupSetBits(g_clock_group, CLOCK_VALID_BIT);
+		ESP_LOGI(TAG, "Time restored, error bound %u s", g_state.base_error_s);
+	} else {
+		ESP_LOGW(TAG, "No saved time");
+	}
+
+	g_save_tim = IB_TIMER_CREATE(save_tim, 0, "clock save", pdMS_TO_TICKS(IB_CLOCK_SAVE_PERIOD_S * 1000),
+			pdTRUE, NULL, save_callback);
+	if ( !g_save_tim || xTimerStart(g_save_tim, 0) != pdPASS )
+		ESP_LOGE(TAG, "Save timer err");
+}
+
+/** \brief SNTP has set the system time. */
+void ib_clock_synced() {
+	time_t now;
+
+	time(&now);
+	portENTER_CRITICAL(&g_clock_mux);
+	ib_clock_state_sync(&g_state, now, mono_s());
+	portEXIT_CRITICAL(&g_clock_mux);
+	if ( g_clock_group )
+		xEventGroupSetBits(g_clock_group, CLOCK_VALID_BIT);
+	save_time();
+}
+
+/** \brief Best known time: the system time when it is synchronized, else the restored time. */
+time_t ib_clock_time() {
+	time_t now;
+	int restored;
+
+	portENTER_CRITICAL(&g_clock_mux);
+	restored = (g_state.source == IB_CLOCK_RESTORED);
+	now = ib_clock_state_now(&g_state, mono_s());
+	portEXIT_CRITICAL(&g_clock_mux);
+	if ( !restored )
+		time(&now);
+	return now;
+}
+
+/** \brief How to decide a scheduled key now.
+ *  \param now set to the time when the result is IB_CLOCK_EVAL
+ *  \param time_info set to the local time of now when the result is IB_CLOCK_EVAL
+ * */
+ib_clock_eval_t ib_clock_eval(time_t *now, struct tm *time_info) {
+	ib_clock_eval_t eval;
+
+	portENTER_CRITICAL(&g_clock_mux);
+	eval = ib_clock_state_eval(&g_state, mono_s());
+	portEXIT_CRITICAL(&g_clock_mux);
+	if ( eval == IB_CLOCK_EVAL ) {
+		*now = ib_clock_time();
+		ib_tz_localtime(*now, time_info);
+	}
+	return eval;
+}
+
+/** \brief Wait until the time is restored or synchronized.
+ *  \return 1 time is valid
+ * */
+int ib_clock_wait_valid(uint32_t wait_ms) {
+	if ( !g_clock_group )
+		return 0;
+	return (xEventGroupWaitBits(g_clock_group, CLOCK_VALID_BIT, pdFALSE, pdTRUE,
+			(wait_ms == UINT32_MAX) ? portMAX_DELAY : pdMS_TO_TICKS(wait_ms)) & CLOCK_VALID_BIT) ? 1 : 0;
+}
+
+static struct {
+	struct arg_str *policy;
+	struct arg_end *end;
+} clock_args;
+
+/** \brief Prints the time source, or sets the schedule policy. */
+static int clock_cmd(int argc, char **argv) {
+	ib_clock_state_t st;
+	int64_t mono = mono_s();
+	time_t now;
+	struct tm time_info;
+	char buf[32];
+
+	int nerrors = arg_parse(argc, argv, (void**) &clock_args);
+	if ( nerrors ) {
+		arg_print_errors(stderr, clock_args.end, argv[0]);
+		return 1;
+	}
+	if ( clock_args.policy->count ) {
+		for ( int i = 0; i < IB_CLOCK_POLICY_N; i++ ) {
+			if ( strcmp(clock_args.policy->sval[0], POLICY_NAMES[i]) )
+				continue;
+			portENTER_CRITICAL(&g_clock_mux);
+			g_state.policy = i;
+			portEXIT_CRITICAL(&g_clock_mux);
+			save_policy(i);
+			return 0;
+		}
+		printf("Invalid policy\n");
+		return 1;
+	}
+	portENTER_CRITICAL(&g_clock_mux);
+	st = g_state;
+	portEXIT_CRITICAL(&g_clock_mux);
+	now = ib_clock_time();
+	ib_tz_localtime(now, &time_info);
+	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &time_info);
+	printf("time:%s source:%s error:%u s policy:%s\n", buf,
+			ib_clock_source_name(ib_clock_state_source(&st, mono)),
+			ib_clock_state_error(&st, mono), ib_clock_policy_name(st.policy));
+	return 0;
+}
+
+/** \brief Command register function. */
+void register_clock() {
+	clock_args.policy = arg_str0("p", "policy", "<restored|deny|allow>", "Schedules while the time is not synchronized");
+	clock_args.end = arg_end(1);
+	const esp_console_cmd_t clock_cmd_def = {
+			.command = "clock",
+			.help = "Time source and schedule policy",
+			.hint = NULL,
+			.func = &clock_cmd,
+			.argtable = &clock_args
+	};
+	ESP_ERROR_CHECK( esp_console_cmd_register(&clock_cmd_def) );
+}
+/** @} */
@@ -0,0 +1,103 @@
+/**
+ * @defgroup ib_clock
+ * @{
+ *
+ * ib_clock.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: root
+ *
+ * Time source of the schedule checks when there is no SNTP.
+ *
+ * The last known good time is saved in NVS every IB_CLOCK_SAVE_PERIOD_S seconds and when SNTP sets the time.
+ * At boot the saved time is restored in ib_clock, the system time is set only by SNTP.
+ * ib_clock_time() is the best known time, used by the schedule checks and the log. The restored time is behind
+ * the real time: by at most IB_CLOCK_SAVE_PERIOD_S (the last save before the power cut) plus the unknown
+ * length of the power cut. The error bound starts with the first part and grows with IB_CLOCK_DRIFT_PPM
+ * of the uptime; the restored time is trusted until the bound reaches IB_CLOCK_MAX_ERROR_S.
+ * The error of a time saved from a restored clock is kept, it only grows until the next SNTP sync.
+ *
+ * The schedule policy (ib_clock_policy_t) decides how the schedules are evaluated while the time
+ * is not synchronized. With no trusted time the scheduled keys are denied, unless the policy is allow.
+ *
+ * The state functions (ib_clock_state_*) do not use the system clock, the monotonic time is passed in s,
+ * so a boot can be simulated (clocksim test command).
+ */
+
+#ifndef MAIN_IB_CLOCK_H_
+#define MAIN_IB_CLOCK_H_
+
+#include <stdint.h>
+#include <time.h>
+
+/** \brief Times before this are not valid (year 2019). */
+#define IB_CLOCK_VALID_FROM 		1546300800LL
+#define IB_CLOCK_SAVE_PERIOD_S 		600
+/** \brief Frequency error of the clock while it is not synchronized. */
+#define IB_CLOCK_DRIFT_PPM 			50
+#define IB_CLOCK_MAX_ERROR_S 		3600
+
+/** \brief Where the time comes from. */
+typedef enum ib_clock_source {
+	/** No valid time, or the error bound of the restored time is too big. */
+	IB_CLOCK_NONE,
+	/** Restored from NVS, behind the real time. */
+	IB_CLOCK_RESTORED,
+	IB_CLOCK_SYNCED,
+} ib_clock_source_t;
+
+/** \brief Evaluation of the schedules while the time is not synchronized. */
+typedef enum ib_clock_policy {
+	/** Use the restored time as if it was synchronized, deny without time. */
+	IB_CLOCK_POLICY_RESTORED,
+	/** Deny the scheduled keys. */
+	IB_CLOCK_POLICY_DENY,
+	/** Allow every key of the database, the schedules are ignored. */
+	IB_CLOCK_POLICY_ALLOW,
+	IB_CLOCK_POLICY_N
+} ib_clock_policy_t;
+
+/** \brief How to decide a scheduled key now. */
+typedef enum ib_clock_eval {
+	/** Check the schedule with the current time. */
+	IB_CLOCK_EVAL,
+	IB_CLOCK_ALLOW,
+	IB_CLOCK_DENY,
+} ib_clock_eval_t;
+
+/** \brief Saved in NVS. */
+typedef struct ib_clock_saved {
+	int64_t time_s;
+	uint32_t error_s;
+} ib_clock_saved_t;
+
+typedef struct ib_clock_state {
+	ib_clock_source_t source;
+	ib_clock_policy_t policy;
+	/** Time at base_mono_s and its error bound. */
+	int64_t base_s;
+	int64_t base_mono_s;
+	uint32_t base_error_s;
+} ib_clock_state_t;
+
+void ib_clock_state_init(ib_clock_state_t *st, ib_clock_policy_t policy);
+int ib_clock_state_restore(ib_clock_state_t *st, const ib_clock_saved_t *saved, int64_t mono_s);
+void ib_clock_state_sync(ib_clock_state_t *st, int64_t time_s, int64_t mono_s);
+int64_t ib_clock_state_now(const ib_clock_state_t *st, int64_t mono_s);
+uint32_t ib_clock_state_error(const ib_clock_state_t *st, int64_t mono_s);
+ib_clock_source_t ib_clock_state_source(const ib_clock_state_t *st, int64_t mono_s);
+ib_clock_eval_t ib_clock_state_eval(const ib_clock_state_t *st, int64_t mono_s);
+int ib_clock_state_save(const ib_clock_state_t *st, int64_t mono_s, ib_clock_saved_t *saved);
+
+const char *ib_clock_source_name(ib_clock_source_t source);
+const char *ib_clock_policy_name(ib_clock_policy_t policy);
+
+void ib_clock_init();
+void ib_clock_synced();
+time_t ib_clock_time();
+ib_clock_eval_t ib_clock_eval(time_t *now, struct tm *time_info);
+int ib_clock_wait_valid(uint32_t wait_ms);
+void register_clock();
+
+#endif /* MAIN_IB_CLOCK_H_ */
+/** @} */
@@ -6,6 +6,8 @@
  */
 
 #include <string.h>
+#include <ctype.h>
+#include <stdint.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_wifi.h"
@@ -17,6 +19,8 @@
 #include "nvs_flash.h"
 #include "driver/gpio.h"
 #include "ib_database.h"
+#include "ib_pool.h"
+#include "cron.h"
 
 //#define TEST_MODE
 
@@ -27,6 +31,9 @@
 
 #define STRICT
 
+/** \brief Why the last line was rejected. */
+static char g_last_error[64];
+
 
 /** \brief String check algorithm.
  *   - Remove the ' ' characters at the beginning of a cron.
@@ -35,6 +42,7 @@
  *  \param bytes of crons
  *  \param from containing raw crons
  *  \ret 0 if String copied
+ *  \ret 1 crons too long, the copy is truncated
  *  \ret -1 crons NULL
  * */
 static int copy_cron(char *crons, int size, char *from){
@@ -70,12 +78,45 @@ static int copy_cron(char *crons, int size, char *from){
 			break;
 	}
 	*crons = '\0';
+	return ( *cur_ptr != '\0' ) ? 1 : 0;
+}
+
+/** \brief Parse an optional epoch field.
+ *  \param t set to 0 when the field is missing or empty
+ *  \ret 0 ok
+ *  \ret -1 not a number
+ * */
+static int parse_epoch(const char *from, uint32_t *t){
+	unsigned long long value;
+	char *end;
+
+	*t = 0;
+	if ( !from )
+		return 0;
+	while ( *from == ' ' )
+		from++;
+	if ( *from == '\0' )
+		return 0;
+	if ( !isdigit((unsigned char)*from) )
+		return -1;
+	value = strtoull(from, &end, 10);
+	while ( *end == ' ' )
+		end++;
+	if ( *end != '\0' || value > UINT32_MAX )
+		return -1;
+	*t = (uint32_t)value;
 	return 0;
 }
 
+/** \brief Reason of the last rejected line of csv_process_line(). */
+const char *csv_last_error(){
+	return g_last_error;
+}
+
 /** \brief Convert a string line to ib_data_t object.
+ *	The crons are compiled, a line with an invalid cron or validity range is rejected (csv_last_error()).
  *	Allocated memory!
- *	\ret NULL if the ib_data_t object cannot be created from the line, (invalid cron length or code)
+ *	\ret NULL if the ib_data_t object cannot be created from the line, (invalid cron length, cron or code)
  *	\ret Pointer to a created ib_data_t object
  * */
 ib_data_t *csv_process_line(char *line){
@@ -83,73 +124,116 @@ ib_data_t *csv_process_line(char *line){
 	uint64_t code_temp;
 	uint8_t cron_len_temp;
 	char cron_temp[CRON_MAXIMUM_SIZE];
-	int fields = IBD_CSV_FIELDS;
+	Evmask masks[CRON_MAX_N];
+	cron_error_t err;
+	uint32_t valid_from, valid_until;
+	char *field[IBD_CSV_FIELDS] = { NULL };
 	char *num_str; //CSV
 	char *cron_str; //CSV
+	char *next;
 
 	if ( !line )
 		return NULL;
 
-	num_str = strtok(line, DELIMITER);
-	fields--;
-	if ( !num_str )
+	field[0] = line;
+	for ( int i = 1; i < IBD_CSV_FIELDS && (next = strchr(field[i - 1], DELIMITER[0])); i++ ) {
+		*next = '\0';				// Empty fields are kept, the validity fields are positional
+		field[i] = next + 1;
+	}
+	num_str = field[0];
+	cron_str = field[1];
+	if ( *num_str == '\0' ) {
+		strcpy(g_last_error, "empty line");
 		return NULL;
+	}
 #ifdef TEST_MODE
 	ESP_LOGD(__func__,"num_str:[%s]",num_str);
-#endif
-	do {
-		cron_str = strtok(NULL, DELIMITER);
-#ifdef TEST_MODE
 	if( cron_str )
 		ESP_LOGD(__func__,"cron_str:[%s]",cron_str);
 #endif
-	} while ( cron_str && --fields );
 
 	code_temp = strtoull(num_str, NULL, 16);
 #ifdef STRICT
-	if ( CODE_MAX_VAL <= code_temp || code_temp <= CODE_MIN_VAL)
+	if ( CODE_MAX_VAL <= code_temp || code_temp <= CODE_MIN_VAL) {
+		strcpy(g_last_error, "invalid code");
 		return NULL;
+	}
 #endif
 #ifdef TEST_MODE
 	ESP_LOGD(__func__,"num_val:[%lld]",code_temp);
 #endif
 	if ( copy_cron(cron_temp, CRON_MAXIMUM_SIZE, cron_str) ) {
-		;
+		strcpy(g_last_error, "crons too long");		// Truncated crons would be another schedule
+		return NULL;
 	}
 	cron_len_temp = strlen(cron_temp);
     if ( cron_len_temp >= CRON_MINIMUM_LEN ) {
-    	ib_d = create_ib_data(code_temp, cron_temp);
+    	if ( cron_compile(cron_temp, masks, CRON_MAX_N, &err) < 0 ) {
+    		snprintf(g_last_error, sizeof(g_last_error), "cron %i column %i: %s", err.cron, err.column, err.msg);
+    		return NULL;
+    	}
+    	if ( parse_epoch(field[2], &valid_from) ) {
+    		strcpy(g_last_error, "invalid valid from");
+    		return NULL;
+    	}
+    	if ( parse_epoch(field[3], &valid_until) ) {
+    		strcpy(g_last_error, "invalid valid until");
+    		return NULL;
+    	}
+    	if ( valid_from && valid_until && valid_from >= valid_until ) {
+    		strcpy(g_last_error, "empty validity range");
+    		return NULL;
+    	}
+    	ib_d = create_ib_data(code_temp, cron_temp, valid_from, valid_until);
     }
     else {	// Cron too short
+    	strcpy(g_last_error, "cron too short");
     	return NULL;
     }
 	return ib_d;
 }
 
 /** \brief Copy the content of the next line.
+ *  A line longer than size - 1 is skipped, line is empty then. "\r\n" is one line end.
  *  \param line buffer
- *  \param size maximum size to be read in a line
- *  \param from where the lines read from
+ *  \param size bytes of line
+ *  \param from where the lines read from, null terminated
  *  \ret   0 wrong param or size = 0, or **from is '\0'
  *  \ret   n of bytes are read
  * */
 uint32_t csv_eat_a_line(char *line, int size, char **from){
 	int index = 0;
+	uint32_t skipped = 0;
 	if ( !( line && from && *from ) )
 		return index;
 	if ( !size )
 		return index;
 	size--; 													// '\0' need place too!
-	while ( size &&  '\n' != (**from)  &&  (**from) != '\r' ) {
+	while ( '\n' != (**from)  &&  (**from) != '\r' ) {
 		if ((**from) == '\0') {
-			*(line + index) = '\0';
-			return index + 1;									// Ret without incrementing from ptr
+			*(line + (skipped ? 0 : index)) = '\0';
+			return index + skipped + 1;							// Ret without incrementing from ptr
 		}
-		*(line + index++) = *(*from)++;
-		size--;
+		if ( size ) {
+			*(line + index++) = **from;
+			size--;
+		} else {
+			skipped++;
+		}
+		(*from)++;
+	}
+	if ( skipped ) {
+		ESP_LOGW(__func__,"Line too long, skipped");
+		index += skipped;
+		*line = '\0';
+	} else {
+		*(line + index) = '\0';
+	}
+	if ( (**from) == '\r' && (*from)[1] == '\n' ) {
+		(*from)++;
+		index++;
 	}
 	(*from) = ((*from)+1);
-	*(line + index) = '\0';
 	return index + 1;
 }
 
@@ -163,7 +247,7 @@ void test_process_line(){
 		return;
 	}
 	printf("Return of csv_process_line:\n code[%lld]\n mems[%i]\n crons[%s]\n",data->code_s.code, data->code_s.mem_d_size, data->crons);
-	free(data);
+	ib_pool_free(data);
 	ESP_LOGI(__func__,"END");
 }
 #endif
@@ -7,19 +7,29 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_wifi.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "esp_event.h"
 #include "esp_event_loop.h"
 #include "esp_spiffs.h"
 #include "nvs_flash.h"
 #include "driver/gpio.h"
+#include "esp_console.h"
+#include "argtable3/argtable3.h"
 
 #include "ib_log.h"
+#include "ib_clock.h"
+#include "ib_tz.h"
 #include "ib_database.h"
+#include "ib_trace.h"
+#include "ib_metrics.h"
+#include "ib_pool.h"
+#include "ib_static.h"
 
 #define TEST_MODE
 
@@ -30,16 +40,45 @@
 
 #endif
 
-const char *FILE_DB_BIN	=			"/spiffs/ibd/ibd.bin";
-const char *FILE_DB_TEMP =	 	  	"/spiffs/ibd/ibd_temp.bin";
+#define FILE_DB_BIN 				"/spiffs/ibd/ibd.bin"
+#define FILE_DB_BIN_B 				"/spiffs/ibd/ibd_b.bin"
+#define FILE_DB_SLOT 				"/spiffs/ibd/ibd_slot.bin"
+#define FILE_DB_TEMP 				"/spiffs/ibd/ibd_temp.bin"
 #define FILE_INFO 		 		  	"/spiffs/ibd/info_object.bin"
 #define FILE_CSV 	 			  	"/spiffs/ibd/database.csv"
+#define FILE_DB_EXP 			  	"/spiffs/ibd/ibd_exp.bin"
 #define READ_PARAM 					"rb"
 #define WRITE_PARAM 				"wb"
 #define APPEND_PARAM 	 			"ab"
 #define APPEND_CSV_PARAM 			"a"
 #define READ_CSV_PARAM  			"r"
 
+/** @defgroup db_lock Writer lock
+ *  Every function which writes the database files (csv, binary, index, checksums) holds it,
+ *  the lookups do not take it.
+ * @{ */
+IB_RECURSIVE_MUTEX_STORAGE(db_lock, 1);
+static SemaphoreHandle_t g_db_lock;
+
+/** \brief Take the writer lock, it is recursive.
+ *  Hold it around a sequence of writes which belong together, like a download: the csv chunks and
+ *  ibd_make_bin_database(). The other writers wait for it.
+ *  \return 0 ibd_init() was not called
+ *  \return 1 locked
+ * */
+int ibd_lock() {
+	if ( !g_db_lock )
+		return 0;
+	xSemaphoreTakeRecursive(g_db_lock, portMAX_DELAY);
+	return 1;
+}
+
+void ibd_unlock() {
+	if ( g_db_lock )
+		xSemaphoreGiveRecursive(g_db_lock);
+}
+/** @} */
+
 
 /** \brief Get the checksums data from file.
  *  \return 0 when file cannot open.
@@ -90,6 +129,15 @@ void ibd_log_delete() {
 	return;
 }
 
+/** \brief Size of the log file, 0 when it does not exist. */
+size_t ibd_log_size() {
+	struct stat st;
+	if ( !stat(FILE_LOG, &st) ) {
+		return st.st_size;
+	}
+	return 0;
+}
+
 /** \return 1 Exists
  *  \return 0 Does not exist
  */
@@ -154,7 +202,7 @@ esp_err_t ibd_log_append_file(char *data, size_t *data_length) {
  *  \return IBD_ERR_NO_MEM
  *  \return IBD_OK
  * */
-esp_err_t ibd_append_csv_file(char *data, int *data_length, uint64_t checksum) {
+static esp_err_t append_csv_file(char *data, int *data_length, uint64_t checksum) {
 	FILE *fptr;
 	info_t checks;
 	struct stat fstat;
@@ -173,6 +221,7 @@ esp_err_t ibd_append_csv_file(char *data, int *data_length, uint64_t checksum) {
 	}
 	size_t free_space = IBD_CSV_FILE_SIZE - get_file_size(fptr);
 	if ( *data_length > free_space ) {
+		fclose(fptr);
 		return IBD_ERR_NO_MEM;
 	}
 	if ( *data_length != fwrite(data, sizeof(char), *data_length, fptr) ) {
@@ -184,33 +233,165 @@ esp_err_t ibd_append_csv_file(char *data, int *data_length, uint64_t checksum) {
 	return IBD_OK;
 }
 
-/** \brief Rename the inactive file to active if it exists.
+/** \brief Append data to the csv file, see append_csv_file(). Takes the writer lock. */
+esp_err_t ibd_append_csv_file(char *data, int *data_length, uint64_t checksum) {
+	esp_err_t ret;
+	if ( !ibd_lock() )
+		return ESP_ERR_INVALID_STATE;
+	ret = append_csv_file(data, data_length, checksum);
+	ibd_unlock();
+	return ret;
+}
+
+/** \brief Incremented when a new database is activated. */
+static volatile uint32_t g_generation;
+
+/** @defgroup db_handle Published database
+ *  The lookups pin the published slot, its file is not removed or written while it is pinned.
+ * @{ */
+#define DB_SLOTS_N 		2
+/** \brief The swap waits this long for the lookups of the previous database. */
+#define DB_GRACE_MS 	2000
+
+typedef struct db_handle {
+	const char *path;
+	/** Lookups which use the file. */
+	uint16_t refs;
+} db_handle_t;
+
+static db_handle_t g_slots[DB_SLOTS_N] = { { .path = FILE_DB_BIN }, { .path = FILE_DB_BIN_B } };
+/** \brief Published database, NULL when there is none. Changed only under the writer lock. */
+static db_handle_t *g_active;
+static portMUX_TYPE g_db_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/** \brief Pin the published database for a lookup.
+ *  \return NULL there is no database
+ * */
+static db_handle_t *db_pin() {
+	db_handle_t *h;
+
+	portENTER_CRITICAL(&g_db_mux);
+	if ( (h = g_active) )
+		h->refs++;
+	portEXIT_CRITICAL(&g_db_mux);
+	return h;
+}
+
+static void db_unpin(db_handle_t *h) {
+	portENTER_CRITICAL(&g_db_mux);
+	h->refs--;
+	portEXIT_CRITICAL(&g_db_mux);
+}
+
+/** \brief The next lookups use this slot, the generation changes with it. */
+static void db_publish(db_handle_t *h) {
+	portENTER_CRITICAL(&g_db_mux);
+	g_active = h;
+	g_generation++;
+	portEXIT_CRITICAL(&g_db_mux);
+}
+
+/** \brief Wait for the lookups of a slot which is not published any more.
+ *  \return 1 the file is not used
+ *  \return 0 still pinned after DB_GRACE_MS
+ * */
+static int db_wait_unpinned(db_handle_t *h) {
+	const int64_t until = esp_timer_get_time() + DB_GRACE_MS * 1000LL;
+	uint16_t refs;
+
+	while ( 1 ) {
+		portENTER_CRITICAL(&g_db_mux);
+		refs = h->refs;
+		portEXIT_CRITICAL(&g_db_mux);
+		if ( !refs )
+			return 1;
+		if ( esp_timer_get_time() >= until )
+			return 0;
+		vTaskDelay(1);
+	}
+}
+
+/** \brief File of the published database for the writer, NULL when there is none. */
+static const char *db_active_path() {
+	return g_active ? g_active->path : NULL;
+}
+
+/** \brief Save the published slot, the file of the other one is removed at boot. */
+static int db_save_slot(uint8_t slot) {
+	FILE *fptr = fopen(FILE_DB_SLOT, WRITE_PARAM);
+	int ret = !fptr || 1 != fwrite(&slot, sizeof(slot), 1, fptr);
+
+	if ( fptr )
+		fclose(fptr);
+	return ret;
+}
+
+/** \brief The saved slot, slot 0 (FILE_DB_BIN) when it is not saved, like before the slots. */
+static uint8_t db_load_slot() {
+	FILE *fptr = fopen(FILE_DB_SLOT, READ_PARAM);
+	uint8_t slot = 0;
+
+	if ( fptr ) {
+		if ( 1 != fread(&slot, sizeof(slot), 1, fptr) || slot >= DB_SLOTS_N )
+			slot = 0;
+		fclose(fptr);
+	}
+	return slot;
+}
+/** @} */
+
+/** \brief Publish FILE_DB_TEMP if it exists.
  * Use after appending data in file finished.
+ * FILE_DB_TEMP is renamed to the slot which is not published, then that slot is published.
+ * The file of the previous database is removed when its lookups are finished, the lookups do not wait.
+ * The caller holds the writer lock, two swaps at once would rename into the same slot.
+ * When nothing is published FILE_DB_TEMP is removed, the published database and its checksums are kept.
+ * \return IBD_OK the new database is published
+ * \return IBD_ERR_NOT_FOUND there is no FILE_DB_TEMP
+ * \return IBD_ERR_WRITE the free slot is still in use or the rename failed
  * */
-static void activate_database() {
+static esp_err_t activate_database() {
 	esp_err_t ret;
 	info_t checks;
 	struct stat filestat;
+	db_handle_t *old = g_active;
+	db_handle_t *next = old == &g_slots[0] ? &g_slots[1] : &g_slots[0];
 	ibd_get_checksum(&checks);
 
 	if ( (stat(FILE_DB_TEMP, &filestat)) )  {
 		ESP_LOGW(__func__,"File does not exist:%s",FILE_DB_TEMP);
+		return IBD_ERR_NOT_FOUND;
 	}
-	else {	// When inactive file is not empty
-		if ( !stat(FILE_DB_BIN, &filestat) ) {			// According to ESP IDF component: SPIFFS
-			unlink(FILE_DB_BIN);
-		}
-		ret = rename(FILE_DB_TEMP, FILE_DB_BIN);
-		if ( ret ) {
-			ESP_LOGI(__func__,"rename ret:%i", ret);
-			return;
-		}
-		checks.checksum_cur = checks.checksum_temp;
-		checks.checksum_temp = 0;
-		if ( ibd_save_checksum(&checks) ) {
-			ESP_LOGE(__func__,"Checksum cannot be saved");
-		}
+	if ( !db_wait_unpinned(next) ) {		// Lookups of the database before the previous one
+		ESP_LOGE(__func__,"%s is still in use", next->path);
+		remove(FILE_DB_TEMP);
+		return IBD_ERR_WRITE;
+	}
+	if ( !stat(next->path, &filestat) ) {			// According to ESP IDF component: SPIFFS
+		unlink(next->path);
+	}
+	ret = rename(FILE_DB_TEMP, next->path);
+	if ( ret ) {
+		ESP_LOGE(__func__,"rename ret:%i", ret);
+		remove(FILE_DB_TEMP);
+		return IBD_ERR_WRITE;
 	}
+	if ( db_save_slot(next - g_slots) ) {
+		ESP_LOGE(__func__,"Slot cannot be saved");
+	}
+	db_publish(next);
+	ib_metric_inc(IB_M_DB_ACTIVATIONS);
+	checks.checksum_cur = checks.checksum_temp;
+	checks.checksum_temp = 0;
+	if ( ibd_save_checksum(&checks) ) {
+		ESP_LOGE(__func__,"Checksum cannot be saved");
+	}
+	if ( old && db_wait_unpinned(old) ) {
+		unlink(old->path);		// Else it is removed by the next activation
+	} else if ( old ) {
+		ESP_LOGW(__func__,"%s is still in use", old->path);
+	}
+	return IBD_OK;
 }
 
 /** \brief Creates an ib_data_t object.
@@ -218,33 +399,87 @@ static void activate_database() {
  * \param crons cron strings
  * \return NULL object cannot be created.
  * \return ib_data_t pointer when space for object was allocated.
- * Allocated memory space!
+ * Allocated from IB_POOL_DATA, free it with ib_pool_free().
  * */
-ib_data_t *create_ib_data(uint64_t code, char *crons) {
+ib_data_t *create_ib_data(uint64_t code, char *crons, uint32_t valid_from, uint32_t valid_until) {
 	uint16_t mem_d_size;
-	uint8_t cron_size;
+	uint16_t cron_size;
+	const uint16_t validity_size = (valid_from || valid_until) ? IBD_VALIDITY_SIZE : 0;
+	const uint32_t validity[2] = { valid_from, valid_until };
 	ib_data_t *ret_data;
 
 	if ( crons )
-		cron_size = (uint8_t)strlen(crons) + 1;
+		cron_size = (uint16_t)strlen(crons) + 1;
 	else
-		cron_size = 0;
-	mem_d_size = sizeof(ib_code_t) + cron_size;
-	ret_data = malloc(cron_size + sizeof(ib_data_t));
-	ret_data->code_s.code = code;
-	ret_data->code_s.mem_d_size = mem_d_size;
+		cron_size = validity_size ? 1 : 0;		// The validity is after a null terminator
+	mem_d_size = sizeof(ib_code_t) + cron_size + validity_size;
+	ret_data = ib_pool_alloc(IB_POOL_DATA, cron_size + validity_size + sizeof(ib_data_t));
 	if ( !ret_data ) {
 		return NULL;
 	}
+	ret_data->code_s.code = code;
+	ret_data->code_s.mem_d_size = mem_d_size;
+	ret_data->valid_from = valid_from;
+	ret_data->valid_until = valid_until;
 	if ( cron_size ) {
 		ret_data->crons =  (size_t*)( (size_t)&(ret_data->code_s) + (size_t)sizeof(ib_code_t));
-		strcpy(ret_data->crons, crons);
+		strcpy(ret_data->crons, crons ? crons : "");
 	}
 	else
 		ret_data->crons = NULL;
+	if ( validity_size )
+		memcpy((char*)&(ret_data->code_s) + sizeof(ib_code_t) + cron_size, validity, IBD_VALIDITY_SIZE);
 	return ret_data;
 }
 
+/** \brief Check the validity range of a key.
+ *  \return 1 valid at now
+ *  \return 0 not valid yet or expired
+ * */
+int ibd_valid_at(const ib_data_t *d, int64_t now) {
+	if ( d->valid_from && now < d->valid_from )
+		return 0;
+	if ( d->valid_until && now >= d->valid_until )
+		return 0;
+	return 1;
+}
+
+/** \brief Read the validity range from the bytes of a record after the code.
+ *  \param validity set to valid from and valid until, 0 when there is none
+ *  \return 0 ok
+ *  \return 1 the crons are not terminated
+ * */
+static int record_validity(const char *body, uint32_t size, uint32_t validity[2]) {
+	size_t len;
+
+	validity[0] = validity[1] = 0;
+	if ( !size )
+		return 0;
+	len = strnlen(body, size);
+	if ( len == size )
+		return 1;
+	if ( size - len - 1 >= IBD_VALIDITY_SIZE )
+		memcpy(validity, body + len + 1, IBD_VALIDITY_SIZE);
+	return 0;
+}
+
+/** \brief Read the next record of the binary file.
+ *  \param body IBD_BODY_MAX_SIZE bytes, the crons and the validity
+ *  \return 1 read
+ *  \return 0 end of the file
+ *  \return -1 invalid record
+ * */
+static int read_record(FILE *fptr, ib_code_t *code_s, char *body, uint32_t *size) {
+	if ( 1 != fread(code_s, sizeof(ib_code_t), 1, fptr) )
+		return 0;
+	if ( code_s->mem_d_size < IB_C_MIN_SIZE || code_s->mem_d_size - IB_C_MIN_SIZE > IBD_BODY_MAX_SIZE )
+		return -1;
+	*size = code_s->mem_d_size - IB_C_MIN_SIZE;
+	if ( *size && 1 != fread(body, *size, 1, fptr) )
+		return -1;
+	return 1;
+}
+
 /** \brief Check log file fit in flash.
  * 	\return 0 Enough memory.
  * 	\return 1 Not enough memory.
@@ -274,7 +509,8 @@ static int is_place_enough() {
 	size_t fsize = 0;
 	size_t used_bytes, total_bytes;
 	long free_bytes;
-	FILE *fptr = fopen(FILE_DB_BIN, "rb");
+	const char *path = db_active_path();
+	FILE *fptr = path ? fopen(path, "rb") : NULL;
 	if ( fptr ) {
 		fsize = get_file_size(fptr);
 		fclose(fptr);
@@ -285,7 +521,8 @@ static int is_place_enough() {
 		if ( free_bytes >= IBD_FILE_SIZE ) {
 			return 1;											// Enough space for update.
 		} else {
-			remove(FILE_DB_BIN);	// Try to delete the huge file...
+			remove(path);	// Try to delete the huge file...
+			g_active = NULL;
 			ESP_LOGW(__func__,"Active databased deleted due to its size");
 			fsize = 0;
 		}
@@ -294,18 +531,283 @@ static int is_place_enough() {
 	free_bytes = total_bytes - used_bytes;
 	if ( (free_bytes) <  2*IBD_FILE_SIZE )
 		return 0;
-	fclose(fptr);
 	return 1;
 }
 
+/** \brief Changes when the content of the database changes, cached data of a key is valid while it is the same. */
+uint32_t ibd_generation() {
+	return g_generation;
+}
+
+/** @defgroup expiry_index Expiry index
+ * @{ */
+static int compare_until(const void *a, const void *b) {
+	const uint32_t x = ((const ib_exp_entry_t*)a)->valid_until, y = ((const ib_exp_entry_t*)b)->valid_until;
+	return (x > y) - (x < y);
+}
+
+static int compare_offset(const void *a, const void *b) {
+	const uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+	return (x > y) - (x < y);
+}
+
+/** \brief Build FILE_DB_EXP from the active database.
+ *  When there are more than IBD_EXP_MAX keys with a valid until, the ones which expire first are kept
+ *  and the horizon is set to the first dropped one.
+ * */
+static void build_expiry_index() {
+	const char *path = db_active_path();
+	FILE *fptr = path ? fopen(path, READ_PARAM) : NULL;
+	ib_exp_header_t header = { .n = 0, .horizon = UINT32_MAX };
+	ib_exp_entry_t *entries, entry;
+	ib_code_t code_s;
+	char *body;
+	uint32_t offset = 0, size, validity[2];
+	int ret, latest;
+
+	remove(FILE_DB_EXP);
+	if ( !fptr )
+		return;
+	entries = malloc(IBD_EXP_MAX * sizeof(ib_exp_entry_t));
+	body = malloc(IBD_BODY_MAX_SIZE);
+	if ( !entries || !body ) {
+		ESP_LOGE(__func__,"No memory for the expiry index");
+		free(entries);
+		free(body);
+		fclose(fptr);
+		return;
+	}
+	while ( 1 == (ret = read_record(fptr, &code_s, body, &size)) ) {
+		if ( !record_validity(body, size, validity) && validity[1] ) {
+			entry.valid_until = validity[1];
+			entry.offset = offset;
+			entry.code = code_s.code;
+			if ( header.n < IBD_EXP_MAX ) {
+				entries[header.n++] = entry;
+			} else {
+				latest = 0;
+				for ( int i = 1; i < IBD_EXP_MAX; i++ ) {
+					if ( entries[i].valid_until > entries[latest].valid_until )
+						latest = i;
+				}
+				if ( entry.valid_until < entries[latest].valid_until ) {
+					if ( entries[latest].valid_until < header.horizon )
+						header.horizon = entries[latest].valid_until;
+					entries[latest] = entry;
+				} else if ( entry.valid_until < header.horizon ) {
+					header.horizon = entry.valid_until;
+				}
+			}
+		}
+		offset += code_s.mem_d_size;
+	}
+	fclose(fptr);
+	free(body);
+	if ( ret < 0 )
+		ESP_LOGE(__func__,"Invalid record at:[%u]", offset);
+	qsort(entries, header.n, sizeof(ib_exp_entry_t), compare_until);
+	fptr = fopen(FILE_DB_EXP, WRITE_PARAM);
+	if ( !fptr || 1 != fwrite(&header, sizeof(header), 1, fptr)
+			|| header.n != fwrite(entries, sizeof(ib_exp_entry_t), header.n, fptr) ) {
+		ESP_LOGE(__func__,"Cannot save %s", FILE_DB_EXP);
+	} else {
+		ESP_LOGI(__func__,"%u keys with valid until", header.n);
+	}
+	if ( fptr )
+		fclose(fptr);
+	free(entries);
+}
+
+/** \brief Read an entry of the expiry index. */
+static int read_exp_entry(FILE *fptr, uint32_t i, ib_exp_entry_t *entry) {
+	fseek(fptr, sizeof(ib_exp_header_t) + i * sizeof(ib_exp_entry_t), SEEK_SET);
+	return 1 == fread(entry, sizeof(ib_exp_entry_t), 1, fptr);
+}
+
+/** \brief Number of the expired keys in the index, binary search. */
+static uint32_t count_expired(FILE *fptr, const ib_exp_header_t *header, int64_t now) {
+	ib_exp_entry_t entry;
+	uint32_t lo = 0, hi = header->n, mid;
+
+	while ( lo < hi ) {
+		mid = lo + (hi - lo) / 2;
+		if ( !read_exp_entry(fptr, mid, &entry) )
+			return lo;
+		if ( entry.valid_until <= now )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/** \brief Number of the expired keys and the next expiry, without scanning the database.
+ *  \param expired number of the expired keys still in the database
+ *  \param next valid until of the next key to expire, 0 when none
+ *  \return IBD_OK
+ *  \return IBD_ERR_NOT_FOUND no index, there is no database
+ * */
+static esp_err_t expiry_report(int64_t now, uint32_t *expired, uint32_t *next) {
+	FILE *fptr = fopen(FILE_DB_EXP, READ_PARAM);
+	ib_exp_header_t header;
+	ib_exp_entry_t entry;
+
+	*expired = 0;
+	*next = 0;
+	if ( !fptr )
+		return IBD_ERR_NOT_FOUND;
+	if ( 1 == fread(&header, sizeof(header), 1, fptr) ) {
+		*expired = count_expired(fptr, &header, now);
+		if ( *expired < header.n && read_exp_entry(fptr, *expired, &entry) )
+			*next = entry.valid_until;
+		else if ( header.horizon != UINT32_MAX )
+			*next = header.horizon;
+	}
+	fclose(fptr);
+	return IBD_OK;
+}
+
+/** \brief Count the expired keys, see expiry_report(). Takes the writer lock, the index is rebuilt by the writers. */
+esp_err_t ibd_expiry_report(int64_t now, uint32_t *expired, uint32_t *next) {
+	esp_err_t ret;
+	if ( !ibd_lock() )
+		return ESP_ERR_INVALID_STATE;
+	ret = expiry_report(now, expired, next);
+	ibd_unlock();
+	return ret;
+}
+
+/** \brief Copy the database without the expired keys in the index to FILE_DB_TEMP.
+ *  A record is dropped only when it is expired itself, a stale index does not remove valid keys.
+ *  \return number of dropped keys, -1 error
+ * */
+static int copy_without_expired(const uint32_t *offsets, uint32_t n, int64_t now) {
+	const char *path = db_active_path();
+	FILE *fbin = path ? fopen(path, READ_PARAM) : NULL;
+	FILE *ftmp = fopen(FILE_DB_TEMP, WRITE_PARAM);
+	ib_code_t code_s;
+	char *body = malloc(IBD_BODY_MAX_SIZE);
+	uint32_t offset = 0, size, validity[2], i = 0;
+	int ret, dropped = 0;
+
+	if ( !fbin || !ftmp || !body ) {
+		dropped = -1;
+		goto end;
+	}
+	while ( 1 == (ret = read_record(fbin, &code_s, body, &size)) ) {
+		while ( i < n && offsets[i] < offset )
+			i++;
+		if ( i < n && offsets[i] == offset && !record_validity(body, size, validity)
+				&& validity[1] && validity[1] <= now ) {
+			dropped++;
+		} else if ( 1 != fwrite(&code_s, sizeof(ib_code_t), 1, ftmp)
+				|| (size && 1 != fwrite(body, size, 1, ftmp)) ) {
+			ESP_LOGE(__func__,"Cannot write %s", FILE_DB_TEMP);
+			dropped = -1;
+			goto end;
+		}
+		offset += code_s.mem_d_size;
+	}
+	if ( ret < 0 ) {
+		ESP_LOGE(__func__,"Invalid record at:[%u]", offset);
+		dropped = -1;
+	}
+end:
+	free(body);
+	if ( fbin )
+		fclose(fbin);
+	if ( ftmp )
+		fclose(ftmp);
+	if ( dropped <= 0 )
+		remove(FILE_DB_TEMP);
+	return dropped;
+}
+
+/** \brief Remove the expired keys from the database (compaction).
+ *  The index tells whether there are any, the database is copied only then.
+ *  The caller holds the writer lock.
+ *  \param purged number of removed keys, only the published copies count
+ *  \return IBD_OK
+ *  \return IBD_ERR_NO_MEM
+ *  \return IBD_ERR_WRITE the database cannot be copied or published, it is not changed
+ * */
+static esp_err_t purge_expired(int64_t now, uint32_t *purged) {
+	FILE *fptr;
+	ib_exp_header_t header;
+	ib_exp_entry_t entry;
+	uint32_t *offsets, n;
+	info_t checks;
+	int dropped;
+	esp_err_t ret = IBD_OK;
+
+	*purged = 0;
+	do {
+		fptr = fopen(FILE_DB_EXP, READ_PARAM);
+		if ( !fptr )
+			break;
+		if ( 1 != fread(&header, sizeof(header), 1, fptr) || !(n = count_expired(fptr, &header, now)) ) {
+			fclose(fptr);
+			break;
+		}
+		offsets = malloc(n * sizeof(uint32_t));
+		if ( !offsets ) {
+			fclose(fptr);
+			return IBD_ERR_NO_MEM;
+		}
+		for ( uint32_t i = 0; i < n; i++ )
+			offsets[i] = read_exp_entry(fptr, i, &entry) ? entry.offset : UINT32_MAX;
+		fclose(fptr);
+		qsort(offsets, n, sizeof(uint32_t), compare_offset);
+		dropped = copy_without_expired(offsets, n, now);
+		free(offsets);
+		if ( dropped < 0 ) {
+			ret = IBD_ERR_WRITE;
+			break;
+		}
+		if ( dropped ) {
+			ibd_get_checksum(&checks);
+			checks.checksum_temp = checks.checksum_cur;		// Same database without the expired keys
+			ibd_save_checksum(&checks);
+			ret = activate_database();
+			if ( ret )
+				break;			// The keys are still there, the index is still valid
+			*purged += dropped;
+		}
+		build_expiry_index();
+	} while ( dropped && header.horizon <= now );		// Expired keys may be missing from the full index
+	if ( *purged ) {
+		ESP_LOGI(__func__,"%u expired keys removed", *purged);
+		ib_metric_add(IB_M_KEYS_PURGED, *purged);
+		ib_log_t msg = { .log_type = IB_LOG_KEY_PURGED, .value = *purged };
+		ib_log_post(&msg);
+	}
+	return ret;
+}
+
+/** \brief Remove the expired keys, see purge_expired().
+ *  Takes the writer lock, so it waits for a download and the download waits for it.
+ * */
+esp_err_t ibd_purge_expired(int64_t now, uint32_t *purged) {
+	esp_err_t ret;
+	*purged = 0;
+	if ( !ibd_lock() )
+		return ESP_ERR_INVALID_STATE;
+	ret = purge_expired(now, purged);
+	ibd_unlock();
+	return ret;
+}
+/** @} */
+
 /** \brief Initialize this module.
  *  Must be called only once.
  *  \return ESP_ERR_NOT_FOUND the ESP spiffs component is not mounted
  *	\return ESP_ERR_NNO_MEM not enough place for file with defined size
  *	\return ESP_OK database is ready for read / write operations
  * */
-esp_err_t ibd_init() {
+static esp_err_t init_database() {
 	FILE *fptr;
+	db_handle_t *slot;
+	struct stat filestat;
 	info_t info = {.checksum_temp = 0, .checksum_csv = 0, .checksum_cur = 0};
 	if ( !esp_spiffs_mounted(IBD_PARTITION_LABEL) )
 		return ESP_ERR_NOT_FOUND;
@@ -316,27 +818,45 @@ esp_err_t ibd_init() {
 		remove(FILE_DB_TEMP);
 		fclose(fptr);
 	}
+	slot = &g_slots[db_load_slot()];
+	for ( int i = 0; i < DB_SLOTS_N; i++ ) {
+		if ( &g_slots[i] != slot && !stat(g_slots[i].path, &filestat) )
+			remove(g_slots[i].path);		// The previous database of an interrupted swap
+	}
+	if ( !stat(slot->path, &filestat) )
+		g_active = slot;
 	if ( is_place_enough() ) {
-		fptr = fopen(FILE_DB_BIN, "rb");
-		if ( !fptr ) {
+		if ( !g_active ) {
 			ESP_LOGI(__func__,"Empty database");
 			return ESP_OK;
 		}
-		fclose(fptr);
+		fptr = fopen(FILE_DB_EXP, "rb");
+		if ( !fptr )
+			build_expiry_index();		// Database of an older version
+		else
+			fclose(fptr);
 		return ESP_OK;
 	}
 	return ESP_ERR_NO_MEM;
 }
-/** \brief Get a ib_data_t from file with specified code value.
- * \param code_val search by this value
- * \param d_ptr will be point to an allocated object, when data can be found
- * \return IBD_FOUND ib_data_t found, d_ptr is not NULL else it is
- * \return IBD_ERR_FILE_OPEN
- * \return IBD_ERR_DATA data object cannot be created
- * \return IBD_ERR_READ read from file error
+
+/** \brief Initialize this module, see init_database().
+ *  Creates the writer lock.
  * */
-esp_err_t ibd_get_by_code(uint64_t code_val, ib_data_t **d_ptr) {
-	FILE *fptr = fopen(FILE_DB_BIN, READ_PARAM);
+esp_err_t ibd_init() {
+	esp_err_t ret;
+	if ( !g_db_lock )
+		g_db_lock = IB_RECURSIVE_MUTEX_CREATE(db_lock, 0);
+	if ( !ibd_lock() )
+		return ESP_ERR_NO_MEM;
+	ret = init_database();
+	ibd_unlock();
+	return ret;
+}
+
+/** \brief Scan the binary database file for the code. */
+static esp_err_t get_by_code(const char *path, uint64_t code_val, ib_data_t **d_ptr) {
+	FILE *fptr = fopen(path, READ_PARAM);
 	if ( !fptr ) {
 		ESP_LOGE(__func__,"File cannot be opened");
 		return IBD_ERR_FILE_OPEN;
@@ -345,8 +865,9 @@ esp_err_t ibd_get_by_code(uint64_t code_val, ib_data_t **d_ptr) {
 	uint32_t offset = 0;
 	uint32_t end_offset = get_file_size(fptr) - IB_C_MIN_SIZE;
 	ib_code_t code_s;
-	char crons[IBD_CRON_MAX_SIZE];
+	char crons[IBD_BODY_MAX_SIZE];
 	uint32_t crons_size;
+	uint32_t validity[2];
 
 	while ( offset < end_offset ) {
 
@@ -355,6 +876,11 @@ esp_err_t ibd_get_by_code(uint64_t code_val, ib_data_t **d_ptr) {
 		if ( 1 == fread(&code_s, sizeof(ib_code_t), 1, fptr) ) {	// Read data ok
 			if ( code_s.code == code_val ) {	// Found
 				crons_size = code_s.mem_d_size - IB_C_MIN_SIZE;
+				if ( crons_size > IBD_BODY_MAX_SIZE ) {
+					ESP_LOGE(__func__,"Invalid record size");
+					fclose(fptr);
+					return IBD_ERR_DATA;
+				}
 				if ( crons_size ) {
 					if ( 1 != fread(crons, crons_size, 1, fptr) ) {
 						ESP_LOGE(__func__,"Read cron from file error!");
@@ -362,9 +888,15 @@ esp_err_t ibd_get_by_code(uint64_t code_val, ib_data_t **d_ptr) {
 						return IBD_ERR_READ;
 					}
 				}
-				*d_ptr = create_ib_data(code_s.code, crons);
+				if ( record_validity(crons, crons_size, validity) ) {
+					ESP_LOGE(__func__,"Crons not terminated");
+					fclose(fptr);
+					return IBD_ERR_DATA;
+				}
+				*d_ptr = create_ib_data(code_s.code, crons_size ? crons : NULL, validity[0], validity[1]);
 				if ( !(*d_ptr) ) {
 					ESP_LOGE(__func__,"Data object cannot be created");
+					fclose(fptr);
 					return IBD_ERR_DATA;
 				}
 				fclose(fptr);
@@ -387,6 +919,39 @@ esp_err_t ibd_get_by_code(uint64_t code_val, ib_data_t **d_ptr) {
 	return IBD_ERR_NOT_FOUND;
 }
 
+/** \brief Get a ib_data_t from file with specified code value.
+ * The lookup is traced (IB_TR_LOOKUP_START, IB_TR_LOOKUP_END).
+ * The published database is pinned while it is read, a swap does not stop the lookup.
+ * \param code_val search by this value
+ * \param d_ptr will be point to an allocated object, when data can be found
+ * \return IBD_FOUND ib_data_t found, d_ptr is not NULL else it is
+ * \return IBD_ERR_FILE_OPEN
+ * \return IBD_ERR_DATA data object cannot be created
+ * \return IBD_ERR_READ read from file error
+ * */
+esp_err_t ibd_get_by_code(uint64_t code_val, ib_data_t **d_ptr) {
+	esp_err_t ret;
+	int64_t start = esp_timer_get_time();
+	db_handle_t *h;
+	ib_trace(IB_TR_LOOKUP_START, IB_TRACE_CURRENT);
+	if ( (h = db_pin()) ) {
+		ret = get_by_code(h->path, code_val, d_ptr);
+		db_unpin(h);
+	} else {
+		ESP_LOGE(__func__,"No database");
+		*d_ptr = NULL;
+		ret = IBD_ERR_FILE_OPEN;
+	}
+	ib_trace(IB_TR_LOOKUP_END, IB_TRACE_CURRENT);
+	ib_metric_inc(IB_M_LOOKUPS);
+	if ( ret == IBD_ERR_NOT_FOUND )
+		ib_metric_inc(IB_M_LOOKUP_MISSES);
+	else if ( ret != IBD_FOUND )
+		ib_metric_inc(IB_M_LOOKUP_ERRORS);
+	ib_metric_observe(IB_H_LOOKUP_US, (uint32_t)(esp_timer_get_time() - start));
+	return ret;
+}
+
 /** \brief Create an ib_data_t object and save it to the flash.
  * Process from buffer.
  *  \param csv buffer
@@ -405,7 +970,7 @@ static int process_csv(char *csv, size_t size, FILE *fptr) {
 #endif
 	while ( size ) {
 		fseek(fptr, 0L, SEEK_CUR);
-		read_bytes = csv_eat_a_line(line, size, &csv);
+		read_bytes = csv_eat_a_line(line, sizeof(line), &csv);
 		processed_bytes += read_bytes;
 		size -= read_bytes;
 #ifdef TEST_MODE
@@ -417,7 +982,8 @@ static int process_csv(char *csv, size_t size, FILE *fptr) {
 		}
 		data = csv_process_line(line);
 		if ( !data ) {
-			ESP_LOGW(__func__,"Invalid line at:[%i]", processed_bytes);
+			ESP_LOGW(__func__,"Invalid line at:[%i]: %s", processed_bytes, csv_last_error());
+			ib_metric_inc(IB_M_CSV_REJECTED);
 		} else {
 #ifdef TEST_MODE
 			printf("ib_data_t s:\n code[%lld]\n mems[%i]\n",data->code_s.code, data->code_s.mem_d_size);
@@ -442,50 +1008,38 @@ static int process_csv(char *csv, size_t size, FILE *fptr) {
 				}
 			}
 		}
-		free(data);
+		ib_pool_free(data);
 	}
 	return processed_bytes;
 }
-/** \brief Write into FILE_DB_BIN or FILE_DB_TEMP
- *	Select FILE_DB_BIN when cannot find.
+/** \brief Open FILE_DB_TEMP for the next database, a published one is never written.
+ *	activate_database() publishes it.
  * */
 static FILE *select_file_to_write() {
-	FILE *fptr = fopen(FILE_DB_BIN, READ_PARAM);
-	const char *filename;
 	const char *fparam;
 	info_t checks;
-	uint64_t *checksum_val;
 	if ( !ibd_get_checksum(&checks) ) {
 		ESP_LOGE(__func__,"Cannot open checksum file!");
 		return NULL;
 	}
 
-	if ( fptr )	{		// There is an Active file
-		filename = FILE_DB_TEMP;
-		checksum_val = &(checks.checksum_temp);
-	}
-	else {
-		filename = FILE_DB_BIN;
-		checksum_val = &(checks.checksum_cur);
-	}
-	if ( *checksum_val != checks.checksum_csv ) {
-		*checksum_val = checks.checksum_csv;
+	if ( checks.checksum_temp != checks.checksum_csv ) {
+		checks.checksum_temp = checks.checksum_csv;
 		fparam = WRITE_PARAM;
 	} else {
 		fparam = APPEND_PARAM;
 	}
-	fclose(fptr);
 	if ( ibd_save_checksum(&checks) ) {
 		ESP_LOGE(__func__,"Cannot save checksum!");
 		return NULL;
 	}
-	return fopen(filename,fparam);
+	return fopen(FILE_DB_TEMP,fparam);
 }
 
 /** \brief Process and save the csv data into binary file.
- * Current file (FILE_DB_BIN or FILE_DB_TEMP) will be overwritten
- *  when info_t data .new_checksum (set by save_checksum function)
- *  is not equals with .active_checksum or .inactive_checksum.
+ * FILE_DB_TEMP will be overwritten
+ *  when info_t data .checksum_csv (set by ibd_append_csv_file function)
+ *  is not equals with .checksum_temp, it is published by the next activation.
  *  \param new_checksum
  *  \param csv
  *  \param data_len maximum bytes to process from file
@@ -494,7 +1048,7 @@ static FILE *select_file_to_write() {
  *  \return ESP_ERR_NOT_FOUND fopen error
  *  \return ESP_ERR_INVALID ARG csv is null
  * */
-esp_err_t ibd_append_from_str(char *csv, size_t *bytes_left) {
+static esp_err_t append_from_str(char *csv, size_t *bytes_left) {
 	FILE *fptr;
 	uint32_t bytes_processed;
 
@@ -517,6 +1071,16 @@ esp_err_t ibd_append_from_str(char *csv, size_t *bytes_left) {
 	}
 	return IBD_OK;
 }
+
+/** \brief Process csv data into FILE_DB_TEMP, see append_from_str(). Takes the writer lock. */
+esp_err_t ibd_append_from_str(char *csv, size_t *bytes_left) {
+	esp_err_t ret;
+	if ( !ibd_lock() )
+		return ESP_ERR_INVALID_STATE;
+	ret = append_from_str(csv, bytes_left);
+	ibd_unlock();
+	return ret;
+}
 /** \brief Cut the \n or \r characters from a line string. */
 char *str_chomp(char *buf) {
 	char *begin = buf;
@@ -540,15 +1104,25 @@ char *str_chomp(char *buf) {
  * 	\return 1 Fatal error at this line.
  * */
 static int process_csv_to_bin(FILE *fcsv, FILE *fbin, uint32_t *lines_proc) {
-	char *linebuf = malloc(IBD_CSV_LINE_MAX_SIZE);
-	size_t linesize = IBD_CSV_LINE_MAX_SIZE;
+	const size_t linesize = IBD_CSV_LINE_MAX_SIZE + 2;		// With the line end
+	char *linebuf = ib_pool_alloc(IB_POOL_LINE, linesize);
 	uint32_t linecnt = 1;
 	*lines_proc = 0;
 	ib_data_t *data;
 	size_t freebytes = IBD_FILE_SIZE - get_file_size(fbin);
-	uint32_t cnt;
-	while ( -1 != (cnt = __getline(&linebuf, &linesize, fcsv) ) ) {
-
+	size_t cnt;
+	int c;
+	if ( !linebuf )
+		return linecnt;
+	while ( fgets(linebuf, linesize, fcsv) ) {
+		cnt = strlen(linebuf);
+		if ( cnt == linesize - 1 && linebuf[cnt - 1] != '\n' ) {	// Too long, skip the rest of the line
+			while ( (c = fgetc(fcsv)) != EOF && c != '\n' )
+				;
+			ESP_LOGW(__func__,"Too long line at:[%i]",linecnt);
+			linecnt++;
+			continue;
+		}
 		if ( cnt > 0) {
 			fseek(fbin,0L,SEEK_CUR);
 			if ( ( data = csv_process_line(str_chomp(linebuf)) ) ) {// Process ok // @suppress("Assignment in condition")
@@ -560,7 +1134,8 @@ static int process_csv_to_bin(FILE *fcsv, FILE *fbin, uint32_t *lines_proc) {
 #endif
 				if ( freebytes < data->code_s.mem_d_size ) {// Check the free space
 					ESP_LOGW(__func__,"Run out of memory at line:[%i]",linecnt);
-					free(linebuf);
+					ib_pool_free(data);
+					ib_pool_free(linebuf);
 					return linecnt;
 				}
 
@@ -576,32 +1151,35 @@ static int process_csv_to_bin(FILE *fcsv, FILE *fbin, uint32_t *lines_proc) {
 				}
 				(*lines_proc)++;
 			} else {// Process not ok
-				ESP_LOGW(__func__,"Cannot process line at:[%i]",linecnt);
+				ESP_LOGW(__func__,"Cannot process line at:[%i]: %s",linecnt, csv_last_error());
 			}
 			linecnt++;
-			free(data);
+			ib_pool_free(data);
 		}
 	}//EOF
 	if ( feof(fcsv) ) {
 		ESP_LOGD(__func__,"EOF reached.");
 	}
-	free(linebuf);
+	ib_pool_free(linebuf);
 	return IBD_OK;
 }
 
 /** \brief Make a binary database from csv file.
+ *  The csv file is removed only when the new database is published.
  *  \return IBD_OK when file successfully loaded.
  *  \return	IBD_ERR_FILE_OPEN when destination binary file cannot be opened
  *  \return	IBD_ERR_INVALID_PARAM when the FILE_PATH null
  *  \return	IBD_ERR_NOT_FOUND when FILE_PATH file cannot be opened
  *  \return	IBD_ERR_DATA file processing stopped
+ *  \return	IBD_ERR_WRITE the database cannot be published, see activate_database()
  * */
-esp_err_t ibd_make_bin_database() {
+static esp_err_t make_bin_database() {
 	FILE *fptr_bin;
 	FILE *fptr_csv;
 	esp_err_t ret;
 	uint32_t line;
 	struct stat filestat;
+	info_t checks;
 
 	if ( !(fptr_bin = select_file_to_write()) ) {
 		ESP_LOGE(__func__,"File cannot be opened!"); // sterror?
@@ -627,7 +1205,15 @@ esp_err_t ibd_make_bin_database() {
 		ESP_LOGE(__func__,"File processing stopped at line:[%i]",ret);
 		return IBD_ERR_DATA;
 	}
-	activate_database();
+	ret = activate_database();
+	if ( ret ) {
+		if ( ibd_get_checksum(&checks) ) {	// The next download replaces the csv, it is not appended
+			checks.checksum_csv = 0;
+			ibd_save_checksum(&checks);
+		}
+		return ret;
+	}
+	build_expiry_index();
 	if ( !stat(FILE_CSV, &filestat) ) {			// Delete csv file: According to ESP IDF component: SPIFFS
 		unlink(FILE_CSV);
 	}
@@ -635,6 +1221,71 @@ esp_err_t ibd_make_bin_database() {
 	return IBD_OK;
 }
 
+/** \brief Make and publish a binary database from the csv file, see make_bin_database().
+ *  Takes the writer lock.
+ * */
+esp_err_t ibd_make_bin_database() {
+	esp_err_t ret;
+	if ( !ibd_lock() )
+		return ESP_ERR_INVALID_STATE;
+	ret = make_bin_database();
+	ibd_unlock();
+	return ret;
+}
+
+static struct {
+	struct arg_lit *purge;
+	struct arg_end *end;
+} expired_args;
+
+/** \brief Prints the number of the expired keys and the next expiry, removes them with -p. */
+static int expired_cmd(int argc, char **argv) {
+	struct tm time_info;
+	time_t now;
+	uint32_t expired, next, purged;
+	char buf[32];
+	esp_err_t ret;
+
+	int nerrors = arg_parse(argc, argv, (void**) &expired_args);
+	if ( nerrors ) {
+		arg_print_errors(stderr, expired_args.end, argv[0]);
+		return 1;
+	}
+	if ( IB_CLOCK_EVAL != ib_clock_eval(&now, &time_info) ) {
+		printf("Time is not valid\n");
+		return 1;
+	}
+	if ( IBD_OK != ibd_expiry_report(now, &expired, &next) ) {
+		printf("No expiry index\n");
+		return 1;
+	}
+	printf("expired:%u\n", expired);
+	if ( next ) {
+		ib_tz_localtime(next, &time_info);
+		strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M", &time_info);
+		printf("next expiry:%s\n", buf);
+	}
+	if ( expired_args.purge->count ) {
+		ret = ibd_purge_expired(now, &purged);
+		printf("purged:%u %s\n", purged, ret == IBD_OK ? "" : "error");
+	}
+	return 0;
+}
+
+/** \brief Command register function. */
+void register_database() {
+	expired_args.purge = arg_lit0("p", "purge", "Remove the expired keys");
+	expired_args.end = arg_end(0);
+	const esp_console_cmd_t expired_cmd_def = {
+			.command = "expired",
+			.help = "Expired keys of the database",
+			.hint = NULL,
+			.func = &expired_cmd,
+			.argtable = &expired_args
+	};
+	ESP_ERROR_CHECK( esp_console_cmd_register(&expired_cmd_def) );
+}
+
 void test_process_csv() {
 	ESP_LOGI(__func__,"START");
 	const char test_filename[] = "/spiffs/testfile";
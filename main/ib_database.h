@@ -17,6 +17,8 @@
  *  - After the csv file filled up with entries, function ib_make_bin_database() must called to generate a binary database
  * from the csv file. After done, the actual database is working.
  *  - Call ibd_get_by_code() function to search the wanted entry specified with iButton key code.
+ *  - The writers (csv append, ibd_make_bin_database(), ibd_purge_expired(), ...) are serialized by the writer lock,
+ * hold ibd_lock() across a whole download so the other writers cannot interleave with its chunks. Lookups do not wait for it.
  *
  *
  *
@@ -36,9 +38,15 @@
  * Field: Crons:
  *  - crons are separated by ";" or choose a character which is not included in crons.\n
  *
+ * Fields: Valid from, valid until (optional):
+ *  - epoch seconds (UTC), empty or missing: no limit.
+ *  - the key is valid from valid from, until valid until (the first second it is not valid).
+ *
  * Examples:\n
  * \code
  * "8899aabbccddeeff|* 6-16 * * 1-5;* 9-13 * * 1,7\n"\n
+ * "8899aabbccddeeff|* 6-16 * * 1-5|1767225600|1774994400\n"\n
+ * "8899aabbccddeeff|* 6-16 * * 1-5||1774994400\n"\n
  * "8899AABBCCDDEEFF|* 6-16 * * 1-5;* 9-13 * * 1,7\r\n"\n
  * "0x_8899AABBCCDDEEFF_|_* 6-16 * * 1-5_;_* 9-13 * * 1,7_\r"     -> "_"shows all possible place of extra spaces.
  * \endcode
@@ -63,6 +71,23 @@
  * 	   - 'or' relation between crons
  * 	   - includes null terminator
  * \endcode
+ * A key with a validity range has IBD_VALIDITY_SIZE more bytes after the null terminator: valid from and valid until
+ * as uint32_t, included in mem_d_size. A record without them is valid all the time.
+ *
+ * Expiry index:
+ *  - FILE_DB_EXP holds the keys with a valid until, sorted by it (ib_exp_entry_t), with their offset in the binary file.
+ *  It is built when a database is activated, at most IBD_EXP_MAX keys: the ones which expire first.
+ *  - ibd_expiry_report() counts the expired keys with a binary search in the index, ibd_purge_expired() copies
+ *  the database without the expired keys (compaction), when the index shows there are any.
+ *
+ * Database swap:
+ *  - A new database is written to a temporary file, it is renamed to one of the two slot files (ibd.bin, ibd_b.bin)
+ *  which is not in use, then that slot is published (ibd_generation() changes). The slot is saved in a file,
+ *  the other slot file is removed at boot.
+ *  - Only one writer swaps at a time, under the writer lock (ibd_lock()).
+ *  - ibd_get_by_code() pins the published slot while it reads the file, the writer removes the previous file
+ *  only when its lookups are finished. A lookup never waits for the swap and never finds the file missing or
+ *  half written, the swap waits for the lookups.
  *
  */
 
@@ -84,6 +109,8 @@
 #define IBD_LOG_FILE_SIZE		(512 * 1024)
 /** \brief Log file critical size. File cannot be greater. */
 #define IBD_LOG_FILE_CRITICAL	(500 * 1024 )
+/** \brief Log file is nearly full above this size, the readers show it. */
+#define IBD_LOG_FILE_WARNING	(384 * 1024 )
 /** @} */
 
 /** @defgroup dsv_file_macros Macros file DSV
@@ -92,9 +119,11 @@
 /** \brief Crons max length. */
 #define IBD_CRON_MAX_SIZE 		256
 #define IBD_CSV_CODE_SIZE 		16
-/** \brief First filed is key code the second is the crons string. */
-#define IBD_CSV_FIELDS 			2
-#define IBD_CSV_LINE_MAX_SIZE 		(IBD_CRON_MAX_SIZE + IBD_CSV_CODE_SIZE + 1)
+/** \brief Key code, crons string, valid from and valid until. */
+#define IBD_CSV_FIELDS 			4
+/** \brief Digits of an epoch value. */
+#define IBD_CSV_EPOCH_SIZE 		10
+#define IBD_CSV_LINE_MAX_SIZE 		(IBD_CRON_MAX_SIZE + IBD_CSV_CODE_SIZE + 2 * (IBD_CSV_EPOCH_SIZE + 1) + 1)
 
 /** \brief Separator between code and cron strings */
 #define DELIMITER 				"|"
@@ -113,6 +142,12 @@
 #define IBD_MIN_MEM_SIZE		(IBD_CODE_SIZE + IBD_CRONS_L_SIZE)
 
 #define IB_C_MIN_SIZE			(IBD_CODE_SIZE + IBD_CRONS_L_SIZE)
+/** \brief Valid from and valid until after the crons. */
+#define IBD_VALIDITY_SIZE		(2 * sizeof(uint32_t))
+/** \brief Maximum size after the code. */
+#define IBD_BODY_MAX_SIZE		(IBD_CRON_MAX_SIZE + IBD_VALIDITY_SIZE)
+/** \brief Keys in the expiry index. */
+#define IBD_EXP_MAX				1024
 /** @} */
 
 /** @defgroup err_codes_macro Error codes
@@ -154,6 +189,9 @@ typedef struct __attribute__ ((__packed__)) ib_code{
  */
 typedef struct __attribute__ ((__packed__)) ib_data{
 	char *crons;
+	/** Epoch, 0: no limit. */
+	uint32_t valid_from;
+	uint32_t valid_until;
 	ib_code_t code_s;
 	// CRON STRING space
 
@@ -167,12 +205,29 @@ typedef struct __attribute__((__packed__)) info_data{
 	uint64_t checksum_temp;		/** Temporary binary database checksum (Needed while processing csv file) */
 	uint64_t checksum_csv;		/** Downloaded csv file checksum. */
 } info_t;
+
+/** \brief Entry of the expiry index. */
+typedef struct __attribute__((__packed__)) ib_exp_entry {
+	uint32_t valid_until;
+	/** Offset of the record in the binary file. */
+	uint32_t offset;
+	uint64_t code;
+} ib_exp_entry_t;
+
+/** \brief Header of the expiry index. */
+typedef struct __attribute__((__packed__)) ib_exp_header {
+	uint32_t n;
+	/** The keys which expire before it are all in the index. UINT32_MAX when all of them are. */
+	uint32_t horizon;
+} ib_exp_header_t;
 /** @} */
 
 int ibd_get_checksum(info_t *d);
 int ibd_save_checksum(info_t *d);
 
-ib_data_t *create_ib_data(uint64_t code, char *crons);
+ib_data_t *create_ib_data(uint64_t code, char *crons, uint32_t valid_from, uint32_t valid_until);
+
+int ibd_valid_at(const ib_data_t *d, int64_t now);
 
 unsigned long ib_get_checksum();
 
@@ -182,12 +237,24 @@ esp_err_t ibd_init();
 
 esp_err_t ibd_get_by_code(uint64_t code_val, ib_data_t **d_ptr);
 
+int ibd_lock();
+
+void ibd_unlock();
+
+uint32_t ibd_generation();
+
 esp_err_t ibd_append_from_str(char *csv, size_t *bytes_left);
 
 esp_err_t ibd_append_csv_file(char *data, int *data_length, uint64_t checksum);
 
 esp_err_t ibd_make_bin_database();
 
+esp_err_t ibd_expiry_report(int64_t now, uint32_t *expired, uint32_t *next);
+
+esp_err_t ibd_purge_expired(int64_t now, uint32_t *purged);
+
+void register_database();
+
 /** LOG */
 esp_err_t ibd_log_append_file(char *data, size_t *data_length);
 
@@ -197,6 +264,8 @@ void ibd_log_delete();
 
 int ibd_log_check_file_exist();
 
+size_t ibd_log_size();
+
 FILE *ibd_log_get_fptr(const char *mode);
 
 
@@ -204,6 +273,8 @@ uint32_t csv_eat_a_line(char *line, int size, char **from);
 
 ib_data_t *csv_process_line(char *line);
 
+const char *csv_last_error();
+
 size_t get_file_size(FILE *fptr);
 
 char *str_chomp(char *buf);
@@ -0,0 +1,119 @@
+/**
+ * ib_fsm.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: root
+ *  @ingroup ib_fsm
+ *  @{
+ */
+
+#include <stddef.h>
+#include "ib_fsm.h"
+
+/** Operation modes, same as IB_READER_MODE_* in ib_reader.h. */
+#define MODE_NORMAL 			0
+#define MODE_BISTABLE 			1
+#define MODE_BISTABLE_SAME_KEY 	2
+
+#define OPEN 		(IB_ACT_LED_ACCESS | IB_ACT_RELAY_OPEN)
+#define CLOSE 		(IB_ACT_LED_IDLE | IB_ACT_RELAY_CLOSE | IB_ACT_INFO_NONE)
+
+/** \brief Transition table. Rows are checked in order, the first match wins,
+ *  so the rows with more guards must precede the default ones.
+ *  A superuser touch opens like a normal key when the superuser mode is disabled.
+ *  Inputs without a row are ignored.
+ * */
+static const ib_fsm_row_t TABLE[] = {
+	/* state					input				guard								next						actions */
+	{ IB_ST_ANY,				IB_IN_LOG_FULL,		0,									IB_ST_LOG_FULL,				IB_ACT_RELAY_CLOSE | IB_ACT_LED_BOTH | IB_ACT_INFO_LOG_FULL },
+
+	{ IB_ST_IDLE,				IB_IN_SU_TOUCHED,	IB_C_SU_ON,							IB_ST_SU_MODE,				IB_ACT_INFO_SU | IB_ACT_TIMEOUT_SU },
+	{ IB_ST_IDLE,				IB_IN_SU_TOUCHED,	IB_C_SU_OFF | IB_C_MODE_BISTABLE,	IB_ST_BISTABLE,				OPEN },
+	{ IB_ST_IDLE,				IB_IN_SU_TOUCHED,	IB_C_SU_OFF | IB_C_MODE_SAME_KEY,	IB_ST_BISTABLE_SAME_KEY,	OPEN | IB_ACT_SAVE_KEY },
+	{ IB_ST_IDLE,				IB_IN_SU_TOUCHED,	IB_C_SU_OFF,						IB_ST_ACCESS,				OPEN | IB_ACT_TIMEOUT },
+	{ IB_ST_IDLE,				IB_IN_TOUCHED,		IB_C_MODE_BISTABLE,					IB_ST_BISTABLE,				OPEN },
+	{ IB_ST_IDLE,				IB_IN_TOUCHED,		IB_C_MODE_SAME_KEY,					IB_ST_BISTABLE_SAME_KEY,	OPEN | IB_ACT_SAVE_KEY },
+	{ IB_ST_IDLE,				IB_IN_TOUCHED,		0,									IB_ST_ACCESS,				OPEN | IB_ACT_TIMEOUT },
+	{ IB_ST_IDLE,				IB_IN_INVALID,		0,									IB_ST_SAME,					IB_ACT_DENY },
+	{ IB_ST_IDLE,				IB_IN_BUTTON,		IB_C_MODE_NORMAL,					IB_ST_ACCESS,				OPEN | IB_ACT_TIMEOUT },
+
+	{ IB_ST_ACCESS,				IB_IN_TIMEOUT,		0,									IB_ST_IDLE,					CLOSE },
+
+	{ IB_ST_BISTABLE,			IB_IN_TOUCHED,		0,									IB_ST_IDLE,					CLOSE },
+
+	{ IB_ST_BISTABLE_SAME_KEY,	IB_IN_TOUCHED,		IB_C_SAME_KEY,						IB_ST_IDLE,					CLOSE },
+
+	{ IB_ST_SU_MODE,			IB_IN_TIMEOUT,		0,									IB_ST_IDLE,					IB_ACT_INFO_NONE },
+
+	{ IB_ST_LOG_FULL,			IB_IN_SU_TOUCHED,	0,									IB_ST_SAME,					IB_ACT_LOG_DELETE },
+	{ IB_ST_LOG_FULL,			IB_IN_BUTTON,		0,									IB_ST_SAME,					IB_ACT_RELAY_OPEN | IB_ACT_TIMEOUT },
+	{ IB_ST_LOG_FULL,			IB_IN_TIMEOUT,		0,									IB_ST_SAME,					IB_ACT_RELAY_CLOSE },
+	{ IB_ST_LOG_FULL,			IB_IN_LOG_CLEARED,	0,									IB_ST_IDLE,					IB_ACT_LED_IDLE | IB_ACT_INFO_NONE },
+};
+
+#define TABLE_ROWS (sizeof(TABLE) / sizeof(TABLE[0]))
+
+static const char *STATE_NAMES[IB_ST_N] = {
+	"idle", "access", "bistable", "bistable same key", "su mode", "log full",
+};
+
+static const char *INPUT_NAMES[IB_IN_N] = {
+	"touched", "su touched", "invalid", "button", "timeout", "log full", "log cleared",
+};
+
+void ib_fsm_init(ib_fsm_t *fsm) {
+	fsm->state = IB_ST_IDLE;
+	fsm->key = 0;
+}
+
+/** \brief Guard conditions which hold now. */
+static uint8_t conditions(const ib_fsm_t *fsm, const ib_fsm_event_t *event, const ib_fsm_ctx_t *ctx) {
+	uint8_t c = ctx->su_enabled ? IB_C_SU_ON : IB_C_SU_OFF;
+	switch ( ctx->mode ) {
+		case MODE_BISTABLE:
+			c |= IB_C_MODE_BISTABLE;
+			break;
+		case MODE_BISTABLE_SAME_KEY:
+			c |= IB_C_MODE_SAME_KEY;
+			break;
+		default:
+			c |= IB_C_MODE_NORMAL;
+			break;
+	}
+	if ( event->key == fsm->key )
+		c |= IB_C_SAME_KEY;
+	return c;
+}
+
+/** \brief Feed an event to the FSM.
+ *  \return actions of the transition, 0 when the input is ignored in the current state
+ * */
+uint16_t ib_fsm_step(ib_fsm_t *fsm, const ib_fsm_event_t *event, const ib_fsm_ctx_t *ctx) {
+	const uint8_t c = conditions(fsm, event, ctx);
+	const ib_fsm_row_t *row;
+
+	for ( size_t i = 0; i < TABLE_ROWS; i++ ) {
+		row = &TABLE[i];
+		if ( row->input != event->input )
+			continue;
+		if ( row->state != IB_ST_ANY && row->state != fsm->state )
+			continue;
+		if ( (row->guard & c) != row->guard )
+			continue;
+		if ( row->actions & IB_ACT_SAVE_KEY )
+			fsm->key = event->key;
+		if ( row->next != IB_ST_SAME )
+			fsm->state = row->next;
+		return row->actions;
+	}
+	return 0;
+}
+
+const char *ib_fsm_state_name(ib_fsm_state_t state) {
+	return (state < IB_ST_N) ? STATE_NAMES[state] : "?";
+}
+
+const char *ib_fsm_input_name(ib_fsm_input_t input) {
+	return (input < IB_IN_N) ? INPUT_NAMES[input] : "?";
+}
+/** @} */
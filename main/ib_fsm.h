@@ -0,0 +1,129 @@
+/**
+ * @defgroup ib_fsm
+ * @ingroup ib_reader
+ * @{
+ *
+ * ib_fsm.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: root
+ *
+ * Table-driven state machine of a reader.
+ *
+ * The FSM is pure C: ib_fsm_step() looks up the first matching row of the transition table
+ * for the current state and input, switches the state and returns the actions (IB_ACT_*)
+ * which must be done on the outputs by the caller. It does not touch hardware,
+ * so it can be replayed on a host or with the 'fsmtest' console command.
+ *
+ * A row matches when all of its guard conditions (IB_C_*) hold. The conditions are
+ * computed from the context (operation mode, superuser enable pin) and the event key.
+ */
+
+#ifndef MAIN_IB_FSM_H_
+#define MAIN_IB_FSM_H_
+
+#include <stdint.h>
+
+/** \brief States. */
+typedef enum ib_fsm_state {
+	/** Waiting for a touch, the standard state. */
+	IB_ST_IDLE,
+	/** Relay opened for the opening time. */
+	IB_ST_ACCESS,
+	/** Relay opened until the next valid key. */
+	IB_ST_BISTABLE,
+	/** Relay opened until the same key. */
+	IB_ST_BISTABLE_SAME_KEY,
+	/** Superuser mode. */
+	IB_ST_SU_MODE,
+	/** Log file is full, all access denied until the superuser touches or the log is cleared. */
+	IB_ST_LOG_FULL,
+	IB_ST_N,
+	/** Table only: row matches in every state. */
+	IB_ST_ANY,
+	/** Table only: stay in the current state. */
+	IB_ST_SAME,
+} ib_fsm_state_t;
+
+/** \brief Inputs. */
+typedef enum ib_fsm_input {
+	IB_IN_TOUCHED,
+	IB_IN_SU_TOUCHED,
+	IB_IN_INVALID,
+	IB_IN_BUTTON,
+	IB_IN_TIMEOUT,
+	IB_IN_LOG_FULL,
+	IB_IN_LOG_CLEARED,
+	IB_IN_N
+} ib_fsm_input_t;
+
+/** @defgroup fsm_actions Actions of a transition
+ * @{ */
+#define IB_ACT_RELAY_OPEN 		(1 << 0)
+#define IB_ACT_RELAY_CLOSE 		(1 << 1)
+/** Red LED on, green LED off. */
+#define IB_ACT_LED_IDLE 		(1 << 2)
+/** Green LED on, red LED off. */
+#define IB_ACT_LED_ACCESS 		(1 << 3)
+#define IB_ACT_LED_BOTH 		(1 << 4)
+/** Access denied indication. */
+#define IB_ACT_DENY 			(1 << 5)
+/** Start the opening time. */
+#define IB_ACT_TIMEOUT 			(1 << 6)
+#define IB_ACT_INFO_NONE 		(1 << 7)
+#define IB_ACT_INFO_SU 			(1 << 8)
+#define IB_ACT_INFO_LOG_FULL 	(1 << 9)
+/** Delete the log file and leave the log full state on all the readers. */
+#define IB_ACT_LOG_DELETE 		(1 << 10)
+/** Done by the FSM: the key of the event is saved for IB_C_SAME_KEY. */
+#define IB_ACT_SAVE_KEY 		(1 << 11)
+/** Start the superuser mode time. */
+#define IB_ACT_TIMEOUT_SU 		(1 << 12)
+/** @} */
+
+/** @defgroup fsm_conditions Guard conditions
+ * @{ */
+#define IB_C_SU_ON 				(1 << 0)
+#define IB_C_SU_OFF 			(1 << 1)
+#define IB_C_MODE_NORMAL 		(1 << 2)
+#define IB_C_MODE_BISTABLE 		(1 << 3)
+#define IB_C_MODE_SAME_KEY 		(1 << 4)
+/** Key of the event equals the saved key. */
+#define IB_C_SAME_KEY 			(1 << 5)
+/** @} */
+
+/** \brief A row of the transition table. */
+typedef struct ib_fsm_row {
+	uint8_t state;
+	uint8_t input;
+	uint8_t guard;
+	uint8_t next;
+	uint16_t actions;
+} ib_fsm_row_t;
+
+/** \brief Event: input and the key code (touches only). */
+typedef struct ib_fsm_event {
+	ib_fsm_input_t input;
+	uint64_t key;
+} ib_fsm_event_t;
+
+/** \brief Context of the guards. */
+typedef struct ib_fsm_ctx {
+	/** IB_READER_MODE_* */
+	uint8_t mode;
+	uint8_t su_enabled;
+} ib_fsm_ctx_t;
+
+typedef struct ib_fsm {
+	ib_fsm_state_t state;
+	uint64_t key;
+} ib_fsm_t;
+
+void ib_fsm_init(ib_fsm_t *fsm);
+uint16_t ib_fsm_step(ib_fsm_t *fsm, const ib_fsm_event_t *event, const ib_fsm_ctx_t *ctx);
+const char *ib_fsm_state_name(ib_fsm_state_t state);
+const char *ib_fsm_input_name(ib_fsm_input_t input);
+
+#endif /* MAIN_IB_FSM_H_ */
+
+/** @} */
@@ -0,0 +1,243 @@
+/**
+ * ib_gen.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: root
+ *  @ingroup ib_gen
+ *  @{
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "ib_gen.h"
+#include "ib_onewire_sim.h"
+#include "ib_tz.h"
+
+#define FAMILY_CODE 		0x01
+#define DAY_S 				86400
+
+/** \brief Touches per hour of day, relative. */
+static const uint8_t g_hour_weight[24] = {
+		1, 1, 1, 1, 1, 2, 6, 20, 40, 25, 12, 10, 18, 15, 10, 10, 14, 30, 20, 8, 4, 3, 2, 1 };
+/** \brief Weight of a weekend day, 1/n of a weekday. */
+#define WEEKEND_DIVISOR 	4
+
+/** \brief 24 random bits. */
+static uint32_t rnd(uint32_t *state) {
+	*state = *state * 1103515245 + 12345;
+	return *state >> 8;
+}
+
+/** \brief Seed of item n, so an item does not depend on the others. */
+static uint32_t item_seed(uint32_t seed, uint32_t n) {
+	uint32_t h = seed ^ (n * 0x9E3779B9);
+	h ^= h >> 16;
+	h *= 0x85EBCA6B;
+	h ^= h >> 13;
+	h *= 0xC2B2AE35;
+	return h ^ (h >> 16);
+}
+
+/** \brief Random entry of a list, n[complexity] entries can be used. */
+static const char *pick(uint32_t *state, const char *const *list, const uint8_t n[], int complexity) {
+	return list[rnd(state) % n[complexity]];
+}
+
+/** \brief Code of a key: family code, serial number, CRC, the byte order of ibutton.c. */
+static uint64_t make_code(uint64_t serial) {
+	uint8_t rom[OW_ROM_SIZE];
+	uint64_t code = 0;
+
+	ow_sim_make_rom(FAMILY_CODE, serial, rom);
+	for ( int i = 0; i < OW_ROM_SIZE; i++ )
+		code = (code << 8) | rom[i];
+	return code;
+}
+
+/** \brief Code of key 0 - g->keys-1. */
+uint64_t ib_gen_code(const ib_gen_t *g, uint32_t key) {
+	return make_code(((uint64_t)item_seed(g->seed, 0) << 8) % (IB_GEN_UNKNOWN_SERIAL / 2) + key + 1);
+}
+
+/** \brief The code is not in a generated database (a touch of an unknown key). */
+int ib_gen_unknown(uint64_t code) {
+	uint64_t serial = 0;
+
+	for ( int i = 1; i < OW_ROM_SIZE - 1; i++ )			// rom[i] is byte i of the code from the MSB
+		serial |= ((code >> (8 * (OW_ROM_SIZE - 1 - i))) & 0xFF) << (8 * (i - 1));
+	return serial >= IB_GEN_UNKNOWN_SERIAL;
+}
+
+/** \brief Crons of a schedule.
+ *  \return length
+ *  \return -1 buf is too small
+ * */
+int ib_gen_schedule(const ib_gen_t *g, uint32_t schedule, char *buf, size_t size) {
+	static const char *const minutes[] = { "*", "*", "0-29", "*/15", "0,30", "*/5" };
+	static const char *const mdays[] = { "*", "*", "*", "1-15", "16-31", "1,15", "L" };
+	static const char *const months[] = { "*", "*", "*", "jan-jun", "3-10", "sep-dec" };
+	static const char *const wdays[] = { "mon-fri", "1-5", "*", "sat-sun", "1,3,5", "2-4", "mon#1", "friL" };
+	static const char *const cals[] = { "", "", "", " !1", " @2" };
+	static const uint8_t n_minutes[] = { 2, 6, 6 }, n_mdays[] = { 3, 6, 7 }, n_months[] = { 3, 6, 6 },
+			n_wdays[] = { 2, 6, 8 }, n_cals[] = { 1, 1, 5 };
+	uint32_t state = item_seed(g->seed ^ 0x5CED, schedule);
+	const int crons = 1 + rnd(&state) % (g->crons ? g->crons : 1);
+	const int c = (g->complexity < IB_GEN_COMPLEXITY_MAX) ? g->complexity : IB_GEN_COMPLEXITY_MAX;
+	int len = 0, n, h1, h2;
+
+	for ( int i = 0; i < crons; i++ ) {
+		h1 = 5 + rnd(&state) % 6;
+		h2 = h1 + 4 + rnd(&state) % 8;
+		if ( h2 > 23 )
+			h2 = 23;
+		n = snprintf(buf + len, size - len, "%s%s %i-%i%s %s %s %s%s", i ? ";" : "",
+				pick(&state, minutes, n_minutes, c), h1, h2, (c >= 1 && rnd(&state) % 4 == 0) ? "/2" : "",
+				pick(&state, mdays, n_mdays, c), pick(&state, months, n_months, c),
+				pick(&state, wdays, n_wdays, c), pick(&state, cals, n_cals, c));
+		if ( n < 0 || (size_t)n >= size - len )
+			return -1;
+		len += n;
+	}
+	return len;
+}
+
+/** \brief CSV line of a key with the line end.
+ *  \return length
+ *  \return -1 buf is too small
+ * */
+int ib_gen_csv_line(const ib_gen_t *g, uint32_t key, char *buf, size_t size) {
+	uint32_t state = item_seed(g->seed ^ 0xC0DE, key);
+	const uint32_t schedule = rnd(&state) % (g->schedules ? g->schedules : 1);
+	int64_t valid_from, valid_until;
+	int len, n;
+
+	len = snprintf(buf, size, "%016llX|", (unsigned long long)ib_gen_code(g, key));
+	if ( len < 0 || (size_t)len >= size )
+		return -1;
+	if ( (n = ib_gen_schedule(g, schedule, buf + len, size - len)) < 0 )
+		return -1;
+	len += n;
+	if ( rnd(&state) % 100 < g->validity_pct ) {
+		valid_from = g->from - (int64_t)(rnd(&state) % 30) * DAY_S;
+		valid_until = valid_from + (int64_t)(1 + rnd(&state) % 400) * DAY_S;
+		n = snprintf(buf + len, size - len, "|%lld|%lld\n", (long long)valid_from, (long long)valid_until);
+	} else {
+		n = snprintf(buf + len, size - len, "\n");
+	}
+	if ( n < 0 || (size_t)n >= size - len )
+		return -1;
+	return len + n;
+}
+
+static uint32_t gcd(uint32_t a, uint32_t b) {
+	while ( b ) {
+		uint32_t r = a % b;
+		a = b;
+		b = r;
+	}
+	return a;
+}
+
+/** \brief Weight of the hour of a time. */
+static int weight(int64_t t) {
+	struct tm tm;
+	ib_tz_gmtime(t, &tm);
+	if ( tm.tm_wday == 0 || tm.tm_wday == 6 )
+		return g_hour_weight[tm.tm_hour];
+	return g_hour_weight[tm.tm_hour] * WEEKEND_DIVISOR;
+}
+
+/** \brief Start a trace.
+ *  \param days the touches are spread over about this many days from g->from
+ * */
+void ib_gen_trace_init(ib_gen_trace_t *tr, const ib_gen_t *g, uint32_t touches, float zipf_s,
+		uint8_t unknown_pct, uint16_t days) {
+	uint32_t sum = 0;
+
+	memset(tr, 0, sizeof(*tr));
+	tr->db = g;
+	tr->touches = touches;
+	tr->zipf_s = zipf_s;
+	tr->unknown_pct = unknown_pct;
+	tr->rng = item_seed(g->seed ^ 0x7ACE, 0);
+	tr->t = g->from;
+	for ( int h = 0; h < 24; h++ ) {
+		sum += g_hour_weight[h] * (5 * WEEKEND_DIVISOR + 2);
+		if ( g_hour_weight[h] * WEEKEND_DIVISOR > tr->weight_max )
+			tr->weight_max = g_hour_weight[h] * WEEKEND_DIVISOR;
+	}
+	/* Average rate * max weight / average weight */
+	tr->rate_max = (double)touches / ((days ? days : 1) * (double)DAY_S) * tr->weight_max / (sum / (7.0 * 24));
+	tr->stride = 1;
+	if ( g->keys > 2 ) {
+		for ( tr->stride = g->keys / 2 + 1; gcd(tr->stride, g->keys) != 1; tr->stride++ )
+			;
+	}
+}
+
+/** \brief Uniform in (0, 1). */
+static double uniform(uint32_t *state) {
+	return (rnd(state) + 0.5) / (double)(1 << 24);
+}
+
+/** \brief Rank of a touched key by the inverse of the continuous Zipf distribution over [1, keys + 1). */
+static uint32_t zipf_rank(ib_gen_trace_t *tr) {
+	const double n = tr->db->keys + 1.0, u = uniform(&tr->rng), s = tr->zipf_s;
+	double x;
+
+	if ( fabs(s - 1.0) < 1e-3 )
+		x = pow(n, u);
+	else
+		x = pow(1.0 + u * (pow(n, 1.0 - s) - 1.0), 1.0 / (1.0 - s));
+	if ( x < 1.0 )
+		x = 1.0;
+	return ((uint32_t)x - 1 < tr->db->keys) ? (uint32_t)x - 1 : tr->db->keys - 1;
+}
+
+/** \brief Next touch of the trace.
+ *  \return 0 ok
+ *  \return -1 end of the trace
+ * */
+int ib_gen_trace_next(ib_gen_trace_t *tr, int64_t *time, uint64_t *code) {
+	if ( tr->emitted >= tr->touches || !tr->db->keys || tr->rate_max <= 0 )
+		return -1;
+	/* Poisson arrivals at the busiest rate, thinned by the weight of the hour */
+	do {
+		tr->t += -log(uniform(&tr->rng)) / tr->rate_max;
+	} while ( uniform(&tr->rng) * tr->weight_max >= weight((int64_t)tr->t) );
+	*time = (int64_t)tr->t;
+	if ( rnd(&tr->rng) % 100 < tr->unknown_pct )
+		*code = make_code(IB_GEN_UNKNOWN_SERIAL + rnd(&tr->rng));
+	else
+		*code = ib_gen_code(tr->db, (uint32_t)(((uint64_t)zipf_rank(tr) * tr->stride) % tr->db->keys));
+	tr->emitted++;
+	return 0;
+}
+
+/** \brief Trace line of a touch with the line end. \return length, -1 buf is too small */
+int ib_gen_trace_line(int64_t time, uint64_t code, char *buf, size_t size) {
+	int n = snprintf(buf, size, "%lld|%016llX\n", (long long)time, (unsigned long long)code);
+	return (n < 0 || (size_t)n >= size) ? -1 : n;
+}
+
+/** \brief Parse a trace line.
+ *  \return 0 ok
+ *  \return -1 invalid line
+ * */
+int ib_gen_trace_parse(const char *line, int64_t *time, uint64_t *code) {
+	char *end;
+
+	*time = strtoll(line, &end, 10);
+	if ( end == line || *end != '|' )
+		return -1;
+	line = end + 1;
+	*code = strtoull(line, &end, 16);
+	if ( end == line || (*end && *end != '\n' && *end != '\r') )
+		return -1;
+	return 0;
+}
+/** @} */
@@ -0,0 +1,94 @@
+/**
+ * @defgroup ib_gen
+ * @{
+ *
+ * ib_gen.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: root
+ *
+ * Synthetic database and touch trace generator for the benchmarks.
+ *
+ * The database is a list of CSV lines in the ib_csv.c format. Key i has a valid iButton code: family code 0x01,
+ * a serial number and the CRC (see ow_sim_make_rom()), so it is in the CODE_MIN_VAL..CODE_MAX_VAL range.
+ * The keys share the schedules: schedule k is generated from the seed and k only, a key uses one of them.
+ * Complexity of the schedules:
+ *  - 0: ranges of hours and weekdays,
+ *  - 1: and lists and steps,
+ *  - 2: and last day of month, nth weekday and the calendar qualifiers.
+ *
+ * The trace is a list of touches sorted by time, one per line:
+ * \code
+ *   epoch|code
+ *   1767254400|01000000100003A7
+ * \endcode
+ * The touched keys follow a Zipf distribution, the rank of the keys is shuffled, so the popular keys are spread
+ * over the database. A given ratio of touches are unknown keys. The touches arrive more often in the working hours
+ * and less often at the weekends (UTC).
+ *
+ * Everything is generated from the seed, the same parameters give the same files. The functions do not use the
+ * file system or the device, the 'gendb' command writes the files (FILE_GEN_CSV, FILE_GEN_TRACE).
+ */
+
+#ifndef MAIN_IB_GEN_H_
+#define MAIN_IB_GEN_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FILE_GEN_CSV 			"/spiffs/ibd/gen.csv"
+#define FILE_GEN_TRACE 			"/spiffs/ibd/gen_trace.txt"
+/** \brief Size of a trace line with the line end. */
+#define IB_GEN_TRACE_LINE_SIZE 	32
+/** \brief Serial numbers of the unknown keys, the database keys are below it. */
+#define IB_GEN_UNKNOWN_SERIAL 	0x800000000000ULL
+/** \brief Maximum complexity of the schedules. */
+#define IB_GEN_COMPLEXITY_MAX 	2
+
+/** \brief Parameters of the database. */
+typedef struct ib_gen {
+	uint32_t keys;
+	/** Different schedules, shared by the keys. */
+	uint32_t schedules;
+	/** Maximum number of crons of a schedule, 1-CRON_MAX_N. */
+	uint8_t crons;
+	/** 0-IB_GEN_COMPLEXITY_MAX. */
+	uint8_t complexity;
+	/** Keys with a validity range, percent. */
+	uint8_t validity_pct;
+	uint32_t seed;
+	/** Start of the trace and of the validity ranges, epoch seconds. */
+	int64_t from;
+} ib_gen_t;
+
+/** \brief Touch trace generator. */
+typedef struct ib_gen_trace {
+	const ib_gen_t *db;
+	uint32_t touches;
+	uint32_t emitted;
+	/** Zipf exponent, 0: every key is touched as often. */
+	float zipf_s;
+	/** Touches of unknown keys, percent. */
+	uint8_t unknown_pct;
+	uint32_t rng;
+	/** Shuffle of the ranks. */
+	uint32_t stride;
+	/** Touches per second at the busiest hour and its weight. */
+	double rate_max;
+	uint32_t weight_max;
+	double t;
+} ib_gen_trace_t;
+
+uint64_t ib_gen_code(const ib_gen_t *g, uint32_t key);
+int ib_gen_unknown(uint64_t code);
+int ib_gen_schedule(const ib_gen_t *g, uint32_t schedule, char *buf, size_t size);
+int ib_gen_csv_line(const ib_gen_t *g, uint32_t key, char *buf, size_t size);
+
+void ib_gen_trace_init(ib_gen_trace_t *tr, const ib_gen_t *g, uint32_t touches, float zipf_s,
+		uint8_t unknown_pct, uint16_t days);
+int ib_gen_trace_next(ib_gen_trace_t *tr, int64_t *time, uint64_t *code);
+int ib_gen_trace_line(int64_t time, uint64_t code, char *buf, size_t size);
+int ib_gen_trace_parse(const char *line, int64_t *time, uint64_t *code);
+
+#endif /* MAIN_IB_GEN_H_ */
+/** @} */
@@ -10,7 +10,10 @@
  *
  *  The checksum from server is periodically downloaded and compared to the local one.
  *  If the checksum does not match, the DSV file will be pulled down.
+ *  An optional second value of the checksum file is the checksum of the calendars (ib_calendar),
+ *  they are downloaded separately when it changes.
  *  The URLS can be configured on console with a serial terminal.
+ *  The runtime metrics (ib_metrics) are posted to the log URL every IB_METRICS_UPLOAD_MS.
  *
  *
  */
@@ -28,10 +31,17 @@
 #include "nvs.h"
 #include "nvs_flash.h"
 #include "esp_http_client.h"
+#include "esp_timer.h"
 #include "cmd_wifi.h"
 
 #include "ib_database.h"
+#include "ib_clock.h"
 #include "ib_reader.h"
+#include "ib_pattern.h"
+#include "ib_calendar.h"
+#include "ib_metrics.h"
+#include "ib_static.h"
+#include "ib_pool.h"
 
 //#define TESTMODE
 
@@ -46,8 +56,20 @@
 /** \brief POST data log message buffer. */
 #define HTTP_POST_FILE_BUFFER	4096
 
+/** \brief Receive buffer of the largest request, the calendars. */
+#define HTTP_RX_BUFFER_SIZE 	(IB_CAL_TEXT_MAX + 1)
+_Static_assert(HTTP_RECEIVE_BUFFER < HTTP_RX_BUFFER_SIZE && HTTP_CHECKSUM_BUFFER < HTTP_RX_BUFFER_SIZE,
+		"HTTP_RX_BUFFER_SIZE too small");
+
+#define UPDATE_TASK_STACK 		8192
+
+IB_TASK_STORAGE(update_task, UPDATE_TASK_STACK, 1);
+IB_EVENT_GROUP_STORAGE(client_group, 1);
+
 /** \brief SPIFFS key. */
 const char key_server_info[] = "db_url";
+/** \brief NVS key of the calendar URL. */
+const char key_calendar_url[] = "cal_url";
 /** \brief SPIFFS namespace. */
 const char namespace[] = "wifi_nvs";
 
@@ -65,6 +87,11 @@ static struct {
     struct arg_end *end;
 } setserver_args;
 
+static struct {
+    struct arg_str *calendar_file_path;
+    struct arg_end *end;
+} setcalendar_args;
+
 #define URL_MAXLEN 63
 
 /** \brief Server URLS. */
@@ -83,6 +110,8 @@ EventGroupHandle_t g_client_event_group;
 TaskHandle_t g_update_handler;
 
 ib_server_conf_t g_server_conf;
+/** \brief Calendar URL, empty when it is not set. */
+char g_cal_url[URL_MAXLEN + 1];
 
 /** \brief Based on sample project. */
 esp_err_t http_event_handler(esp_http_client_event_t *evt) {
@@ -119,6 +148,25 @@ esp_err_t http_event_handler(esp_http_client_event_t *evt) {
     return ESP_OK;
 }
 
+/** \brief Receive buffer of a request, size is at most HTTP_RX_BUFFER_SIZE.
+ *  The requests run one by one in the update task, they share the block of IB_POOL_HTTP.
+ * */
+static char *rx_buffer_get(size_t size) {
+	return ib_pool_alloc(IB_POOL_HTTP, size);
+}
+
+static void rx_buffer_put(char *buffer) {
+	ib_pool_free(buffer);
+}
+
+/** \brief Count a finished HTTP request and its duration. */
+static void http_done(int64_t start, int failed) {
+	ib_metric_inc(IB_M_HTTP_REQUESTS);
+	if ( failed )
+		ib_metric_inc(IB_M_HTTP_FAILURES);
+	ib_metric_observe(IB_H_HTTP_MS, (uint32_t)((esp_timer_get_time() - start) / 1000));
+}
+
 /** \brief Refresh server configuration.
  *  It copies the configuration data from NVS. Used after initialization.
  */
@@ -137,8 +185,11 @@ static esp_err_t refresh_server_conf() {
 		nvs_close(nvs);
 		return ret;
 	}
-	ESP_LOGI(TAG,"data from nvs:\nChecksum path:%s\nDatabase path:%s\nLogfile path:%s",
-			g_server_conf.ch_url, g_server_conf.db_url, g_server_conf.log_url);
+	length = sizeof(g_cal_url);
+	if ( ESP_OK != nvs_get_str(nvs, key_calendar_url, g_cal_url, &length) )
+		g_cal_url[0] = '\0';
+	ESP_LOGI(TAG,"data from nvs:\nChecksum path:%s\nDatabase path:%s\nLogfile path:%s\nCalendar path:%s",
+			g_server_conf.ch_url, g_server_conf.db_url, g_server_conf.log_url, g_cal_url);
 	nvs_close(nvs);
 	return ESP_OK;
 }
@@ -152,15 +203,17 @@ char *ib_client_get_log_url() {
  * File will be saved in the specified DSV file in file system.
  * \return -1 Not enough memory
  * \return 1 Any error occurred.
+ * \return IBD_ERR_* the database cannot be made from the file, see ibd_make_bin_database()
  * \return ESP_OK when successfully download.
  */
 esp_err_t save_csv_from_server(uint64_t checksum) {
-	char *buffer = malloc(HTTP_RECEIVE_BUFFER+1);
+	char *buffer = rx_buffer_get(HTTP_RECEIVE_BUFFER+1);
 	esp_err_t ret;
+	int64_t start = esp_timer_get_time();
 
 
 	if ( !buffer ) {
-		ESP_LOGE(__func__,"Cannot malloc for receive buffer");
+		ESP_LOGE(__func__,"No memory for receive buffer");
 		return -1;
 	}
 
@@ -172,13 +225,14 @@ esp_err_t save_csv_from_server(uint64_t checksum) {
     esp_http_client_handle_t client = esp_http_client_init(&config);
     if ( !client ) {
     	ESP_LOGE(TAG, "Invalid URL");
-    	free(buffer);
+    	rx_buffer_put(buffer);
     	return 1;
     }
     ret = esp_http_client_open(client, 0);
     if ( ESP_OK != ret ) {
     	ESP_LOGE(TAG,"Failed to open HTTP connection: %s", esp_err_to_name(ret));
-    	free(buffer);
+    	http_done(start, 1);
+    	rx_buffer_put(buffer);
     	return 1;
     }
 
@@ -187,11 +241,14 @@ esp_err_t save_csv_from_server(uint64_t checksum) {
 	int content_left = esp_http_client_fetch_headers(client);
     ESP_LOGD(TAG, "content_len:%i", content_left);
 
+	ibd_lock();		// No other writer between the chunks and the rebuild
 	do  {
 		to_read_len = (content_left <= HTTP_RECEIVE_BUFFER) ? content_left : HTTP_RECEIVE_BUFFER;
 		read_len = esp_http_client_read(client, buffer, to_read_len);
 		if ( read_len == -1 ) {		// RET -1
 			ESP_LOGE(TAG, "Read HTTP stream error");
+		} else {
+			ib_metric_add(IB_M_SYNC_BYTES, read_len);
 		}
 		content_left -= read_len;
 		buffer[read_len] = '\0';
@@ -204,27 +261,90 @@ esp_err_t save_csv_from_server(uint64_t checksum) {
 	} while ( (content_left) > 0 );
     esp_http_client_close(client);
     esp_http_client_cleanup(client);
+    http_done(start, 0);
 
-    ibd_make_bin_database();
-    free(buffer);
-    return ESP_OK;
+    ret = ibd_make_bin_database();
+    ibd_unlock();
+    if ( ESP_OK != ret ) {
+    	ESP_LOGE(TAG, "Database cannot be made: %i", ret);
+    }
+    rx_buffer_put(buffer);
+    return ret;
+}
+
+/** \brief Download the calendars from server.
+ *  The file is small, it is read into one buffer and parsed by ib_calendar.
+ *  \return ESP_OK when successfully download.
+ * */
+static esp_err_t save_calendar_from_server(uint64_t checksum) {
+	char *buffer;
+	esp_err_t ret;
+	int content_len, read_len, total = 0;
+	int64_t start = esp_timer_get_time();
+
+	if ( !g_cal_url[0] )
+		return ESP_ERR_NOT_FOUND;
+	buffer = rx_buffer_get(IB_CAL_TEXT_MAX + 1);
+	if ( !buffer ) {
+		ESP_LOGE(__func__,"No memory for receive buffer");
+		return ESP_ERR_NO_MEM;
+	}
+	esp_http_client_config_t config = {
+		.url = g_cal_url,
+		.event_handler = http_event_handler
+	};
+	esp_http_client_handle_t client = esp_http_client_init(&config);
+	if ( !client ) {
+		ESP_LOGE(TAG, "Invalid URL");
+		rx_buffer_put(buffer);
+		return ESP_ERR_INVALID_ARG;
+	}
+	ret = esp_http_client_open(client, 0);
+	if ( ESP_OK != ret ) {
+		ESP_LOGE(TAG,"Failed to open HTTP connection: %s", esp_err_to_name(ret));
+		esp_http_client_cleanup(client);
+		http_done(start, 1);
+		rx_buffer_put(buffer);
+		return ret;
+	}
+	content_len = esp_http_client_fetch_headers(client);
+	if ( content_len > IB_CAL_TEXT_MAX ) {
+		ESP_LOGE(TAG, "Calendar file too big: %i", content_len);
+		ret = ESP_ERR_INVALID_SIZE;
+	} else {
+		while ( total < IB_CAL_TEXT_MAX &&
+				(read_len = esp_http_client_read(client, buffer + total, IB_CAL_TEXT_MAX - total)) > 0 )
+			total += read_len;
+		ib_metric_add(IB_M_SYNC_BYTES, total);
+		ret = ib_cal_update(buffer, total, checksum);
+	}
+	esp_http_client_close(client);
+	esp_http_client_cleanup(client);
+	http_done(start, ret == ESP_ERR_INVALID_SIZE);
+	rx_buffer_put(buffer);
+	return ret;
 }
 
 /** \brief Get checksum value from server.
  *  Get the checksum file from server and copy to argument.
  *  \param checksum value from server.
+ *  \param cal_checksum second value from server, checksum of the calendars, 0 when it is missing.
  *  \return 0 Successfully downloaded.
  *  \return -1 Malloc failed
  *  \return 1 HTTP failure
  * */
-int get_checksum_from_server(uint64_t *checksum) {
-	char *buffer = malloc(HTTP_CHECKSUM_BUFFER+1);
+int get_checksum_from_server(uint64_t *checksum, uint64_t *cal_checksum) {
+	char *buffer = rx_buffer_get(HTTP_CHECKSUM_BUFFER+1);
+	char *end;
 	esp_err_t ret;
 	int content_len;
 	int read_len;
+	int64_t start = esp_timer_get_time();
 
+	*checksum = 0;
+	*cal_checksum = 0;
 	if ( !buffer ) {
-		ESP_LOGE(__func__,"Cannot malloc for receive buffer");
+		ESP_LOGE(__func__,"No memory for receive buffer");
 		return -1;
 	}
 
@@ -235,14 +355,15 @@ int get_checksum_from_server(uint64_t *checksum) {
     };
     esp_http_client_handle_t client = esp_http_client_init(&config);
     if ( !client ) {
-    	free(buffer);
+    	rx_buffer_put(buffer);
     	ESP_LOGE(TAG, "Invalid URL");
     	return 1;
     }
     ret = esp_http_client_open(client, 0);
     if ( ESP_OK != ret ) {
     	ESP_LOGE(TAG,"Failed to open HTTP connection: %s", esp_err_to_name(ret));
-    	free(buffer);
+    	http_done(start, 1);
+    	rx_buffer_put(buffer);
     	return 1;
     }
 
@@ -254,7 +375,8 @@ int get_checksum_from_server(uint64_t *checksum) {
     		ESP_LOGE(TAG, "Read HTTP stream");
     	}
     	buffer[read_len] = '\0';
-    	*checksum = strtoull(buffer, NULL, 16);
+    	*checksum = strtoull(buffer, &end, 16);
+    	*cal_checksum = strtoull(end, NULL, 16);
 		ESP_LOGD(TAG, "read_len:%d",read_len);
     	ESP_LOGD(TAG, "data:%s", buffer);
     }
@@ -267,7 +389,8 @@ int get_checksum_from_server(uint64_t *checksum) {
     }
     esp_http_client_close(client);
     esp_http_client_cleanup(client);
-    free(buffer);
+    http_done(start, ret != ESP_OK);
+    rx_buffer_put(buffer);
     return 0;
 }
 
@@ -283,6 +406,7 @@ esp_err_t post_logfile() {
 	FILE *fptr;
 	char buff[HTTP_POST_FILE_BUFFER];
 	size_t fsize = 0, buflen;
+	int64_t start = esp_timer_get_time();
 
 	fptr = fopen(FILE_LOG, "r");
 	if ( !fptr ) {
@@ -303,6 +427,7 @@ esp_err_t post_logfile() {
 	ret = esp_http_client_open(client, fsize);
 	if ( ret != ESP_OK ) {
 		esp_http_client_cleanup(client);
+		http_done(start, 1);
 		fclose(fptr);
 		return ESP_ERR_HTTP_FETCH_HEADER;
 	}
@@ -313,6 +438,7 @@ esp_err_t post_logfile() {
 		ret = fread(buff, sizeof(char), buflen, fptr);
 		if ( ret != buflen ) {
 			ESP_LOGD(__func__, "FILE read bytes remaining");
+			http_done(start, 1);
 			fclose(fptr);
 			return ESP_ERR_HTTP_WRITE_DATA;
 		}
@@ -323,40 +449,81 @@ esp_err_t post_logfile() {
 		fsize -= ret;
 		if ( ret != buflen ) {
 			ESP_LOGD(__func__, "HTTP write failed: %i bytes remaining", fsize - ret);
+			http_done(start, 1);
 			fclose(fptr);
 			return ESP_ERR_HTTP_WRITE_DATA;
 		}
+		ib_metric_add(IB_M_LOG_UPLOAD_BYTES, buflen);
 	}
 	ret = esp_http_client_get_status_code(client);
 	ESP_LOGD(__func__,"Response status code: %i", ret);
 	esp_http_client_close(client);
 	esp_http_client_cleanup(client);
+	http_done(start, 0);
 	fclose(fptr);
 	return ESP_OK;
 }
 
+/** \brief Send the metrics to the log server as a compact JSON message. */
+static void post_metrics() {
+	char *str;
+	cJSON *msg = ib_metrics_json();
+
+	if ( !msg )
+		return;
+	if ( cJSON_AddStringToObject(msg, "device", ib_get_device_name()) ) {
+		str = cJSON_PrintUnformatted(msg);
+		if ( str ) {
+			if ( ib_client_send_logmsg(str, strlen(str) + 1) )
+				ESP_LOGW(TAG, "Metrics cannot be sent");
+			ib_pool_free(str);
+		}
+	}
+	cJSON_Delete(msg);
+}
+
 /** \brief Sync task.
  * Get the current database checksum and post the logfile if exist.
  * Task can be hold by groupbit: BIT_START_UPDATING
  * */
 void update_from_server_task() {
 	uint64_t checksum_got;
+	uint64_t cal_checksum_got;
 	info_t checksums;
 	esp_err_t ret;
+	int checksum_ret;
+	uint32_t purged;
+	struct tm time_info;
+	time_t now;
+	int64_t metrics_sent = esp_timer_get_time();
     while ( 1 ) {
     	xEventGroupWaitBits(g_client_event_group, BIT_START_UPDATING,
     			pdFALSE, pdTRUE, portMAX_DELAY);
 
-    	if ( !get_checksum_from_server(&checksum_got) ) {		// Successfully connected and downloaded
+    	checksum_ret = get_checksum_from_server(&checksum_got, &cal_checksum_got);
+    	ib_pattern_set_status(IB_STATUS_OFFLINE, checksum_ret == 1);
+    	if ( !checksum_ret ) {		// Successfully connected and downloaded
 			ibd_get_checksum(&checksums);
 			if ( checksum_got != checksums.checksum_cur ) {
 				ESP_LOGI(TAG, "Start downloading csv file");
+				ib_pattern_set_status(IB_STATUS_SYNCING, 1);
 				if ( ESP_OK != save_csv_from_server(checksum_got) ) {
 					ESP_LOGI(TAG, "DSV file cannot be download.");
 				} else {
 					ESP_LOGI(TAG, "Successful download.");
 				}
+				ib_pattern_set_status(IB_STATUS_SYNCING, 0);
 			}
+			if ( cal_checksum_got && cal_checksum_got != ib_cal_checksum() ) {
+				ESP_LOGI(TAG, "Start downloading calendars");
+				if ( ESP_OK != save_calendar_from_server(cal_checksum_got) )
+					ESP_LOGI(TAG, "Calendars cannot be download.");
+			}
+    	}
+    	if ( IB_CLOCK_EVAL == ib_clock_eval(&now, &time_info) ) {
+    		ret = ibd_purge_expired(now, &purged);
+    		if ( ret != IBD_OK )
+    			ESP_LOGE(TAG, "Expired keys cannot be removed: %i", ret);
     	}
     	if ( ibd_log_check_file_exist() ) {
     		ret = post_logfile();
@@ -364,11 +531,17 @@ void update_from_server_task() {
     			ESP_LOGE(__func__,"Cannot post logfile: %s", esp_err_to_name(ret));
     		} else {
     			ibd_log_delete();
+    			ib_metric_set(IB_G_LOG_FILE, 0);
+    			ib_pattern_set_status(IB_STATUS_LOG_NEARLY_FULL, 0);
     			if ( ib_waiting_for_su_touch() ) {
     				ib_not_need_su_touch();
     			}
     		}
     	}
+    	if ( !checksum_ret && esp_timer_get_time() - metrics_sent >= IB_METRICS_UPLOAD_MS * 1000LL ) {
+    		post_metrics();
+    		metrics_sent = esp_timer_get_time();
+    	}
     	xEventGroupWaitBits(g_client_event_group, BIT_START_UPDATE_NOW,
     			pdTRUE, pdTRUE, UPDATES_PERIOD_MS / portTICK_PERIOD_MS);
     }
@@ -386,6 +559,7 @@ int ib_client_send_logmsg(char *data, size_t length) {
 		return -1;
 	//char length_str[64];
 	esp_err_t ret;
+	int64_t start = esp_timer_get_time();
 	esp_http_client_config_t config = {
 			.url = g_server_conf.log_url,
 			.event_handler = http_event_handler
@@ -401,6 +575,7 @@ int ib_client_send_logmsg(char *data, size_t length) {
 	if ( ret != ESP_OK ) {
 		ESP_LOGE(__func__, "HTTP open failed: %s", esp_err_to_name(ret));
 		esp_http_client_cleanup(client);
+		http_done(start, 1);
 		return 1;
 	}
 	//itoa(length,length_str, 10);
@@ -413,6 +588,7 @@ int ib_client_send_logmsg(char *data, size_t length) {
 	ESP_LOGD(__func__,"Response status code: %i", ret);
 	esp_http_client_close(client);
 	esp_http_client_cleanup(client);
+	http_done(start, 0);
 	return 0;
 }
 
@@ -432,10 +608,10 @@ esp_err_t ib_client_init() {
 	esp_err_t ret;
 	xEventGroupWaitBits(wifi_event_group, CONNECTED_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
 
-	g_client_event_group = xEventGroupCreate();
+	g_client_event_group = IB_EVENT_GROUP_CREATE(client_group, 0);
 
-	if ( pdPASS != xTaskCreate(&update_from_server_task, "Database update",
-			8192, NULL, 5, &g_update_handler) ) {
+	if ( pdPASS != IB_TASK_CREATE(update_task, 0, &update_from_server_task, "Database update",
+			NULL, 5, &g_update_handler) ) {
 		ESP_LOGE(TAG, "Cannot create task");
 		return 1;
 	}
@@ -530,6 +706,33 @@ static int setserver_url(int argc, char** argv) {
 	return save_servers_conf(argc, argv[1], argv[2], argv[3], argv[4]);
 }
 
+/** \brief Command callback function, saves the calendar URL to NVS. */
+static int setcalendar_url(int argc, char** argv) {
+	nvs_handle nvs;
+	esp_err_t ret;
+
+	int nerrors = arg_parse(argc, argv, (void**) &setcalendar_args);
+	if ( nerrors ) {
+		arg_print_errors(stderr, setcalendar_args.end, argv[0]);
+		return 1;
+	}
+	if ( strlen(g_server_conf.server_url) + strlen(setcalendar_args.calendar_file_path->sval[0]) > URL_MAXLEN ) {
+		printf("Too long calendar file path\n");
+		return 1;
+	}
+	strcpy(g_cal_url, g_server_conf.server_url);
+	strcat(g_cal_url, setcalendar_args.calendar_file_path->sval[0]);
+	ret = nvs_open(namespace, NVS_READWRITE, &nvs);
+	if ( ESP_OK != ret ) {
+		return ret;
+	}
+	ret = nvs_set_str(nvs, key_calendar_url, g_cal_url);
+	if ( ESP_OK == ret )
+		ret = nvs_commit(nvs);
+	nvs_close(nvs);
+	return ret;
+}
+
 /** \brief Command register function. */
 void register_setserver() {
 	setserver_args.server_URL 		  = arg_str1(NULL, NULL, "<URL>", "URL of server");
@@ -545,6 +748,17 @@ void register_setserver() {
 			.argtable = &setserver_args
 	};
 	ESP_ERROR_CHECK( esp_console_cmd_register(&setserver_cmd) );
+
+	setcalendar_args.calendar_file_path = arg_str1(NULL, NULL, "<File path>", "File path of the calendars on the server");
+	setcalendar_args.end = arg_end(0);
+	const esp_console_cmd_t setcalendar_cmd = {
+			.command = "setcalendar",
+		    .help = "Change the calendar URL",
+			.hint = NULL,
+			.func = &setcalendar_url,
+			.argtable = &setcalendar_args
+	};
+	ESP_ERROR_CHECK( esp_console_cmd_register(&setcalendar_cmd) );
 }
 
 
@@ -32,8 +32,14 @@
 #include "ib_reader.h"
 #include "ib_http_client.h"
 #include "ib_database.h"
+#include "ib_pattern.h"
+#include "ib_clock.h"
+#include "ib_tz.h"
 #include "cmd_wifi.h"
 #include  "ib_sntp.h"
+#include "ib_metrics.h"
+#include "ib_static.h"
+#include "ib_pool.h"
 
 #define TAG 			"iB_logger"
 
@@ -41,10 +47,11 @@
 
 /** \brief Deepness of log message queue. */
 #define QUEUE_DEPTH		10
+#define LOGSENDER_STACK	4096
+
+IB_QUEUE_STORAGE(log_q, QUEUE_DEPTH, sizeof(ib_log_t), 1);
+IB_TASK_STORAGE(logsender, LOGSENDER_STACK, 1);
 
-extern EventGroupHandle_t wifi_event_group;
-extern const int CONNECTED_BIT;
-extern EventGroupHandle_t ib_sntp_event_group;
 
 volatile uint8_t ib_log_initialized = 0;
 
@@ -56,7 +63,11 @@ QueueHandle_t g_queue;
  * 	Only adds a new ib_log_t type element in the queue then returns.
  * */
 void ib_log_post(ib_log_t *msg) {
-	xQueueSend(g_queue, msg, 0);
+	if ( !g_queue )		// Not initialized yet.
+		return;
+	ib_metric_inc(IB_M_LOG_POSTED);
+	if ( pdTRUE != xQueueSend(g_queue, msg, 0) )
+		ib_metric_inc(IB_M_LOG_DROPPED);
 }
 
 /** \brief Make JSON message from ib_log_t.
@@ -76,8 +87,8 @@ cJSON *create_json_msg(ib_log_t *logmsg) {
 
 	time_t time_raw;
 	struct tm time_now;
-	time(&time_raw);
-	localtime_r(&time_raw, &time_now);
+	time_raw = ib_clock_time();
+	ib_tz_localtime(time_raw, &time_now);
 
 	if ( !cJSON_AddStringToObject(logm, "device", ib_get_device_name()) ) {
 		goto end;
@@ -92,6 +103,15 @@ cJSON *create_json_msg(ib_log_t *logmsg) {
 		goto end;
 	}
 
+	if ( !cJSON_AddNumberToObject(logm, "reader", logmsg->reader) ) {
+		goto end;
+	}
+
+	if ( !strcmp(logmsg->log_type, IB_LOG_KEY_LOCKOUT_END) &&
+			!cJSON_AddNumberToObject(logm, "count", logmsg->count) ) {
+		goto end;
+	}
+
 	time_j = cJSON_CreateObject();
 	if ( !time_j ) {
 		goto end;
@@ -132,6 +152,7 @@ cJSON *create_json_msg(ib_log_t *logmsg) {
 		ESP_LOGD(__func__,"%s",string);
 	else
 		ESP_LOGD(__func__,"Failed to print log message");
+	ib_pool_free(string);
 #endif
 	if (logm)
 		return logm;
@@ -146,10 +167,15 @@ end:
  */
 void save_to_flash(char *data, size_t len) {
 	esp_err_t ret;
+	size_t size;
 	ret = ibd_log_append_file(data, &len);
 	if ( ret == IBD_ERR_CRITICAL_SIZE ) {
 		ib_need_su_touch();
 	}
+	ib_metric_inc(ret == IBD_OK ? IB_M_LOG_SAVED : IB_M_LOG_SAVE_ERRORS);
+	size = ibd_log_size();
+	ib_metric_set(IB_G_LOG_FILE, size);
+	ib_pattern_set_status(IB_STATUS_LOG_NEARLY_FULL, size > IBD_LOG_FILE_WARNING);
 }
 
 /** \brief JSON log info sender.
@@ -163,6 +189,7 @@ static void logsender_task() {
 	size_t data_len;
 	while ( 1 ) {
 		xQueueReceive(g_queue, &msg, portMAX_DELAY);
+		ib_metric_set(IB_G_LOG_QUEUE, uxQueueMessagesWaiting(g_queue));
 
 		msg_json = create_json_msg(&msg);
 		if ( msg_json ) {
@@ -176,7 +203,9 @@ static void logsender_task() {
 					save_to_flash(data_str, data_len);
 				} else {
 					ESP_LOGD(__func__,"Send JSON log msg");
+					ib_metric_inc(IB_M_LOG_SENT);
 				}
+				ib_pool_free(data_str);
 			} else {
 				ESP_LOGE(TAG, "JSON print error");
 			}
@@ -186,15 +215,15 @@ static void logsender_task() {
 	}
 }
 
-/** Wait for WiFi and SNTP. The create task, and send system up log message.
+/** Wait for a valid time (restored or SNTP). The create task, and send system up log message.
+ *  The messages are saved to flash while there is no network.
  * */
 void ib_log_init() {
 	if ( ib_log_initialized ) {
 		ESP_LOGW(TAG,"Already initialized");
 		return;
 	}
-	xEventGroupWaitBits(wifi_event_group, CONNECTED_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
-	xEventGroupWaitBits(ib_sntp_event_group, IB_TIME_SET_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+	ib_clock_wait_valid(UINT32_MAX);
 
 	ib_log_t msg = {.log_type = IB_SYSTEM_UP, .value = 0};
 
@@ -203,13 +232,13 @@ void ib_log_init() {
 		return;
 	}
 
-	g_queue = xQueueCreate(QUEUE_DEPTH, sizeof(ib_log_t));
+	g_queue = IB_QUEUE_CREATE(log_q, 0);
 	if ( !g_queue ) {
-		ESP_LOGE(TAG, "No heap memory for queue");
+		ESP_LOGE(TAG, "Cannot create queue");
 		return;
 	}
 
-	if ( xTaskCreate(&logsender_task, "Logsender", 4096, NULL, 4, NULL)
+	if ( IB_TASK_CREATE(logsender, 0, &logsender_task, "Logsender", NULL, 4, NULL)
 			!= pdPASS) {
 		ESP_LOGE(TAG, "Cannot create task");
 		return;
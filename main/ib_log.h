@@ -18,10 +18,14 @@
 /** \brief Log data to be send.
  *  Variable value can be iButton key code.
  *  Variable log_type must be a log message type.
+ *  Variable reader is the id of the reader which made the event.
+ *  Variable count is the number of the denied touches of a lockout (IB_LOG_KEY_LOCKOUT_END).
  *  */
 typedef struct ib_log {
 	uint64_t value;
 	const char *log_type;
+	uint8_t reader;
+	uint32_t count;
 } ib_log_t;
 
 /** @defgroup log_message_types
@@ -34,6 +38,15 @@ typedef struct ib_log {
 #define IB_LOG_KEY_OUT_OF_DOMAIN 		"OD"
 #define IB_SYSTEM_UP			 		"UP"
 #define IB_LOG_DATAB 			 		"DOWN"
+/** Too many invalid touches, key code is 0 for the global lockout: the misses are not logged until it ends. */
+#define IB_LOG_KEY_LOCKOUT 				"LO"
+#define IB_LOG_KEY_LOCKOUT_END 			"LE"
+/** Key touched outside of its validity range. */
+#define IB_LOG_KEY_EXPIRED 				"EX"
+/** Expired keys removed from the database, value is their number. */
+#define IB_LOG_KEY_PURGED 				"PU"
+/** Runtime metrics (ib_metrics), not a key event. */
+#define IB_LOG_STATS 					"ST"
 /** @} */
 
 #define IB_LOG_ERR_CONNECTION_LOST 100
@@ -0,0 +1,198 @@
+/**
+ * ib_metrics.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: root
+ *  @ingroup ib_metrics
+ *  @{
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "esp_attr.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_console.h"
+#include "argtable3/argtable3.h"
+
+#include "ib_metrics.h"
+#include "ib_log.h"
+
+static const char *COUNTER_NAMES[IB_M_COUNTERS_N] = {
+	"touches",
+	"decision drops",
+	"decisions abandoned",
+	"granted",
+	"denied unknown",
+	"denied schedule",
+	"denied expired",
+	"denied lockout",
+	"verdict cached",
+	"lookups",
+	"lookup misses",
+	"lookup errors",
+	"db activations",
+	"csv rejected",
+	"keys purged",
+	"log posted",
+	"log dropped",
+	"log sent",
+	"log saved",
+	"log save errors",
+	"http requests",
+	"http failures",
+	"sync bytes",
+	"log upload bytes",
+};
+
+static const char *GAUGE_NAMES[IB_G_GAUGES_N] = {
+	"log queue",
+	"log file",
+	"free heap",
+	"min free heap",
+};
+
+static const char *HISTOGRAM_NAMES[IB_H_HISTOGRAMS_N] = {
+	"lookup us",
+	"decision us",
+	"http ms",
+};
+
+static const uint32_t BUCKET_EDGES[IB_METRICS_BUCKETS - 1] = IB_METRICS_BUCKET_EDGES;
+
+static volatile uint32_t g_counters[IB_M_COUNTERS_N];
+static volatile int32_t g_gauges[IB_G_GAUGES_N];
+static volatile uint32_t g_buckets[IB_H_HISTOGRAMS_N][IB_METRICS_BUCKETS];
+static volatile uint32_t g_max[IB_H_HISTOGRAMS_N];
+/** Number of clears since the boot, it is uploaded so the server does not take a clear for a delta. */
+static volatile uint32_t g_clears;
+
+void IRAM_ATTR ib_metric_inc(ib_counter_t counter) {
+	__atomic_fetch_add(&g_counters[counter], 1, __ATOMIC_RELAXED);
+}
+
+void IRAM_ATTR ib_metric_add(ib_counter_t counter, uint32_t n) {
+	__atomic_fetch_add(&g_counters[counter], n, __ATOMIC_RELAXED);
+}
+
+void ib_metric_set(ib_gauge_t gauge, int32_t value) {
+	__atomic_store_n(&g_gauges[gauge], value, __ATOMIC_RELAXED);
+}
+
+/** \brief Add a value to a histogram. */
+void ib_metric_observe(ib_histogram_t histogram, uint32_t value) {
+	uint32_t max = g_max[histogram];
+	int b = 0;
+
+	while ( b < IB_METRICS_BUCKETS - 1 && value > BUCKET_EDGES[b] )
+		b++;
+	__atomic_fetch_add(&g_buckets[histogram][b], 1, __ATOMIC_RELAXED);
+	while ( value > max && !__atomic_compare_exchange_n(&g_max[histogram], &max, value, 1,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED) )
+		;
+}
+
+uint32_t ib_metric_counter(ib_counter_t counter) {
+	return g_counters[counter];
+}
+
+static void refresh_heap() {
+	ib_metric_set(IB_G_FREE_HEAP, esp_get_free_heap_size());
+	ib_metric_set(IB_G_MIN_FREE_HEAP, esp_get_minimum_free_heap_size());
+}
+
+/** \brief Compact JSON message of the metrics, without the device name.
+ *  \return NULL no memory
+ * */
+cJSON *ib_metrics_json() {
+	cJSON *msg = cJSON_CreateObject(), *array, *buckets;
+
+	refresh_heap();
+	if ( !msg || !cJSON_AddStringToObject(msg, "type", IB_LOG_STATS)
+			|| !cJSON_AddNumberToObject(msg, "uptime", (double)(esp_timer_get_time() / 1000000))
+			|| !cJSON_AddNumberToObject(msg, "clears", g_clears) )
+		goto error;
+	if ( !(array = cJSON_CreateArray()) )
+		goto error;
+	cJSON_AddItemToObject(msg, "c", array);
+	for ( int i = 0; i < IB_M_COUNTERS_N; i++ )
+		cJSON_AddItemToArray(array, cJSON_CreateNumber(g_counters[i]));
+	if ( !(array = cJSON_CreateArray()) )
+		goto error;
+	cJSON_AddItemToObject(msg, "g", array);
+	for ( int i = 0; i < IB_G_GAUGES_N; i++ )
+		cJSON_AddItemToArray(array, cJSON_CreateNumber(g_gauges[i]));
+	if ( !(array = cJSON_CreateArray()) )
+		goto error;
+	cJSON_AddItemToObject(msg, "h", array);
+	for ( int h = 0; h < IB_H_HISTOGRAMS_N; h++ ) {
+		if ( !(buckets = cJSON_CreateArray()) )
+			goto error;
+		cJSON_AddItemToArray(array, buckets);
+		for ( int b = 0; b < IB_METRICS_BUCKETS; b++ )
+			cJSON_AddItemToArray(buckets, cJSON_CreateNumber(g_buckets[h][b]));
+	}
+	return msg;
+error:
+	cJSON_Delete(msg);
+	return NULL;
+}
+
+/** \brief Clear the counters and the histograms, the gauges are kept.
+ *  The next upload carries the new clear count. */
+void ib_metrics_clear() {
+	memset((void*)g_counters, 0, sizeof(g_counters));
+	memset((void*)g_buckets, 0, sizeof(g_buckets));
+	memset((void*)g_max, 0, sizeof(g_max));
+	g_clears++;
+}
+
+static struct {
+	struct arg_lit *clear;
+	struct arg_end *end;
+} stats_args;
+
+/** \brief Prints the metrics. */
+static int stats_cmd(int argc, char **argv) {
+	int nerrors = arg_parse(argc, argv, (void**) &stats_args);
+	if ( nerrors ) {
+		arg_print_errors(stderr, stats_args.end, argv[0]);
+		return 1;
+	}
+	if ( stats_args.clear->count ) {
+		ib_metrics_clear();
+		return 0;
+	}
+	refresh_heap();
+	printf("uptime %lld s, %u clears\n", esp_timer_get_time() / 1000000, g_clears);
+	for ( int i = 0; i < IB_M_COUNTERS_N; i++ )
+		printf("%-18s %10u\n", COUNTER_NAMES[i], g_counters[i]);
+	for ( int i = 0; i < IB_G_GAUGES_N; i++ )
+		printf("%-18s %10i\n", GAUGE_NAMES[i], g_gauges[i]);
+	printf("%-12s", "");
+	for ( int b = 0; b < IB_METRICS_BUCKETS - 1; b++ )
+		printf(" <=%-6u", BUCKET_EDGES[b]);
+	printf(" %-8s %8s\n", ">", "max");
+	for ( int h = 0; h < IB_H_HISTOGRAMS_N; h++ ) {
+		printf("%-12s", HISTOGRAM_NAMES[h]);
+		for ( int b = 0; b < IB_METRICS_BUCKETS; b++ )
+			printf(" %8u", g_buckets[h][b]);
+		printf(" %8u\n", g_max[h]);
+	}
+	return 0;
+}
+
+/** \brief Command register function. */
+void register_stats() {
+	stats_args.clear = arg_lit0("c", "clear", "Clear the counters and the histograms");
+	stats_args.end = arg_end(0);
+	const esp_console_cmd_t stats_cmd_def = {
+			.command = "stats",
+			.help = "Counters, gauges and histograms of the runtime",
+			.hint = NULL,
+			.func = &stats_cmd,
+			.argtable = &stats_args
+	};
+	ESP_ERROR_CHECK( esp_console_cmd_register(&stats_cmd_def) );
+}
+/** @} */
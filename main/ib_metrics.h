@@ -0,0 +1,96 @@
+/**
+ * @defgroup ib_metrics
+ * @{
+ *
+ * ib_metrics.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: root
+ *
+ * Runtime metrics registry.
+ *
+ * Counters, gauges and histograms with fixed buckets in static memory. Updating a metric is an atomic operation
+ * without a lock, it can be called from any task. The histogram buckets are the same for all histograms,
+ * IB_METRICS_BUCKET_EDGES upper limits and an overflow bucket, the unit is given by the name of the histogram.
+ *
+ * The 'stats' console command prints the metrics. The sync task (ib_http_client) uploads them to the log server
+ * every IB_METRICS_UPLOAD_MS as a compact JSON message of type IB_LOG_STATS, the values are arrays in the order
+ * of the enums:
+ * \code
+ * {"type":"ST","uptime":3600,"clears":0,"c":[12,0,...],"g":[0,1024,...],"h":[[3,9,0,...],...],"device":"name"}
+ * \endcode
+ * The counters are never cleared by the upload, the server computes the differences. A smaller uptime shows
+ * a reboot, a new "clears" (number of 'stats -c' since the boot) shows a clear, the server starts again
+ * from the values of that message in both cases.
+ */
+
+#ifndef MAIN_IB_METRICS_H_
+#define MAIN_IB_METRICS_H_
+
+#include <stdint.h>
+#include "cJSON.h"
+
+/** \brief Upload period of the metrics. */
+#define IB_METRICS_UPLOAD_MS 	(5 * 60 * 1000)
+/** \brief Histogram buckets: upper limits and the overflow bucket. */
+#define IB_METRICS_BUCKET_EDGES { 100, 300, 1000, 3000, 10000, 30000, 100000, 300000 }
+#define IB_METRICS_BUCKETS 		9
+
+/** \brief Counters. */
+typedef enum ib_counter {
+	IB_M_TOUCHES,			/**< Codes handed to the decision worker. */
+	IB_M_DECISION_DROPS,	/**< Decision queue full, touch dropped. */
+	IB_M_DECISION_ABANDONED,	/**< No verdict until DECISION_ABANDON_MS, touch dropped. */
+	IB_M_GRANTED,
+	IB_M_DENIED_UNKNOWN,	/**< Key is not in the database. */
+	IB_M_DENIED_SCHEDULE,	/**< Out of the time domains or by the clock policy. */
+	IB_M_DENIED_EXPIRED,	/**< Outside of the validity range. */
+	IB_M_DENIED_LOCKOUT,	/**< Locked out by ib_throttle. */
+	IB_M_VERDICT_CACHED,	/**< Verdict from the schedule cache, without lookup. */
+	IB_M_LOOKUPS,			/**< ibd_get_by_code() calls. */
+	IB_M_LOOKUP_MISSES,
+	IB_M_LOOKUP_ERRORS,
+	IB_M_DB_ACTIVATIONS,	/**< New database activated. */
+	IB_M_CSV_REJECTED,		/**< Invalid CSV lines. */
+	IB_M_KEYS_PURGED,
+	IB_M_LOG_POSTED,		/**< Log messages posted to the queue. */
+	IB_M_LOG_DROPPED,		/**< Log queue full, message lost. */
+	IB_M_LOG_SENT,
+	IB_M_LOG_SAVED,			/**< Saved to the log file, they could not be sent. */
+	IB_M_LOG_SAVE_ERRORS,
+	IB_M_HTTP_REQUESTS,
+	IB_M_HTTP_FAILURES,
+	IB_M_SYNC_BYTES,		/**< Downloaded database and calendar bytes. */
+	IB_M_LOG_UPLOAD_BYTES,	/**< Uploaded log file bytes. */
+	IB_M_COUNTERS_N
+} ib_counter_t;
+
+/** \brief Gauges. */
+typedef enum ib_gauge {
+	IB_G_LOG_QUEUE,			/**< Messages waiting in the log queue. */
+	IB_G_LOG_FILE,			/**< Bytes of the log file. */
+	IB_G_FREE_HEAP,			/**< Refreshed when the metrics are printed or uploaded. */
+	IB_G_MIN_FREE_HEAP,
+	IB_G_GAUGES_N
+} ib_gauge_t;
+
+/** \brief Histograms. */
+typedef enum ib_histogram {
+	IB_H_LOOKUP_US,			/**< ibd_get_by_code(). */
+	IB_H_DECISION_US,		/**< Lookup and schedule of a touch. */
+	IB_H_HTTP_MS,			/**< HTTP requests of the sync task. */
+	IB_H_HISTOGRAMS_N
+} ib_histogram_t;
+
+void ib_metric_inc(ib_counter_t counter);
+void ib_metric_add(ib_counter_t counter, uint32_t n);
+void ib_metric_set(ib_gauge_t gauge, int32_t value);
+void ib_metric_observe(ib_histogram_t histogram, uint32_t value);
+
+uint32_t ib_metric_counter(ib_counter_t counter);
+cJSON *ib_metrics_json();
+void ib_metrics_clear();
+void register_stats();
+
+#endif /* MAIN_IB_METRICS_H_ */
+/** @} */
@@ -0,0 +1,390 @@
+/**
+ * ib_onewire.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: root
+ *  @ingroup ib_onewire
+ *  @{
+ *
+ *  Slot timings are in us, the standard and the overdrive speed tables are below.
+ *  A slot is started by ow_engine_step() and it ends with an alarm request,
+ *  so the recovery time between the slots is spent in the alarm.
+ *
+ *  A transaction is made of phases after the presence pulse:
+ *   - OVERDRIVE: OVERDRIVE SKIP ROM command, then an overdrive reset,
+ *   - COMMAND: the ROM command byte,
+ *   - ROM: 64 read slots (READ ROM),
+ *   - SEARCH: 64 x (read bit, read complement, write direction) slots (SEARCH ROM).
+ */
+
+#include <string.h>
+#include "ib_onewire.h"
+
+/** \brief Line check before the reset, speed independent. */
+#define OW_T_LINE_CHECK 	100
+
+/** \brief Standard speed timings. */
+static OW_DATA_ATTR const ow_timing_t OW_STANDARD = {
+	.reset = 480,
+	.presence = 70,
+	.presence_end = 410,
+	.write1_low = 5,
+	.write1_rest = 80,
+	.write0_low = 80,
+	.write0_rest = 5,
+	.read_low = 5,
+	.read_sample = 10,
+	.read_rest = 45,
+};
+
+/** \brief Overdrive speed timings, rounded up to 1 us.
+ *  The interrupt latency of the alarm is about as long as these slots, they are busy waits.
+ * */
+static OW_DATA_ATTR const ow_timing_t OW_OVERDRIVE = {
+	.reset = 70,
+	.presence = 8,
+	.presence_end = 40,
+	.write1_low = 1,
+	.write1_rest = 8,
+	.write0_low = 8,
+	.write0_rest = 3,
+	.read_low = 1,
+	.read_sample = 1,
+	.read_rest = 7,
+	.busy_wait = 1,
+};
+
+/** \brief Number of bits of the command byte and of the ROM. */
+#define OW_CMD_BITS 		8
+#define OW_ROM_BITS 		(OW_ROM_SIZE * 8)
+
+/** \brief Engine states. It tells what must be done when the alarm expires. */
+typedef enum ow_state {
+	OW_ST_IDLE,
+	OW_ST_LINE_CHECK,
+	OW_ST_RESET_LOW,
+	OW_ST_PRESENCE,
+	OW_ST_PRESENCE_END,
+	OW_ST_SLOT,
+	OW_ST_WRITE0_END,
+} ow_state_t;
+
+/** \brief Transaction phases after the presence pulse. */
+typedef enum ow_phase {
+	OW_PH_OVERDRIVE,
+	OW_PH_COMMAND,
+	OW_PH_ROM,
+	OW_PH_SEARCH,
+} ow_phase_t;
+
+#define BUS_PULL(e) 		((e)->bus->pull((e)->bus->ctx))
+#define BUS_RELEASE(e) 		((e)->bus->release((e)->bus->ctx))
+#define BUS_LEVEL(e) 		((e)->bus->level((e)->bus->ctx))
+#define BUS_DELAY(e, us) 	((e)->bus->delay_us((e)->bus->ctx, (us)))
+#define BUS_ALARM(e, us) 	((e)->bus->alarm_us((e)->bus->ctx, (us)))
+#define BUS_ENTER(e) 		do { if ( (e)->bus->enter ) (e)->bus->enter((e)->bus->ctx); } while (0)
+#define BUS_EXIT(e) 		do { if ( (e)->bus->exit ) (e)->bus->exit((e)->bus->ctx); } while (0)
+
+#define ROM_BIT(rom, n) 	(((rom)[(n) >> 3] >> ((n) & 0x07)) & 0x01)
+
+/** \brief Transaction ended, notify the owner. */
+static void OW_ISR_ATTR finish(ow_engine_t *e, uint8_t status) {
+	e->status = status;
+	e->state = OW_ST_IDLE;
+	e->busy = 0;
+	if ( e->done )
+		e->done(e, e->done_arg);
+}
+
+/** \brief Presence pulse sampled, wait for the end of its window. */
+static void OW_ISR_ATTR presence_sampled(ow_engine_t *e, int level) {
+	e->status = level ? OW_NO_PRESENCE : OW_OK;
+	if ( e->status == OW_OK && e->bus->presence )
+		e->bus->presence(e->bus->ctx);
+	e->state = OW_ST_PRESENCE_END;
+	BUS_ALARM(e, e->timing->presence_end);
+}
+
+static void OW_ISR_ATTR start_reset(ow_engine_t *e) {
+	int level;
+
+	if ( e->timing->busy_wait ) {
+		BUS_ENTER(e);
+		BUS_PULL(e);
+		BUS_DELAY(e, e->timing->reset);
+		BUS_RELEASE(e);
+		BUS_DELAY(e, e->timing->presence);
+		level = BUS_LEVEL(e);
+		BUS_EXIT(e);
+		presence_sampled(e, level);
+		return;
+	}
+	BUS_PULL(e);
+	e->state = OW_ST_RESET_LOW;
+	BUS_ALARM(e, e->timing->reset);
+}
+
+static void OW_ISR_ATTR write_slot(ow_engine_t *e, int bit) {
+	if ( bit ) {
+		BUS_ENTER(e);
+		BUS_PULL(e);
+		BUS_DELAY(e, e->timing->write1_low);
+		BUS_RELEASE(e);
+		BUS_EXIT(e);
+		e->state = OW_ST_SLOT;
+		BUS_ALARM(e, e->timing->write1_rest);
+	} else if ( e->timing->busy_wait ) {
+		BUS_ENTER(e);
+		BUS_PULL(e);
+		BUS_DELAY(e, e->timing->write0_low);
+		BUS_RELEASE(e);
+		BUS_EXIT(e);
+		e->state = OW_ST_SLOT;
+		BUS_ALARM(e, e->timing->write0_rest);
+	} else {
+		BUS_PULL(e);
+		e->state = OW_ST_WRITE0_END;
+		BUS_ALARM(e, e->timing->write0_low);
+	}
+}
+
+/** \brief Read slot, the sample is taken before the alarm of the recovery time. */
+static int OW_ISR_ATTR read_slot(ow_engine_t *e) {
+	int level;
+	BUS_ENTER(e);
+	BUS_PULL(e);
+	BUS_DELAY(e, e->timing->read_low);
+	BUS_RELEASE(e);
+	BUS_DELAY(e, e->timing->read_sample);
+	level = BUS_LEVEL(e);
+	BUS_EXIT(e);
+	e->state = OW_ST_SLOT;
+	BUS_ALARM(e, e->timing->read_rest);
+	return level;
+}
+
+/** \brief A search pass found a device. Start the next pass or finish. */
+static void OW_ISR_ATTR search_pass_end(ow_engine_t *e) {
+	memcpy(e->roms[e->found++], e->rom, OW_ROM_SIZE);
+	e->last_discrepancy = e->last_zero;
+	if ( !e->last_discrepancy || e->found >= OW_SEARCH_MAX ) {
+		finish(e, OW_OK);
+		return;
+	}
+	e->last_zero = 0;
+	start_reset(e);
+}
+
+/** \brief Next slot of a search pass.
+ *  Every ROM bit takes three slots: the bit, its complement, and the direction.
+ *  Devices with a different bit than the direction leave the search.
+ *  When both the bit and the complement are 0 there is a discrepancy:
+ *  below the last discrepancy the previous path is followed, at it 1 is taken,
+ *  above it 0 is taken and remembered as the last zero.
+ * */
+static void OW_ISR_ATTR search_slot(ow_engine_t *e) {
+	const uint8_t n = e->bit + 1;	// Bit number from 1, 0 means no discrepancy.
+	int dir;
+
+	if ( e->bit >= OW_ROM_BITS ) {
+		search_pass_end(e);
+		return;
+	}
+	switch ( e->search_slot ) {
+		case 0:
+			e->id_bit = read_slot(e);
+			e->search_slot = 1;
+			break;
+		case 1:
+			e->cmp_bit = read_slot(e);
+			e->search_slot = 2;
+			break;
+		default:
+			if ( e->id_bit && e->cmp_bit ) {	// Nobody answered, devices left the bus.
+				finish(e, e->found ? OW_OK : OW_NO_PRESENCE);
+				return;
+			}
+			if ( e->id_bit != e->cmp_bit ) {
+				dir = e->id_bit;
+			} else {
+				if ( n < e->last_discrepancy )
+					dir = ROM_BIT(e->rom, e->bit);
+				else
+					dir = (n == e->last_discrepancy);
+				if ( !dir )
+					e->last_zero = n;
+			}
+			if ( dir )
+				e->rom[e->bit >> 3] |= (1 << (e->bit & 0x07));
+			else
+				e->rom[e->bit >> 3] &= ~(1 << (e->bit & 0x07));
+			write_slot(e, dir);
+			e->bit++;
+			e->search_slot = 0;
+			break;
+	}
+}
+
+/** \brief Start the next time slot of the current phase. */
+static void OW_ISR_ATTR next_slot(ow_engine_t *e) {
+	switch ( e->phase ) {
+		case OW_PH_OVERDRIVE:
+			if ( e->bit < OW_CMD_BITS ) {
+				write_slot(e, (OW_CMD_OVERDRIVE_SKIP >> e->bit++) & 0x01);
+				return;
+			}
+			e->timing = &OW_OVERDRIVE;
+			start_reset(e);
+			return;
+		case OW_PH_COMMAND:
+			if ( e->bit < OW_CMD_BITS ) {
+				write_slot(e, (e->command >> e->bit++) & 0x01);
+				return;
+			}
+			e->bit = 0;
+			e->search_slot = 0;
+			e->phase = (e->command == OW_CMD_SEARCH_ROM) ? OW_PH_SEARCH : OW_PH_ROM;
+			next_slot(e);
+			return;
+		case OW_PH_ROM:
+			if ( e->bit < OW_ROM_BITS ) {
+				if ( read_slot(e) )
+					e->rom[e->bit >> 3] |= (1 << (e->bit & 0x07));
+				e->bit++;
+				return;
+			}
+			finish(e, OW_OK);
+			return;
+		case OW_PH_SEARCH:
+			search_slot(e);
+			return;
+		default:
+			return;
+	}
+}
+
+/** \brief Presence pulse window ended. Select the first phase. */
+static void OW_ISR_ATTR presence_end(ow_engine_t *e) {
+	if ( e->status != OW_OK ) {
+		if ( e->timing == &OW_OVERDRIVE && !e->found ) {
+			// No overdrive device. Standard reset brings every device back to standard speed.
+			e->overdrive_try = 0;
+			e->timing = &OW_STANDARD;
+			start_reset(e);
+			return;
+		}
+		finish(e, e->found ? OW_OK : OW_NO_PRESENCE);
+		return;
+	}
+	e->bit = 0;
+	e->phase = (e->overdrive_try && e->timing != &OW_OVERDRIVE) ? OW_PH_OVERDRIVE : OW_PH_COMMAND;
+	next_slot(e);
+}
+
+/** \brief Start a transaction with the given ROM command. */
+static int start(ow_engine_t *e, uint8_t command) {
+	if ( e->busy )
+		return 1;
+	e->busy = 1;
+	e->command = command;
+	e->timing = &OW_STANDARD;
+	e->overdrive_try = e->overdrive;
+	e->bit = 0;
+	e->found = 0;
+	e->last_discrepancy = 0;
+	e->last_zero = 0;
+	memset(e->rom, 0, sizeof(e->rom));
+	if ( !BUS_LEVEL(e) ) {		// Pulled down to GND: reader is shorted.
+		finish(e, OW_SHORT);
+		return 0;
+	}
+	e->state = OW_ST_LINE_CHECK;
+	BUS_ALARM(e, OW_T_LINE_CHECK);
+	return 0;
+}
+
+/** \brief Initialize an engine.
+ *  \param bus backend of the line
+ *  \param done called when a transaction finished
+ *  \param arg passed to done
+ * */
+void ow_engine_init(ow_engine_t *engine, const ow_backend_t *bus, ow_done_cb done, void *arg) {
+	memset(engine, 0, sizeof(*engine));
+	engine->bus = bus;
+	engine->done = done;
+	engine->done_arg = arg;
+	engine->timing = &OW_STANDARD;
+	engine->state = OW_ST_IDLE;
+}
+
+/** \brief Use overdrive speed in the next transactions.
+ *  Only for buses where every device supports overdrive:
+ *  the other devices do not answer the overdrive reset.
+ * */
+void ow_engine_set_overdrive(ow_engine_t *engine, int enable) {
+	engine->overdrive = enable ? 1 : 0;
+}
+
+/** \brief Was the last transaction done in overdrive speed? */
+int ow_engine_overdrive_used(ow_engine_t *engine) {
+	return engine->timing == &OW_OVERDRIVE;
+}
+
+/** \brief Start a reset - presence - READ ROM transaction.
+ *  Returns immediately, the result is given by the done callback:
+ *  status is OW_OK and rom holds the raw ROM data (not checked),
+ *  or status is OW_NO_PRESENCE or OW_SHORT.
+ *  \return 0 transaction started
+ *  \return 1 engine is busy
+ * */
+int ow_read_rom_start(ow_engine_t *engine) {
+	return start(engine, OW_CMD_READ_ROM);
+}
+
+/** \brief Start enumerating the devices with SEARCH ROM.
+ *  Returns immediately, the result is given by the done callback:
+ *  status is OW_OK, found is the number of devices and roms holds their raw ROM data (not checked),
+ *  or status is OW_NO_PRESENCE or OW_SHORT.
+ *  \return 0 search started
+ *  \return 1 engine is busy
+ * */
+int ow_search_start(ow_engine_t *engine) {
+	return start(engine, OW_CMD_SEARCH_ROM);
+}
+
+/** \brief Perform the next step of the transaction.
+ *  Must be called by the backend when the requested alarm expires.
+ * */
+void OW_ISR_ATTR ow_engine_step(ow_engine_t *engine) {
+	switch ( engine->state ) {
+		case OW_ST_LINE_CHECK:
+			if ( !BUS_LEVEL(engine) ) {		// Input is still pulled down: reader is shorted.
+				finish(engine, OW_SHORT);
+				break;
+			}
+			start_reset(engine);
+			break;
+		case OW_ST_RESET_LOW:
+			BUS_RELEASE(engine);
+			engine->state = OW_ST_PRESENCE;
+			BUS_ALARM(engine, engine->timing->presence);
+			break;
+		case OW_ST_PRESENCE:
+			presence_sampled(engine, BUS_LEVEL(engine));
+			break;
+		case OW_ST_PRESENCE_END:
+			presence_end(engine);
+			break;
+		case OW_ST_WRITE0_END:
+			BUS_RELEASE(engine);
+			engine->state = OW_ST_SLOT;
+			BUS_ALARM(engine, engine->timing->write0_rest);
+			break;
+		case OW_ST_SLOT:
+			next_slot(engine);
+			break;
+		default:
+			break;
+	}
+}
+/** @} */
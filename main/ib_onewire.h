@@ -0,0 +1,151 @@
+/**
+ * @defgroup ib_onewire
+ * @{
+ * ib_onewire.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: root
+ *
+ * Non-blocking 1-Wire transaction engine.
+ *
+ * The engine is a state machine which performs one bus transaction
+ * (reset, presence detect, command byte, ROM read) as a chain of short steps.
+ * Every step drives or samples the line and then asks the backend for an alarm,
+ * the next step runs when that alarm expires. Only the time critical part of a
+ * read slot (max. 15 us) is done with a busy wait, the long parts of the slots
+ * (reset pulse, recovery time) never block the CPU.
+ * In overdrive speed the slots are as short as the interrupt latency, so the reset, the presence
+ * sample and the low part of every slot are busy waits (max. 78 us), only the recovery times are alarms.
+ *
+ * Transactions:
+ *  - READ ROM: the ROM of the only device on the bus,
+ *  - SEARCH ROM: enumerates all the devices on the bus (max. OW_SEARCH_MAX) in one call,
+ *    it runs the search passes with discrepancy tracking until the last device.
+ *
+ * Both can run in overdrive speed (ow_engine_set_overdrive()). Then the devices are switched
+ * with OVERDRIVE SKIP ROM and the transaction is done with the overdrive timings.
+ * When no device answers the overdrive reset, the transaction is repeated in standard speed.
+ *
+ * The engine does not know anything about the hardware. A backend (ow_backend_t)
+ * gives the line operations and the alarm, so the same engine runs with the GPIO
+ * and hardware timer backend (ibutton.c) or with a simulated bus.
+ */
+
+#ifndef MAIN_IB_ONEWIRE_H_
+#define MAIN_IB_ONEWIRE_H_
+
+#include <stdint.h>
+
+/** \brief Engine functions run from the alarm interrupt, keep them in IRAM on the target. */
+#ifdef ESP_PLATFORM
+#include "esp_attr.h"
+#define OW_ISR_ATTR IRAM_ATTR
+#define OW_DATA_ATTR DRAM_ATTR
+#else
+#define OW_ISR_ATTR
+#define OW_DATA_ATTR
+#endif
+
+/** \brief ROM size of a 1-Wire device in bytes. */
+#define OW_ROM_SIZE 		8
+
+/** \brief Maximum number of devices found by a search. */
+#define OW_SEARCH_MAX 		4
+
+/** \brief 1-Wire ROM commands. */
+#define OW_CMD_READ_ROM 		0x33
+#define OW_CMD_SEARCH_ROM 		0xF0
+#define OW_CMD_OVERDRIVE_SKIP 	0x3C
+
+/** @defgroup ow_status Transaction results
+ * @{ */
+#define OW_OK 				0
+/** No presence pulse after reset. */
+#define OW_NO_PRESENCE 		1
+/** Line was low before the reset pulse. */
+#define OW_SHORT 			2
+/** @} */
+
+/** \brief Bus backend.
+ *  - pull: drive the line low,
+ *  - release: let the pull-up resistor lift the line,
+ *  - level: sample the line,
+ *  - delay_us: busy wait, used only inside a slot (max. 15 us, 78 us for the overdrive reset),
+ *  - alarm_us: call ow_engine_step() once after the given time,
+ *  - presence: optional, called when a presence pulse is detected.
+ *
+ *  - enter, exit: optional, disable and enable the interrupts around the busy waits of a slot,
+ *  so an other interrupt cannot stretch them.
+ *
+ *  All functions can be called from interrupt context.
+ * */
+typedef struct ow_backend {
+	void (*pull)(void *ctx);
+	void (*release)(void *ctx);
+	int (*level)(void *ctx);
+	void (*delay_us)(void *ctx, uint32_t us);
+	void (*alarm_us)(void *ctx, uint32_t us);
+	void (*presence)(void *ctx);
+	void (*enter)(void *ctx);
+	void (*exit)(void *ctx);
+	void *ctx;
+} ow_backend_t;
+
+struct ow_engine;
+
+/** \brief Called when a transaction finished. Can be called from interrupt context. */
+typedef void (*ow_done_cb)(struct ow_engine *engine, void *arg);
+
+/** \brief Slot timings in us. */
+typedef struct ow_timing {
+	uint16_t reset;
+	uint16_t presence;
+	uint16_t presence_end;
+	uint8_t write1_low;
+	uint8_t write1_rest;
+	uint8_t write0_low;
+	uint8_t write0_rest;
+	uint8_t read_low;
+	uint8_t read_sample;
+	uint8_t read_rest;
+	/** Reset, presence sample and the low part of the slots are busy waits, an alarm would be late. */
+	uint8_t busy_wait;
+} ow_timing_t;
+
+/** \brief Engine object. Every bus needs its own one.
+ *  After a READ ROM the result is in rom.
+ *  After a SEARCH ROM the results are in roms, the number of devices is found.
+ * */
+typedef struct ow_engine {
+	const ow_backend_t *bus;
+	ow_done_cb done;
+	void *done_arg;
+	volatile int busy;
+	const ow_timing_t *timing;
+	uint8_t overdrive;
+	uint8_t overdrive_try;
+	uint8_t state;
+	uint8_t phase;
+	uint8_t command;
+	uint8_t bit;
+	uint8_t status;
+	uint8_t rom[OW_ROM_SIZE];
+	/** Search state. */
+	uint8_t search_slot;
+	uint8_t id_bit;
+	uint8_t cmp_bit;
+	uint8_t last_discrepancy;
+	uint8_t last_zero;
+	uint8_t found;
+	uint8_t roms[OW_SEARCH_MAX][OW_ROM_SIZE];
+} ow_engine_t;
+
+void ow_engine_init(ow_engine_t *engine, const ow_backend_t *bus, ow_done_cb done, void *arg);
+void ow_engine_set_overdrive(ow_engine_t *engine, int enable);
+int ow_engine_overdrive_used(ow_engine_t *engine);
+int ow_read_rom_start(ow_engine_t *engine);
+int ow_search_start(ow_engine_t *engine);
+void ow_engine_step(ow_engine_t *engine);
+
+#endif /* MAIN_IB_ONEWIRE_H_ */
+/** @} */
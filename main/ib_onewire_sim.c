@@ -0,0 +1,343 @@
+/**
+ * ib_onewire_sim.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: root
+ *  @ingroup ib_onewire_sim
+ *  @{
+ *
+ *  The slaves follow the master edges:
+ *   - a release after a long low pulse is a reset, slaves schedule their presence pulse,
+ *   - the length of the following 8 low pulses gives the command byte,
+ *   - after READ ROM every falling edge starts a read slot, the slave holds the line low when its bit is 0,
+ *   - after SEARCH ROM the slave sends every bit and its complement, then reads the direction,
+ *     it leaves the search when the direction differs from its bit,
+ *   - after OVERDRIVE SKIP ROM an overdrive capable slave uses the overdrive timings
+ *     until the next standard reset.
+ */
+
+#include <string.h>
+#include "ib_onewire_sim.h"
+
+/** @defgroup ow_sim_timings Slave timings in us
+ * @{ */
+/** Shorter low pulses are write slots, longer ones are resets. */
+#define SLAVE_RESET_MIN 		300
+/** Write 1 low time is shorter than this. */
+#define SLAVE_WRITE1_MAX 		15
+/** Slave holds the line low in a read 0 slot. */
+#define SLAVE_READ0_LOW 		30
+#define SLAVE_PRESENCE_WAIT 	30
+#define SLAVE_PRESENCE_LEN 		120
+/** Overdrive timings. */
+#define SLAVE_OD_RESET_MIN 		48
+#define SLAVE_OD_WRITE1_MAX 	3
+#define SLAVE_OD_READ0_LOW 		3
+#define SLAVE_OD_PRESENCE_WAIT 	2
+#define SLAVE_OD_PRESENCE_LEN 	8
+/** @} */
+
+/** \brief Slave states. */
+enum {
+	SLAVE_IDLE,
+	SLAVE_COMMAND,
+	SLAVE_ROM,
+	SLAVE_SEARCH,
+};
+
+/** \brief Random number for the faults (LCG). */
+static uint32_t sim_rand(ow_sim_t *sim) {
+	sim->seed = sim->seed * 1103515245 + 12345;
+	return (sim->seed >> 8);
+}
+
+static void record(ow_sim_t *sim, uint64_t t, uint8_t source, uint8_t level) {
+	if ( sim->wave_len >= OW_SIM_WAVE_SIZE )
+		return;
+	sim->wave[sim->wave_len].t_us = (uint32_t)t;
+	sim->wave[sim->wave_len].source = source;
+	sim->wave[sim->wave_len].level = level;
+	sim->wave_len++;
+}
+
+/** \brief Slave holds the line low in [from, until). */
+static void slave_drive(ow_sim_t *sim, ow_sim_slave_t *slave, uint64_t from, uint64_t until) {
+	slave->low_from = from;
+	slave->low_until = until;
+	record(sim, from, OW_SIM_SRC_SLAVE, 0);
+	record(sim, until, OW_SIM_SRC_SLAVE, 1);
+}
+
+static int slave_rom_bit(ow_sim_slave_t *slave) {
+	return (slave->rom[slave->bit >> 3] >> (slave->bit & 0x07)) & 0x01;
+}
+
+/** \brief Master pulled the line down. Starts a read slot in ROM and SEARCH state. */
+static void slaves_falling_edge(ow_sim_t *sim) {
+	ow_sim_slave_t *slave;
+	int bit;
+	for ( int i = 0; i < sim->slaves_n; i++ ) {
+		slave = &sim->slaves[i];
+		if ( slave->state == SLAVE_ROM ) {
+			bit = slave_rom_bit(slave);
+			if ( ++slave->bit >= OW_ROM_SIZE * 8 )
+				slave->state = SLAVE_IDLE;
+		} else if ( slave->state == SLAVE_SEARCH && slave->search_slot < 2 ) {
+			bit = slave_rom_bit(slave) ^ slave->search_slot;	// Bit, then its complement.
+		} else {
+			continue;
+		}
+		if ( !bit )
+			slave_drive(sim, slave, sim->now_us,
+					sim->now_us + (slave->overdrive ? SLAVE_OD_READ0_LOW : SLAVE_READ0_LOW));
+	}
+}
+
+/** \brief Command byte received. */
+static void slave_command(ow_sim_t *sim, ow_sim_slave_t *slave) {
+	slave->bit = 0;
+	slave->search_slot = 0;
+	switch ( slave->command ) {
+		case OW_CMD_READ_ROM:
+			slave->state = SLAVE_ROM;
+			break;
+		case OW_CMD_SEARCH_ROM:
+			slave->state = SLAVE_SEARCH;
+			break;
+		case OW_CMD_OVERDRIVE_SKIP:
+			slave->overdrive = sim->overdrive;
+			slave->state = SLAVE_IDLE;
+			break;
+		default:
+			slave->state = SLAVE_IDLE;
+			break;
+	}
+}
+
+/** \brief Direction slot of the search. */
+static void slave_search_write(ow_sim_slave_t *slave, int dir) {
+	slave->search_slot = 0;
+	if ( dir != slave_rom_bit(slave) ) {
+		slave->state = SLAVE_IDLE;
+		return;
+	}
+	if ( ++slave->bit >= OW_ROM_SIZE * 8 )
+		slave->state = SLAVE_IDLE;
+}
+
+/** \brief Master released the line. Decodes resets and write slots.
+ *  A slow rising edge makes the low pulse longer for the slaves.
+ * */
+static void slaves_rising_edge(ow_sim_t *sim) {
+	ow_sim_slave_t *slave;
+	uint64_t low_time = sim->now_us - sim->master_low_from + sim->rise_us;
+	int write1;
+	for ( int i = 0; i < sim->slaves_n; i++ ) {
+		slave = &sim->slaves[i];
+		if ( low_time >= SLAVE_RESET_MIN ) {
+			slave->overdrive = 0;
+			slave->state = SLAVE_COMMAND;
+			slave->command = 0;
+			slave->bit = 0;
+			slave_drive(sim, slave, sim->now_us + sim->presence_wait_us,
+					sim->now_us + sim->presence_wait_us + sim->presence_len_us);
+			continue;
+		}
+		if ( slave->overdrive && low_time >= SLAVE_OD_RESET_MIN ) {
+			slave->state = SLAVE_COMMAND;
+			slave->command = 0;
+			slave->bit = 0;
+			slave_drive(sim, slave, sim->now_us + SLAVE_OD_PRESENCE_WAIT,
+					sim->now_us + SLAVE_OD_PRESENCE_WAIT + SLAVE_OD_PRESENCE_LEN);
+			continue;
+		}
+		write1 = low_time < (slave->overdrive ? SLAVE_OD_WRITE1_MAX : SLAVE_WRITE1_MAX);
+		switch ( slave->state ) {
+			case SLAVE_COMMAND:
+				if ( write1 )
+					slave->command |= (1 << slave->bit);
+				if ( ++slave->bit >= 8 )
+					slave_command(sim, slave);
+				break;
+			case SLAVE_SEARCH:
+				if ( slave->search_slot < 2 )
+					slave->search_slot++;		// End of a read slot.
+				else
+					slave_search_write(slave, write1);
+				break;
+			default:
+				break;
+		}
+	}
+}
+
+/** \brief Line level now, without noise.
+ *  Wired-AND of the master and the slaves, low while a driver is active
+ *  and for rise_us after the last driver released it.
+ * */
+static int line_level(ow_sim_t *sim) {
+	const uint64_t now = sim->now_us;
+	uint64_t last_release = sim->master_released;
+	ow_sim_slave_t *slave;
+
+	if ( sim->shorted || sim->master_low )
+		return 0;
+	for ( int i = 0; i < sim->slaves_n; i++ ) {
+		slave = &sim->slaves[i];
+		if ( slave->low_from <= now && now < slave->low_until )
+			return 0;
+		if ( slave->low_until <= now && slave->low_until > last_release )
+			last_release = slave->low_until;
+	}
+	if ( last_release && now < last_release + sim->rise_us )
+		return 0;
+	return 1;
+}
+
+/** @defgroup ow_sim_backend Backend functions
+ * @{ */
+static void sim_pull(void *ctx) {
+	ow_sim_t *sim = ctx;
+	if ( sim->master_low )
+		return;
+	sim->master_low = 1;
+	sim->master_low_from = sim->now_us;
+	record(sim, sim->now_us, OW_SIM_SRC_MASTER, 0);
+	slaves_falling_edge(sim);
+}
+
+static void sim_release(void *ctx) {
+	ow_sim_t *sim = ctx;
+	if ( !sim->master_low )
+		return;
+	sim->master_low = 0;
+	sim->master_released = sim->now_us;
+	record(sim, sim->now_us, OW_SIM_SRC_MASTER, 1);
+	slaves_rising_edge(sim);
+}
+
+static int sim_level(void *ctx) {
+	ow_sim_t *sim = ctx;
+	int level = line_level(sim);
+	if ( sim->noise_ppm && (sim_rand(sim) % 1000000) < sim->noise_ppm )
+		level = !level;
+	record(sim, sim->now_us, OW_SIM_SRC_SAMPLE, level);
+	return level;
+}
+
+static void sim_delay_us(void *ctx, uint32_t us) {
+	ow_sim_t *sim = ctx;
+	sim->now_us += us;
+}
+
+static void sim_alarm_us(void *ctx, uint32_t us) {
+	ow_sim_t *sim = ctx;
+	sim->alarm_at = sim->now_us + us;
+	if ( sim->jitter_us )
+		sim->alarm_at += sim_rand(sim) % (sim->jitter_us + 1);
+	sim->alarm_pending = 1;
+}
+/** @} */
+
+/** \brief Initialize an empty bus without faults.
+ *  \param seed of the fault generator
+ * */
+void ow_sim_init(ow_sim_t *sim, uint32_t seed) {
+	memset(sim, 0, sizeof(*sim));
+	sim->backend.pull = sim_pull;
+	sim->backend.release = sim_release;
+	sim->backend.level = sim_level;
+	sim->backend.delay_us = sim_delay_us;
+	sim->backend.alarm_us = sim_alarm_us;
+	sim->backend.ctx = sim;
+	sim->presence_wait_us = SLAVE_PRESENCE_WAIT;
+	sim->presence_len_us = SLAVE_PRESENCE_LEN;
+	sim->seed = seed;
+	sim->now_us = 1;
+	ow_engine_init(&sim->engine, &sim->backend, NULL, NULL);
+}
+
+/** \brief Connect a slave to the bus.
+ *  \return 0 added
+ *  \return 1 bus is full
+ * */
+int ow_sim_add_slave(ow_sim_t *sim, const uint8_t rom[OW_ROM_SIZE]) {
+	if ( sim->slaves_n >= OW_SIM_MAX_SLAVES )
+		return 1;
+	memset(&sim->slaves[sim->slaves_n], 0, sizeof(ow_sim_slave_t));
+	memcpy(sim->slaves[sim->slaves_n].rom, rom, OW_ROM_SIZE);
+	sim->slaves_n++;
+	return 0;
+}
+
+/** \brief Disconnect all slaves. */
+void ow_sim_remove_slaves(ow_sim_t *sim) {
+	sim->slaves_n = 0;
+}
+
+/** \brief Create a valid ROM: family code, 48 bit serial number (LSB first) and CRC. */
+void ow_sim_make_rom(uint8_t family, uint64_t serial, uint8_t rom[OW_ROM_SIZE]) {
+	uint8_t crc = 0, byte, mix;
+	rom[0] = family;
+	for ( int i = 1; i < OW_ROM_SIZE - 1; i++ ) {
+		rom[i] = (uint8_t)serial;
+		serial >>= 8;
+	}
+	for ( int i = 0; i < OW_ROM_SIZE - 1; i++ ) {
+		byte = rom[i];
+		for ( int b = 0; b < 8; b++ ) {
+			mix = (crc ^ byte) & 0x01;
+			crc >>= 1;
+			if ( mix )
+				crc ^= 0x8C;
+			byte >>= 1;
+		}
+	}
+	rom[OW_ROM_SIZE - 1] = crc;
+}
+
+/** \brief Run the started transaction until the engine finishes. */
+static void run(ow_sim_t *sim, uint64_t start, uint32_t *latency_us) {
+	while ( sim->alarm_pending ) {
+		sim->alarm_pending = 0;
+		sim->now_us = sim->alarm_at;
+		ow_engine_step(&sim->engine);
+	}
+	if ( latency_us )
+		*latency_us = (uint32_t)(sim->now_us - start);
+}
+
+/** \brief Run a whole READ ROM transaction on the simulated bus.
+ *  \param rom raw ROM data read by the engine, can be NULL
+ *  \param latency_us simulated time of the transaction, can be NULL
+ *  \return status of the transaction (OW_OK, OW_NO_PRESENCE, OW_SHORT)
+ *  \return -1 engine is busy
+ * */
+int ow_sim_read_rom(ow_sim_t *sim, uint8_t rom[OW_ROM_SIZE], uint32_t *latency_us) {
+	const uint64_t start = sim->now_us;
+
+	sim->wave_len = 0;
+	if ( ow_read_rom_start(&sim->engine) )
+		return -1;
+	run(sim, start, latency_us);
+	if ( rom )
+		memcpy(rom, sim->engine.rom, OW_ROM_SIZE);
+	return sim->engine.status;
+}
+
+/** \brief Run a whole SEARCH ROM enumeration on the simulated bus.
+ *  The found ROMs are in sim->engine.roms, their number is sim->engine.found.
+ *  \param latency_us simulated time of the enumeration, can be NULL
+ *  \return status of the search (OW_OK, OW_NO_PRESENCE, OW_SHORT)
+ *  \return -1 engine is busy
+ * */
+int ow_sim_search(ow_sim_t *sim, uint32_t *latency_us) {
+	const uint64_t start = sim->now_us;
+
+	sim->wave_len = 0;
+	if ( ow_search_start(&sim->engine) )
+		return -1;
+	run(sim, start, latency_us);
+	return sim->engine.status;
+}
+/** @} */
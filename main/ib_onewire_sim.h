@@ -0,0 +1,111 @@
+/**
+ * @defgroup ib_onewire_sim
+ * @ingroup ib_onewire
+ * @{
+ * ib_onewire_sim.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: root
+ *
+ * Simulated 1-Wire bus for the ib_onewire engine.
+ *
+ * It is an ow_backend_t with a virtual clock: delays and alarms only move the clock,
+ * so a whole transaction runs in a few microseconds of real time, on the target or on a host.
+ * The bus can hold DS1990A slave models. A slave answers the reset with a presence pulse
+ * and sends its ROM after a READ ROM command, it takes part in SEARCH ROM too.
+ * When overdrive is set, the slaves switch to overdrive speed after OVERDRIVE SKIP ROM.
+ *
+ * Faults can be set to test the engine:
+ *  - noise: probability of a flipped sample,
+ *  - short: line is tied to GND,
+ *  - slow rise: line stays low for the given time after it has been released,
+ *  - jitter: random extra latency of the alarms (interrupt latency).
+ *
+ * Line events are recorded in a waveform buffer.
+ *
+ * Usage:
+ * \code
+ * ow_sim_t sim;
+ * uint8_t rom[OW_ROM_SIZE];
+ * ow_sim_init(&sim, seed);
+ * ow_sim_make_rom(0x01, 0x1A0000D0ULL, rom);
+ * ow_sim_add_slave(&sim, rom);
+ * if ( ow_sim_read_rom(&sim, rom, &latency) == OW_OK ) ...
+ * \endcode
+ */
+
+#ifndef MAIN_IB_ONEWIRE_SIM_H_
+#define MAIN_IB_ONEWIRE_SIM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include "ib_onewire.h"
+
+/** \brief Maximum number of slaves on the simulated bus. */
+#define OW_SIM_MAX_SLAVES 	4
+/** \brief Number of recorded line events. */
+#define OW_SIM_WAVE_SIZE 	512
+
+/** @defgroup ow_sim_sources Waveform event sources
+ * @{ */
+#define OW_SIM_SRC_MASTER 	0
+#define OW_SIM_SRC_SLAVE 	1
+#define OW_SIM_SRC_SAMPLE 	2
+/** @} */
+
+/** \brief A recorded line event. level is 0 when the source pulls the line down. */
+typedef struct ow_sim_event {
+	uint32_t t_us;
+	uint8_t source;
+	uint8_t level;
+} ow_sim_event_t;
+
+/** \brief DS1990A model. */
+typedef struct ow_sim_slave {
+	uint8_t rom[OW_ROM_SIZE];
+	uint8_t state;
+	uint8_t command;
+	uint8_t bit;
+	uint8_t search_slot;
+	uint8_t overdrive;
+	uint64_t low_from;
+	uint64_t low_until;
+} ow_sim_slave_t;
+
+/** \brief Simulated bus. */
+typedef struct ow_sim {
+	ow_backend_t backend;
+	ow_engine_t engine;
+	uint64_t now_us;
+	uint64_t alarm_at;
+	int alarm_pending;
+	int master_low;
+	uint64_t master_low_from;
+	uint64_t master_released;
+	ow_sim_slave_t slaves[OW_SIM_MAX_SLAVES];
+	int slaves_n;
+	/** Presence pulse: wait after the reset and length in us. */
+	uint32_t presence_wait_us;
+	uint32_t presence_len_us;
+	/** Slaves support overdrive speed. */
+	int overdrive;
+	/** Faults. */
+	uint32_t noise_ppm;
+	int shorted;
+	uint32_t rise_us;
+	uint32_t jitter_us;
+	uint32_t seed;
+	/** Waveform. */
+	ow_sim_event_t wave[OW_SIM_WAVE_SIZE];
+	size_t wave_len;
+} ow_sim_t;
+
+void ow_sim_init(ow_sim_t *sim, uint32_t seed);
+int ow_sim_add_slave(ow_sim_t *sim, const uint8_t rom[OW_ROM_SIZE]);
+void ow_sim_remove_slaves(ow_sim_t *sim);
+void ow_sim_make_rom(uint8_t family, uint64_t serial, uint8_t rom[OW_ROM_SIZE]);
+int ow_sim_read_rom(ow_sim_t *sim, uint8_t rom[OW_ROM_SIZE], uint32_t *latency_us);
+int ow_sim_search(ow_sim_t *sim, uint32_t *latency_us);
+
+#endif /* MAIN_IB_ONEWIRE_SIM_H_ */
+/** @} */
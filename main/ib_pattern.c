@@ -0,0 +1,341 @@
+/**
+ * ib_pattern.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: root
+ *  @ingroup ib_pattern
+ *  @{
+ */
+
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+#include "esp_log.h"
+
+#include "ib_pattern.h"
+#include "ib_static.h"
+
+#define TAG "IB_PATTERN"
+
+/** \brief Step flag: the LEDs show the base state in this step. */
+#define IB_LED_BASE 	(1 << 7)
+
+/** @defgroup pattern_commands Commands of the timer service task
+ *  The parameter of the pended call is the command and its value.
+ * @{ */
+#define CMD_PLAY 		0
+#define CMD_STOP 		1
+#define CMD_BASE 		2
+#define CMD_STATUS 		3
+#define CMD(cmd, value) (((uint32_t)(cmd) << 8) | ((value) & 0xFF))
+/** @} */
+
+/** Wait for a free place in the timer command queue, in ms. */
+#define PEND_WAIT_MS 	10
+
+#define STEPS(s) s, (sizeof(s) / sizeof(s[0]))
+
+static const ib_pattern_step_t STEPS_SU[] = { { IB_LED_BOTH, 500 }, { IB_LED_RED, 500 } };
+static const ib_pattern_step_t STEPS_LOG_FULL[] = { { IB_LED_BOTH, 500 }, { 0, 500 } };
+static const ib_pattern_step_t STEPS_BUSY[] = { { IB_LED_GREEN, 250 }, { IB_LED_RED, 250 } };
+static const ib_pattern_step_t STEPS_DENY[] = { { 0, 1000 } };
+static const ib_pattern_step_t STEPS_OFFLINE[] = { { 0, 150 }, { IB_LED_BASE, 2850 } };
+static const ib_pattern_step_t STEPS_SYNCING[] = { { IB_LED_BOTH, 100 }, { IB_LED_BASE, 900 } };
+static const ib_pattern_step_t STEPS_LOG_NEARLY_FULL[] = {
+	{ 0, 150 }, { IB_LED_BASE, 150 }, { 0, 150 }, { IB_LED_BASE, 3550 }
+};
+
+/** \brief The patterns, index is the ib_pattern_id_t. */
+static const ib_pattern_t PATTERNS[IB_PAT_N] = {
+	{ "su", 				STEPS(STEPS_SU), 				0, IB_PAT_PRIO_STATE },
+	{ "log full", 			STEPS(STEPS_LOG_FULL), 			0, IB_PAT_PRIO_STATE },
+	{ "busy", 				STEPS(STEPS_BUSY), 				0, IB_PAT_PRIO_FEEDBACK },
+	{ "deny", 				STEPS(STEPS_DENY), 				1, IB_PAT_PRIO_FEEDBACK },
+	{ "offline", 			STEPS(STEPS_OFFLINE), 			0, IB_PAT_PRIO_STATUS },
+	{ "syncing", 			STEPS(STEPS_SYNCING), 			0, IB_PAT_PRIO_STATUS },
+	{ "log nearly full", 	STEPS(STEPS_LOG_NEARLY_FULL), 	0, IB_PAT_PRIO_STATUS },
+};
+
+static TimerHandle_t g_timer;
+IB_TIMER_STORAGE(pattern_tim, 1);
+static ib_pattern_player_t *g_players[IB_PATTERN_PLAYERS_MAX];
+static int g_players_n;
+/** IB_STATUS_* flags. */
+static volatile uint32_t g_status;
+
+/** \brief Pattern by id.
+ *  \return NULL invalid id
+ * */
+const ib_pattern_t *ib_pattern_get(ib_pattern_id_t id) {
+	return (id < IB_PAT_N) ? &PATTERNS[id] : NULL;
+}
+
+/** @defgroup pattern_player Player
+ *  Time is in ms, it may wrap around.
+ * @{ */
+static uint32_t step_ms(const ib_pattern_slot_t *slot) {
+	uint16_t ms = slot->pattern->steps[slot->step].ms;
+	return ms ? ms : 1;
+}
+
+static int top_slot(const ib_pattern_player_t *player) {
+	for ( int i = IB_PAT_PRIO_N - 1; i >= 0; i-- ) {
+		if ( player->slots[i].pattern )
+			return i;
+	}
+	return -1;
+}
+
+/** \brief Switch the LEDs when they change. */
+static void render(ib_pattern_player_t *player) {
+	const ib_pattern_slot_t *slot;
+	uint8_t leds = player->base;
+
+	if ( player->top >= 0 ) {
+		slot = &player->slots[player->top];
+		if ( !(slot->pattern->steps[slot->step].leds & IB_LED_BASE) )
+			leds = slot->pattern->steps[slot->step].leds;
+	}
+	if ( leds == player->leds )
+		return;
+	player->leds = leds;
+	if ( player->output )
+		player->output(player->arg, leds);
+}
+
+/** \brief Find the top slot again. A paused pattern continues with its current step from now. */
+static void resume(ib_pattern_player_t *player, uint32_t now_ms) {
+	int top = top_slot(player);
+	if ( top != player->top ) {
+		player->top = top;
+		if ( top >= 0 )
+			player->slots[top].edge_at = now_ms + step_ms(&player->slots[top]);
+	}
+	render(player);
+}
+
+/** \brief Initialize a player. The LEDs are set at the first change. */
+void ib_pattern_player_init(ib_pattern_player_t *player, ib_pattern_output_cb output, void *arg) {
+	for ( int i = 0; i < IB_PAT_PRIO_N; i++ )
+		player->slots[i].pattern = NULL;
+	player->top = -1;
+	player->base = 0;
+	player->leds = 0xFF;
+	player->output = output;
+	player->arg = arg;
+}
+
+/** \brief Start a pattern from its first step, it replaces the pattern of the same priority. */
+void ib_pattern_player_play(ib_pattern_player_t *player, const ib_pattern_t *pattern, uint32_t now_ms) {
+	ib_pattern_slot_t *slot;
+
+	if ( !pattern || !pattern->steps_n || pattern->prio >= IB_PAT_PRIO_N )
+		return;
+	slot = &player->slots[pattern->prio];
+	slot->pattern = pattern;
+	slot->step = 0;
+	slot->played = 0;
+	slot->edge_at = now_ms + step_ms(slot);
+	resume(player, now_ms);
+}
+
+/** \brief Stop the pattern of a priority. */
+void ib_pattern_player_stop(ib_pattern_player_t *player, ib_pattern_prio_t prio, uint32_t now_ms) {
+	if ( prio >= IB_PAT_PRIO_N )
+		return;
+	player->slots[prio].pattern = NULL;
+	resume(player, now_ms);
+}
+
+/** \brief LEDs when no pattern plays, IB_LED_* mask. */
+void ib_pattern_player_base(ib_pattern_player_t *player, uint8_t leds) {
+	player->base = leds & IB_LED_BOTH;
+	render(player);
+}
+
+/** \brief Do the edges up to now.
+ *  The next step starts at the edge, not at now, so a late call does not shift the pattern.
+ * */
+void ib_pattern_player_advance(ib_pattern_player_t *player, uint32_t now_ms) {
+	ib_pattern_slot_t *slot;
+	uint32_t edge;
+
+	while ( player->top >= 0 ) {
+		slot = &player->slots[player->top];
+		if ( (int32_t)(now_ms - slot->edge_at) < 0 )
+			break;
+		edge = slot->edge_at;
+		if ( ++slot->step >= slot->pattern->steps_n ) {
+			slot->step = 0;
+			if ( slot->pattern->repeat && ++slot->played >= slot->pattern->repeat ) {
+				slot->pattern = NULL;
+				resume(player, edge);
+				continue;
+			}
+		}
+		slot->edge_at = edge + step_ms(slot);
+	}
+	render(player);
+}
+
+/** \brief Time of the next edge.
+ *  \return 0 the LEDs are steady
+ *  \return 1 at_ms is set
+ * */
+int ib_pattern_player_next_edge(const ib_pattern_player_t *player, uint32_t *at_ms) {
+	if ( player->top < 0 )
+		return 0;
+	*at_ms = player->slots[player->top].edge_at;
+	return 1;
+}
+/** @} */
+
+static uint32_t now_ms() {
+	return xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
+
+/** \brief Arm the timer for the nearest edge of all the players, stop it when all are steady.
+ *  Runs in the timer service task, so the timer commands must not block.
+ * */
+static void reschedule() {
+	uint32_t now = now_ms();
+	uint32_t at, next = 0;
+	int found = 0;
+	int32_t wait_ms;
+	TickType_t ticks;
+
+	for ( int i = 0; i < g_players_n; i++ ) {
+		if ( !ib_pattern_player_next_edge(g_players[i], &at) )
+			continue;
+		if ( !found || (int32_t)(at - next) < 0 )
+			next = at;
+		found = 1;
+	}
+	if ( !found ) {
+		xTimerStop(g_timer, 0);
+		return;
+	}
+	wait_ms = (int32_t)(next - now);
+	ticks = (wait_ms > 0) ? (wait_ms + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS : 1;
+	xTimerChangePeriod(g_timer, ticks ? ticks : 1, 0);
+}
+
+static void timer_callback(TimerHandle_t timer) {
+	uint32_t now = now_ms();
+	for ( int i = 0; i < g_players_n; i++ )
+		ib_pattern_player_advance(g_players[i], now);
+	reschedule();
+}
+
+/** \brief Pattern of the status flags.
+ *  \return NULL no status
+ * */
+static const ib_pattern_t *status_pattern(uint32_t status) {
+	if ( status & IB_STATUS_OFFLINE )
+		return &PATTERNS[IB_PAT_OFFLINE];
+	if ( status & IB_STATUS_LOG_NEARLY_FULL )
+		return &PATTERNS[IB_PAT_LOG_NEARLY_FULL];
+	if ( status & IB_STATUS_SYNCING )
+		return &PATTERNS[IB_PAT_SYNCING];
+	return NULL;
+}
+
+/** \brief Show the current status on all the players, a running status pattern is not restarted. */
+static void apply_status(uint32_t now) {
+	const ib_pattern_t *pattern = status_pattern(g_status);
+	ib_pattern_player_t *player;
+
+	for ( int i = 0; i < g_players_n; i++ ) {
+		player = g_players[i];
+		if ( player->slots[IB_PAT_PRIO_STATUS].pattern == pattern )
+			continue;
+		if ( pattern )
+			ib_pattern_player_play(player, pattern, now);
+		else
+			ib_pattern_player_stop(player, IB_PAT_PRIO_STATUS, now);
+	}
+}
+
+/** \brief Pended call, runs in the timer service task. */
+static void command(void *arg, uint32_t param) {
+	ib_pattern_player_t *player = arg;
+	const uint8_t value = param & 0xFF;
+	uint32_t now = now_ms();
+
+	switch ( param >> 8 ) {
+		case CMD_PLAY:
+			ib_pattern_player_advance(player, now);
+			ib_pattern_player_play(player, ib_pattern_get(value), now);
+			break;
+		case CMD_STOP:
+			ib_pattern_player_advance(player, now);
+			ib_pattern_player_stop(player, value, now);
+			break;
+		case CMD_BASE:
+			ib_pattern_player_base(player, value);
+			break;
+		case CMD_STATUS:
+			apply_status(now);
+			break;
+		default:
+			break;
+	}
+	reschedule();
+}
+
+static void pend(ib_pattern_player_t *player, uint32_t param) {
+	if ( !g_timer )
+		return;
+	if ( pdPASS != xTimerPendFunctionCall(command, player, param, pdMS_TO_TICKS(PEND_WAIT_MS)) )
+		ESP_LOGE(TAG, "Command %u lost", param >> 8);
+}
+
+/** \brief Create the timer of the players. */
+void ib_pattern_init() {
+	if ( g_timer )
+		return;
+	g_timer = IB_TIMER_CREATE(pattern_tim, 0, "led pattern", 1, pdFALSE, NULL, timer_callback);
+	if ( !g_timer )
+		ESP_LOGE(TAG, "Timer create err");
+}
+
+/** \brief Add an initialized player to the timer. It shows the current status. */
+void ib_pattern_add(ib_pattern_player_t *player) {
+	if ( g_players_n >= IB_PATTERN_PLAYERS_MAX ) {
+		ESP_LOGE(TAG, "Too many players");
+		return;
+	}
+	g_players[g_players_n] = player;
+	g_players_n++;
+	pend(NULL, CMD(CMD_STATUS, 0));
+}
+
+/** \brief Start a pattern on a player. */
+void ib_pattern_play(ib_pattern_player_t *player, ib_pattern_id_t id) {
+	pend(player, CMD(CMD_PLAY, id));
+}
+
+/** \brief Stop the pattern of the priority on a player. */
+void ib_pattern_stop(ib_pattern_player_t *player, ib_pattern_prio_t prio) {
+	pend(player, CMD(CMD_STOP, prio));
+}
+
+/** \brief Set the LEDs of a player when no pattern plays, IB_LED_* mask. */
+void ib_pattern_set_base(ib_pattern_player_t *player, uint8_t leds) {
+	pend(player, CMD(CMD_BASE, leds));
+}
+
+/** \brief Set or clear IB_STATUS_* flags, shown on all the players.
+ *  Can be called from any task.
+ * */
+void ib_pattern_set_status(uint32_t flags, int on) {
+	uint32_t prev;
+	if ( on )
+		prev = __atomic_fetch_or(&g_status, flags, __ATOMIC_RELAXED);
+	else
+		prev = __atomic_fetch_and(&g_status, ~flags, __ATOMIC_RELAXED);
+	if ( on ? ((prev & flags) != flags) : (prev & flags) )
+		pend(NULL, CMD(CMD_STATUS, 0));
+}
+/** @} */
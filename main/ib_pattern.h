@@ -0,0 +1,136 @@
+/**
+ * @defgroup ib_pattern
+ * @ingroup ib_reader
+ * @{
+ *
+ * ib_pattern.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: root
+ *
+ * LED pattern engine of the readers.
+ *
+ * A pattern is a sequence of steps, a step is the state of the LEDs (IB_LED_* mask) and its length in ms.
+ * The steps are played repeat times, or until the pattern is stopped when repeat is 0.
+ * Every reader has a player with one slot per priority (ib_pattern_prio_t): the pattern of the highest
+ * busy slot drives the LEDs, the lower ones are paused and continue when it ends.
+ * When no pattern plays, the LEDs show the base state set by the FSM (ib_pattern_set_base()).
+ *
+ * All the players are driven by a single one-shot FreeRTOS timer, which sleeps until the nearest edge,
+ * so there is no wakeup while the LEDs are steady. The commands run in the timer service task
+ * (xTimerPendFunctionCall()), so the players need no lock and the callers do not block.
+ *
+ * The player functions (ib_pattern_player_*) do not use FreeRTOS, the time is passed in ms.
+ */
+
+#ifndef MAIN_IB_PATTERN_H_
+#define MAIN_IB_PATTERN_H_
+
+#include <stdint.h>
+
+/** @defgroup pattern_leds LED mask of a step
+ * @{ */
+#define IB_LED_RED 		(1 << 0)
+#define IB_LED_GREEN 	(1 << 1)
+#define IB_LED_BOTH 	(IB_LED_RED | IB_LED_GREEN)
+/** @} */
+
+/** \brief Maximum number of players. */
+#define IB_PATTERN_PLAYERS_MAX 	4
+
+/** \brief Slots of a player, the higher overrides the lower. */
+typedef enum ib_pattern_prio {
+	/** Device status: offline, syncing, log nearly full. */
+	IB_PAT_PRIO_STATUS,
+	/** State of the FSM: superuser mode, log full. */
+	IB_PAT_PRIO_STATE,
+	/** Short feedback of a touch: busy, denied. */
+	IB_PAT_PRIO_FEEDBACK,
+	IB_PAT_PRIO_N
+} ib_pattern_prio_t;
+
+/** \brief The patterns. */
+typedef enum ib_pattern_id {
+	/** Superuser mode: green blinks. */
+	IB_PAT_SU,
+	/** Log file is full: both LEDs blink. */
+	IB_PAT_LOG_FULL,
+	/** Decision is late: red and green alternate. */
+	IB_PAT_BUSY,
+	/** Access denied: LEDs off for 1 s, once. */
+	IB_PAT_DENY,
+	/** Server cannot be reached: red goes off shortly every 3 s. */
+	IB_PAT_OFFLINE,
+	/** Database download: green flashes every second. */
+	IB_PAT_SYNCING,
+	/** Log file is nearly full: red double blink every 4 s. */
+	IB_PAT_LOG_NEARLY_FULL,
+	IB_PAT_N
+} ib_pattern_id_t;
+
+/** @defgroup pattern_status Device status flags
+ *  When more flags are set, the first one in this list is shown.
+ * @{ */
+#define IB_STATUS_OFFLINE 			(1 << 0)
+#define IB_STATUS_LOG_NEARLY_FULL 	(1 << 1)
+#define IB_STATUS_SYNCING 			(1 << 2)
+/** @} */
+
+/** \brief A step: LEDs and length. */
+typedef struct ib_pattern_step {
+	uint8_t leds;
+	uint16_t ms;
+} ib_pattern_step_t;
+
+/** \brief A pattern. */
+typedef struct ib_pattern {
+	const char *name;
+	const ib_pattern_step_t *steps;
+	uint8_t steps_n;
+	/** Number of plays, 0: until it is stopped. */
+	uint8_t repeat;
+	ib_pattern_prio_t prio;
+} ib_pattern_t;
+
+/** \brief A pattern in a slot of a player. */
+typedef struct ib_pattern_slot {
+	const ib_pattern_t *pattern;
+	uint8_t step;
+	uint8_t played;
+	/** End of the current step, valid in the top slot only. */
+	uint32_t edge_at;
+} ib_pattern_slot_t;
+
+/** \brief Switches the LEDs. */
+typedef void (*ib_pattern_output_cb)(void *arg, uint8_t leds);
+
+/** \brief LED player of a reader. */
+typedef struct ib_pattern_player {
+	ib_pattern_slot_t slots[IB_PAT_PRIO_N];
+	/** Playing slot, -1: base. */
+	int8_t top;
+	uint8_t base;
+	/** Current state of the LEDs. */
+	uint8_t leds;
+	ib_pattern_output_cb output;
+	void *arg;
+} ib_pattern_player_t;
+
+const ib_pattern_t *ib_pattern_get(ib_pattern_id_t id);
+
+void ib_pattern_player_init(ib_pattern_player_t *player, ib_pattern_output_cb output, void *arg);
+void ib_pattern_player_play(ib_pattern_player_t *player, const ib_pattern_t *pattern, uint32_t now_ms);
+void ib_pattern_player_stop(ib_pattern_player_t *player, ib_pattern_prio_t prio, uint32_t now_ms);
+void ib_pattern_player_base(ib_pattern_player_t *player, uint8_t leds);
+void ib_pattern_player_advance(ib_pattern_player_t *player, uint32_t now_ms);
+int ib_pattern_player_next_edge(const ib_pattern_player_t *player, uint32_t *at_ms);
+
+void ib_pattern_init();
+void ib_pattern_add(ib_pattern_player_t *player);
+void ib_pattern_play(ib_pattern_player_t *player, ib_pattern_id_t id);
+void ib_pattern_stop(ib_pattern_player_t *player, ib_pattern_prio_t prio);
+void ib_pattern_set_base(ib_pattern_player_t *player, uint8_t leds);
+void ib_pattern_set_status(uint32_t flags, int on);
+
+#endif /* MAIN_IB_PATTERN_H_ */
+/** @} */
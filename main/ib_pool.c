@@ -0,0 +1,209 @@
+/**
+ * ib_pool.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: root
+ *  @ingroup ib_pool
+ *  @{
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_console.h"
+#include "esp_log.h"
+#include "argtable3/argtable3.h"
+#include "cJSON.h"
+
+#include "ib_pool.h"
+#include "ib_database.h"
+#include "ib_calendar.h"
+
+#define TAG "IB_POOL"
+
+/** \brief Blocks are aligned to 8 bytes like malloc(). */
+#define BLOCK_SIZE(size) 	(((size) + 7) & ~(size_t)7)
+#define STORAGE(size, n) 	(BLOCK_SIZE(size) / sizeof(uint64_t) * (n))
+
+/** @defgroup pool_sizes Sizes
+ *  Block size in bytes and number of blocks.
+ * @{ */
+/** Decision worker, console and CSV processing. */
+#define DATA_SIZE 		(sizeof(ib_data_t) + IBD_BODY_MAX_SIZE)
+#define DATA_N 			6
+#define LINE_SIZE 		(IBD_CSV_LINE_MAX_SIZE + 2)
+#define LINE_N 			2
+/** The largest request of the sync task, the calendars. */
+#define HTTP_SIZE 		(IB_CAL_TEXT_MAX + 1)
+#define HTTP_N 			1
+/** A log message has about 30 items and strings, the metrics about 80. */
+#define JSON_S_SIZE 	64
+#define JSON_S_N 		96
+#define JSON_M_SIZE 	256
+#define JSON_M_N 		8
+#define JSON_L_SIZE 	1024
+#define JSON_L_N 		3
+/** @} */
+
+typedef struct pool {
+	const char *name;
+	uint32_t size;
+	uint16_t blocks;
+	uint8_t *storage;
+	/** Freed blocks, the next pointer is in the block. */
+	void *free_list;
+	/** Blocks used at least once, the rest is not in the free list. */
+	uint16_t carved;
+	ib_pool_stats_t stats;
+} pool_t;
+
+static uint64_t g_data_storage[STORAGE(DATA_SIZE, DATA_N)];
+static uint64_t g_line_storage[STORAGE(LINE_SIZE, LINE_N)];
+static uint64_t g_http_storage[STORAGE(HTTP_SIZE, HTTP_N)];
+static uint64_t g_json_s_storage[STORAGE(JSON_S_SIZE, JSON_S_N)];
+static uint64_t g_json_m_storage[STORAGE(JSON_M_SIZE, JSON_M_N)];
+static uint64_t g_json_l_storage[STORAGE(JSON_L_SIZE, JSON_L_N)];
+
+#define POOL(id, label, bytes, n, array) \
+	[id] = { .name = label, .size = BLOCK_SIZE(bytes), .blocks = n, .storage = (uint8_t*)array }
+
+static pool_t g_pools[IB_POOLS_N] = {
+	POOL(IB_POOL_DATA, "data", DATA_SIZE, DATA_N, g_data_storage),
+	POOL(IB_POOL_LINE, "csv line", LINE_SIZE, LINE_N, g_line_storage),
+	POOL(IB_POOL_HTTP, "http", HTTP_SIZE, HTTP_N, g_http_storage),
+	POOL(IB_POOL_JSON_S, "json s", JSON_S_SIZE, JSON_S_N, g_json_s_storage),
+	POOL(IB_POOL_JSON_M, "json m", JSON_M_SIZE, JSON_M_N, g_json_m_storage),
+	POOL(IB_POOL_JSON_L, "json l", JSON_L_SIZE, JSON_L_N, g_json_l_storage),
+};
+
+static portMUX_TYPE g_pool_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/** \brief Take a block.
+ *  \return NULL the pool is empty
+ * */
+static void *take(pool_t *p) {
+	void *block = NULL;
+
+	portENTER_CRITICAL(&g_pool_mux);
+	if ( p->free_list ) {
+		block = p->free_list;
+		p->free_list = *(void**)block;
+	} else if ( p->carved < p->blocks ) {
+		block = p->storage + (size_t)p->carved++ * p->size;
+	}
+	if ( block ) {
+		p->stats.allocs++;
+		if ( ++p->stats.used > p->stats.peak )
+			p->stats.peak = p->stats.used;
+	}
+	portEXIT_CRITICAL(&g_pool_mux);
+	return block;
+}
+
+static void *fallback(pool_t *p, size_t size) {
+	portENTER_CRITICAL(&g_pool_mux);
+	p->stats.fallbacks++;
+	portEXIT_CRITICAL(&g_pool_mux);
+	return malloc(size);
+}
+
+/** \brief Allocate from a pool, or from the heap when it is empty or the size is too big.
+ *  \return NULL no memory
+ * */
+void *ib_pool_alloc(ib_pool_id_t pool, size_t size) {
+	pool_t *p = &g_pools[pool];
+	void *block = size <= p->size ? take(p) : NULL;
+
+	return block ? block : fallback(p, size);
+}
+
+/** \brief Free a block of a pool or a heap pointer, NULL is ignored. */
+void ib_pool_free(void *ptr) {
+	uint8_t *block = ptr;
+	pool_t *p;
+
+	if ( !ptr )
+		return;
+	for ( int i = 0; i < IB_POOLS_N; i++ ) {
+		p = &g_pools[i];
+		if ( block < p->storage || block >= p->storage + (size_t)p->blocks * p->size )
+			continue;
+		if ( (block - p->storage) % p->size ) {
+			ESP_LOGE(TAG, "Invalid block of %s", p->name);
+			return;
+		}
+		portENTER_CRITICAL(&g_pool_mux);
+		*(void**)block = p->free_list;
+		p->free_list = block;
+		p->stats.used--;
+		portEXIT_CRITICAL(&g_pool_mux);
+		return;
+	}
+	free(ptr);
+}
+
+/** \brief cJSON allocation: the smallest JSON pool which has a free block. */
+static void *json_malloc(size_t size) {
+	void *block;
+
+	for ( int i = IB_POOL_JSON_S; i <= IB_POOL_JSON_L; i++ ) {
+		if ( size <= g_pools[i].size && (block = take(&g_pools[i])) )
+			return block;
+	}
+	for ( int i = IB_POOL_JSON_S; i <= IB_POOL_JSON_L; i++ ) {
+		if ( size <= g_pools[i].size || i == IB_POOL_JSON_L )
+			return fallback(&g_pools[i], size);
+	}
+	return NULL;
+}
+
+/** \brief Set the pools as the allocator of cJSON. Call it before cJSON is used. */
+void ib_pool_init() {
+	cJSON_Hooks hooks = { .malloc_fn = json_malloc, .free_fn = ib_pool_free };
+	cJSON_InitHooks(&hooks);
+}
+
+size_t ib_pool_block_size(ib_pool_id_t pool) {
+	return g_pools[pool].size;
+}
+
+const char *ib_pool_name(ib_pool_id_t pool) {
+	return g_pools[pool].name;
+}
+
+void ib_pool_stats(ib_pool_id_t pool, ib_pool_stats_t *stats) {
+	portENTER_CRITICAL(&g_pool_mux);
+	*stats = g_pools[pool].stats;
+	portEXIT_CRITICAL(&g_pool_mux);
+	stats->size = g_pools[pool].size;
+	stats->blocks = g_pools[pool].blocks;
+}
+
+/** \brief Prints the pools. */
+static int pool_cmd(int argc, char **argv) {
+	ib_pool_stats_t s;
+	uint32_t total = 0;
+
+	printf("%-10s %6s %6s %5s %5s %10s %10s\n", "pool", "size", "blocks", "used", "peak", "allocs", "fallbacks");
+	for ( int i = 0; i < IB_POOLS_N; i++ ) {
+		ib_pool_stats(i, &s);
+		total += s.size * s.blocks;
+		printf("%-10s %6u %6u %5u %5u %10u %10u\n", ib_pool_name(i), s.size, s.blocks, s.used, s.peak,
+				s.allocs, s.fallbacks);
+	}
+	printf("%u bytes\n", total);
+	return 0;
+}
+
+/** \brief Command register function. */
+void register_pool() {
+	const esp_console_cmd_t pool_cmd_def = {
+			.command = "pool",
+			.help = "Usage of the fixed-block pools",
+			.hint = NULL,
+			.func = &pool_cmd,
+	};
+	ESP_ERROR_CHECK( esp_console_cmd_register(&pool_cmd_def) );
+}
+/** @} */
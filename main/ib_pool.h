@@ -0,0 +1,63 @@
+/**
+ * @defgroup ib_pool
+ * @{
+ *
+ * ib_pool.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: root
+ *
+ * Fixed-block pools of the frequent allocations.
+ *
+ * The database records (create_ib_data()), the CSV line buffer, the HTTP receive buffer and the cJSON objects
+ * are allocated very often with different sizes, in the heap they fragment the DRAM over a long uptime.
+ * Every pool is a static array of equal blocks, a block goes back to the free list of its pool, so the pools
+ * do not fragment and the heap is not touched by these allocations.
+ *
+ * ib_pool_alloc() falls back to the heap when the pool is empty or the size is bigger than a block,
+ * this is counted in the statistics. ib_pool_free() finds the pool by the address, any other pointer is
+ * passed to free(), so a block can be freed without knowing where it comes from.
+ * cJSON uses the IB_POOL_JSON_* pools by the size of the allocation after ib_pool_init().
+ *
+ * The pools are thread safe, the blocks are taken in a short critical section.
+ * The 'pool' console command prints the usage and the peak of the pools.
+ */
+
+#ifndef MAIN_IB_POOL_H_
+#define MAIN_IB_POOL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** \brief Pools. */
+typedef enum ib_pool_id {
+	IB_POOL_DATA,		/**< ib_data_t with the longest record. */
+	IB_POOL_LINE,		/**< CSV line with the line end. */
+	IB_POOL_HTTP,		/**< Receive buffer of the sync task. */
+	IB_POOL_JSON_S,		/**< cJSON items and short strings. */
+	IB_POOL_JSON_M,
+	IB_POOL_JSON_L,		/**< Printed messages. */
+	IB_POOLS_N
+} ib_pool_id_t;
+
+/** \brief Statistics of a pool. */
+typedef struct ib_pool_stats {
+	uint32_t size;
+	uint16_t blocks;
+	uint16_t used;
+	uint16_t peak;
+	uint32_t allocs;
+	/** Allocations from the heap: pool empty or too big. */
+	uint32_t fallbacks;
+} ib_pool_stats_t;
+
+void ib_pool_init();
+void *ib_pool_alloc(ib_pool_id_t pool, size_t size);
+void ib_pool_free(void *ptr);
+size_t ib_pool_block_size(ib_pool_id_t pool);
+void ib_pool_stats(ib_pool_id_t pool, ib_pool_stats_t *stats);
+const char *ib_pool_name(ib_pool_id_t pool);
+void register_pool();
+
+#endif /* MAIN_IB_POOL_H_ */
+/** @} */
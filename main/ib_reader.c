@@ -8,15 +8,26 @@
  * This module implements the access control functions like opening relay, blink the LEDs.
  *
  *
- *  It is state a machine which has more inputs:
+ *  It is state a machine (ib_fsm, table-driven) which has more inputs:
  *  	- iButton reader,
  *  	- button,
- *  	- timeouts.
+ *  	- timeouts,
+ *  	- log file full and cleared.
  *
- *  Inputs are realized with FreeRTOS queue, and inputs_t.\n
- *  Two tasks:
- *  	1.: reads the button state, and read the iButton data.
- *  	2.: informs the user of the state machine, example: blink leds
+ *  There are IB_READERS_N reader instances (ib_reader_t). Every reader has its own
+ *  1-Wire bus, pins, relay, FSM and configuration. The database and the logger are shared.
+ *
+ *  Every reader has a single event queue (input_q, ib_event_t), owned by its reader task:
+ *  the interrupts, the timers, the decision worker and the logger only post events,
+ *  only the reader task steps the FSM, so the transitions need no lock.\n
+ *  One task per reader: reads the button state, and read the iButton data.\n
+ *  The LEDs are driven by the ib_pattern engine: every reader has a player, one timer drives all of them.
+ *  One decision worker task for all the readers:
+ *  	looks up the key in the database, checks its schedule and logs the event,
+ *  	then sends the verdict back to the reader, which feeds it to its FSM.
+ *  	When the verdict does not arrive within DECISION_DEADLINE_MS, the reader shows busy,
+ *  	after DECISION_ABANDON_MS it gives up the decision and takes the touches again.
+ *  	Every decision has a sequence id, a late verdict of an abandoned decision is dropped.
  * 	Uses
  * 		- software timers to create timeouts,
  * 		- queues to perform communications between the input generators and the state machine.
@@ -33,6 +44,8 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/timers.h"
 #include "esp_system.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
 #include "esp_log.h"
 #include "esp_err.h"
 #include "argtable3/argtable3.h"
@@ -44,37 +57,26 @@
 #include "ibutton.h"
 #include "cron.h"
 #include "ib_database.h"
+#include "ib_pool.h"
 #include "ib_log.h"
+#include "ib_trace.h"
+#include "ib_fsm.h"
+#include "ib_pattern.h"
+#include "ib_throttle.h"
+#include "ib_clock.h"
+#include "ib_schedule.h"
+#include "ib_calendar.h"
+#include "ib_metrics.h"
+#include "ib_static.h"
 
 #define TAG "IB_READER"
 
+/** NVS key of reader 0. The other readers use this key with their id appended. */
 const char READER_KEY_NVS[] = "reader_config";
 const char READER_NSPACE_NVS[] = "reader_ns";
 
-/** \brief Input types of the state machine.
- *  Only these types of input works.
- * */
-typedef enum inputs {
-    input_touched,
-    input_su_touched,
-	input_invalid_touched,
-    input_button,
-	input_tout,
-} inputs_t;
-
-/** \brief Indicating the current state.
- *  This enumeration data is used as an input to a queue which is used by LED blinker task.
- *  Put any type of these in to queue to change color.
- * */
-typedef enum infos {
-	blink_green,
-	blink_red,
-	blink_both,
-	blink_both2,
-	blink_none,
-} infos_t;
-
 /** Configuration settings.
+ *  Saved for every reader, devicename is used only from reader 0.
  *  */
 typedef struct ib_conf{
 	/** Super user key code. */
@@ -87,104 +89,198 @@ typedef struct ib_conf{
 	char devicename[128];
 } ib_conf_t;
 
-/** Holds the current state of the FSM. */
-typedef void ( *p_state_handler )(inputs_t input);
+/** \brief Pins of a reader. */
+typedef struct ib_reader_pins {
+	gpio_num_t data;
+	gpio_num_t button;
+	gpio_num_t red;
+	gpio_num_t green;
+	gpio_num_t relay;
+} ib_reader_pins_t;
 
-/** FreeRTOS handlers */
-typedef struct ib_handles{
-	p_state_handler fsm_state;
-	p_state_handler fsm_prev_state;
-	SemaphoreHandle_t st_semaphor;
+struct ib_reader;
+
+/** \brief A key decision: request to the worker and the verdict back to the reader.
+ *  Stage latencies in us: read (1-Wire), lookup (database), schedule (cron check),
+ *  relay (verdict arrived until the FSM switched the outputs).
+ * */
+typedef struct ib_decision {
+	struct ib_reader *reader;
+	/** Sequence id, the verdict is fed to the FSM only when it belongs to the pending decision. */
+	uint32_t seq;
+	uint64_t code;
+	/** Log file is full, only log the touch. */
+	int log_full;
+	ib_fsm_input_t verdict;
+	int64_t verdict_at_us;
+	uint32_t read_us;
+	uint32_t lookup_us;
+	uint32_t schedule_us;
+	uint32_t relay_us;
+} ib_decision_t;
+
+/** \brief Event types of the reader task. */
+typedef enum ib_event_type {
+	/** Falling edge on the data line: a key contacted the probe. */
+	EV_TOUCH,
+	/** No event for a while: the data line is polled. */
+	EV_POLL,
+	/** Edge on the button input. */
+	EV_BUTTON,
+	/** 1-Wire read finished. */
+	EV_READ,
+	/** Verdict of the decision worker. */
+	EV_VERDICT,
+	/** Decision deadline expired. */
+	EV_DEADLINE,
+	/** FSM input (timeout, log full, log cleared). */
+	EV_FSM,
+} ib_event_type_t;
+
+/** \brief An event in the input_q of a reader. */
+typedef struct ib_event {
+	ib_event_type_t type;
+	union {
+		ib_read_t read;
+		ib_decision_t decision;
+		ib_fsm_input_t input;
+	};
+} ib_event_t;
+
+/** \brief A reader instance: configuration, FSM state and FreeRTOS handlers. */
+typedef struct ib_reader{
+	int id;
+	const ib_reader_pins_t *pins;
+	ib_conf_t config;
+	ib_bus_t *bus;
+	ib_fsm_t fsm;
 	QueueHandle_t input_q;
 	TaskHandle_t reader_t;
-	TaskHandle_t info_t;
-	QueueHandle_t info_q;
+	ib_pattern_player_t leds;
 	TimerHandle_t timeout_tim;
-} ib_handlers;
+	TimerHandle_t reader_tim;
+	TimerHandle_t deadline_tim;
+	/** Sequence id of the last decision. */
+	uint32_t decision_seq;
+	int decision_pending;
+	int busy_shown;
+	volatile BaseType_t enable_reader;
+} ib_reader_t;
 
 #define ON GPIO_MODE_INPUT
 #define OFF GPIO_MODE_OUTPUT
-#define LED_RED(x)\
-	gpio_set_direction(PIN_RED,x);
-#define LED_GREEN(x)\
-	gpio_set_direction(PIN_GREEN,x);
-
-#define RELAY_OPEN gpio_set_level(PIN_RELAY,1);
-#define RELAY_CLOSE gpio_set_level(PIN_RELAY,0);
-
-
-#define INFO_QUEUE_LENGTH 5
-#define INFO_QUEUE_ITEM_SIZE sizeof(infos_t)
-#define INPUT_QUEUE_LENGTH 1
-#define INPUT_QUEUE_ITEM_SIZE sizeof(inputs_t)
-
-/** MUTEX wait */
-#define MUT_WAIT (100 / portTICK_PERIOD_MS)
-
-/** Basic time in ms */
+#define LED_RED(r, x)\
+	gpio_set_direction((r)->pins->red,x);
+#define LED_GREEN(r, x)\
+	gpio_set_direction((r)->pins->green,x);
+
+/** Traced as point: the relay opened by a key or by the button. */
+#define RELAY_OPEN(r, point)\
+	{ gpio_set_level((r)->pins->relay,1); ib_trace(point, (r)->id); }
+#define RELAY_CLOSE(r) gpio_set_level((r)->pins->relay,0);
+
+
+#define INPUT_QUEUE_LENGTH 8
+#define INPUT_QUEUE_ITEM_SIZE sizeof(ib_event_t)
+/** Pending decisions of all the readers. */
+#define DECISION_QUEUE_LENGTH 4
+#define DECISION_QUEUE_ITEM_SIZE sizeof(ib_decision_t)
+#define READER_TASK_STACK 4096
+#define DECISION_TASK_STACK 4096
+
+/** The reader shows busy when the verdict does not arrive in time, in ms. */
+#define DECISION_DEADLINE_MS 	300
+/** The reader gives up the decision when the verdict does not arrive until this, in ms. */
+#define DECISION_ABANDON_MS 	3000
+
+/** Fallback poll of the data line when no edge arrives, in ms. */
+#define READER_IDLE_POLL_MS 	250
+/** Poll period while a key is on the probe, in ms. */
+#define READER_PRESENT_POLL_MS 	20
+/** Button edges are ignored for this time after a press, in ms. */
+#define BUTTON_DEBOUNCE_MS 		50
+
+/** Wait for a free place in input_q when the event must not be lost, in ms. */
+#define EVENT_POST_WAIT_MS 	1000
+
+/** Basic time in ms, the superuser mode lasts for this time. */
 #define TIMEOUT_BASIC_MS 30000
 
 volatile uint32_t initialized;
 
-ib_conf_t g_config = {
-		.openingtime = STANDARD_OPENING_TIME,
-		.devicename = STANDARD_DEVICE_NAME
+/** \brief Pins of the readers, index is the reader id. */
+static const ib_reader_pins_t READER_PINS[IB_READERS_N] = {
+	{ .data = PIN_DATA, .button = PIN_BUTTON, .red = PIN_RED, .green = PIN_GREEN, .relay = PIN_RELAY },
+#if IB_READERS_N > 1
+	{ .data = PIN_DATA_2, .button = PIN_BUTTON_2, .red = PIN_RED_2, .green = PIN_GREEN_2, .relay = PIN_RELAY_2 },
+#endif
 };
-ib_handlers g_handlers;
 
-volatile BaseType_t g_enable_reader = pdTRUE;
+ib_reader_t g_readers[IB_READERS_N];
 
-volatile uint64_t g_accessed_key_prev;
-volatile uint64_t g_accessed_key;
+IB_TASK_STORAGE(reader_task, READER_TASK_STACK, IB_READERS_N);
+IB_QUEUE_STORAGE(input_q, INPUT_QUEUE_LENGTH, INPUT_QUEUE_ITEM_SIZE, IB_READERS_N);
+IB_TIMER_STORAGE(reader_tim, IB_READERS_N);
+IB_TIMER_STORAGE(timeout_tim, IB_READERS_N);
+IB_TIMER_STORAGE(deadline_tim, IB_READERS_N);
+IB_TASK_STORAGE(decision_task, DECISION_TASK_STACK, 1);
+IB_QUEUE_STORAGE(decision_q, DECISION_QUEUE_LENGTH, DECISION_QUEUE_ITEM_SIZE, 1);
 
-/** addtogroup state_functions
- * @{ */
-static void st_check_touch();
-static void st_wait_for_clear_log();
-static void st_access_allow();
-static void st_su_mode();
-static void st_check_touch();
-/** @} */
+/** Requests of the decision worker. */
+static QueueHandle_t g_decision_q;
 
-static void save_config();
+static void save_config(ib_reader_t *reader);
 
-static void refresh_config() {
+/** \brief NVS key of the reader configuration. */
+static void config_key(ib_reader_t *reader, char *key, size_t size) {
+	if ( reader->id == 0 )
+		snprintf(key, size, "%s", READER_KEY_NVS);
+	else
+		snprintf(key, size, "%s%i", READER_KEY_NVS, reader->id);
+}
+
+static void refresh_config(ib_reader_t *reader) {
 	nvs_handle handl;
 	esp_err_t ret;
-	size_t size = sizeof(g_config);
+	size_t size = sizeof(reader->config);
+	char key[16];
 
+	config_key(reader, key, sizeof(key));
 	ret = nvs_open(READER_NSPACE_NVS, NVS_READONLY, &handl);
 	if ( ret == ESP_OK ) { // Found
-		ret = nvs_get_blob(handl, READER_KEY_NVS, &g_config, &size);
+		ret = nvs_get_blob(handl, key, &reader->config, &size);
 		nvs_close(handl);
 		if ( ret == ESP_OK ) {
-			ESP_LOGI(TAG, "Found configuration in NVS");
+			ESP_LOGI(TAG, "Found configuration of reader %i in NVS", reader->id);
+			return;
 		} else {
 			ESP_LOGE(__func__,"NVS get: %s", esp_err_to_name(ret));
 		}
-		return;
 	} else {
 		ESP_LOGE(__func__,"NVS open: %s", esp_err_to_name(ret));
 	}
-	ESP_LOGI(TAG, "Not found configuration in NVS");
-	g_config.buttonenable = 1;
-	strcpy(g_config.devicename, STANDARD_DEVICE_NAME);
-	g_config.mode = IB_READER_MODE_NORMAL;
-	g_config.openingtime = 3000;
-	g_config.su_key = 0;
-	save_config();
+	ESP_LOGI(TAG, "Not found configuration of reader %i in NVS", reader->id);
+	reader->config.buttonenable = 1;
+	strcpy(reader->config.devicename, STANDARD_DEVICE_NAME);
+	reader->config.mode = IB_READER_MODE_NORMAL;
+	reader->config.openingtime = STANDARD_OPENING_TIME;
+	reader->config.su_key = 0;
+	save_config(reader);
 }
 
 /** \brief Saves the current (ib_conf_t) configurations. */
-static void save_config() {
+static void save_config(ib_reader_t *reader) {
 	nvs_handle handler;
 	esp_err_t ret;
+	char key[16];
+
+	config_key(reader, key, sizeof(key));
 	ret = nvs_open(READER_NSPACE_NVS, NVS_READWRITE, &handler);
 	if ( ret != ESP_OK ) {
 		ESP_ERROR_CHECK(ret);
 		return;
 	}
-	ret = nvs_set_blob(handler, READER_KEY_NVS, &g_config, sizeof(g_config));
+	ret = nvs_set_blob(handler, key, &reader->config, sizeof(reader->config));
 	if ( ret != ESP_OK ) {
 		ESP_ERROR_CHECK(ret);
 		nvs_close(handler);
@@ -195,48 +291,124 @@ static void save_config() {
 		ESP_ERROR_CHECK(ret);
 	}
 	nvs_close(handler);
-	refresh_config();
+}
+
+/** \brief Reader by id.
+ *  \return NULL invalid id
+ * */
+static ib_reader_t *get_reader(int id) {
+	if ( id < 0 || id >= IB_READERS_N ) {
+		ESP_LOGE(TAG, "Invalid reader id:%i", id);
+		return NULL;
+	}
+	return &g_readers[id];
 }
 
 /** \brief Change the device name. */
 void ib_set_device_name(const char *name){
-	strncpy(g_config.devicename, name, 127);
-	save_config();
+	strncpy(g_readers[0].config.devicename, name, 127);
+	save_config(&g_readers[0]);
 }
 /** \brief Change superuser key code. */
-void ib_set_su_key(uint64_t code){
-	g_config.su_key = code;
-	save_config();
+void ib_set_su_key(int id, uint64_t code){
+	ib_reader_t *reader = get_reader(id);
+	if ( !reader )
+		return;
+	reader->config.su_key = code;
+	save_config(reader);
 }
 /** \brief Opening time. */
-void ib_set_opening_time(uint32_t ms){
-	g_config.openingtime = ms;
-	save_config();
+void ib_set_opening_time(int id, uint32_t ms){
+	ib_reader_t *reader = get_reader(id);
+	if ( !reader )
+		return;
+	reader->config.openingtime = ms;
+	save_config(reader);
 }
 /** \brief Change operational mode. */
-void ib_set_mode(uint32_t mode){
+void ib_set_mode(int id, uint32_t mode){
+	ib_reader_t *reader = get_reader(id);
+	if ( !reader )
+		return;
 	if ( mode == IB_READER_MODE_NORMAL ||
 		 mode == IB_READER_MODE_BISTABLE ||
 		 mode == IB_READER_MODE_BISTABLE_SAME_KEY) {
-		g_config.mode = mode;
-		save_config();
+		reader->config.mode = mode;
+		save_config(reader);
 		return;
 	}
 	ESP_LOGE(TAG,"Invalid mode");
 }
 
+/** \brief Post an event to the reader task.
+ *  \return pdTRUE posted
+ * */
+static BaseType_t post_event(ib_reader_t *reader, const ib_event_t *event, TickType_t wait){
+	if ( pdTRUE != xQueueSend(reader->input_q, event, wait) ) {
+		ESP_LOGE(TAG, "Event %i lost, reader %i", event->type, reader->id);
+		return pdFALSE;
+	}
+	return pdTRUE;
+}
+
+static void post_from_isr(ib_reader_t *reader, const ib_event_t *event){
+	BaseType_t woken = pdFALSE;
+	xQueueSendFromISR(reader->input_q, event, &woken);
+	if ( woken == pdTRUE )
+		portYIELD_FROM_ISR();
+}
+
 /** \brief timeout_tim software timer callback function.
- *  Add a input_tout (timeout) to FSM's queue.
+ *  Add a IB_IN_TIMEOUT to FSM's queue.
  * */
 static void timeout_callback(TimerHandle_t timer){
-	inputs_t input = input_tout;
-	xQueueOverwrite(g_handlers.input_q,&input);
+	ib_event_t event = { .type = EV_FSM, .input = IB_IN_TIMEOUT };
+	post_event(pvTimerGetTimerID(timer), &event, 0);
+}
+
+/** \brief Data line falling edge interrupt.
+ *  Disables itself, the reader task enables it again when the probe is free.
+ * */
+static void touch_isr(void *arg){
+	ib_reader_t *reader = arg;
+	ib_event_t event = { .type = EV_TOUCH };
+	ib_trace(IB_TR_TOUCH, reader->id);
+	gpio_intr_disable(reader->pins->data);
+	post_from_isr(reader, &event);
+}
+
+/** \brief Button edge interrupt.
+ *  Disables itself, the reader task enables it again after reading the level.
+ * */
+static void button_isr(void *arg){
+	ib_reader_t *reader = arg;
+	ib_event_t event = { .type = EV_BUTTON };
+	ib_trace(IB_TR_BUTTON, reader->id);
+	gpio_intr_disable(reader->pins->button);
+	post_from_isr(reader, &event);
+}
+
+/** \brief 1-Wire read finished, called from the bus timer interrupt. */
+static void IRAM_ATTR read_done_callback(ib_read_t *result, void *arg){
+	ib_reader_t *reader = arg;
+	ib_event_t event = { .type = EV_READ, .read = *result };
+	BaseType_t woken = pdFALSE;
+	xQueueSendFromISR(reader->input_q, &event, &woken);
+	if ( woken == pdTRUE )
+		portYIELD_FROM_ISR();
+}
+
+/** \brief Decision deadline timer callback. */
+static void deadline_callback(TimerHandle_t timer){
+	ib_event_t event = { .type = EV_DEADLINE };
+	post_event(pvTimerGetTimerID(timer), &event, 0);
 }
 
 /** \brief Called by the reader disable timer.
  * */
 static void reader_enable_callback(TimerHandle_t timer){
-	g_enable_reader = pdTRUE;
+	ib_reader_t *reader = pvTimerGetTimerID(timer);
+	reader->enable_reader = pdTRUE;
 }
 
 /** \brief Check su enable pin. */	// TODO not implemented.
@@ -245,107 +417,359 @@ static int is_su_mode_enable(){
 }
 
 /** \brief Makes FSM input. (FreeRTOS timer) */
-static void timeout_set(int ms){
-	xTimerStop(g_handlers.timeout_tim, 0);
-	xTimerChangePeriod(g_handlers.timeout_tim,
+static void timeout_set(ib_reader_t *reader, int ms){
+	xTimerStop(reader->timeout_tim, 0);
+	xTimerChangePeriod(reader->timeout_tim,
 						ms / portTICK_RATE_MS,
 						0);
-	xTimerStart(g_handlers.timeout_tim, 0);
+	xTimerStart(reader->timeout_tim, 0);
 }
 
-/** \brief Change the reader LED's. */
-static void send_info(infos_t info){
-	xQueueSend(g_handlers.info_q,&info,0);
-	timeout_set(TIMEOUT_BASIC_MS);
+/** \brief Output of the LED player. */
+static void led_output(void *arg, uint8_t leds){
+	ib_reader_t *reader = arg;
+	LED_RED(reader, (leds & IB_LED_RED) ? ON : OFF);
+	LED_GREEN(reader, (leds & IB_LED_GREEN) ? ON : OFF);
 }
 
-/** \brief Change the FSM state.
- * 	Using MUTEX.
- *  */
-static void switch_state_to( p_state_handler new_state, TickType_t wait){
-	if ( xSemaphoreTake(g_handlers.st_semaphor, wait) == pdTRUE ) {
-		g_handlers.fsm_prev_state = g_handlers.fsm_state;
-		g_handlers.fsm_state = new_state;
-		xSemaphoreGive(g_handlers.st_semaphor);
-	} else {
-		ESP_LOGW(TAG, "Could not change state");
+/** \brief Do the actions of an FSM transition on the outputs.
+ *  \param input of the transition, the relay open is traced by its cause
+ * */
+static void fsm_apply(ib_reader_t *reader, uint16_t actions, ib_fsm_input_t input){
+	if ( actions & (IB_ACT_LED_IDLE | IB_ACT_LED_ACCESS | IB_ACT_LED_BOTH) )
+		ib_pattern_stop(&reader->leds, IB_PAT_PRIO_FEEDBACK);	// The new state is not hidden by a feedback.
+	if ( actions & IB_ACT_RELAY_CLOSE )
+		RELAY_CLOSE(reader);
+	if ( actions & IB_ACT_RELAY_OPEN )
+		RELAY_OPEN(reader, (input == IB_IN_BUTTON) ? IB_TR_BUTTON_OPEN : IB_TR_RELAY_OPEN);
+	if ( actions & IB_ACT_LED_IDLE )
+		ib_pattern_set_base(&reader->leds, IB_LED_RED);
+	if ( actions & IB_ACT_LED_ACCESS )
+		ib_pattern_set_base(&reader->leds, IB_LED_GREEN);
+	if ( actions & IB_ACT_LED_BOTH )
+		ib_pattern_set_base(&reader->leds, IB_LED_BOTH);
+	if ( actions & IB_ACT_DENY )
+		ib_pattern_play(&reader->leds, IB_PAT_DENY);
+	if ( actions & IB_ACT_INFO_NONE )
+		ib_pattern_stop(&reader->leds, IB_PAT_PRIO_STATE);
+	if ( actions & IB_ACT_INFO_SU )
+		ib_pattern_play(&reader->leds, IB_PAT_SU);
+	if ( actions & IB_ACT_INFO_LOG_FULL )
+		ib_pattern_play(&reader->leds, IB_PAT_LOG_FULL);
+	if ( actions & IB_ACT_TIMEOUT )
+		timeout_set(reader, reader->config.openingtime);
+	if ( actions & IB_ACT_TIMEOUT_SU )
+		timeout_set(reader, TIMEOUT_BASIC_MS);
+	if ( actions & IB_ACT_LOG_DELETE ) {
+		ibd_log_delete();
+		ib_pattern_set_status(IB_STATUS_LOG_NEARLY_FULL, 0);
+		ib_not_need_su_touch();		// Queued, the FSM is not re-entered
+	}
+}
+
+/** \brief Feed an input to the FSM. Only the reader task calls it. */
+static void fsm_input(ib_reader_t *reader, ib_fsm_input_t input, uint64_t key){
+	const ib_fsm_event_t event = { .input = input, .key = key };
+	const ib_fsm_ctx_t ctx = { .mode = reader->config.mode, .su_enabled = is_su_mode_enable() };
+	const ib_fsm_state_t from = reader->fsm.state;
+	uint16_t actions;
+
+	actions = ib_fsm_step(&reader->fsm, &event, &ctx);
+	if ( from != reader->fsm.state )
+		ESP_LOGD(TAG, "Reader %i: %s -%s-> %s", reader->id, ib_fsm_state_name(from),
+				ib_fsm_input_name(input), ib_fsm_state_name(reader->fsm.state));
+	fsm_apply(reader, actions, input);
+}
+
+/** \brief Log the start of a lockout. */
+static void log_lockout(ib_throttle_ret_t thr, uint64_t code, uint8_t reader){
+	ib_log_t msg = { .log_type = IB_LOG_KEY_LOCKOUT, .reader = reader };
+	if ( thr != IB_THR_LOCKOUT_CODE && thr != IB_THR_LOCKOUT_GLOBAL )
+		return;
+	msg.value = (thr == IB_THR_LOCKOUT_GLOBAL) ? IB_THROTTLE_GLOBAL_CODE : code;
+	ESP_LOGW(TAG, "Lockout of %s", (thr == IB_THR_LOCKOUT_GLOBAL) ? "the unknown keys" : "a key");
+	ib_log_post(&msg);
+}
+
+/** \brief Log the ended lockouts with their number of denied touches. */
+static void log_lockouts_ended(){
+	ib_throttle_report_t report;
+	ib_log_t msg = { .log_type = IB_LOG_KEY_LOCKOUT_END };
+	while ( ib_thr_expired(&report) ) {
+		msg.value = report.code;
+		msg.reader = report.reader;
+		msg.count = report.suppressed;
+		ib_log_post(&msg);
 	}
 }
 
 /** \brief Search key and check its cron.
+ *  Runs in the decision worker, measures the lookup and the schedule stages.
+ *  A locked out key is denied without lookup and log message (ib_throttle),
+ *  during a global lockout the keys are looked up but the misses are not logged, the codes which missed
+ *  in the current database are not looked up again and the other scans are paced (ib_thr_pace()).
+ *  The superuser key is never throttled.
+ *  While the time is not synchronized, the schedule is decided by the ib_clock policy.
+ *  A verdict cached until the next change of the schedule (ib_schedule) is used without lookup.
  *  \return 0 key is not in the database or out of the time domains
  *  \return 1 access allow
  * */
-static int key_code_lookup(uint64_t code){
+static int key_code_lookup(ib_decision_t *decision){
 	esp_err_t ret, retval;
 	ib_data_t *data = NULL;
-	time_t time_raw;
 	struct tm time_info;
+	time_t now;
 	char *type = NULL;
-
-	time(&time_raw);
-	localtime_r(&time_raw, &time_info);
-
-	if ( ib_waiting_for_su_touch() ) {
+	int64_t t_start, t_found;
+	int allowed, expired = 0;
+	uint32_t generation;
+	ib_clock_eval_t eval;
+	ib_throttle_ret_t thr = IB_THR_PASS;
+	const int su = (decision->code == decision->reader->config.su_key);
+	const uint32_t db_generation = ibd_generation();		// Before the scan, a miss belongs to it
+
+	if ( decision->log_full ) {
 		type = IB_LOG_LOG_FILE_FULL;
 		retval = 0;
+	} else if ( !su && (thr = ib_thr_check(decision->code, db_generation)) == IB_THR_LOCKED ) {
+		ESP_LOGD(TAG, "Key locked out");
+		ib_metric_inc(IB_M_DENIED_LOCKOUT);
+		return 0;
 	} else {
-		ret = ibd_get_by_code(code, &data);
-		if( ret == IBD_FOUND ) { // @suppress("Assignment in condition")
-			if ( !data ) {
+		t_start = esp_timer_get_time();
+		eval = ib_clock_eval(&now, &time_info);
+		generation = ibd_generation() + ib_cal_generation();
+		if ( thr == IB_THR_MISSED ) {
+			ret = IBD_ERR_NOT_FOUND;		// Missed in this database, not scanned again
+		} else if ( eval == IB_CLOCK_EVAL && ib_schedule_cached(decision->code, now, generation, &allowed) ) {
+			ret = IBD_FOUND;
+			ib_metric_inc(IB_M_VERDICT_CACHED);
+		} else {
+			if ( thr == IB_THR_QUIET )
+				ib_thr_pace();
+			ret = ibd_get_by_code(decision->code, &data);
+			if ( ret == IBD_FOUND && !data ) {
 				ESP_LOGE(__func__, "Object ptr null");
 				return 0;
 			}
-			if ( checkcrons(data->crons, &time_info) ) {
+		}
+		t_found = esp_timer_get_time();
+		decision->lookup_us = (uint32_t)(t_found - t_start);
+		if( ret == IBD_FOUND ) { // @suppress("Assignment in condition")
+			ib_trace(IB_TR_CRON_START, decision->reader->id);
+			if ( data ) {
+				switch ( eval ) {
+					case IB_CLOCK_EVAL:
+						expired = !ibd_valid_at(data, now);
+						allowed = expired ? 0 : ib_schedule_check(data, now, &time_info, generation);
+						break;
+					case IB_CLOCK_ALLOW:
+						allowed = 1;
+						break;
+					default:
+						allowed = 0;
+						break;
+				}
+			}
+			ib_trace(IB_TR_CRON_END, decision->reader->id);
+			if ( allowed ) {
 				type = IB_LOG_KEY_ACCESS_GAINED;
-				ESP_LOGI(TAG, "Key gained access");
+				ESP_LOGI(TAG, "Key gained access on reader %i", decision->reader->id);
+				ib_metric_inc(IB_M_GRANTED);
 				retval = 1;
+			} else if ( expired ) {
+				type = IB_LOG_KEY_EXPIRED;
+				ESP_LOGW(TAG, "Key outside of its validity");
+				ib_metric_inc(IB_M_DENIED_EXPIRED);
+				retval = 0;
 			} else {
 				type = IB_LOG_KEY_OUT_OF_DOMAIN;
 				ESP_LOGW(TAG, "Key out of time-domain");
+				ib_metric_inc(IB_M_DENIED_SCHEDULE);
 				retval = 0;
 			}
+			decision->schedule_us = (uint32_t)(esp_timer_get_time() - t_found);
+			ib_pool_free(data);
 		}
 		else if(ret == IBD_ERR_NOT_FOUND) {
 			type = IB_LOG_KEY_INVALID_KEY_TOUCH;
-			ESP_LOGW(__func__,"Key not found!");
+			ib_metric_inc(IB_M_DENIED_UNKNOWN);
 			retval = 0;
+			if ( !su )
+				log_lockout(ib_thr_miss(decision->code, decision->reader->id, db_generation),
+						decision->code, decision->reader->id);
+			if ( thr == IB_THR_QUIET || thr == IB_THR_MISSED )
+				return 0;		// Counted in the global lockout
+			ESP_LOGW(__func__,"Key not found!");
 		}
 		else {
 			ESP_LOGW(__func__,"ibd_get_by_code errcode:%x",ret);
 			return 0;
 		}
 	}
-	ib_log_t msg = { .log_type = type, .value = code};
+	ib_log_t msg = { .log_type = type, .value = decision->code, .reader = decision->reader->id };
 	ib_log_post(&msg);
 	return retval;
 }
 
+/** \brief Decision worker task.
+ *
+ *  Takes the codes of the touched keys from g_decision_q, looks them up
+ * and sends the verdict (IB_IN_TOUCHED, IB_IN_SU_TOUCHED or IB_IN_INVALID)
+ * back to the input_q of the reader. The slow database scan does not block the readers.
+ *  While a lockout is running, it wakes up at its end to log it.
+ * */
+static void ib_decision_task(void *pvParam){
+	ib_event_t event = { .type = EV_VERDICT };
+	ib_decision_t *decision = &event.decision;
+	ib_reader_t *reader;
+	uint32_t lockout_ms;
+	TickType_t wait;
+	int64_t start;
+
+	while(1){
+		wait = ib_thr_next_expiry(&lockout_ms) ? pdMS_TO_TICKS(lockout_ms) + 1 : portMAX_DELAY;
+		if(pdTRUE != xQueueReceive(g_decision_q, decision, wait)){
+			log_lockouts_ended();
+			continue;
+		}
+		reader = decision->reader;
+		ib_trace_set_current(reader->id);
+		start = esp_timer_get_time();
+		if (key_code_lookup(decision))
+			decision->verdict = IB_IN_TOUCHED;
+		else if (decision->code == reader->config.su_key)
+			decision->verdict = IB_IN_SU_TOUCHED;
+		else
+			decision->verdict = IB_IN_INVALID;
+		decision->verdict_at_us = esp_timer_get_time();
+		ib_metric_observe(IB_H_DECISION_US, (uint32_t)(decision->verdict_at_us - start));
+		post_event(reader, &event, portMAX_DELAY);		// The reader task always drains its queue
+	}
+}
+
 /** \brief Called when a key has been touched.
  *
- *  It looks up the key in the database
- * and makes a decision which input must be generated.
- * Put an input related to the return of key_code_lookup function.
+ *  Hands the code to the decision worker and starts the deadline timer.
+ *  When the worker queue is full, the touch is dropped and busy is shown.
  * */
-static void key_touched_event(uint64_t code){
-	inputs_t input;
+static void key_touched_event(ib_reader_t *reader, uint64_t code, uint32_t read_us){
+	ib_decision_t decision = {
+		.reader = reader,
+		.seq = reader->decision_seq + 1,
+		.code = code,
+		.log_full = (reader->fsm.state == IB_ST_LOG_FULL),
+		.read_us = read_us,
+	};
+
+	ib_trace(IB_TR_KEY_EVENT, reader->id);
+	ib_metric_inc(IB_M_TOUCHES);
+	if(pdTRUE != xQueueSend(g_decision_q, &decision, 0)){
+		ESP_LOGW(TAG, "Decision queue full, reader %i", reader->id);
+		ib_metric_inc(IB_M_DECISION_DROPS);
+		ib_pattern_play(&reader->leds, IB_PAT_BUSY);
+		reader->busy_shown = 1;
+		return;
+	}
+	reader->decision_seq = decision.seq;
+	reader->decision_pending = 1;
+	xTimerChangePeriod(reader->deadline_tim, pdMS_TO_TICKS(DECISION_DEADLINE_MS), 0);
+}
 
-	if (key_code_lookup(code)) {
-		g_accessed_key = code;
-		input = input_touched;
+/** \brief The verdict arrived, feed it to the FSM.
+ *  The verdict of an abandoned decision is dropped.
+ * */
+static void verdict_event(ib_reader_t *reader, ib_decision_t *decision){
+	if ( !reader->decision_pending || decision->seq != reader->decision_seq ) {
+		ESP_LOGW(TAG, "Late verdict dropped, reader %i", reader->id);
+		return;
 	}
-	else if (code == g_config.su_key){
-		input = input_su_touched;
-	} else {
-		input = input_invalid_touched;
+	ib_trace(IB_TR_VERDICT, reader->id);
+	xTimerStop(reader->deadline_tim, 0);
+	reader->decision_pending = 0;
+	if ( reader->busy_shown ) {
+		reader->busy_shown = 0;
+		ib_pattern_stop(&reader->leds, IB_PAT_PRIO_FEEDBACK);
 	}
-	xQueueSend(g_handlers.input_q,&input,0);
+	fsm_input(reader, decision->verdict, decision->code);
+	ib_trace(IB_TR_FSM, reader->id);
+	decision->relay_us = (uint32_t)(esp_timer_get_time() - decision->verdict_at_us);
+	ESP_LOGI(TAG, "Decision reader:%i read:%u lookup:%u schedule:%u relay:%u us",
+			reader->id, decision->read_us, decision->lookup_us,
+			decision->schedule_us, decision->relay_us);
 }
 
+/** \brief The verdict is late.
+ *  First busy is shown, at DECISION_ABANDON_MS the decision is abandoned, so the reader takes
+ *  the touches again. Its verdict is dropped when it arrives later.
+ * */
+static void deadline_event(ib_reader_t *reader){
+	if( !reader->decision_pending )
+		return;
+	if( !reader->busy_shown ){
+		ESP_LOGW(TAG, "Decision late, reader %i", reader->id);
+		ib_pattern_play(&reader->leds, IB_PAT_BUSY);
+		reader->busy_shown = 1;
+		xTimerChangePeriod(reader->deadline_tim,
+				pdMS_TO_TICKS(DECISION_ABANDON_MS - DECISION_DEADLINE_MS), 0);
+		return;
+	}
+	ESP_LOGE(TAG, "Decision abandoned, reader %i", reader->id);
+	ib_metric_inc(IB_M_DECISION_ABANDONED);
+	ib_trace(IB_TR_NO_DECISION, reader->id);
+	reader->decision_pending = 0;
+	reader->busy_shown = 0;
+	ib_pattern_stop(&reader->leds, IB_PAT_PRIO_FEEDBACK);
+}
+
+/** \brief Process a finished read of the 1-Wire bus.
+ *  \param read result posted by the bus engine
+ *  \return 1 a device is on the probe
+ *  \return 0 no device
+ * */
+static int read_event(ib_reader_t *reader, ib_read_t *read, uint32_t read_us, int traced){
+	int decided = 0;
+
+	if(read->ret == IB_NO_DEVICE || read->ret == IB_SHORT){
+		if( traced )
+			ib_trace(IB_TR_NO_DECISION, reader->id);
+		return 0;
+	}
+	if(pdTRUE == reader->enable_reader){
+		switch (read->ret) {
+			case IB_OK:
+				ESP_LOGD(TAG,"READ: Reader: %i Code: %llu Devices: %i",reader->id,read->code,read->devices);
+				if ( reader->decision_pending )
+					break;
+				if(pdPASS == xTimerReset(reader->reader_tim,0))
+					reader->enable_reader = pdFALSE;
+				key_touched_event(reader, read->code, read_us);
+				decided = 1;
+				break;
+			case IB_FAM_ERR:
+				ESP_LOGD(TAG,"Family code");
+				break;
+			case IB_CRC_ERR:
+				ESP_LOGD(TAG,"Invalid crc");
+				break;
+			default:
+				break;
+		}
+	}
+	if( traced && !decided )
+		ib_trace(IB_TR_NO_DECISION, reader->id);
+	if(pdFAIL == xTimerReset(reader->reader_tim,0))
+		reader->enable_reader = pdTRUE;
+	return 1;
+}
 
 /** \brief Task function of iButton reader module.
+ *  Every reader has its own task, pvParam is the ib_reader_t.
  *
- *  Checks the button state then reads the iButton reader.
+ *  The task sleeps on its event queue (input_q): an edge on the data line or on the button,
+ *  a finished read, a verdict or an FSM input. When no event arrives, the data line is polled with
+ *  a low rate (READER_IDLE_POLL_MS), while a key is on the probe it is polled with READER_PRESENT_POLL_MS.
+ *  The read is performed by the 1-Wire engine in the background, its result arrives as EV_READ.
  *  It ensures that the touched iButton will generate an input which type
  * depends on the key whether has a right to access or not.
  *  After a successful key reading, the reader will be disabled for a defined time
@@ -353,382 +777,232 @@ static void key_touched_event(uint64_t code){
  * To enable the reader again, the key has to disconnect for the defined time.
  * */
 static void ib_reader_task(void *pvParam){
+	ib_reader_t *reader = pvParam;
+	const ib_reader_pins_t *pins = reader->pins;
 
-	g_handlers.fsm_state = st_check_touch;
-	LED_RED(ON);
-	LED_GREEN(OFF);
+	ib_pattern_set_base(&reader->leds, IB_LED_RED);
 
-	TimerHandle_t reader_tim = xTimerCreate("reader timer",
-			READER_DISABLE_TICKS, pdFALSE, 0, reader_enable_callback);
-	g_handlers.timeout_tim = xTimerCreate("timeout alarm",
-				30000, pdFALSE, 0, timeout_callback);
+	reader->reader_tim = IB_TIMER_CREATE(reader_tim, reader->id, "reader timer",
+			READER_DISABLE_TICKS, pdFALSE, reader, reader_enable_callback);
+	reader->timeout_tim = IB_TIMER_CREATE(timeout_tim, reader->id, "timeout alarm",
+				30000, pdFALSE, reader, timeout_callback);
+	reader->deadline_tim = IB_TIMER_CREATE(deadline_tim, reader->id, "decision deadline",
+				pdMS_TO_TICKS(DECISION_DEADLINE_MS), pdFALSE, reader, deadline_callback);
 
-	uint64_t ibutton_code;
-	inputs_t input_incoming;
+	ib_event_t event;
+	int64_t read_started_us = 0;
 	int button_prev_state = 0;
+	int key_present = 0;
+	int reading = 0;
+	int traced = 0;
+	TickType_t button_pressed_at = 0;
+	TickType_t wait;
 
 	vTaskDelay(100 / portTICK_PERIOD_MS); 		// Button capacitance!
+	gpio_intr_enable(pins->button);
+	event.type = EV_POLL;
 	while(1){
-		if( !gpio_get_level(PIN_BUTTON)){
-			if(!button_prev_state){
-				g_handlers.fsm_state(input_button);
-				ESP_LOGD(TAG,"Button pressed");
-			}
-			button_prev_state = 1;
-		}
-		else if(ib_presence()){
-			if(pdTRUE == g_enable_reader){
-				switch (ib_read_code(&ibutton_code)) {
-					case IB_OK:
-						ESP_LOGD(TAG,"READ: Code: %llu",ibutton_code);
-						if(pdPASS == xTimerReset(reader_tim,0))
-							g_enable_reader = pdFALSE;
-							key_touched_event(ibutton_code);
-						break;
-					case IB_FAM_ERR:
-						ESP_LOGD(TAG,"Family code");
-
-						break;
-					case IB_CRC_ERR:
-						ESP_LOGD(TAG,"Invalid crc");
-						break;
-					default:
-						break;
+		switch ( event.type ) {
+			case EV_BUTTON:
+				if( !gpio_get_level(pins->button) ){
+					if( !button_prev_state &&
+							(xTaskGetTickCount() - button_pressed_at) >= pdMS_TO_TICKS(BUTTON_DEBOUNCE_MS) ){
+						button_pressed_at = xTaskGetTickCount();
+						fsm_input(reader, IB_IN_BUTTON, 0);
+						ESP_LOGD(TAG,"Button pressed");
+					}
+					button_prev_state = 1;
 				}
-			}
-			if(pdFAIL == xTimerReset(reader_tim,0))
-				g_enable_reader = pdTRUE;
-		}
-		else
-			button_prev_state = 0;
-
-		if(pdTRUE == xQueueReceive(g_handlers.input_q, &input_incoming, 10 / portTICK_RATE_MS) )
-			g_handlers.fsm_state(input_incoming);
-	}
-}
-/** \brief Outputs information for users.
- * Blink or change the lighting LEDs on the reader.
- * The task waits in the blocked state until incoming a command to change information output.
- *  */
-static void ib_info_task(void *pvParam){
-	infos_t info_state = blink_none;
-	int delay_ms = 500;
-	gpio_mode_t led_out_state = GPIO_MODE_OUTPUT;
-	while(1){
-		if(blink_none == info_state){
-			if(pdPASS == xQueueReceive(g_handlers.info_q,&info_state,portMAX_DELAY)){
-				led_out_state = GPIO_MODE_OUTPUT;
-				ESP_LOGD(TAG,"infoqueue got");
-			}
-		}
-		else{
-			if(pdPASS == xQueueReceive(g_handlers.info_q,&info_state,delay_ms / portTICK_RATE_MS)){
-				led_out_state = GPIO_MODE_OUTPUT;
-				ESP_LOGD(TAG,"infoqueue got during blinking");
-			}
-			ESP_LOGD(TAG,"Time to blink it");
-		}
-		switch(info_state) {
-			case blink_both:
-				LED_RED(led_out_state);
-				LED_GREEN(led_out_state);
-				delay_ms = 500;
+				else
+					button_prev_state = 0;
+				gpio_intr_enable(pins->button);
 				break;
-			case blink_green:
-				LED_GREEN(led_out_state);
-				delay_ms = 500;
+			case EV_TOUCH:
+			case EV_POLL:
+				if( reading || button_prev_state )
+					break;
+				gpio_intr_disable(pins->data);	// The engine pulls the line too.
+				traced = (event.type == EV_TOUCH);	// The polls would flood the trace ring
+				if( traced )
+					ib_trace(IB_TR_READ_START, reader->id);
+				if( !ib_read_start(reader->bus, traced) ) {
+					reading = 1;
+					read_started_us = esp_timer_get_time();
+				} else if( traced ) {
+					ib_trace(IB_TR_NO_DECISION, reader->id);
+				}
 				break;
-			case blink_red:
-				LED_RED(led_out_state);
-				delay_ms = 500;
+			case EV_READ:
+				key_present = read_event(reader, &event.read,
+						(uint32_t)(esp_timer_get_time() - read_started_us), traced);
+				reading = 0;
+				if( !key_present )
+					gpio_intr_enable(pins->data);
 				break;
-			case blink_both2:
-				LED_GREEN(led_out_state);
-				if(led_out_state == ON){
-					LED_RED(OFF);
-				}
-				else{
-					LED_RED(ON);
-				}
-				delay_ms = 250;
+			case EV_VERDICT:
+				verdict_event(reader, &event.decision);
+				break;
+			case EV_DEADLINE:
+				deadline_event(reader);
+				break;
+			case EV_FSM:
+				fsm_input(reader, event.input, 0);
 				break;
 			default:
 				break;
 		}
-		led_out_state = (led_out_state == ON) ? OFF : ON;
+
+		wait = key_present ? pdMS_TO_TICKS(READER_PRESENT_POLL_MS) : pdMS_TO_TICKS(READER_IDLE_POLL_MS);
+		if( pdFALSE == xQueueReceive(reader->input_q, &event, wait) )
+			event.type = EV_POLL;		// Fallback poll
 	}
 }
 
-/** \brief Creates two tasks. */
-static void create_tasks(){
+/** \brief Creates the queues of a reader. */
+static void create_queues(ib_reader_t *reader){
+
+	reader->input_q = IB_QUEUE_CREATE(input_q, reader->id);
+	if(reader->input_q == 0)
+		ESP_LOGE(__func__,"input_q queue create err");
 
-	g_handlers.info_q = xQueueCreate(INFO_QUEUE_LENGTH,INFO_QUEUE_ITEM_SIZE);
-	if(g_handlers.info_q == 0)
-		ESP_LOGE(__func__,"info_q queue create err");
+}
 
-	g_handlers.input_q = xQueueCreate(INPUT_QUEUE_LENGTH,INPUT_QUEUE_ITEM_SIZE);
-		if(g_handlers.info_q == 0)
-			ESP_LOGE(__func__,"input_q queue create err");
+/** \brief Creates the task of a reader. */
+static void create_tasks(ib_reader_t *reader){
+	char task_name[configMAX_TASK_NAME_LEN];
 
-	const char task_name[] = "ibutton reader task";
-	if(xTaskCreate(ib_reader_task, task_name, 4096,
-			0, 7, &g_handlers.reader_t) != pdPASS){
+	snprintf(task_name, sizeof(task_name), "ib reader %i", reader->id);
+	if(IB_TASK_CREATE(reader_task, reader->id, ib_reader_task, task_name,
+			reader, 7, &reader->reader_t) != pdPASS){
 		ESP_LOGE(__func__,"'%s' cannot be created",task_name);
 	}
-	const char task2_name[] = "ibutton info task";
-	if(xTaskCreate(ib_info_task, task2_name, 4096,
-			0, 7, &g_handlers.info_t) != pdPASS){
-		ESP_LOGE(__func__,"'%s' cannot be created",task2_name);
-	}
 }
 
-static void gpio_set(){
-	gpio_pad_select_gpio(PIN_BUTTON);
-	gpio_set_level(PIN_BUTTON, 1);
-	gpio_set_direction(PIN_BUTTON, GPIO_MODE_INPUT);
-	gpio_set_pull_mode(PIN_BUTTON, GPIO_PULLUP_ONLY);
+static void gpio_set(ib_reader_t *reader){
+	const ib_reader_pins_t *pins = reader->pins;
 
-	gpio_pad_select_gpio(PIN_RELAY);
-	gpio_set_direction(PIN_RELAY, GPIO_MODE_OUTPUT);
-	gpio_set_level(PIN_RELAY, 0);
+	gpio_pad_select_gpio(pins->button);
+	gpio_set_level(pins->button, 1);
+	gpio_set_direction(pins->button, GPIO_MODE_INPUT);
+	gpio_set_pull_mode(pins->button, GPIO_PULLUP_ONLY);
+	gpio_set_intr_type(pins->button, GPIO_INTR_ANYEDGE);
+	gpio_isr_handler_add(pins->button, button_isr, reader);
+	gpio_intr_disable(pins->button);
 
-	gpio_pad_select_gpio(PIN_GREEN);
-	gpio_set_direction(PIN_GREEN, GPIO_MODE_INPUT);
-	gpio_set_level(PIN_GREEN, 0);
+	gpio_pad_select_gpio(pins->relay);
+	gpio_set_direction(pins->relay, GPIO_MODE_OUTPUT);
+	gpio_set_level(pins->relay, 0);
 
-	gpio_pad_select_gpio(PIN_RED);
-	gpio_set_direction(PIN_RED, GPIO_MODE_INPUT);
-	gpio_set_level(PIN_RED, 0);
+	gpio_pad_select_gpio(pins->green);
+	gpio_set_direction(pins->green, GPIO_MODE_INPUT);
+	gpio_set_level(pins->green, 0);
 
-	gpio_pad_select_gpio(PIN_SU_ENABLE);
-	gpio_set_level(PIN_SU_ENABLE, 1);
-	gpio_set_direction(PIN_SU_ENABLE, GPIO_MODE_INPUT);
-	gpio_set_pull_mode(PIN_SU_ENABLE, GPIO_PULLUP_ONLY);
+	gpio_pad_select_gpio(pins->red);
+	gpio_set_direction(pins->red, GPIO_MODE_INPUT);
+	gpio_set_level(pins->red, 0);
 }
 
 /** \brief Returns the current device name. */
 char *ib_get_device_name() {
-	return g_config.devicename;
+	return g_readers[0].config.devicename;
 }
 
-/** \brief Starts an iButton reader module.
+/** \brief Starts the iButton reader module with all the readers.
  * */
 void start_ib_reader(){
+	ib_reader_t *reader;
+
 	if(initialized){
 		ESP_LOGW(__func__, "Already initialized");
 		return;
 	}
 
-	gpio_set();
-	refresh_config();
-	onewire_init(PIN_DATA);
-	create_tasks();
-	g_handlers.st_semaphor = xSemaphoreCreateMutex();
-	initialized = 1;
-}
-
-/** \brief Is FSM in the error state? */
-int ib_waiting_for_su_touch() {
-	return (g_handlers.fsm_state == st_wait_for_clear_log) ? 1 : 0;
-}
-
-/** \brief Wait for superuser touch intervention.
- *	Bring the device into a waiting state. Used when logfile is full.
- * */
-void ib_need_su_touch() {
-	RELAY_CLOSE;
-	LED_GREEN(ON);
-	LED_RED(ON);
-	send_info(blink_both);
-	switch_state_to(st_wait_for_clear_log, portMAX_DELAY);
-}
+	gpio_install_isr_service(0);
+	gpio_pad_select_gpio(PIN_SU_ENABLE);
+	gpio_set_level(PIN_SU_ENABLE, 1);
+	gpio_set_direction(PIN_SU_ENABLE, GPIO_MODE_INPUT);
+	gpio_set_pull_mode(PIN_SU_ENABLE, GPIO_PULLUP_ONLY);
 
-/** \brief Go back to normal operation. */
-void ib_not_need_su_touch() {
-	LED_GREEN(OFF);
-	LED_RED(ON);
-	switch_state_to(st_check_touch, portMAX_DELAY);
-}
-/** ___________________________________________________________________________________________________  */
-/** @ingroup state_functions
- *  This is a special state, when the iButton reader is turned down: All access denied.
- *  Used in case of fatal error.
- * */
-static void st_wait_for_clear_log(inputs_t input) {
-	switch (input) {
-		case input_su_touched:
-			LED_GREEN(OFF);
-			LED_RED(ON);
-			switch_state_to(st_check_touch, MUT_WAIT);
-			ibd_log_delete();
-			break;
-		case input_button:
-			RELAY_OPEN;
-			timeout_set(g_config.openingtime);
-			break;
-		case input_tout:
-			RELAY_CLOSE;
-			break;
-		default:
-			break;
+	ib_thr_init();
+	g_decision_q = IB_QUEUE_CREATE(decision_q, 0);
+	if(g_decision_q == 0)
+		ESP_LOGE(__func__,"decision queue create err");
+	if(IB_TASK_CREATE(decision_task, 0, ib_decision_task, "ib decision",
+			NULL, 6, NULL) != pdPASS){
+		ESP_LOGE(__func__,"'ib decision' cannot be created");
 	}
-}
-
-/** @ingroup state_functions
- *  Open relay, access gained.
- * */
-static void st_access_allow(inputs_t input) {
-	switch (input) {
-		case input_tout:
-			LED_GREEN(OFF);
-			LED_RED(ON);
-			RELAY_CLOSE;
-			infos_t info = blink_none;
-			send_info(info);
-			switch_state_to(g_handlers.fsm_prev_state, MUT_WAIT);
-			break;
-		default:
-			break;
+	ib_pattern_init();
+
+	for ( int i = 0; i < IB_READERS_N; i++ ) {
+		reader = &g_readers[i];
+		reader->id = i;
+		reader->pins = &READER_PINS[i];
+		reader->enable_reader = pdTRUE;
+		gpio_set(reader);
+		refresh_config(reader);
+		create_queues(reader);
+		ib_fsm_init(&reader->fsm);
+		ib_pattern_player_init(&reader->leds, led_output, reader);
+		ib_pattern_add(&reader->leds);
+		reader->bus = onewire_init(reader->pins->data, read_done_callback, reader);
+		if ( !reader->bus ) {
+			ESP_LOGE(__func__, "No bus for reader %i", i);
+			continue;
+		}
+		ib_set_overdrive(reader->bus, READER_OVERDRIVE);
+		gpio_set_intr_type(reader->pins->data, GPIO_INTR_NEGEDGE);
+		gpio_isr_handler_add(reader->pins->data, touch_isr, reader);
+		gpio_intr_disable(reader->pins->data);
+		create_tasks(reader);
 	}
+	initialized = 1;
 }
 
-/** @ingroup state_functions
- *  Access allow in bistable mode.
- *  Any next key touch closes the relay.
+/** \brief Is FSM in the error state?
+ *  \return 1 when any of the readers waits for the superuser.
  * */
-static void st_acces_allow_bistable(inputs_t input) {
-	switch(input) {
-		case input_touched:
-			LED_GREEN(OFF);
-			LED_RED(ON);
-			RELAY_CLOSE;
-			infos_t info = blink_none;
-			send_info(info);
-			switch_state_to(g_handlers.fsm_prev_state, MUT_WAIT);
-			break;
-		default:
-			break;
+int ib_waiting_for_su_touch() {
+	for ( int i = 0; i < IB_READERS_N; i++ ) {
+		if ( g_readers[i].fsm.state == IB_ST_LOG_FULL )
+			return 1;
 	}
+	return 0;
 }
 
-/** @ingroup state_functions
- *  Access allow in bistable mode.
- *  Only that key will close the relay which gained access.
- * */
-static void st_acces_allow_bistable_same_key(inputs_t input) {
-	switch(input) {
-		case input_touched:
-			if ( g_accessed_key == g_accessed_key_prev ) {
-				LED_GREEN(OFF);
-				LED_RED(ON);
-				RELAY_CLOSE;
-				infos_t info = blink_none;
-				send_info(info);
-				switch_state_to(g_handlers.fsm_prev_state, MUT_WAIT);
-			}
-			break;
-		default:
-			break;
+/** \brief Is the caller one of the reader tasks? */
+static int in_reader_task() {
+	const TaskHandle_t self = xTaskGetCurrentTaskHandle();
+	for ( int i = 0; i < IB_READERS_N; i++ ) {
+		if ( g_readers[i].reader_t == self )
+			return 1;
 	}
+	return 0;
 }
 
-/** @ingroup state_functions
- * Super user mode.
+/** \brief Post an FSM input to all the readers, also to the reader of the caller.
+ *  Every FSM is stepped only by its reader task, from its queue.
+ *  A reader task does not wait for a full queue, the other callers wait EVENT_POST_WAIT_MS.
  * */
-static void st_su_mode(inputs_t input) {
-	switch(input) {
-		case input_tout:
-			send_info(blink_none);
-			switch_state_to(st_check_touch, MUT_WAIT);
-			break;
-		default:
-			break;
+static void post_input_all(ib_fsm_input_t input) {
+	const ib_event_t event = { .type = EV_FSM, .input = input };
+	const TickType_t wait = in_reader_task() ? 0 : pdMS_TO_TICKS(EVENT_POST_WAIT_MS);
+	ib_reader_t *reader;
+	for ( int i = 0; i < IB_READERS_N; i++ ) {
+		reader = &g_readers[i];
+		if ( reader->input_q )
+			post_event(reader, &event, wait);
 	}
 }
 
-/** @ingroup state_functions
- *  This state is the standard one.
+/** \brief Wait for superuser touch intervention.
+ *	Bring all the readers into a waiting state. Used when logfile is full.
  * */
-static void st_check_touch(inputs_t input) {
-	switch(input) {
-		case input_su_touched:
-			if(is_su_mode_enable()){
-				send_info(blink_green);
-				switch_state_to(st_su_mode, MUT_WAIT);
-				ESP_LOGD(TAG,"Touched su");
-				break;
-			}
-			else{
-				input = input_touched;
-				// OPEN IT LIKE A NORMAL KEY
-			}
-			/* no break */
-		case input_touched:
-			LED_RED(OFF);
-			LED_GREEN(ON);
-			RELAY_OPEN;
-			switch (g_config.mode) {
-				case IB_READER_MODE_BISTABLE:
-					switch_state_to(st_acces_allow_bistable, MUT_WAIT);
-					break;
-				case IB_READER_MODE_BISTABLE_SAME_KEY:
-					g_accessed_key_prev = g_accessed_key;
-					switch_state_to(st_acces_allow_bistable_same_key, MUT_WAIT);
-					break;
-				default:
-					timeout_set(g_config.openingtime);
-					switch_state_to(st_access_allow, MUT_WAIT);
-					break;
-			}
-			ESP_LOGD(TAG,"Touched");
-			break;
-		case input_invalid_touched:
-			LED_RED(OFF);
-			LED_GREEN(OFF);
-			vTaskDelay(1000 / portTICK_PERIOD_MS);
-			LED_RED(ON);
-			LED_GREEN(OFF);
-			ESP_LOGD(TAG,"Invalid touched");
-			break;
-		case input_button:
-			if ( g_config.mode == IB_READER_MODE_NORMAL ) {
-				LED_RED(OFF);
-				LED_GREEN(ON);
-				RELAY_OPEN;
-				timeout_set(g_config.openingtime);
-				switch_state_to(st_access_allow, MUT_WAIT);
-			}
-			break;
-		default:
-			break;
-	}
+void ib_need_su_touch() {
+	post_input_all(IB_IN_LOG_FULL);
+}
 
+/** \brief Go back to normal operation. */
+void ib_not_need_su_touch() {
+	post_input_all(IB_IN_LOG_CLEARED);
 }
-	/** @} */
 /** @} */
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
@@ -5,7 +5,6 @@
  *      Author: root
  *  @defgroup ib_reader
  *  @{
- *  @defgroup state_functions State functions
  */
 
 #ifndef MAIN_IB_READER_H_
@@ -25,6 +24,10 @@
 
 #define STANDARD_DEVICE_NAME	"iBreader1"
 
+/** Read the keys in overdrive speed. Use it only when the keys support overdrive,
+ *  the reader falls back to standard speed otherwise, which makes every read longer. */
+#define READER_OVERDRIVE 		0
+
 /** Data pin connected to data wire of the iButton reader. */
 #define PIN_DATA 		GPIO_NUM_5
 /** Pushbutton. */
@@ -33,6 +36,18 @@
 #define PIN_GREEN 		GPIO_NUM_23
 #define PIN_RELAY 		GPIO_NUM_19
 #define PIN_SU_ENABLE	GPIO_NUM_15
+
+/** Number of reader instances (e.g. entry and exit probes of a turnstile). Max. IB_BUS_MAX. */
+#ifndef IB_READERS_N
+#define IB_READERS_N 	1
+#endif
+
+/** Pins of the second reader. */
+#define PIN_DATA_2 		GPIO_NUM_4
+#define PIN_BUTTON_2 	GPIO_NUM_21
+#define PIN_RED_2		GPIO_NUM_25
+#define PIN_GREEN_2 	GPIO_NUM_26
+#define PIN_RELAY_2 	GPIO_NUM_27
 /** @} */
 
 /** @defgroup op_modes Operation mode types
@@ -57,9 +72,9 @@ int ib_waiting_for_su_touch();
 
 char *ib_get_device_name();
 void ib_set_device_name(const char* name);
-void ib_set_su_key(uint64_t code);
-void ib_set_opening_time(uint32_t ms);
-void ib_set_mode(uint32_t mode);
+void ib_set_su_key(int id, uint64_t code);
+void ib_set_opening_time(int id, uint32_t ms);
+void ib_set_mode(int id, uint32_t mode);
 
 #endif /* MAIN_IB_READER_H_ */
 
@@ -0,0 +1,222 @@
+/**
+ * ib_schedule.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: root
+ *  @ingroup ib_schedule
+ *  @{
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_console.h"
+#include "esp_log.h"
+#include "argtable3/argtable3.h"
+
+#include "cron.h"
+#include "ib_database.h"
+#include "ib_pool.h"
+#include "ib_clock.h"
+#include "ib_tz.h"
+#include "ib_schedule.h"
+
+#define TAG "IB_SCHEDULE"
+
+static ib_verdict_cache_t g_cache;
+static portMUX_TYPE g_cache_mux = portMUX_INITIALIZER_UNLOCKED;
+
+/** @defgroup verdict_cache Cache
+ * @{ */
+void ib_verdict_init(ib_verdict_cache_t *cache) {
+	memset(cache, 0, sizeof(*cache));
+}
+
+/** \brief Cached verdict of a code.
+ *  \return 1 allowed is set
+ *  \return 0 not cached, or the verdict is not valid now
+ * */
+int ib_verdict_get(ib_verdict_cache_t *cache, uint64_t code, int64_t now, uint32_t generation, int *allowed) {
+	ib_verdict_t *v;
+
+	for ( int i = 0; i < IB_VERDICT_N; i++ ) {
+		v = &cache->entries[i];
+		if ( !v->used || v->code != code )
+			continue;
+		if ( v->generation != generation || now < v->from || now >= v->until ) {
+			v->used = 0;
+			break;
+		}
+		*allowed = v->allowed;
+		cache->stats.hits++;
+		return 1;
+	}
+	cache->stats.misses++;
+	return 0;
+}
+
+/** \brief Cache the verdict of a code, valid from now until until. The oldest entry is replaced. */
+void ib_verdict_put(ib_verdict_cache_t *cache, uint64_t code, int allowed,
+		int64_t now, int64_t until, uint32_t generation) {
+	ib_verdict_t *v = NULL;
+
+	if ( until <= now )
+		return;
+	for ( int i = 0; i < IB_VERDICT_N; i++ ) {
+		if ( cache->entries[i].used && cache->entries[i].code == code ) {
+			v = &cache->entries[i];
+			break;
+		}
+	}
+	if ( !v ) {
+		v = &cache->entries[cache->next];
+		cache->next = (cache->next + 1) % IB_VERDICT_N;
+	}
+	v->code = code;
+	v->allowed = allowed ? 1 : 0;
+	v->from = now;
+	v->until = until;
+	v->generation = generation;
+	v->used = 1;
+}
+/** @} */
+
+/** \brief Check the crons now and find the next change of the verdict.
+ *  \param time_info local time of now
+ *  \param until set to the time of the next change, or the next local time offset change.
+ *  It is now when the crons cannot be compiled.
+ *  \return 1 allowed now, invalid crons are denied
+ * */
+int ib_schedule_next(const char *crons, time_t now, const struct tm *time_info, int64_t *until) {
+	Evmask masks[CRON_MAX_N];
+	cron_error_t err;
+	struct tm at;
+	time_t change;
+	int n, allowed;
+
+	n = cron_compile(crons, masks, CRON_MAX_N, &err);
+	if ( n < 0 ) {
+		ESP_LOGW(TAG, "Cron %i column %i: %s", err.cron, err.column, err.msg);
+		*until = now;
+		return 0;
+	}
+	allowed = cron_match(masks, n, time_info);
+	*until = ib_tz_next_transition(now);
+	if ( cron_next_change(masks, n, time_info, &at) >= 0 ) {
+		change = mktime(&at);
+		if ( change > now && change < *until )
+			*until = change;
+	}
+	return allowed;
+}
+
+/** \brief Cached verdict of a code.
+ *  \return 1 allowed is set
+ * */
+int ib_schedule_cached(uint64_t code, time_t now, uint32_t generation, int *allowed) {
+	int ret;
+	portENTER_CRITICAL(&g_cache_mux);
+	ret = ib_verdict_get(&g_cache, code, now, generation, allowed);
+	portEXIT_CRITICAL(&g_cache_mux);
+	return ret;
+}
+
+/** \brief Check the crons of a key and cache the verdict until it changes.
+ *  The key must be valid at now (ibd_valid_at()), the verdict is cached until the end of its validity at most.
+ *  \param generation database generation of the crons, read before the lookup
+ *  \return 1 allowed
+ * */
+int ib_schedule_check(const ib_data_t *data, time_t now, const struct tm *time_info, uint32_t generation) {
+	const uint64_t code = data->code_s.code;
+	int64_t until;
+	int allowed = ib_schedule_next(data->crons, now, time_info, &until);
+
+	if ( data->valid_until && data->valid_until < until )
+		until = data->valid_until;
+	portENTER_CRITICAL(&g_cache_mux);
+	ib_verdict_put(&g_cache, code, allowed, now, until, generation);
+	portEXIT_CRITICAL(&g_cache_mux);
+	return allowed;
+}
+
+static struct {
+	struct arg_str *code;
+	struct arg_end *end;
+} when_args;
+
+/** \brief Prints the next opening or closing of a key, or the cached verdicts. */
+static int when_cmd(int argc, char **argv) {
+	ib_verdict_cache_t *copy;
+	ib_data_t *data = NULL;
+	Evmask masks[CRON_MAX_N];
+	cron_error_t err;
+	const time_t now = ib_clock_time();
+	struct tm time_info, at;
+	char buf[32];
+	int n, allowed;
+	esp_err_t ret;
+
+	int nerrors = arg_parse(argc, argv, (void**) &when_args);
+	if ( nerrors ) {
+		arg_print_errors(stderr, when_args.end, argv[0]);
+		return 1;
+	}
+	if ( !when_args.code->count ) {
+		copy = malloc(sizeof(ib_verdict_cache_t));
+		if ( !copy ) {
+			printf("No memory\n");
+			return 1;
+		}
+		portENTER_CRITICAL(&g_cache_mux);
+		*copy = g_cache;
+		portEXIT_CRITICAL(&g_cache_mux);
+		printf("hits:%u misses:%u generation:%u\n", copy->stats.hits, copy->stats.misses, ibd_generation());
+		for ( int i = 0; i < IB_VERDICT_N; i++ ) {
+			if ( !copy->entries[i].used )
+				continue;
+			printf("%016llX %s for %lld s\n", copy->entries[i].code,
+					copy->entries[i].allowed ? "allowed" : "denied", copy->entries[i].until - now);
+		}
+		free(copy);
+		return 0;
+	}
+
+	ret = ibd_get_by_code(strtoull(when_args.code->sval[0], NULL, 16), &data);
+	if ( ret != IBD_FOUND || !data ) {
+		printf("Key not found\n");
+		return 1;
+	}
+	printf("crons:[%s]\n", data->crons ? data->crons : "");
+	n = cron_compile(data->crons, masks, CRON_MAX_N, &err);
+	ib_pool_free(data);
+	if ( n < 0 ) {
+		printf("Cron %i column %i: %s\n", err.cron, err.column, err.msg);
+		return 1;
+	}
+	ib_tz_localtime(now, &time_info);
+	allowed = cron_match(masks, n, &time_info);
+	if ( cron_next_change(masks, n, &time_info, &at) < 0 ) {
+		printf("%s, no change in %i days\n", allowed ? "allowed" : "denied", CRON_SEARCH_DAYS);
+		return 0;
+	}
+	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M", &at);
+	printf("%s at %s (%lld min)\n", allowed ? "closes" : "opens", buf,
+			(long long)((mktime(&at) - now + 59) / 60));
+	return 0;
+}
+
+/** \brief Command register function. */
+void register_schedule() {
+	when_args.code = arg_str0(NULL, NULL, "<code>", "Key code in hex, the cached verdicts without it");
+	when_args.end = arg_end(1);
+	const esp_console_cmd_t when_cmd_def = {
+			.command = "when",
+			.help = "Next opening or closing of a key",
+			.hint = NULL,
+			.func = &when_cmd,
+			.argtable = &when_args
+	};
+	ESP_ERROR_CHECK( esp_console_cmd_register(&when_cmd_def) );
+}
+/** @} */
@@ -0,0 +1,65 @@
+/**
+ * @defgroup ib_schedule
+ * @{
+ *
+ * ib_schedule.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: root
+ *
+ * Verdicts of the key schedules, kept until the schedule changes state.
+ *
+ * The crons of a key are compiled to bitmasks (cron_compile()) and the next opening or closing is
+ * searched with cron_next_change(). The verdict of a touched key is cached until that time, the next local time
+ * offset change (ib_tz) or the next database or calendar change (ibd_generation(), ib_cal_generation()). While the schedule does not change state
+ * the key is decided without the database scan and the cron check, the cached verdicts are not refreshed every minute.
+ * A time before the computation of the verdict (clock set back) is a miss. The verdict of a key with a validity range
+ * is not kept after its valid until, a key outside of its range is denied before the schedule and it is not cached.
+ *
+ * The cache functions (ib_verdict_*) take the time and the database generation as parameters,
+ * so they do not depend on the device.
+ */
+
+#ifndef MAIN_IB_SCHEDULE_H_
+#define MAIN_IB_SCHEDULE_H_
+
+#include <stdint.h>
+#include <time.h>
+#include "ib_database.h"
+
+/** \brief Number of cached verdicts. */
+#define IB_VERDICT_N 		16
+
+typedef struct ib_verdict {
+	uint64_t code;
+	/** Time of the computation. */
+	int64_t from;
+	/** Next change of the schedule state, or of the local time offset. */
+	int64_t until;
+	uint32_t generation;
+	uint8_t used;
+	uint8_t allowed;
+} ib_verdict_t;
+
+typedef struct ib_verdict_cache {
+	ib_verdict_t entries[IB_VERDICT_N];
+	/** Next entry to replace. */
+	uint8_t next;
+	struct {
+		uint32_t hits;
+		uint32_t misses;
+	} stats;
+} ib_verdict_cache_t;
+
+void ib_verdict_init(ib_verdict_cache_t *cache);
+int ib_verdict_get(ib_verdict_cache_t *cache, uint64_t code, int64_t now, uint32_t generation, int *allowed);
+void ib_verdict_put(ib_verdict_cache_t *cache, uint64_t code, int allowed,
+		int64_t now, int64_t until, uint32_t generation);
+
+int ib_schedule_next(const char *crons, time_t now, const struct tm *time_info, int64_t *until);
+int ib_schedule_cached(uint64_t code, time_t now, uint32_t generation, int *allowed);
+int ib_schedule_check(const ib_data_t *data, time_t now, const struct tm *time_info, uint32_t generation);
+void register_schedule();
+
+#endif /* MAIN_IB_SCHEDULE_H_ */
+/** @} */
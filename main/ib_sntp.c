@@ -25,6 +25,8 @@
 #include "lwip/ip_addr.h"
 
 #include "ib_reader.h"	// Set esp time
+#include "ib_clock.h"
+#include "ib_static.h"
 
 #include "/home/major/Documents/ESP32/ESP-IDF/IDF/components/lwip/include/lwip/lwip/dns.h"
 
@@ -32,8 +34,12 @@
 
 #define SERVER_NAME_MAX_SIZE 64
 #define SERVER_NAMES_N 4
+#define OBTAIN_TASK_STACK 4096
 
 EventGroupHandle_t ib_sntp_event_group;
+static TaskHandle_t g_obtain_task_h;
+IB_EVENT_GROUP_STORAGE(sntp_group, 1);
+IB_TASK_STORAGE(obtain_task, OBTAIN_TASK_STACK, 1);
 
 
 /** NTP Server names */
@@ -69,10 +75,11 @@ static int choose_another_server(){
 	return 1;
 }
 
-/** \brief Get time from NTP server task.
- *
+/** \brief Wait for the system time from the SNTP server, try the other servers.
+ *  \return 0 Time set
+ *  \return 1 No NTP servers available
  * */
-static void obtain_time_task(){
+static int wait_for_time(){
 	time_t now = 0;
 	struct tm time_info = { 0 };
 
@@ -87,23 +94,36 @@ static void obtain_time_task(){
 			ESP_LOGW(__func__,"SNTP server not available, try another...\n Domain:%s",g_chosen_server_name);
 			if( choose_another_server() ){
 				ESP_LOGE(__func__,"No NTP servers available");
-				vTaskDelete(xTaskGetCurrentTaskHandle());
+				return 1;
 			}
 			printf("Try another server:%s\n",g_chosen_server_name);
 			retries = 1;
 		}
 	}
-	setenv("TZ","CET-1CEST,M3.5.0,M10.5.0/3",1);
-	tzset();
-	time(&now);
-	localtime_r(&now, &time_info);
-	ESP_LOGI(__func__,"Got time from SNTP server. Domain:%s",g_chosen_server_name);
-	ESP_LOGI(__func__,"Current local time: %s", asctime(&time_info));
-	xEventGroupSetBits(ib_sntp_event_group, IB_TIME_SET_BIT);
-	vTaskDelete(xTaskGetCurrentTaskHandle());
+	return 0;
 }
 
-/** \brief Make a task to obtain time.
+/** \brief Get time from NTP server task.
+ *  The task is created once, ib_sntp_obtain_time() wakes it up.
+ * */
+static void obtain_time_task(){
+	time_t now;
+	struct tm time_info;
+
+	while ( 1 ) {
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		if ( wait_for_time() )
+			continue;
+		ib_clock_synced();
+		time(&now);
+		localtime_r(&now, &time_info);
+		ESP_LOGI(__func__,"Got time from SNTP server. Domain:%s",g_chosen_server_name);
+		ESP_LOGI(__func__,"Current local time: %s", asctime(&time_info));
+		xEventGroupSetBits(ib_sntp_event_group, IB_TIME_SET_BIT);
+	}
+}
+
+/** \brief Start SNTP and wake up the task to obtain time.
  *
  * */
 void ib_sntp_obtain_time(){
@@ -115,9 +135,15 @@ void ib_sntp_obtain_time(){
 	//sntp_setserver(idx, addr)
 	sntp_setservername(0, (char*)g_chosen_server_name);
 	sntp_init();
-	ib_sntp_event_group = xEventGroupCreate();
-	TaskHandle_t obtain_time_task_h;	// Listener task, decide the time is successfully set or not
-	xTaskCreate(obtain_time_task, "sntp_obtain", 4096, NULL, 5, &obtain_time_task_h);
+	if ( !g_obtain_task_h ) {	// Listener task, decide the time is successfully set or not
+		ib_sntp_event_group = IB_EVENT_GROUP_CREATE(sntp_group, 0);
+		if ( pdPASS != IB_TASK_CREATE(obtain_task, 0, obtain_time_task, "sntp_obtain", NULL, 5,
+				&g_obtain_task_h) ) {
+			ESP_LOGE(__func__,"Cannot create task");
+			return;
+		}
+	}
+	xTaskNotifyGive(g_obtain_task_h);
 }
 
 
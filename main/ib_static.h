@@ -0,0 +1,149 @@
+/**
+ * @defgroup ib_static
+ * @{
+ *
+ * ib_static.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: root
+ *
+ * Storage of the FreeRTOS objects: heap or static.
+ *
+ * With CONFIG_IB_STATIC_ALLOCATION (menuconfig, iButton reader) the tasks, queues, timers, event groups and mutexes
+ * of the application are created in static storage, so the RAM of the application is fixed at link time and
+ * only the IDF components allocate from the heap. Without it they are created in the heap, as before.
+ *
+ * A module declares the storage of its objects at file scope, then creates them with the same name:
+ * \code
+ * IB_TASK_STORAGE(logsender, 4096, 1);
+ * IB_QUEUE_STORAGE(log_q, QUEUE_DEPTH, sizeof(ib_log_t), 1);
+ * ...
+ * g_queue = IB_QUEUE_CREATE(log_q, 0);
+ * IB_TASK_CREATE(logsender, 0, &logsender_task, "Logsender", NULL, 4, NULL);
+ * \endcode
+ * The last parameter of a storage is the number of objects, the second parameter of a create is the index.
+ * The sizes must be constant expressions, they are checked at compile time in both modes.
+ * A static object must not be deleted, the tasks run forever.
+ */
+
+#ifndef MAIN_IB_STATIC_H_
+#define MAIN_IB_STATIC_H_
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/timers.h"
+#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+
+#ifdef CONFIG_IB_STATIC_ALLOCATION
+#define IB_STATIC_ALLOCATION 	1
+#else
+#define IB_STATIC_ALLOCATION 	0
+#endif
+
+#if IB_STATIC_ALLOCATION && !configSUPPORT_STATIC_ALLOCATION
+#error "CONFIG_IB_STATIC_ALLOCATION needs the static allocation of FreeRTOS (CONFIG_SUPPORT_STATIC_ALLOCATION)"
+#endif
+
+/** \brief Name of the allocation mode for the logs. */
+#define IB_ALLOCATION_NAME 		(IB_STATIC_ALLOCATION ? "static" : "heap")
+
+#define IB_TASK_CHECK(name, size, n) \
+	_Static_assert((size) >= configMINIMAL_STACK_SIZE && (size) % sizeof(StackType_t) == 0 && (n) > 0, \
+			#name ": invalid stack size")
+#define IB_QUEUE_CHECK(name, length, item, n) \
+	_Static_assert((length) > 0 && (item) > 0 && (n) > 0, #name ": invalid queue size")
+#define IB_OBJECT_CHECK(name, n) \
+	_Static_assert((n) > 0, #name ": no objects")
+
+#if IB_STATIC_ALLOCATION
+
+/** \brief Stack (bytes) and control block of n tasks. */
+#define IB_TASK_STORAGE(name, size, n) \
+	IB_TASK_CHECK(name, size, n); \
+	enum { name##_STACK = (size) }; \
+	static StaticTask_t name##_tcb[n]; \
+	static StackType_t name##_stack[n][(size) / sizeof(StackType_t)]
+
+/** \brief Create task i. \return pdPASS, pdFAIL like xTaskCreate(). */
+#define IB_TASK_CREATE(name, i, func, label, arg, prio, handle) \
+	ib_static_task(xTaskCreateStatic(func, label, name##_STACK, arg, prio, name##_stack[i], &name##_tcb[i]), \
+			handle)
+
+/** \brief Items and control block of n queues. */
+#define IB_QUEUE_STORAGE(name, length, item, n) \
+	IB_QUEUE_CHECK(name, length, item, n); \
+	enum { name##_LENGTH = (length), name##_ITEM = (item) }; \
+	static StaticQueue_t name##_queue[n]; \
+	static uint8_t name##_storage[n][(length) * (item)]
+
+#define IB_QUEUE_CREATE(name, i) \
+	xQueueCreateStatic(name##_LENGTH, name##_ITEM, name##_storage[i], &name##_queue[i])
+
+#define IB_TIMER_STORAGE(name, n) \
+	IB_OBJECT_CHECK(name, n); \
+	static StaticTimer_t name##_timer[n]
+
+#define IB_TIMER_CREATE(name, i, label, period, reload, id, callback) \
+	xTimerCreateStatic(label, period, reload, id, callback, &name##_timer[i])
+
+#define IB_EVENT_GROUP_STORAGE(name, n) \
+	IB_OBJECT_CHECK(name, n); \
+	static StaticEventGroup_t name##_group[n]
+
+#define IB_EVENT_GROUP_CREATE(name, i) \
+	xEventGroupCreateStatic(&name##_group[i])
+
+#define IB_RECURSIVE_MUTEX_STORAGE(name, n) \
+	IB_OBJECT_CHECK(name, n); \
+	static StaticSemaphore_t name##_mutex[n]
+
+#define IB_RECURSIVE_MUTEX_CREATE(name, i) \
+	xSemaphoreCreateRecursiveMutexStatic(&name##_mutex[i])
+
+static inline BaseType_t ib_static_task(TaskHandle_t task, TaskHandle_t *handle) {
+	if ( handle )
+		*handle = task;
+	return task ? pdPASS : pdFAIL;
+}
+
+#else
+
+#define IB_TASK_STORAGE(name, size, n) \
+	IB_TASK_CHECK(name, size, n); \
+	enum { name##_STACK = (size) }
+
+#define IB_TASK_CREATE(name, i, func, label, arg, prio, handle) \
+	xTaskCreate(func, label, name##_STACK, arg, prio, handle)
+
+#define IB_QUEUE_STORAGE(name, length, item, n) \
+	IB_QUEUE_CHECK(name, length, item, n); \
+	enum { name##_LENGTH = (length), name##_ITEM = (item) }
+
+#define IB_QUEUE_CREATE(name, i) \
+	xQueueCreate(name##_LENGTH, name##_ITEM)
+
+#define IB_TIMER_STORAGE(name, n) \
+	IB_OBJECT_CHECK(name, n)
+
+#define IB_TIMER_CREATE(name, i, label, period, reload, id, callback) \
+	xTimerCreate(label, period, reload, id, callback)
+
+#define IB_EVENT_GROUP_STORAGE(name, n) \
+	IB_OBJECT_CHECK(name, n)
+
+#define IB_EVENT_GROUP_CREATE(name, i) \
+	xEventGroupCreate()
+
+#define IB_RECURSIVE_MUTEX_STORAGE(name, n) \
+	IB_OBJECT_CHECK(name, n)
+
+#define IB_RECURSIVE_MUTEX_CREATE(name, i) \
+	xSemaphoreCreateRecursiveMutex()
+
+#endif
+
+#endif /* MAIN_IB_STATIC_H_ */
+/** @} */
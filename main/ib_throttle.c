@@ -0,0 +1,350 @@
+/**
+ * ib_throttle.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: root
+ *  @ingroup ib_throttle
+ *  @{
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_console.h"
+#include "esp_log.h"
+#include "argtable3/argtable3.h"
+
+#include "ib_throttle.h"
+
+static ib_throttle_t g_thr;
+static portMUX_TYPE g_thr_mux = portMUX_INITIALIZER_UNLOCKED;
+/** Time of the last paced scan, only the decision worker uses it. */
+static uint32_t g_scan_at;
+
+/** @defgroup throttle_table Table
+ *  Time is in ms, it may wrap around.
+ * @{ */
+static void bucket_init(ib_bucket_t *b, uint16_t burst, uint32_t now_ms) {
+	memset(b, 0, sizeof(*b));
+	b->tokens = burst;
+	b->refill_at = now_ms;
+}
+
+static int is_locked(const ib_bucket_t *b, uint32_t now_ms) {
+	return b->locked && (int32_t)(now_ms - b->locked_until) < 0;
+}
+
+/** \brief Add the tokens of the elapsed time. A full bucket resets the escalation. */
+static void refill(ib_bucket_t *b, uint16_t burst, uint32_t refill_ms, uint32_t now_ms) {
+	uint32_t n;
+
+	if ( b->tokens >= burst ) {
+		b->refill_at = now_ms;
+		return;
+	}
+	n = (now_ms - b->refill_at) / refill_ms;
+	if ( !n )
+		return;
+	if ( b->tokens + n >= burst ) {
+		b->tokens = burst;
+		b->refill_at = now_ms;
+		if ( !b->locked )
+			b->level = 0;
+	} else {
+		b->tokens += n;
+		b->refill_at += n * refill_ms;
+	}
+}
+
+/** \brief Take a token, lock out when the bucket gets empty.
+ *  \return 1 lockout started
+ * */
+static int charge(ib_bucket_t *b, uint16_t burst, uint32_t refill_ms, uint8_t reader, uint32_t now_ms) {
+	uint32_t lockout_ms;
+
+	refill(b, burst, refill_ms, now_ms);
+	if ( b->tokens )
+		b->tokens--;
+	if ( b->tokens || is_locked(b, now_ms) )
+		return 0;
+	lockout_ms = (uint32_t)IB_THROTTLE_LOCKOUT_MS << b->level;
+	if ( lockout_ms >= IB_THROTTLE_LOCKOUT_MAX_MS )
+		lockout_ms = IB_THROTTLE_LOCKOUT_MAX_MS;
+	else
+		b->level++;
+	b->locked = 1;
+	b->locked_until = now_ms + lockout_ms;
+	b->reader = reader;
+	return 1;
+}
+
+static ib_throttle_entry_t *find(ib_throttle_t *thr, uint64_t code) {
+	for ( int i = 0; i < IB_THROTTLE_CODES; i++ ) {
+		if ( thr->entries[i].used && thr->entries[i].code == code )
+			return &thr->entries[i];
+	}
+	return NULL;
+}
+
+/** \brief Entry of the code, a new one replaces a free entry or the least recently seen one.
+ *  Locked entries are replaced only when all of them are locked.
+ * */
+static ib_throttle_entry_t *find_or_add(ib_throttle_t *thr, uint64_t code, uint32_t now_ms) {
+	ib_throttle_entry_t *e = find(thr, code);
+	ib_throttle_entry_t *victim = NULL;
+	ib_throttle_entry_t *oldest = NULL;
+
+	if ( e )
+		return e;
+	for ( int i = 0; i < IB_THROTTLE_CODES; i++ ) {
+		e = &thr->entries[i];
+		if ( !e->used ) {
+			victim = e;
+			break;
+		}
+		if ( !oldest || (int32_t)(e->seen_at - oldest->seen_at) < 0 )
+			oldest = e;
+		if ( !e->bucket.locked && (!victim || (int32_t)(e->seen_at - victim->seen_at) < 0) )
+			victim = e;
+	}
+	if ( !victim )
+		victim = oldest;
+	if ( victim->used )
+		thr->stats.evictions++;
+	victim->used = 1;
+	victim->code = code;
+	victim->seen_at = now_ms;
+	bucket_init(&victim->bucket, IB_THROTTLE_CODE_BURST, now_ms);
+	return victim;
+}
+
+void ib_throttle_init(ib_throttle_t *thr, uint32_t now_ms) {
+	memset(thr, 0, sizeof(*thr));
+	bucket_init(&thr->global, IB_THROTTLE_GLOBAL_BURST, now_ms);
+}
+
+/** \brief Check a code before the lookup.
+ *  \param generation of the database
+ *  \return IB_THR_LOCKED deny without lookup, the touch is counted in the lockout of the code
+ *  \return IB_THR_MISSED global lockout and the code missed in this generation, call ib_throttle_miss() without lookup
+ *  \return IB_THR_QUIET global lockout, look it up, a miss is counted by ib_throttle_miss() instead of logged
+ *  \return IB_THR_PASS
+ * */
+ib_throttle_ret_t ib_throttle_check(ib_throttle_t *thr, uint64_t code, uint32_t generation, uint32_t now_ms) {
+	ib_throttle_entry_t *e;
+
+	thr->stats.checks++;
+	e = find(thr, code);
+	if ( e ) {
+		e->seen_at = now_ms;
+		if ( is_locked(&e->bucket, now_ms) ) {
+			e->bucket.suppressed++;
+			thr->stats.denied++;
+			return IB_THR_LOCKED;
+		}
+	}
+	if ( !is_locked(&thr->global, now_ms) )
+		return IB_THR_PASS;
+	if ( e && e->generation == generation ) {
+		thr->stats.cached++;
+		return IB_THR_MISSED;
+	}
+	return IB_THR_QUIET;
+}
+
+/** \brief The code is not in the database, charge its bucket and the global one.
+ *  \param generation of the database which does not have the code
+ *  \return IB_THR_LOCKOUT_GLOBAL or IB_THR_LOCKOUT_CODE when a lockout started
+ *  \return IB_THR_PASS
+ * */
+ib_throttle_ret_t ib_throttle_miss(ib_throttle_t *thr, uint64_t code, uint8_t reader, uint32_t generation,
+		uint32_t now_ms) {
+	ib_throttle_entry_t *e = find_or_add(thr, code, now_ms);
+	ib_throttle_ret_t ret = IB_THR_PASS;
+
+	thr->stats.misses++;
+	e->seen_at = now_ms;
+	e->generation = generation;
+	if ( is_locked(&thr->global, now_ms) )
+		thr->global.suppressed++;
+	if ( charge(&e->bucket, IB_THROTTLE_CODE_BURST, IB_THROTTLE_CODE_REFILL_MS, reader, now_ms) ) {
+		thr->stats.lockouts++;
+		ret = IB_THR_LOCKOUT_CODE;
+	}
+	if ( charge(&thr->global, IB_THROTTLE_GLOBAL_BURST, IB_THROTTLE_GLOBAL_REFILL_MS, reader, now_ms) ) {
+		thr->stats.lockouts++;
+		ret = IB_THR_LOCKOUT_GLOBAL;
+	}
+	return ret;
+}
+
+static int pop_expired(ib_bucket_t *b, uint64_t code, uint32_t now_ms, ib_throttle_report_t *report) {
+	if ( !b->locked || is_locked(b, now_ms) )
+		return 0;
+	report->code = code;
+	report->reader = b->reader;
+	report->suppressed = b->suppressed;
+	b->locked = 0;
+	b->suppressed = 0;
+	return 1;
+}
+
+/** \brief Take an ended lockout.
+ *  \return 1 report is set, call it again
+ *  \return 0 no more ended lockout
+ * */
+int ib_throttle_expired(ib_throttle_t *thr, uint32_t now_ms, ib_throttle_report_t *report) {
+	if ( pop_expired(&thr->global, IB_THROTTLE_GLOBAL_CODE, now_ms, report) )
+		return 1;
+	for ( int i = 0; i < IB_THROTTLE_CODES; i++ ) {
+		if ( thr->entries[i].used &&
+				pop_expired(&thr->entries[i].bucket, thr->entries[i].code, now_ms, report) )
+			return 1;
+	}
+	return 0;
+}
+
+/** \brief Time until the nearest end of a lockout.
+ *  \return 0 no lockout
+ *  \return 1 in_ms is set
+ * */
+int ib_throttle_next_expiry(const ib_throttle_t *thr, uint32_t now_ms, uint32_t *in_ms) {
+	const ib_bucket_t *b;
+	int32_t left, min = 0;
+	int found = 0;
+
+	for ( int i = -1; i < IB_THROTTLE_CODES; i++ ) {
+		if ( i >= 0 && !thr->entries[i].used )
+			continue;
+		b = (i < 0) ? &thr->global : &thr->entries[i].bucket;
+		if ( !b->locked )
+			continue;
+		left = (int32_t)(b->locked_until - now_ms);
+		if ( left < 0 )
+			left = 0;
+		if ( !found || left < min )
+			min = left;
+		found = 1;
+	}
+	if ( found )
+		*in_ms = min;
+	return found;
+}
+/** @} */
+
+static uint32_t now_ms() {
+	return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+/** \brief Reset the shared instance. */
+void ib_thr_init() {
+	portENTER_CRITICAL(&g_thr_mux);
+	ib_throttle_init(&g_thr, now_ms());
+	portEXIT_CRITICAL(&g_thr_mux);
+}
+
+ib_throttle_ret_t ib_thr_check(uint64_t code, uint32_t generation) {
+	ib_throttle_ret_t ret;
+	portENTER_CRITICAL(&g_thr_mux);
+	ret = ib_throttle_check(&g_thr, code, generation, now_ms());
+	portEXIT_CRITICAL(&g_thr_mux);
+	return ret;
+}
+
+ib_throttle_ret_t ib_thr_miss(uint64_t code, uint8_t reader, uint32_t generation) {
+	ib_throttle_ret_t ret;
+	portENTER_CRITICAL(&g_thr_mux);
+	ret = ib_throttle_miss(&g_thr, code, reader, generation, now_ms());
+	portEXIT_CRITICAL(&g_thr_mux);
+	return ret;
+}
+
+/** \brief Wait before a scan of the database during a global lockout (IB_THR_QUIET).
+ *  The scans are at least IB_THROTTLE_QUIET_SCAN_MS apart. Only the decision worker calls it.
+ * */
+void ib_thr_pace() {
+	uint32_t since = now_ms() - g_scan_at;
+
+	if ( since < IB_THROTTLE_QUIET_SCAN_MS )
+		vTaskDelay(pdMS_TO_TICKS(IB_THROTTLE_QUIET_SCAN_MS - since) + 1);
+	g_scan_at = now_ms();
+}
+
+int ib_thr_expired(ib_throttle_report_t *report) {
+	int ret;
+	portENTER_CRITICAL(&g_thr_mux);
+	ret = ib_throttle_expired(&g_thr, now_ms(), report);
+	portEXIT_CRITICAL(&g_thr_mux);
+	return ret;
+}
+
+int ib_thr_next_expiry(uint32_t *in_ms) {
+	int ret;
+	portENTER_CRITICAL(&g_thr_mux);
+	ret = ib_throttle_next_expiry(&g_thr, now_ms(), in_ms);
+	portEXIT_CRITICAL(&g_thr_mux);
+	return ret;
+}
+
+static struct {
+	struct arg_lit *clear;
+	struct arg_end *end;
+} throttle_args;
+
+/** \brief Prints the counters and the locked out codes. */
+static int throttle_cmd(int argc, char **argv) {
+	ib_throttle_t *copy;
+	const ib_throttle_entry_t *e;
+	uint32_t now = now_ms();
+
+	int nerrors = arg_parse(argc, argv, (void**) &throttle_args);
+	if ( nerrors ) {
+		arg_print_errors(stderr, throttle_args.end, argv[0]);
+		return 1;
+	}
+	if ( throttle_args.clear->count ) {
+		ib_thr_init();
+		return 0;
+	}
+	copy = malloc(sizeof(ib_throttle_t));
+	if ( !copy ) {
+		printf("No memory\n");
+		return 1;
+	}
+	portENTER_CRITICAL(&g_thr_mux);
+	*copy = g_thr;
+	portEXIT_CRITICAL(&g_thr_mux);
+
+	printf("checks:%u misses:%u denied:%u cached misses:%u lockouts:%u evictions:%u\n",
+			copy->stats.checks, copy->stats.misses, copy->stats.denied, copy->stats.cached,
+			copy->stats.lockouts, copy->stats.evictions);
+	printf("global tokens:%u%s\n", copy->global.tokens,
+			is_locked(&copy->global, now) ? " locked" : "");
+	for ( int i = 0; i < IB_THROTTLE_CODES; i++ ) {
+		e = &copy->entries[i];
+		if ( !e->used || !is_locked(&e->bucket, now) )
+			continue;
+		printf("%016llX locked for %u ms, denied %u\n", e->code,
+				e->bucket.locked_until - now, e->bucket.suppressed);
+	}
+	free(copy);
+	return 0;
+}
+
+/** \brief Command register function. */
+void register_throttle() {
+	throttle_args.clear = arg_lit0("c", "clear", "Clear the lockouts and the counters");
+	throttle_args.end = arg_end(0);
+	const esp_console_cmd_t throttle_cmd_def = {
+			.command = "throttle",
+			.help = "Invalid key rate limiter state",
+			.hint = NULL,
+			.func = &throttle_cmd,
+			.argtable = &throttle_args
+	};
+	ESP_ERROR_CHECK( esp_console_cmd_register(&throttle_cmd_def) );
+}
+/** @} */
@@ -0,0 +1,136 @@
+/**
+ * @defgroup ib_throttle
+ * @ingroup ib_reader
+ * @{
+ *
+ * ib_throttle.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: root
+ *
+ * Rate limiter of the invalid keys, in front of the database lookup.
+ *
+ * Every unknown code (not in the database) takes a token from its own bucket and from the global bucket.
+ * The buckets refill with a constant rate up to their burst size. When the bucket of a code is empty,
+ * the code is locked out: its touches are denied without the database scan and without a log message per touch.
+ * When the global bucket is empty, only the log budget is protected: the codes are still looked up, so a valid
+ * key opens, but the misses are not logged one by one, they are counted in the global lockout.
+ * A global lockout never denies a key, otherwise touching random codes would lock every user out.
+ * It protects the flash too:
+ *  - The per-code table remembers the database generation of the last miss of a code. During a global lockout
+ *  a code which already missed in the current database is counted as a miss without the database scan.
+ *  - The scans of the other codes are paced, at most one per IB_THROTTLE_QUIET_SCAN_MS (ib_thr_pace()).
+ *  The remaining cost of an attack with always new codes is one scan per IB_THROTTLE_QUIET_SCAN_MS,
+ *  and a valid key waits at most IB_THROTTLE_QUIET_SCAN_MS more during the global lockout.
+ * The lockout time doubles with every new lockout up to the maximum,
+ * it goes back to the base time when the bucket is full again.
+ *
+ * The per-code buckets are in a fixed-size table, the least recently seen code is replaced.
+ * The lockouts are logged in aggregated form: one message when it starts, one with the number
+ * of the denied touches when it ends.
+ *
+ * The table functions (ib_throttle_*) do not use FreeRTOS, the time is passed in ms.
+ * The decision worker uses the shared instance through the ib_thr_* functions.
+ */
+
+#ifndef MAIN_IB_THROTTLE_H_
+#define MAIN_IB_THROTTLE_H_
+
+#include <stdint.h>
+
+/** @defgroup throttle_limits Limits
+ * @{ */
+/** \brief Size of the per-code table. */
+#define IB_THROTTLE_CODES 				32
+#define IB_THROTTLE_CODE_BURST 			5
+#define IB_THROTTLE_CODE_REFILL_MS 		10000
+#define IB_THROTTLE_GLOBAL_BURST 		20
+#define IB_THROTTLE_GLOBAL_REFILL_MS 	2000
+/** \brief First lockout, doubles with every new lockout. */
+#define IB_THROTTLE_LOCKOUT_MS 			30000
+#define IB_THROTTLE_LOCKOUT_MAX_MS 		(15 * 60 * 1000)
+/** \brief Minimum time between two scans of the database during a global lockout. */
+#define IB_THROTTLE_QUIET_SCAN_MS 		100
+/** @} */
+
+/** \brief Code of the global lockout in the reports. */
+#define IB_THROTTLE_GLOBAL_CODE 		0
+
+/** \brief Result of ib_throttle_check() and ib_throttle_miss(). */
+typedef enum ib_throttle_ret {
+	IB_THR_PASS,
+	/** Denied, the code is locked out. */
+	IB_THR_LOCKED,
+	/** Global lockout: look the code up, but do not log a miss. */
+	IB_THR_QUIET,
+	/** Global lockout and the code missed in this database: a miss without lookup, not logged. */
+	IB_THR_MISSED,
+	/** The miss started a lockout of the code. */
+	IB_THR_LOCKOUT_CODE,
+	/** The miss started a global lockout. */
+	IB_THR_LOCKOUT_GLOBAL,
+} ib_throttle_ret_t;
+
+/** \brief Token bucket with lockout. */
+typedef struct ib_bucket {
+	uint16_t tokens;
+	/** Escalation, the next lockout is IB_THROTTLE_LOCKOUT_MS << level. */
+	uint8_t level;
+	uint8_t locked;
+	uint8_t reader;
+	uint32_t refill_at;
+	uint32_t locked_until;
+	/** Touches denied during the lockout, misses not logged for the global one. */
+	uint32_t suppressed;
+} ib_bucket_t;
+
+typedef struct ib_throttle_entry {
+	uint64_t code;
+	uint32_t seen_at;
+	/** Database generation of the last miss. */
+	uint32_t generation;
+	uint8_t used;
+	ib_bucket_t bucket;
+} ib_throttle_entry_t;
+
+/** \brief An ended lockout. */
+typedef struct ib_throttle_report {
+	/** IB_THROTTLE_GLOBAL_CODE for the global lockout. */
+	uint64_t code;
+	uint8_t reader;
+	uint32_t suppressed;
+} ib_throttle_report_t;
+
+typedef struct ib_throttle_stats {
+	uint32_t checks;
+	uint32_t misses;
+	uint32_t denied;
+	/** Misses without lookup during a global lockout. */
+	uint32_t cached;
+	uint32_t lockouts;
+	uint32_t evictions;
+} ib_throttle_stats_t;
+
+typedef struct ib_throttle {
+	ib_throttle_entry_t entries[IB_THROTTLE_CODES];
+	ib_bucket_t global;
+	ib_throttle_stats_t stats;
+} ib_throttle_t;
+
+void ib_throttle_init(ib_throttle_t *thr, uint32_t now_ms);
+ib_throttle_ret_t ib_throttle_check(ib_throttle_t *thr, uint64_t code, uint32_t generation, uint32_t now_ms);
+ib_throttle_ret_t ib_throttle_miss(ib_throttle_t *thr, uint64_t code, uint8_t reader, uint32_t generation,
+		uint32_t now_ms);
+int ib_throttle_expired(ib_throttle_t *thr, uint32_t now_ms, ib_throttle_report_t *report);
+int ib_throttle_next_expiry(const ib_throttle_t *thr, uint32_t now_ms, uint32_t *in_ms);
+
+void ib_thr_init();
+ib_throttle_ret_t ib_thr_check(uint64_t code, uint32_t generation);
+ib_throttle_ret_t ib_thr_miss(uint64_t code, uint8_t reader, uint32_t generation);
+void ib_thr_pace();
+int ib_thr_expired(ib_throttle_report_t *report);
+int ib_thr_next_expiry(uint32_t *in_ms);
+void register_throttle();
+
+#endif /* MAIN_IB_THROTTLE_H_ */
+/** @} */
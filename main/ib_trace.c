@@ -0,0 +1,205 @@
+/**
+ * ib_trace.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: root
+ *  @ingroup ib_trace
+ *  @{
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "esp_console.h"
+#include "esp_log.h"
+#include "argtable3/argtable3.h"
+
+#include "ib_trace.h"
+
+/** \brief Only these tags are summarized. */
+#define IB_TRACE_TAGS 		8
+
+static const char *POINT_NAMES[IB_TR_POINTS_N] = {
+	"touch",
+	"read start",
+	"presence",
+	"rom done",
+	"key event",
+	"lookup start",
+	"lookup end",
+	"cron start",
+	"cron end",
+	"verdict",
+	"relay open",
+	"fsm",
+	"button",
+	"no decision",
+	"button open",
+};
+
+static ib_trace_entry_t g_ring[IB_TRACE_SIZE];
+/** Number of the recorded entries, the ring index is the lower bits. */
+static volatile uint32_t g_head;
+static volatile uint8_t g_current;
+
+#if IB_TRACE_ENABLE
+/** \brief Record a trace point.
+ *  \param tag reader id or IB_TRACE_CURRENT
+ * */
+void IRAM_ATTR ib_trace(ib_trace_point_t point, uint8_t tag) {
+	uint32_t i = __atomic_fetch_add(&g_head, 1, __ATOMIC_RELAXED) & (IB_TRACE_SIZE - 1);
+	if ( tag == IB_TRACE_CURRENT )
+		tag = g_current;
+	g_ring[i].t_us = (uint32_t)esp_timer_get_time();
+	g_ring[i].point = point;
+	g_ring[i].tag = tag;
+}
+
+/** \brief Tag of the IB_TRACE_CURRENT points. */
+void ib_trace_set_current(uint8_t tag) {
+	g_current = tag;
+}
+#endif
+
+/** \brief Drop all the entries. */
+void ib_trace_clear() {
+	g_head = 0;
+}
+
+static int compare_u32(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+	return (x > y) - (x < y);
+}
+
+/** \brief Collect the time since the touch of a trace point.
+ *  \return number of samples
+ * */
+static size_t collect(const ib_trace_entry_t *entries, size_t n, uint8_t point, uint32_t *samples) {
+	uint32_t anchor[IB_TRACE_TAGS];
+	uint32_t seen[IB_TRACE_TAGS] = {0};
+	uint8_t open[IB_TRACE_TAGS] = {0};
+	size_t count = 0;
+	const ib_trace_entry_t *e;
+
+	for ( size_t i = 0; i < n; i++ ) {
+		e = &entries[i];
+		if ( e->tag >= IB_TRACE_TAGS || e->point >= IB_TR_POINTS_N )
+			continue;
+		if ( e->point == IB_TR_TOUCH ) {
+			anchor[e->tag] = e->t_us;
+			seen[e->tag] = 0;
+			open[e->tag] = 1;
+		}
+		if ( !open[e->tag] || (seen[e->tag] & (1 << e->point)) )
+			continue;
+		seen[e->tag] |= (1 << e->point);
+		if ( e->point == point )
+			samples[count++] = e->t_us - anchor[e->tag];
+		if ( e->point == IB_TR_FSM || e->point == IB_TR_NO_DECISION )
+			open[e->tag] = 0;
+	}
+	return count;
+}
+
+/** \brief Collect the button response times: last button edge to the next relay open of the button.
+ *  \return number of samples
+ * */
+static size_t collect_button(const ib_trace_entry_t *entries, size_t n, uint32_t *samples) {
+	uint32_t pressed[IB_TRACE_TAGS];
+	uint8_t open[IB_TRACE_TAGS] = {0};
+	size_t count = 0;
+	const ib_trace_entry_t *e;
+
+	for ( size_t i = 0; i < n; i++ ) {
+		e = &entries[i];
+		if ( e->tag >= IB_TRACE_TAGS )
+			continue;
+		if ( e->point == IB_TR_BUTTON ) {
+			pressed[e->tag] = e->t_us;
+			open[e->tag] = 1;
+		} else if ( e->point == IB_TR_BUTTON_OPEN && open[e->tag] ) {
+			samples[count++] = e->t_us - pressed[e->tag];
+			open[e->tag] = 0;
+		}
+	}
+	return count;
+}
+
+static void print_percentiles(const char *name, uint32_t *samples, size_t count) {
+	if ( !count ) {
+		printf("%-14s %6u\n", name, 0);
+		return;
+	}
+	qsort(samples, count, sizeof(uint32_t), compare_u32);
+	printf("%-14s %6u %8u %8u %8u %8u\n", name, count,
+			samples[(count - 1) * 50 / 100],
+			samples[(count - 1) * 95 / 100],
+			samples[(count - 1) * 99 / 100],
+			samples[count - 1]);
+}
+
+static struct {
+	struct arg_lit *clear;
+	struct arg_end *end;
+} trace_args;
+
+/** \brief Prints p50/p95/p99 and max of the time since the touch for every trace point. */
+static int trace_cmd(int argc, char **argv) {
+	ib_trace_entry_t *entries;
+	uint32_t *samples;
+	uint32_t head, start;
+	size_t n, count;
+
+	int nerrors = arg_parse(argc, argv, (void**) &trace_args);
+	if ( nerrors ) {
+		arg_print_errors(stderr, trace_args.end, argv[0]);
+		return 1;
+	}
+	if ( trace_args.clear->count ) {
+		ib_trace_clear();
+		return 0;
+	}
+	head = g_head;
+	n = (head < IB_TRACE_SIZE) ? head : IB_TRACE_SIZE;
+	start = head - n;
+	entries = malloc(n * sizeof(ib_trace_entry_t) + 1);
+	samples = malloc(n * sizeof(uint32_t) + 1);
+	if ( !entries || !samples ) {
+		printf("No memory\n");
+		free(entries);
+		free(samples);
+		return 1;
+	}
+	for ( size_t i = 0; i < n; i++ )
+		entries[i] = g_ring[(start + i) & (IB_TRACE_SIZE - 1)];
+
+	printf("%u entries, us since touch\n", n);
+	printf("%-14s %6s %8s %8s %8s %8s\n", "point", "n", "p50", "p95", "p99", "max");
+	for ( uint8_t p = IB_TR_READ_START; p <= IB_TR_FSM; p++ ) {
+		count = collect(entries, n, p, samples);
+		print_percentiles(POINT_NAMES[p], samples, count);
+	}
+	printf("us since button\n");
+	count = collect_button(entries, n, samples);
+	print_percentiles("relay open", samples, count);
+	free(entries);
+	free(samples);
+	return 0;
+}
+
+/** \brief Command register function. */
+void register_trace() {
+	trace_args.clear = arg_lit0("c", "clear", "Clear the trace ring");
+	trace_args.end = arg_end(0);
+	const esp_console_cmd_t trace_cmd_def = {
+			.command = "trace",
+			.help = "Touch to relay latency percentiles",
+			.hint = NULL,
+			.func = &trace_cmd,
+			.argtable = &trace_args
+	};
+	ESP_ERROR_CHECK( esp_console_cmd_register(&trace_cmd_def) );
+}
+/** @} */
@@ -0,0 +1,84 @@
+/**
+ * @defgroup ib_trace
+ * @{
+ *
+ * ib_trace.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: root
+ *
+ * Touch-to-relay latency tracing.
+ *
+ * Trace points are timestamped (esp_timer, us) and stored in a fixed-size RAM ring,
+ * the oldest entries are overwritten. Recording a point is an atomic index increment
+ * and an 8 byte write, it can be called from interrupts too, so it stays enabled in production.
+ *
+ * The 'trace' console command summarizes the ring: for every point the time since the touch
+ * (first IB_TR_TOUCH of the same tag) is collected, only the first occurrence of a point
+ * counts after a touch, and the sequence ends with IB_TR_FSM, or with IB_TR_NO_DECISION when the read of the touch
+ * found no key, the key was not decided or its decision was abandoned.
+ * The polls of the data line are not traced, only the reads of a touch.
+ * The button response is the time from the last IB_TR_BUTTON to the next IB_TR_BUTTON_OPEN of the same tag.
+ * The relay opened by the button is traced as IB_TR_BUTTON_OPEN, so a press which opens nothing is not paired
+ * with a later open of a key.
+ *
+ * The tag is the reader id. Points in the shared code (database) use IB_TRACE_CURRENT,
+ * which is the tag set by ib_trace_set_current() (the decision worker sets the reader id).
+ */
+
+#ifndef MAIN_IB_TRACE_H_
+#define MAIN_IB_TRACE_H_
+
+#include <stdint.h>
+
+/** \brief 0 removes the trace points. */
+#ifndef IB_TRACE_ENABLE
+#define IB_TRACE_ENABLE 	1
+#endif
+
+/** \brief Number of entries in the ring, power of 2. */
+#define IB_TRACE_SIZE 		512
+
+/** \brief Tag of the current decision. */
+#define IB_TRACE_CURRENT 	0xFF
+
+/** \brief Trace points in the order of a touch. */
+typedef enum ib_trace_point {
+	IB_TR_TOUCH,		/**< Falling edge on the data line. */
+	IB_TR_READ_START,	/**< 1-Wire transaction started. */
+	IB_TR_PRESENCE,		/**< Presence pulse detected. */
+	IB_TR_ROM_DONE,		/**< ROM read finished. */
+	IB_TR_KEY_EVENT,	/**< Code handed to the decision worker. */
+	IB_TR_LOOKUP_START,	/**< Database lookup. */
+	IB_TR_LOOKUP_END,
+	IB_TR_CRON_START,	/**< Schedule evaluation. */
+	IB_TR_CRON_END,
+	IB_TR_VERDICT,		/**< Verdict arrived at the reader. */
+	IB_TR_RELAY_OPEN,	/**< Relay opened. */
+	IB_TR_FSM,			/**< FSM handled the verdict, end of the sequence. */
+	IB_TR_BUTTON,		/**< Edge on the button input. */
+	IB_TR_NO_DECISION,	/**< The touch ended without a verdict, end of the sequence. */
+	IB_TR_BUTTON_OPEN,	/**< Relay opened by the button. */
+	IB_TR_POINTS_N
+} ib_trace_point_t;
+
+/** \brief A trace entry. */
+typedef struct ib_trace_entry {
+	uint32_t t_us;
+	uint8_t point;
+	uint8_t tag;
+} ib_trace_entry_t;
+
+#if IB_TRACE_ENABLE
+void ib_trace(ib_trace_point_t point, uint8_t tag);
+void ib_trace_set_current(uint8_t tag);
+#else
+static inline void ib_trace(ib_trace_point_t point, uint8_t tag) {}
+static inline void ib_trace_set_current(uint8_t tag) {}
+#endif
+void ib_trace_clear();
+void register_trace();
+
+#endif /* MAIN_IB_TRACE_H_ */
+
+/** @} */
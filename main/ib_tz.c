@@ -0,0 +1,302 @@
+/**
+ * ib_tz.c
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: root
+ *  @ingroup ib_tz
+ *  @{
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "esp_console.h"
+#include "esp_log.h"
+#include "argtable3/argtable3.h"
+#include "nvs.h"
+
+#include "ib_clock.h"
+#include "ib_tz.h"
+
+#define TAG "IB_TZ"
+
+#define DAY_S 	86400LL
+
+const char TZ_NSPACE_NVS[] = "tz_ns";
+const char TZ_KEY_NVS[] = "tz";
+
+/** Double buffer: the new table is built in the inactive one, then it is switched. */
+static ib_tz_table_t g_tables[2];
+static ib_tz_table_t * volatile g_active;
+static char g_tz[IB_TZ_LEN] = IB_TZ_DEFAULT;
+
+/** @defgroup tz_calendar Calendar arithmetic
+ *  Proleptic Gregorian calendar, days since 1970-01-01.
+ * @{ */
+static int64_t days_from_civil(int64_t y, int m, int d) {
+	y -= m <= 2;
+	const int64_t era = (y >= 0 ? y : y - 399) / 400;
+	const int64_t yoe = y - era * 400;
+	const int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	const int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + doe - 719468;
+}
+
+static void civil_from_days(int64_t z, int64_t *y, int *m, int *d) {
+	z += 719468;
+	const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+	const int64_t doe = z - era * 146097;
+	const int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	const int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	const int64_t mp = (5 * doy + 2) / 153;
+	*d = doy - (153 * mp + 2) / 5 + 1;
+	*m = mp < 10 ? mp + 3 : mp - 9;
+	*y = yoe + era * 400 + (*m <= 2);
+}
+
+/** \brief Broken-down time of t seconds since the epoch, without time zone. */
+void ib_tz_gmtime(int64_t t, struct tm *time_info) {
+	int64_t days = t / DAY_S;
+	int64_t sod = t % DAY_S;
+	int64_t y;
+	int m, d;
+
+	if ( sod < 0 ) {
+		sod += DAY_S;
+		days--;
+	}
+	civil_from_days(days, &y, &m, &d);
+	time_info->tm_sec = sod % 60;
+	time_info->tm_min = (sod / 60) % 60;
+	time_info->tm_hour = sod / 3600;
+	time_info->tm_mday = d;
+	time_info->tm_mon = m - 1;
+	time_info->tm_year = y - 1900;
+	time_info->tm_wday = ((days % 7) + 11) % 7;		// 1970-01-01 was Thursday.
+	time_info->tm_yday = days - days_from_civil(y, 1, 1);
+	time_info->tm_isdst = 0;
+}
+/** @} */
+
+/** \brief UTC offset of the current TZ at t, from the C library. */
+static int32_t offset_at(int64_t t, uint8_t *isdst) {
+	time_t raw = t;
+	struct tm tm;
+	int64_t local;
+
+	localtime_r(&raw, &tm);
+	local = days_from_civil(tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday) * DAY_S +
+			tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec;
+	*isdst = tm.tm_isdst > 0;
+	return local - t;
+}
+
+/** \brief Compute the offset changes of the current TZ (environment) from the start of a year.
+ *  The offset is sampled daily, a change is searched to the second.
+ *  The table ends at IB_TZ_TIME_MAX when the years reach it.
+ *  \param from a time in the first year
+ *  \return number of transitions
+ * */
+int ib_tz_table_build(ib_tz_table_t *table, int64_t from, int years) {
+	struct tm first;
+	int64_t t, lo, hi, mid;
+	int32_t prev, off;
+	uint8_t prev_dst, dst, mid_dst;
+
+	ib_tz_gmtime(from, &first);
+	table->from = days_from_civil(first.tm_year + 1900, 1, 1) * DAY_S - DAY_S;	// Any offset.
+	table->until = days_from_civil(first.tm_year + 1900 + years, 1, 1) * DAY_S;
+	if ( table->until > IB_TZ_TIME_MAX )
+		table->until = IB_TZ_TIME_MAX;
+	table->transitions_n = 0;
+	table->offset = prev = offset_at(table->from, &prev_dst);
+	table->isdst = prev_dst;
+
+	for ( t = table->from + DAY_S; t - DAY_S < table->until; t += DAY_S ) {
+		hi = (t < table->until) ? t : table->until - 1;		// Never beyond IB_TZ_TIME_MAX
+		off = offset_at(hi, &dst);
+		if ( off == prev && dst == prev_dst )
+			continue;
+		lo = t - DAY_S;
+		while ( hi - lo > 1 ) {
+			mid = lo + (hi - lo) / 2;
+			if ( offset_at(mid, &mid_dst) == prev && mid_dst == prev_dst )
+				lo = mid;
+			else
+				hi = mid;
+		}
+		if ( table->transitions_n >= IB_TZ_TRANSITIONS_MAX ) {
+			table->until = hi;
+			break;
+		}
+		table->transitions[table->transitions_n].at = hi;
+		table->transitions[table->transitions_n].offset = off;
+		table->transitions[table->transitions_n].isdst = dst;
+		table->transitions_n++;
+		prev = off;
+		prev_dst = dst;
+	}
+	return table->transitions_n;
+}
+
+/** \brief Local time of t from the table.
+ *  \return 0 t is out of the table
+ * */
+int ib_tz_table_local(const ib_tz_table_t *table, int64_t t, struct tm *time_info) {
+	int lo = 0, hi = table->transitions_n, mid;
+	int32_t offset = table->offset;
+	uint8_t isdst = table->isdst;
+
+	if ( t < table->from || t >= table->until )
+		return 0;
+	while ( lo < hi ) {		// First transition after t.
+		mid = (lo + hi) / 2;
+		if ( table->transitions[mid].at <= t )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if ( lo > 0 ) {
+		offset = table->transitions[lo - 1].offset;
+		isdst = table->transitions[lo - 1].isdst;
+	}
+	ib_tz_gmtime(t + offset, time_info);
+	time_info->tm_isdst = isdst;
+	return 1;
+}
+
+/** \brief First offset change after t.
+ *  \return the end of the table when there is no change in it, INT64_MAX after the table
+ * */
+int64_t ib_tz_table_next(const ib_tz_table_t *table, int64_t t) {
+	if ( t >= table->until )
+		return INT64_MAX;
+	for ( int i = 0; i < table->transitions_n; i++ ) {
+		if ( table->transitions[i].at > t )
+			return table->transitions[i].at;
+	}
+	return table->until;
+}
+
+/** \brief Apply g_tz and compute its table from the current year. */
+static void rebuild() {
+	ib_tz_table_t *table = (g_active == &g_tables[0]) ? &g_tables[1] : &g_tables[0];
+	int64_t now = ib_clock_time();
+
+	if ( now < IB_CLOCK_VALID_FROM )
+		now = IB_CLOCK_VALID_FROM;
+	setenv("TZ", g_tz, 1);
+	tzset();
+	ib_tz_table_build(table, now, IB_TZ_YEARS);
+	g_active = table;
+	ESP_LOGI(TAG, "%s: %i transitions", g_tz, table->transitions_n);
+}
+
+/** \brief Load the time zone from NVS. Call it after ib_clock_init(). */
+void ib_tz_init() {
+	nvs_handle handle;
+	size_t size = sizeof(g_tz);
+	esp_err_t ret;
+
+	ret = nvs_open(TZ_NSPACE_NVS, NVS_READONLY, &handle);
+	if ( ret == ESP_OK ) {
+		if ( nvs_get_str(handle, TZ_KEY_NVS, g_tz, &size) != ESP_OK )
+			strcpy(g_tz, IB_TZ_DEFAULT);
+		nvs_close(handle);
+	}
+	rebuild();
+}
+
+/** \brief Change the time zone and save it.
+ *  \param tz POSIX TZ string, example: CET-1CEST,M3.5.0,M10.5.0/3
+ * */
+esp_err_t ib_tz_set(const char *tz) {
+	nvs_handle handle;
+	esp_err_t ret;
+
+	if ( !tz || strlen(tz) >= IB_TZ_LEN || !(isalpha((unsigned char)tz[0]) || tz[0] == '<') )
+		return ESP_ERR_INVALID_ARG;
+	ret = nvs_open(TZ_NSPACE_NVS, NVS_READWRITE, &handle);
+	if ( ret != ESP_OK )
+		return ret;
+	ret = nvs_set_str(handle, TZ_KEY_NVS, tz);
+	if ( ret == ESP_OK )
+		ret = nvs_commit(handle);
+	nvs_close(handle);
+	if ( ret != ESP_OK )
+		return ret;
+	strcpy(g_tz, tz);
+	rebuild();
+	return ESP_OK;
+}
+
+const char *ib_tz_get() {
+	return g_tz;
+}
+
+/** \brief Local time of t. */
+void ib_tz_localtime(time_t t, struct tm *time_info) {
+	const ib_tz_table_t *table = g_active;
+	if ( !table || !ib_tz_table_local(table, t, time_info) )
+		localtime_r(&t, time_info);
+}
+
+/** \brief First local time offset change after t. */
+int64_t ib_tz_next_transition(int64_t t) {
+	const ib_tz_table_t *table = g_active;
+	return table ? ib_tz_table_next(table, t) : INT64_MAX;
+}
+
+static struct {
+	struct arg_str *tz;
+	struct arg_end *end;
+} tz_args;
+
+/** \brief Prints the time zone and the transitions of the next two years, or sets the time zone. */
+static int tz_cmd(int argc, char **argv) {
+	const ib_tz_table_t *table = g_active;
+	const int64_t now = ib_clock_time();
+	struct tm time_info;
+	char buf[32];
+	esp_err_t ret;
+
+	int nerrors = arg_parse(argc, argv, (void**) &tz_args);
+	if ( nerrors ) {
+		arg_print_errors(stderr, tz_args.end, argv[0]);
+		return 1;
+	}
+	if ( tz_args.tz->count ) {
+		ret = ib_tz_set(tz_args.tz->sval[0]);
+		if ( ret != ESP_OK )
+			printf("Cannot set: %s\n", esp_err_to_name(ret));
+		return ret != ESP_OK;
+	}
+	printf("TZ:%s\n", g_tz);
+	if ( !table )
+		return 0;
+	for ( int i = 0; i < table->transitions_n; i++ ) {
+		if ( table->transitions[i].at < now || table->transitions[i].at > now + 2 * 366 * DAY_S )
+			continue;
+		ib_tz_gmtime(table->transitions[i].at + table->transitions[i].offset, &time_info);
+		strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &time_info);
+		printf("%s offset:%i s%s\n", buf, table->transitions[i].offset,
+				table->transitions[i].isdst ? " dst" : "");
+	}
+	return 0;
+}
+
+/** \brief Command register function. */
+void register_tz() {
+	tz_args.tz = arg_str0(NULL, NULL, "<TZ>", "POSIX time zone, example: " IB_TZ_DEFAULT);
+	tz_args.end = arg_end(1);
+	const esp_console_cmd_t tz_cmd_def = {
+			.command = "tz",
+			.help = "Time zone of the schedules",
+			.hint = NULL,
+			.func = &tz_cmd,
+			.argtable = &tz_args
+	};
+	ESP_ERROR_CHECK( esp_console_cmd_register(&tz_cmd_def) );
+}
+/** @} */
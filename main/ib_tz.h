@@ -0,0 +1,75 @@
+/**
+ * @defgroup ib_tz
+ * @{
+ *
+ * ib_tz.h
+ *
+ *  Created on: Oct 18, 2026
+ *      Author: root
+ *
+ * Local time of the schedule checks with precomputed DST transitions.
+ *
+ * The time zone is a POSIX TZ string, saved in NVS ('tz' command). When it is set, the UTC offset changes
+ * of the next IB_TZ_YEARS years are computed with the C library once and stored in a table.
+ * The table ends at IB_TZ_TIME_MAX at the latest: time_t of IDF v3 is 32 bit, localtime_r() wraps around
+ * after 2038-01-19 03:14:07 UTC.
+ * ib_tz_localtime() is a binary search in the table and calendar arithmetic, it does not walk the TZ rules.
+ * Out of the table it falls back to localtime_r().
+ *
+ * The schedules are matched with the wall clock: the minutes of the skipped hour (spring) do not exist,
+ * so they never match, the minutes of the repeated hour (autumn) match twice.
+ *
+ * The table functions (ib_tz_table_*) do not use NVS, so they can be tested against localtime_r (tztest).
+ */
+
+#ifndef MAIN_IB_TZ_H_
+#define MAIN_IB_TZ_H_
+
+#include <stdint.h>
+#include <time.h>
+#include "esp_err.h"
+
+#define IB_TZ_DEFAULT 			"CET-1CEST,M3.5.0,M10.5.0/3"
+/** \brief Maximum length of the TZ string. */
+#define IB_TZ_LEN 				48
+/** \brief Years in the table. */
+#define IB_TZ_YEARS 			20
+/** \brief Last second localtime_r() can convert. */
+#ifndef IB_TZ_TIME_MAX
+#define IB_TZ_TIME_MAX 			(sizeof(time_t) < sizeof(int64_t) ? (int64_t)INT32_MAX : INT64_MAX)
+#endif
+/** \brief Two changes per year, and a spare. */
+#define IB_TZ_TRANSITIONS_MAX 	(IB_TZ_YEARS * 2 + 2)
+
+/** \brief A change of the UTC offset. */
+typedef struct ib_tz_transition {
+	/** First second of the new offset, UTC. */
+	int64_t at;
+	int32_t offset;
+	uint8_t isdst;
+} ib_tz_transition_t;
+
+typedef struct ib_tz_table {
+	int64_t from;
+	int64_t until;
+	/** Offset at from, before the first transition. */
+	int32_t offset;
+	uint8_t isdst;
+	ib_tz_transition_t transitions[IB_TZ_TRANSITIONS_MAX];
+	int transitions_n;
+} ib_tz_table_t;
+
+int ib_tz_table_build(ib_tz_table_t *table, int64_t from, int years);
+int ib_tz_table_local(const ib_tz_table_t *table, int64_t t, struct tm *time_info);
+int64_t ib_tz_table_next(const ib_tz_table_t *table, int64_t t);
+void ib_tz_gmtime(int64_t t, struct tm *time_info);
+
+void ib_tz_init();
+esp_err_t ib_tz_set(const char *tz);
+const char *ib_tz_get();
+void ib_tz_localtime(time_t t, struct tm *time_info);
+int64_t ib_tz_next_transition(int64_t t);
+void register_tz();
+
+#endif /* MAIN_IB_TZ_H_ */
+/** @} */
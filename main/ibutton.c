@@ -9,22 +9,50 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_system.h"
+#include "esp_attr.h"
+#include "esp_intr_alloc.h"
 #include "driver/gpio.h"
+#include "driver/timer.h"
+#include "soc/gpio_struct.h"
+#include "soc/timer_group_struct.h"
 #include "rom/ets_sys.h"
+#include "ib_onewire.h"
+#include "ib_trace.h"
 #include "ibutton.h"
 
-gpio_num_t DATA_GPIO_NUM;
-
-#define GET_LEVEL (gpio_get_level(DATA_GPIO_NUM))
-#define PULL (gpio_set_direction(DATA_GPIO_NUM, GPIO_MODE_OUTPUT))
-#define RELEASE (gpio_set_direction(DATA_GPIO_NUM, GPIO_MODE_INPUT))
+/** \brief Line operations with registers, gpio driver functions are not in IRAM.
+ *  Output level is always 0, the line is pulled down by enabling the output. */
+#define GET_LEVEL(pin) (((pin) < 32) ? ((GPIO.in >> (pin)) & 0x1) : ((GPIO.in1.data >> ((pin) - 32)) & 0x1))
+#define PULL(pin) do { if ((pin) < 32) GPIO.enable_w1ts = (1 << (pin)); else GPIO.enable1_w1ts.data = (1 << ((pin) - 32)); } while (0)
+#define RELEASE(pin) do { if ((pin) < 32) GPIO.enable_w1tc = (1 << (pin)); else GPIO.enable1_w1tc.data = (1 << ((pin) - 32)); } while (0)
 #define FAMILY_CODE 0x01
 
+/** \brief Hardware timers of the bus alarms. 1 MHz counter, 1 tick = 1 us.
+ *  Every bus uses its own timer, so there can be IB_BUS_MAX buses. */
+#define OW_TIMER_DIVIDER 	80
 
-static const uint8_t COMMAND_BYTE = 0x33;
+/** \brief A 1-Wire bus: data pin, alarm timer and engine.
+ *  The trace tag is the index of the bus. */
+struct ib_bus {
+	gpio_num_t pin;
+	uint8_t tag;
+	timer_group_t group;
+	timer_idx_t idx;
+	timg_dev_t *timer;
+	ow_backend_t backend;
+	ow_engine_t engine;
+	ib_read_cb cb;
+	void *cb_arg;
+	/** The current read records its trace points. */
+	volatile uint8_t traced;
+	/** Disables the interrupts around the busy waits of a slot. */
+	portMUX_TYPE mux;
+};
 
+static ib_bus_t g_buses[IB_BUS_MAX];
+static int g_buses_n;
 
-static const uint8_t CRC8_TABLE[256] =
+static DRAM_ATTR const uint8_t CRC8_TABLE[256] =
 {
 	  0, 94,188,226, 97, 63,221,131,194,156,126, 32,163,253, 31, 65,
 	157,195, 33,127,252,162, 64, 30, 95,  1,227,189, 62, 96,130,220,
@@ -44,77 +72,14 @@ static const uint8_t CRC8_TABLE[256] =
 	116, 42,200,150, 21, 75,169,247,182,232, 10, 84,215,137,107, 53
 };
 
-static uint8_t crc8_check(uint8_t *data, uint8_t length){
+static uint8_t IRAM_ATTR crc8_check(uint8_t *data, uint8_t length){
 	uint8_t crc = 0;
 	for(int i = 0; i < length; i++)
 		crc = CRC8_TABLE[crc ^ data[i]];
 	return crc;
 }
-/** \brief Send a byte out.
- *
- * */
-static void send_byte(uint8_t data){
-	for(int i = 8; i > 0; i--){
-		if(data & 0x01){
-			PULL;
-			ets_delay_us(5);
-			RELEASE;
-			ets_delay_us(80);
-		}
-		else{
-			PULL;
-			ets_delay_us(80);
-			RELEASE;
-			ets_delay_us(5);
-		}
-		data >>= 1;
-	}
-}
-
-/** \brief Reads a byte.
- *  Must called just after the command byte has been sent out.
- *  \ret uint64_t ibutton code.
- * */
-static uint8_t read_byte(){
-	uint8_t byte = 0;
-	for(int i = 8; i > 0; i--){
-		PULL;
-		ets_delay_us(5);
-		RELEASE;
-		ets_delay_us(10);
-		byte >>= 1;
-		if(GET_LEVEL)
-			byte |= 0b10000000;
-		ets_delay_us(30);
-	}
-	return byte;
-}
-
-
-/**
- *  Test if an iButton device is connected to the reader or not. It filters the short circuit.
- *
- *  \ret 0 when the input level was low before reset pulse send,
- *  or no answer after reset pulse. (See one-wire protocol).
- *  \ret 1 when the input had been pulled down only after the reset pulse,
- *  in this case this function assumes that an iButton device had given a presence pulse.
- * */
-int ib_presence(){
-	int line_level_tmp = GET_LEVEL;
-	ets_delay_us(100);
-	if(!(line_level_tmp && GET_LEVEL))			// Input is still pulled down to GDN: reader is shorted.
-		return 0;
-	PULL;
-	ets_delay_us(480);
-	RELEASE;
-	ets_delay_us(70);
-	line_level_tmp = GET_LEVEL;
-	ets_delay_us(410);
-	return line_level_tmp ? 0 : 1;
-}
-
 /** \brief uint8_t array to uint64_t conversion. * */
-static uint64_t bytes_to_code(uint8_t *data){
+static uint64_t IRAM_ATTR bytes_to_code(uint8_t *data){
 	uint64_t code_val = 0;
 	if(!data)
 		return code_val;
@@ -132,37 +97,179 @@ static uint64_t bytes_to_code(uint8_t *data){
 	return code_val;
 }
 
-/**
- * Read the iButton ROM.
- * This function must be called, when an iButton has just been connected to the reader.
- * \param ib_code serial number of iButton device.
- * \ret IB_OK when the computed CRC equals the MSB from the ROM data and LSB equals 01h (iButton family code).
- * \ret IB_CRC_ERR when CRC error.
- * \ret IB_FAM_ERR when the family code does not match.
- * */
-ib_ret_t ib_read_code(uint64_t *ib_code){
-	uint8_t data[8];
-
-	portDISABLE_INTERRUPTS();
-	send_byte(COMMAND_BYTE);
-	ets_delay_us(480);
-	for(uint8_t curr_data = 0; curr_data < 8; curr_data++){
-		data[curr_data] = read_byte();
-	}
-	portENABLE_INTERRUPTS();
 
-	if(data[0] != FAMILY_CODE)
+/** @defgroup gpio_backend GPIO and hardware timer backend
+ *  Backend context is the ib_bus_t.
+ * @{ */
+static void IRAM_ATTR bus_pull(void *ctx) {
+	PULL(((ib_bus_t*)ctx)->pin);
+}
+
+static void IRAM_ATTR bus_release(void *ctx) {
+	RELEASE(((ib_bus_t*)ctx)->pin);
+}
+
+static int IRAM_ATTR bus_level(void *ctx) {
+	return GET_LEVEL(((ib_bus_t*)ctx)->pin);
+}
+
+static void IRAM_ATTR bus_delay_us(void *ctx, uint32_t us) {
+	ets_delay_us(us);
+}
+
+static void IRAM_ATTR bus_enter(void *ctx) {
+	portENTER_CRITICAL_ISR(&((ib_bus_t*)ctx)->mux);
+}
+
+static void IRAM_ATTR bus_exit(void *ctx) {
+	portEXIT_CRITICAL_ISR(&((ib_bus_t*)ctx)->mux);
+}
+
+/** \brief Restart the counter from zero and arm the alarm. */
+static void IRAM_ATTR bus_alarm_us(void *ctx, uint32_t us) {
+	ib_bus_t *bus = ctx;
+	bus->timer->hw_timer[bus->idx].load_high = 0;
+	bus->timer->hw_timer[bus->idx].load_low = 0;
+	bus->timer->hw_timer[bus->idx].reload = 1;
+	bus->timer->hw_timer[bus->idx].alarm_high = 0;
+	bus->timer->hw_timer[bus->idx].alarm_low = us;
+	bus->timer->hw_timer[bus->idx].config.alarm_en = TIMER_ALARM_EN;
+}
+
+static void IRAM_ATTR bus_presence(void *ctx) {
+	ib_bus_t *bus = ctx;
+	if ( bus->traced )
+		ib_trace(IB_TR_PRESENCE, bus->tag);
+}
+
+static void IRAM_ATTR bus_timer_isr(void *arg) {
+	ib_bus_t *bus = arg;
+	if ( bus->idx == TIMER_0 )
+		bus->timer->int_clr_timers.t0 = 1;
+	else
+		bus->timer->int_clr_timers.t1 = 1;
+	ow_engine_step(&bus->engine);
+}
+/** @} */
+
+/** \brief Check a ROM.
+ *  IB_OK when the computed CRC equals the MSB from the ROM data and LSB equals 01h (iButton family code).
+ * */
+static ib_ret_t IRAM_ATTR check_rom(uint8_t *rom, uint64_t *code) {
+	if ( rom[0] != FAMILY_CODE )
 		return IB_FAM_ERR;
-	if(crc8_check(data,8))
+	if ( crc8_check(rom, OW_ROM_SIZE) )
 		return IB_CRC_ERR;
-
-	*ib_code = bytes_to_code(data);
+	*code = bytes_to_code(rom);
 	return IB_OK;
 }
 
-void onewire_init(gpio_num_t data_pin){
+/** \brief Search finished: pick the first valid iButton and pass the result to the owner.
+ *  Other 1-Wire devices on the bus are skipped. When there is no valid iButton,
+ *  the result is the error of the first device.
+ * */
+static void IRAM_ATTR read_done(ow_engine_t *engine, void *arg) {
+	ib_bus_t *bus = arg;
+	ib_read_t result = { .code = 0, .devices = 0 };
+	ib_ret_t ret;
+
+	if ( bus->traced )
+		ib_trace(IB_TR_ROM_DONE, bus->tag);
+	switch ( engine->status ) {
+		case OW_OK:
+			result.devices = engine->found;
+			result.ret = IB_NO_DEVICE;
+			for ( int i = 0; i < engine->found; i++ ) {
+				ret = check_rom(engine->roms[i], &result.code);
+				if ( i == 0 || ret == IB_OK )
+					result.ret = ret;
+				if ( ret == IB_OK )
+					break;
+			}
+			break;
+		case OW_SHORT:
+			result.ret = IB_SHORT;
+			break;
+		default:
+			result.ret = IB_NO_DEVICE;
+			break;
+	}
+	if ( bus->cb )
+		bus->cb(&result, bus->cb_arg);
+}
+
+/**
+ * Start reading the iButton ROM.
+ * Performs reset, presence detection and enumerates the devices with SEARCH ROM without blocking,
+ * so an iButton is read even when there are more devices on the bus.
+ * The ib_read_t result is passed to the callback given at onewire_init().
+ * When there is no presence pulse the result is IB_NO_DEVICE.
+ * \param traced record IB_TR_PRESENCE and IB_TR_ROM_DONE, only for the reads of a touch
+ * \return 0 read started
+ * \return 1 previous read is still in progress
+ * */
+int ib_read_start(ib_bus_t *bus, int traced) {
+	bus->traced = traced;
+	return ow_search_start(&bus->engine);
+}
+
+/** \brief Read the keys in overdrive speed.
+ *  Falls back to standard speed when the devices do not support overdrive.
+ * */
+void ib_set_overdrive(ib_bus_t *bus, int enable) {
+	ow_engine_set_overdrive(&bus->engine, enable);
+}
+
+/** \brief Initialize a bus.
+ *  \param data_pin 1-Wire data line
+ *  \param cb receives the results of ib_read_start(), called from interrupt context
+ *  \param arg passed to cb
+ *  \return NULL when all the timers are used (IB_BUS_MAX)
+ *  \return the bus
+ * */
+ib_bus_t *onewire_init(gpio_num_t data_pin, ib_read_cb cb, void *arg){
+	ib_bus_t *bus;
+	timer_config_t config = {
+		.alarm_en = TIMER_ALARM_DIS,
+		.counter_en = TIMER_PAUSE,
+		.intr_type = TIMER_INTR_LEVEL,
+		.counter_dir = TIMER_COUNT_UP,
+		.auto_reload = TIMER_AUTORELOAD_DIS,
+		.divider = OW_TIMER_DIVIDER
+	};
+
+	if ( g_buses_n >= IB_BUS_MAX )
+		return NULL;
+	bus = &g_buses[g_buses_n];
+	bus->pin = data_pin;
+	bus->tag = g_buses_n;
+	bus->group = (g_buses_n / 2) ? TIMER_GROUP_1 : TIMER_GROUP_0;
+	bus->idx = (g_buses_n % 2) ? TIMER_1 : TIMER_0;
+	bus->timer = (bus->group == TIMER_GROUP_0) ? &TIMERG0 : &TIMERG1;
+	bus->cb = cb;
+	bus->cb_arg = arg;
+	bus->backend.pull = bus_pull;
+	bus->backend.release = bus_release;
+	bus->backend.level = bus_level;
+	bus->backend.delay_us = bus_delay_us;
+	bus->backend.alarm_us = bus_alarm_us;
+	bus->backend.presence = bus_presence;
+	bus->backend.enter = bus_enter;
+	bus->backend.exit = bus_exit;
+	bus->backend.ctx = bus;
+	bus->mux = (portMUX_TYPE)portMUX_INITIALIZER_UNLOCKED;
+	g_buses_n++;
+
 	gpio_pad_select_gpio(data_pin);
 	gpio_set_direction(data_pin, GPIO_MODE_INPUT);
 	gpio_set_level(data_pin, 0);
-	DATA_GPIO_NUM = data_pin;
+	ow_engine_init(&bus->engine, &bus->backend, read_done, bus);
+
+	timer_init(bus->group, bus->idx, &config);
+	timer_set_counter_value(bus->group, bus->idx, 0);
+	timer_enable_intr(bus->group, bus->idx);
+	timer_isr_register(bus->group, bus->idx, bus_timer_isr,
+			bus, ESP_INTR_FLAG_IRAM, NULL);
+	timer_start(bus->group, bus->idx);
+	return bus;
 }
@@ -8,17 +8,40 @@
 #ifndef MAIN_IBUTTON_H_
 #define MAIN_IBUTTON_H_
 
+#include "driver/gpio.h"
+
 typedef int ib_ret_t;
 
 #define IB_OK 0
 #define IB_FAM_ERR 1
 #define IB_CRC_ERR 2
+/** No presence pulse: no key on the reader. */
+#define IB_NO_DEVICE 3
+/** Data line is pulled down before the reset. */
+#define IB_SHORT 4
 
 #define BYTE_ORDER_LSB_IS_FAMILY_CODE 0
 
-void onewire_init(gpio_num_t data_pin);
-int ib_presence();
-ib_ret_t ib_read_code(uint64_t *ib_code);
+/** \brief Maximum number of buses, every bus needs a hardware timer. */
+#define IB_BUS_MAX 4
+
+/** \brief A 1-Wire bus. */
+typedef struct ib_bus ib_bus_t;
+
+/** \brief Result of an ib_read_start() call. */
+typedef struct ib_read {
+	ib_ret_t ret;
+	uint64_t code;
+	/** Number of devices found on the bus. */
+	uint8_t devices;
+} ib_read_t;
+
+/** \brief Called from interrupt context when a read finished. */
+typedef void (*ib_read_cb)(ib_read_t *result, void *arg);
+
+ib_bus_t *onewire_init(gpio_num_t data_pin, ib_read_cb cb, void *arg);
+int ib_read_start(ib_bus_t *bus, int traced);
+void ib_set_overdrive(ib_bus_t *bus, int enable);
 
 
 
@@ -17,6 +17,7 @@
  *  This software consists of the following main modules:
  *   - ibutton module:
  *   	- Read iButton device ROM data. This is used for the authentication.
+ *   	- The 1-Wire transactions are performed by the ib_onewire engine, driven by a hardware timer.
  *   - cron module:
  *   	- Check the current time matches the cron strings which belongs to each iButton key.
  *   	- Part of the UNIX-like crontab.
@@ -50,6 +51,7 @@
 #include "esp_system.h"
 #include "esp_log.h"
 #include "esp_err.h"
+#include "esp_heap_caps.h"
 #include "esp_vfs_dev.h"
 #include "driver/uart.h"
 #include "nvs.h"
@@ -63,6 +65,11 @@
 #include "esp_spiffs.h"
 #include "ib_http_client.h"
 #include "ib_log.h"
+#include "ib_clock.h"
+#include "ib_tz.h"
+#include "ib_calendar.h"
+#include "ib_static.h"
+#include "ib_pool.h"
 
 void spiffs_init() {
 	ESP_LOGI("SPIFF","Initializing...");
@@ -95,6 +102,12 @@ void initials() {
 	}
 }
 
+/** \brief Report the heap left when everything is started. */
+static void heap_report() {
+	ESP_LOGI("HEAP", "%s allocation, free:%u largest block:%u", IB_ALLOCATION_NAME,
+			heap_caps_get_free_size(MALLOC_CAP_8BIT), heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+}
+
 static void nvs_init() {
 	esp_err_t err = nvs_flash_init();
 	if (err == ESP_ERR_NVS_NO_FREE_PAGES) {
@@ -105,6 +118,7 @@ static void nvs_init() {
 }
 
 void app_main(){
+	ib_pool_init();
 	gpio_pad_select_gpio(4);
 	gpio_set_direction(4, GPIO_MODE_OUTPUT);
 	nvs_init();
@@ -112,9 +126,13 @@ void app_main(){
 	start_console();
 	wifi_get_data();
 	initials();
+	ib_cal_init();
+	ib_clock_init();
+	ib_tz_init();
 	start_ib_reader();
 	ib_client_init();
 	ib_log_init();
+	heap_report();
 
 	while(1){
 		gpio_set_level(4, 1);